@@ -0,0 +1,13 @@
+# EGL is optional, it provides the context for --headless rendering.
+IF (NOT WIN32 AND NOT APPLE)
+	FIND_PACKAGE(PkgConfig QUIET)
+	IF (PKG_CONFIG_FOUND)
+		pkg_search_module(EGL QUIET egl)
+	ENDIF ()
+	IF (EGL_FOUND)
+		message(STATUS "EGL found, headless rendering enabled")
+		add_definitions(-DSKINNING_HAVE_EGL=1)
+		INCLUDE_DIRECTORIES(${EGL_INCLUDE_DIRS})
+		LIST(APPEND stdgl_libraries ${EGL_LIBRARIES})
+	ENDIF ()
+ENDIF ()
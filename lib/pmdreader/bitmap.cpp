@@ -11,12 +11,14 @@
 
 #include "bitmap.h"
 #include "image.h"
+#include <climits>
  
-BMP_BITMAPFILEHEADER bmfh; 
-BMP_BITMAPINFOHEADER bmih; 
-
+// Reentrant: the headers are locals and every path closes the file, so
+// textures may be decoded on several threads at once.
 bool readBMP(const char *fname, Image& image)
 { 
+	BMP_BITMAPFILEHEADER bmfh; 
+	BMP_BITMAPINFOHEADER bmih; 
 	FILE* file; 
 	BMP_DWORD pos; 
  
@@ -34,44 +36,55 @@ bool readBMP(const char *fname, Image& image)
  
 	ret += fread( &bmih, sizeof(BMP_BITMAPINFOHEADER), 1, file ); 
 
-	if (ret == 0)
-		return false;
- 
 	// error checking
-	if ( bmfh.bfType!= 0x4d42 ) {	// "BM" actually
+	if ( ret != 6 || bmfh.bfType!= 0x4d42 ) {	// "BM" actually
+		fclose( file );
 		return false;
 	}
-	if ( bmih.biBitCount != 24 )  
+	if ( bmih.biBitCount != 24 || bmih.biWidth <= 0 || bmih.biHeight <= 0 ) {
+		fclose( file );
 		return false; 
+	}
 /*
  	if ( bmih.biCompression != BMP_BI_RGB ) {
 		return NULL;
 	}
 */
-	fseek( file, pos, SEEK_SET ); 
- 
-	int width = image.width = bmih.biWidth; 
-	int height = image.height = bmih.biHeight; 
+	int width = bmih.biWidth; 
+	int height = bmih.biHeight; 
  
-	int padWidth = width * 3; 
-	int pad = 0; 
+	// In size_t: a forged header must not overflow the sizes, and must
+	// not make us allocate more than the file holds.
+	size_t padWidth = size_t(width) * 3; 
+	size_t pad = 0; 
 	if ( padWidth % 4 != 0 ) { 
 		pad = 4 - (padWidth % 4); 
 		padWidth += pad; 
 	} 
-	int bytes = height*padWidth; 
-	image.stride = padWidth;
+	size_t bytes = size_t(height) * padWidth; 
+	fseek( file, 0, SEEK_END );
+	long fileSize = ftell( file );
+	if ( padWidth > size_t(INT_MAX) || fileSize < 0 || pos > size_t(fileSize) ||
+	     bytes > size_t(fileSize) - pos ) {
+		fclose( file );
+		return false;
+	}
+	fseek( file, pos, SEEK_SET ); 
+
+	image.width = width;
+	image.height = height;
+	image.stride = int(padWidth);
+	image.channels = 3;
  
 	image.bytes.resize(bytes);
 	unsigned char *data = image.bytes.data();
 
 	int foo = fread( data, bytes, 1, file ); 
+	fclose( file );
 	
 	if (!foo) {
 		return false;
 	}
-
-	fclose( file );
 	
 	// shuffle bitmap data such that it is (R,G,B) tuples in row-major order
 	int i, j;
@@ -95,7 +108,9 @@ bool readBMP(const char *fname, Image& image)
 			in += 3;
 			out += 3;
 		}
+		// Keep the padding so that image.stride stays valid
 		in += pad;
+		out += pad;
 	}
 	return true;
 } 
@@ -0,0 +1,97 @@
+#include "mapped_file.h"
+#include <stdexcept>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& fn)
+	: path_(fn)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+	                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("MappedFile: cannot open " + fn);
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		throw std::runtime_error("MappedFile: " + fn + " is empty");
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("MappedFile: cannot map " + fn);
+	}
+	file_ = file;
+	mapping_ = mapping;
+	data_ = (const uint8_t*)view;
+	size_ = size_t(size.QuadPart);
+#else
+	int fd = open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("MappedFile: cannot open " + fn);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		throw std::runtime_error("MappedFile: " + fn + " is empty");
+	}
+	void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file referenced
+	::close(fd);
+	if (view == MAP_FAILED)
+		throw std::runtime_error("MappedFile: cannot map " + fn);
+	madvise(view, size_t(st.st_size), MADV_SEQUENTIAL);
+	data_ = (const uint8_t*)view;
+	size_ = size_t(st.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+	if (this == &other)
+		return *this;
+	close();
+	std::swap(path_, other.path_);
+	std::swap(data_, other.data_);
+	std::swap(size_, other.size_);
+#ifdef _WIN32
+	std::swap(file_, other.file_);
+	std::swap(mapping_, other.mapping_);
+#endif
+	return *this;
+}
+
+void MappedFile::close()
+{
+	if (!data_)
+		return ;
+#ifdef _WIN32
+	UnmapViewOfFile(data_);
+	CloseHandle((HANDLE)mapping_);
+	CloseHandle((HANDLE)file_);
+	mapping_ = file_ = nullptr;
+#else
+	munmap((void*)data_, size_);
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
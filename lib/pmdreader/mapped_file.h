@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * MappedFile: read-only memory mapping of a whole file.
+ *
+ * Pages are only read from disk when touched and are shared with the page
+ * cache, so parsing from the mapping needs no buffer of the file's size.
+ * Throws std::runtime_error if the file cannot be opened or mapped.
+ */
+class MappedFile {
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& fn);
+	~MappedFile();
+	MappedFile(MappedFile&& other);
+	MappedFile& operator=(MappedFile&& other);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	const std::string& getPath() const { return path_; }
+private:
+	void close();
+
+	std::string path_;
+	const uint8_t* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+#endif
@@ -62,6 +62,10 @@
 #include <iconv.h>
 #endif
 
+// Bone and morph names are interned by pmdreader's name table
+#include "../name_table.h"
+#include "../text_decode.h"
+
 #include "util/dwarf.inl"
 #include "util/math.inl"
 
@@ -76,48 +76,50 @@ namespace mmd {
         const std::wstring &GetName() const;
         void SetName(const std::wstring &name);
 
+        // Bones and morphs are keyed by their NameTable ids (UTF-8 names),
+        // so a motion joins any model by integer comparison.
         const BoneKeyframe &GetBoneKeyframe(
-            const std::wstring &bone_name, size_t frame
+            std::uint32_t bone_name, size_t frame
         ) const;
         BoneKeyframe &GetBoneKeyframe(
-            const std::wstring &bone_name, size_t frame
+            std::uint32_t bone_name, size_t frame
         );
 
         BonePose GetBonePose(
-            const std::wstring &bone_name, size_t frame
+            std::uint32_t bone_name, size_t frame
         ) const;
         BonePose GetBonePose(
-            const std::wstring &bone_name, double time
+            std::uint32_t bone_name, double time
         ) const;
 
         const MorphKeyframe &GetMorphKeyframe(
-            const std::wstring &morph_name, size_t frame
+            std::uint32_t morph_name, size_t frame
         ) const;
         MorphKeyframe &GetMorphKeyframe(
-            const std::wstring &morph_name, size_t frame
+            std::uint32_t morph_name, size_t frame
         );
 
         MorphPose GetMorphPose(
-            const std::wstring &morph_name, size_t frame
+            std::uint32_t morph_name, size_t frame
         ) const;
         MorphPose GetMorphPose(
-            const std::wstring &morph_name, double time
+            std::uint32_t morph_name, double time
         ) const;
 
-        void RegisterBone(const std::wstring &bone_name);
-        void RegisterMorph(const std::wstring &morph_name);
+        void RegisterBone(std::uint32_t bone_name);
+        void RegisterMorph(std::uint32_t morph_name);
 
-        void UnregisterBone(const std::wstring &bone_name);
-        void UnregisterMorph(const std::wstring &morph_name);
+        void UnregisterBone(std::uint32_t bone_name);
+        void UnregisterMorph(std::uint32_t morph_name);
 
-        bool IsBoneRegistered(const std::wstring &bone_name) const;
-        bool IsMorphRegistered(const std::wstring &morph_name) const;
+        bool IsBoneRegistered(std::uint32_t bone_name) const;
+        bool IsMorphRegistered(std::uint32_t morph_name) const;
 
-        size_t QueryBoneKeyframeForward(const std::wstring &bone_name, size_t frame) const;
-        size_t QueryBoneKeyframeBackward(const std::wstring &bone_name, size_t frame) const;
+        size_t QueryBoneKeyframeForward(std::uint32_t bone_name, size_t frame) const;
+        size_t QueryBoneKeyframeBackward(std::uint32_t bone_name, size_t frame) const;
 
-        size_t QueryMorphKeyframeForward(const std::wstring &morph_name, size_t frame) const;
-        size_t QueryMorphKeyframeBackward(const std::wstring &morph_name, size_t frame) const;
+        size_t QueryMorphKeyframeForward(std::uint32_t morph_name, size_t frame) const;
+        size_t QueryMorphKeyframeBackward(std::uint32_t morph_name, size_t frame) const;
 
         size_t GetLength() const;
         void Clear();
@@ -125,8 +127,8 @@ namespace mmd {
     private:
         std::wstring name_;
         size_t length_;
-        std::map<std::wstring, std::map<size_t, BoneKeyframe>> bone_motions_;
-        std::map<std::wstring, std::map<size_t, MorphKeyframe>> morph_motions_;
+        std::map<std::uint32_t, std::map<size_t, BoneKeyframe>> bone_motions_;
+        std::map<std::uint32_t, std::map<size_t, MorphKeyframe>> morph_motions_;
     };
 
     class Pose {
@@ -111,38 +111,38 @@ Motion::MorphKeyframe::GetWeightInterpolator() {
 }
 
 inline void
-Motion::RegisterBone(const std::wstring &bone_name) {
+Motion::RegisterBone(std::uint32_t bone_name) {
     bone_motions_.insert(std::make_pair(bone_name, std::map<size_t, BoneKeyframe>()));
 }
 
 inline void
-Motion::RegisterMorph(const std::wstring &morph_name) {
+Motion::RegisterMorph(std::uint32_t morph_name) {
     morph_motions_.insert(std::make_pair(morph_name, std::map<size_t, MorphKeyframe>()));
 }
 
 inline void
-Motion::UnregisterBone(const std::wstring &bone_name) {
+Motion::UnregisterBone(std::uint32_t bone_name) {
     bone_motions_.erase(bone_name);
 }
 
 inline void
-Motion::UnregisterMorph(const std::wstring &morph_name) {
+Motion::UnregisterMorph(std::uint32_t morph_name) {
     morph_motions_.erase(morph_name);
 }
 
 inline bool
-Motion::IsBoneRegistered(const std::wstring &bone_name) const {
+Motion::IsBoneRegistered(std::uint32_t bone_name) const {
     return (bone_motions_.count(bone_name)>0);
 }
 
 inline bool
-Motion::IsMorphRegistered(const std::wstring &morph_name) const {
+Motion::IsMorphRegistered(std::uint32_t morph_name) const {
     return (morph_motions_.count(morph_name)>0);
 }
 
 inline size_t
-Motion::QueryBoneKeyframeForward(const std::wstring &bone_name, size_t frame) const {
-    std::map<std::wstring, std::map<size_t, BoneKeyframe>>::const_iterator i = bone_motions_.find(bone_name);
+Motion::QueryBoneKeyframeForward(std::uint32_t bone_name, size_t frame) const {
+    std::map<std::uint32_t, std::map<size_t, BoneKeyframe>>::const_iterator i = bone_motions_.find(bone_name);
     if(i!=bone_motions_.end()) {
         std::map<size_t, BoneKeyframe>::const_iterator j = i->second.lower_bound(frame);
         if(j!=i->second.end()) {
@@ -156,8 +156,8 @@ Motion::QueryBoneKeyframeForward(const std::wstring &bone_name, size_t frame) co
 }
 
 inline size_t
-Motion::QueryBoneKeyframeBackward(const std::wstring &bone_name, size_t frame) const {
-    std::map<std::wstring, std::map<size_t, BoneKeyframe>>::const_iterator i = bone_motions_.find(bone_name);
+Motion::QueryBoneKeyframeBackward(std::uint32_t bone_name, size_t frame) const {
+    std::map<std::uint32_t, std::map<size_t, BoneKeyframe>>::const_iterator i = bone_motions_.find(bone_name);
     if(i!=bone_motions_.end()) {
         std::map<size_t, BoneKeyframe>::const_iterator j = i->second.upper_bound(frame);
         if(j!=i->second.begin()) {
@@ -171,8 +171,8 @@ Motion::QueryBoneKeyframeBackward(const std::wstring &bone_name, size_t frame) c
 }
 
 inline size_t
-Motion::QueryMorphKeyframeForward(const std::wstring &morph_name, size_t frame) const {
-    std::map<std::wstring, std::map<size_t, MorphKeyframe>>::const_iterator i = morph_motions_.find(morph_name);
+Motion::QueryMorphKeyframeForward(std::uint32_t morph_name, size_t frame) const {
+    std::map<std::uint32_t, std::map<size_t, MorphKeyframe>>::const_iterator i = morph_motions_.find(morph_name);
     if(i!=morph_motions_.end()) {
         std::map<size_t, MorphKeyframe>::const_iterator j = i->second.lower_bound(frame);
         if(j!=i->second.end()) {
@@ -186,8 +186,8 @@ Motion::QueryMorphKeyframeForward(const std::wstring &morph_name, size_t frame)
 }
 
 inline size_t
-Motion::QueryMorphKeyframeBackward(const std::wstring &morph_name, size_t frame) const {
-    std::map<std::wstring, std::map<size_t, MorphKeyframe>>::const_iterator i = morph_motions_.find(morph_name);
+Motion::QueryMorphKeyframeBackward(std::uint32_t morph_name, size_t frame) const {
+    std::map<std::uint32_t, std::map<size_t, MorphKeyframe>>::const_iterator i = morph_motions_.find(morph_name);
     if(i!=morph_motions_.end()) {
         std::map<size_t, MorphKeyframe>::const_iterator j = i->second.upper_bound(frame);
         if(j!=i->second.begin()) {
@@ -214,12 +214,12 @@ Motion::SetName(const std::wstring &name) {
 }
 
 inline const Motion::BoneKeyframe&
-Motion::GetBoneKeyframe(const std::wstring &bone_name, size_t frame) const {
+Motion::GetBoneKeyframe(std::uint32_t bone_name, size_t frame) const {
     return bone_motions_.find(bone_name)->second.find(frame)->second;
 }
 
 inline Motion::BoneKeyframe&
-Motion::GetBoneKeyframe(const std::wstring &bone_name, size_t frame) {
+Motion::GetBoneKeyframe(std::uint32_t bone_name, size_t frame) {
     if(frame>length_) {
         length_ = frame;
     }
@@ -227,12 +227,12 @@ Motion::GetBoneKeyframe(const std::wstring &bone_name, size_t frame) {
 }
 
 inline const Motion::MorphKeyframe&
-Motion::GetMorphKeyframe(const std::wstring &morph_name, size_t frame) const {
+Motion::GetMorphKeyframe(std::uint32_t morph_name, size_t frame) const {
     return morph_motions_.find(morph_name)->second.find(frame)->second;
 }
 
 inline Motion::MorphKeyframe&
-Motion::GetMorphKeyframe(const std::wstring &morph_name, size_t frame) {
+Motion::GetMorphKeyframe(std::uint32_t morph_name, size_t frame) {
     if(frame>length_) {
         length_ = frame;
     }
@@ -253,7 +253,7 @@ Motion::Clear() {
 }
 
 inline Motion::BonePose
-Motion::GetBonePose(const std::wstring &bone_name, size_t frame) const {
+Motion::GetBonePose(std::uint32_t bone_name, size_t frame) const {
     const std::map<size_t, BoneKeyframe>& keyframes
         = bone_motions_.find(bone_name)->second;
 
@@ -319,7 +319,7 @@ Motion::GetBonePose(const std::wstring &bone_name, size_t frame) const {
 }
 
 inline Motion::BonePose
-Motion::GetBonePose(const std::wstring &bone_name, double time) const {
+Motion::GetBonePose(std::uint32_t bone_name, double time) const {
     const std::map<size_t, BoneKeyframe>& keyframes
         = bone_motions_.find(bone_name)->second;
 
@@ -380,7 +380,7 @@ Motion::GetBonePose(const std::wstring &bone_name, double time) const {
 }
 
 inline Motion::MorphPose
-Motion::GetMorphPose(const std::wstring &morph_name, size_t frame) const {
+Motion::GetMorphPose(std::uint32_t morph_name, size_t frame) const {
     const std::map<size_t, MorphKeyframe>& keyframes
         = morph_motions_.find(morph_name)->second;
 
@@ -424,7 +424,7 @@ Motion::GetMorphPose(const std::wstring &morph_name, size_t frame) const {
 }
 
 inline Motion::MorphPose
-Motion::GetMorphPose(const std::wstring &morph_name, double time) const {
+Motion::GetMorphPose(std::uint32_t morph_name, double time) const {
     const std::map<size_t, MorphKeyframe>& keyframes
         = morph_motions_.find(morph_name)->second;
 
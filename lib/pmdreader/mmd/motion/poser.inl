@@ -42,6 +42,12 @@ namespace mmd {
         const Model &GetModel() const;
         Model &GetModel();
 
+        // NameTable ids of the model's names, for MotionPlayer
+        size_t GetBoneNum() const;
+        std::uint32_t GetBoneNameId(size_t index) const;
+        size_t GetMorphNum() const;
+        std::uint32_t GetMorphNameId(size_t index) const;
+
     private:
 
         struct BoneImage {
@@ -181,22 +187,32 @@ namespace mmd {
         Poser &operator=(Poser&);
     };
 
-    class MotionPlayer {
+    /*
+      Plays a Motion on a poser: Poser, or any type with the GetBoneNum,
+      GetBoneNameId, GetMorphNum, GetMorphNameId, SetBonePose(size_t, ...)
+      and SetMorphPose(size_t, ...) members of Poser, such as a skeleton
+      outside libmmd.
+    */
+    template<typename PoserType>
+    class BasicMotionPlayer {
     public:
-        MotionPlayer(const Motion &motion, Poser &poser);
+        BasicMotionPlayer(const Motion &motion, PoserType &poser);
         void SeekFrame(size_t frame);
         void SeekTime(double time);
 
     private:
-        MotionPlayer &operator=(const MotionPlayer&);
+        BasicMotionPlayer &operator=(const BasicMotionPlayer&);
 
-        std::vector<std::pair<std::wstring, size_t>> bone_map_;
-        std::vector<std::pair<std::wstring, size_t>> morph_map_;
+        // Name ids of the motion, joined to bone and morph indices once
+        std::vector<std::pair<std::uint32_t, size_t>> bone_map_;
+        std::vector<std::pair<std::uint32_t, size_t>> morph_map_;
 
         const Motion &motion_;
-        Poser &poser_;
+        PoserType &poser_;
     };
 
+    typedef BasicMotionPlayer<Poser> MotionPlayer;
+
 #include "poser_impl.inl"
 
 } /* End of namespace mmd */
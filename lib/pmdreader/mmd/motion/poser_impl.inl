@@ -463,6 +463,15 @@ inline void Poser::Deform() {
 inline const Model& Poser::GetModel() const { return model_; }
 inline Model& Poser::GetModel() { return model_; }
 
+inline size_t Poser::GetBoneNum() const { return model_.GetBoneNum(); }
+inline std::uint32_t Poser::GetBoneNameId(size_t index) const {
+    return FindUTF16Name(model_.GetBone(index).GetName());
+}
+inline size_t Poser::GetMorphNum() const { return model_.GetMorphNum(); }
+inline std::uint32_t Poser::GetMorphNameId(size_t index) const {
+    return FindUTF16Name(model_.GetMorph(index).GetName());
+}
+
 inline void Poser::SetBonePose(size_t index, const Motion::BonePose& bone_pose) {
     bone_images_[index].translation_ = bone_pose.GetTranslation();
     bone_images_[index].rotation_ = bone_pose.GetRotation();
@@ -519,37 +528,39 @@ inline void Poser::MaterialImage::Init(float value) {
     diffuse_ = specular_ = ambient_ = edge_color_ = texture_ = sub_texture_ = toon_texture_ = seed;
 }
 
-inline MotionPlayer::MotionPlayer(const Motion& motion, Poser& poser) : motion_(motion), poser_(poser) {
-    const Model& model = poser_.GetModel();
-    for(size_t i=0;i<model.GetBoneNum();++i) {
-        const std::wstring &name = model.GetBone(i).GetName();
-        if(motion_.IsBoneRegistered(name)) {
+template<typename PoserType>
+inline BasicMotionPlayer<PoserType>::BasicMotionPlayer(const Motion& motion, PoserType& poser) : motion_(motion), poser_(poser) {
+    for(size_t i=0;i<poser_.GetBoneNum();++i) {
+        std::uint32_t name = poser_.GetBoneNameId(i);
+        if(name!=NameTable::kNoName && motion_.IsBoneRegistered(name)) {
             bone_map_.push_back(std::make_pair(name, i));
         }
     }
 
-    for(size_t i=0;i<model.GetMorphNum();++i) {
-        const std::wstring &name = model.GetMorph(i).GetName();
-        if(motion_.IsMorphRegistered(name)) {
+    for(size_t i=0;i<poser_.GetMorphNum();++i) {
+        std::uint32_t name = poser_.GetMorphNameId(i);
+        if(name!=NameTable::kNoName && motion_.IsMorphRegistered(name)) {
             morph_map_.push_back(std::make_pair(name, i));
         }
     }
 }
 
-inline void MotionPlayer::SeekFrame(size_t frame) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
+template<typename PoserType>
+inline void BasicMotionPlayer<PoserType>::SeekFrame(size_t frame) {
+    for(std::vector<std::pair<std::uint32_t, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
         poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, frame));
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
+    for(std::vector<std::pair<std::uint32_t, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
         poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, frame));
     }
 }
 
-inline void MotionPlayer::SeekTime(double time) {
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
+template<typename PoserType>
+inline void BasicMotionPlayer<PoserType>::SeekTime(double time) {
+    for(std::vector<std::pair<std::uint32_t, size_t>>::iterator i=morph_map_.begin();i!=morph_map_.end();++i) {
         poser_.SetMorphPose(i->second, motion_.GetMorphPose(i->first, time));
     }
-    for(std::vector<std::pair<std::wstring, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
+    for(std::vector<std::pair<std::uint32_t, size_t>>::iterator i=bone_map_.begin();i!=bone_map_.end();++i) {
         poser_.SetBonePose(i->second, motion_.GetBonePose(i->first, time));
     }
 }
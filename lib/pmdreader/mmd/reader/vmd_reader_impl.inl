@@ -25,7 +25,7 @@ inline void VmdReader::ReadMotion(Motion &motion) {
 
         for(size_t i=0;i<bone_motion_num;++i) {
             interprete::vmd_bone b = file_.Read<interprete::vmd_bone>();
-            Motion::BoneKeyframe &keyframe = motion.GetBoneKeyframe(ShiftJISToUTF16String(b.bone_name), b.nframe);
+            Motion::BoneKeyframe &keyframe = motion.GetBoneKeyframe(InternShiftJISName(b.bone_name), b.nframe);
             keyframe.SetTranslation(b.translation);
             keyframe.SetRotation(b.rotation);
 
@@ -65,7 +65,7 @@ inline void VmdReader::ReadMotion(Motion &motion) {
         
         for(size_t i=0;i<morph_motion_num;++i) {
             interprete::vmd_morph m = file_.Read<interprete::vmd_morph>();
-            Motion::MorphKeyframe &keyframe = motion.GetMorphKeyframe(ShiftJISToUTF16String(m.morph_name), m.nframe);
+            Motion::MorphKeyframe &keyframe = motion.GetMorphKeyframe(InternShiftJISName(m.morph_name), m.nframe);
             keyframe.SetWeight(m.weight);
         }
 
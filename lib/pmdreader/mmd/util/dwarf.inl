@@ -108,6 +108,11 @@ namespace mmd {
     std::wstring UTF8ToUTF16String(const std::string &s);
     std::wstring ShiftJISToUTF16String(const std::string &s);
 
+    // NameTable ids of bone and morph names
+    template<size_t length>
+    std::uint32_t InternShiftJISName(const mmd_string<length> &s);
+    std::uint32_t FindUTF16Name(const std::wstring &ws);
+
 #include "dwarf_impl.inl"
 
 } /* End of namespace mmd */
@@ -232,3 +232,18 @@ inline std::wstring ShiftJISToUTF16String(const std::string &s) {
     return std::wstring((std::uint16_t*)&to_buffer[0], (std::uint16_t*)&to_buffer[s.size()*4-to_length+1]);
 #endif
 }
+
+template<size_t length> inline std::uint32_t InternShiftJISName(const mmd_string<length> &s) {
+    return NameTable::instance().intern(ShiftJisToUtf8((const char*)s.content_, length));
+}
+
+inline std::uint32_t FindUTF16Name(const std::wstring &ws) {
+    // Model names hold one UTF-16 code unit per wchar_t
+    std::vector<std::uint8_t> bytes;
+    bytes.reserve(ws.size()*2);
+    for(size_t i=0;i<ws.size();++i) {
+        bytes.push_back(std::uint8_t(ws[i]&0xff));
+        bytes.push_back(std::uint8_t((ws[i]>>8)&0xff));
+    }
+    return NameTable::instance().find(Utf16LeToUtf8(bytes.data(), bytes.size()));
+}
@@ -1,64 +1,80 @@
 /*
  * Notes for hacking:
- * libmmd is a header only library. Keeping mmd.hxx only included by a source
- * file rather a header file can reduce compiling time.
+ * The model is parsed in place from a memory mapping of the file (see
+ * PmdView and PmxView), its records are converted straight into the
+ * caller's arrays. Bones of either format are first copied into
+ * bone_positions_ and bone_parents_, everything after that is shared.
+ * Textures start decoding on a TextureLoader as soon as the file is opened,
+ * so they overlap with the geometry and skeleton work of the caller.
  */
 #include "mmdadapter.h"
-#include "mmd/mmdslim.hh"
-#include "bitmap.h"
+#include "pmd_view.h"
+#include "pmx_view.h"
+#include "text_decode.h"
+#include "texture_loader.h"
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cstdio>
 #include <iostream>
 #include <exception>
-#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <unordered_set>
 
 using std::endl;
 
 namespace {
-	glm::vec4 conv(const mmd::Vector4f& rhs)
+	glm::vec4 conv4(const float* v, float w)
 	{
-		glm::vec4 lhs;
-		lhs[0] = rhs.v[0];
-		lhs[1] = rhs.v[1];
-		lhs[2] = rhs.v[2];
-		lhs[3] = rhs.v[3];
-		return lhs;
+		return glm::vec4(v[0], v[1], v[2], w);
 	}
-	glm::vec4 conv(const mmd::Vector3f& rhs)
+
+	// Texture name of a material, without the sphere map part
+	std::string diffuseTextureName(std::string name)
 	{
-		glm::vec4 lhs;
-		lhs[0] = rhs.v[0];
-		lhs[1] = rhs.v[1];
-		lhs[2] = rhs.v[2];
-	    lhs[3] = 0.0;
-		return lhs;
+		name = name.substr(0, name.find('*'));
+		size_t dot = name.find_last_of('.');
+		if (dot != std::string::npos) {
+			std::string ext = name.substr(dot + 1);
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			if (ext == "sph" || ext == "spa")
+				return std::string();
+		}
+		return name;
 	}
-	glm::vec2 conv(const mmd::Vector2f& rhs)
+
+	bool fileExists(const std::string& fn)
 	{
-		glm::vec2 lhs;
-		lhs[0] = rhs.v[0];
-		lhs[1] = rhs.v[1];
-		return lhs;
+		FILE* f = fopen(fn.c_str(), "rb");
+		if (f)
+			fclose(f);
+		return f != nullptr;
 	}
-	glm::uvec3 conv(const mmd::Vector3D<std::uint32_t>& rhs)
+
+	bool isPmx(const std::string& fn)
 	{
-		glm::uvec3 lhs;
-		lhs[0] = rhs.v[0];
-		lhs[1] = rhs.v[1];
-		lhs[2] = rhs.v[2];
-		return lhs;
+		char magic[4] = { 0 };
+		FILE* f = fopen(fn.c_str(), "rb");
+		if (!f)
+			return false;
+		size_t n = fread(magic, 1, sizeof(magic), f);
+		fclose(f);
+		return n == sizeof(magic) && memcmp(magic, "PMX ", 4) == 0;
 	}
 };
 
 class MMDAdapter {
 	bool isBoneHasRoot0(int bone_id)
 	{
-		do {
-			const auto& bone = model_.GetBone(bone_id);
-			int parent = bone.GetParentIndex();
-			if (parent < 0)
-				break;
+		// Bounded, a malformed file may contain cycles
+		for (size_t depth = 0; depth <= bone_parents_.size(); depth++) {
+			int parent = bone_parents_[bone_id];
+			if (parent < 0 || parent == bone_id)
+				return bone_id == 0;
 			bone_id = parent;
-		} while (true);
-		return bone_id == 0;
+		}
+		return false;
 	}
 public:
 	MMDAdapter()
@@ -69,25 +85,25 @@ public:
 	{
 	}
 
+	void setTextureThreads(size_t nthreads)
+	{
+		texture_threads_ = nthreads;
+	}
+
 	bool open(const std::string& fn)
 	{
 		try {
-			mmd::FileReader file(fn);
-			mmd::PmdReader reader(file);
-			reader.ReadModel(model_);
-
-			size_t useful_bone_id = 0;
-			for (size_t i = 0; i < model_.GetBoneNum(); i++) {
-				if (!isBoneHasRoot0(i)) {
-					pmd_bone_to_useful_bone_[i] = -1;
-					continue;
-				}
-				useful_bone_to_pmd_bone_[useful_bone_id] = i;
-				pmd_bone_to_useful_bone_[i] = useful_bone_id;
-				useful_bone_id++;
-			}
+			if (isPmx(fn))
+				pmx_.reset(new PmxView(fn));
+			else
+				view_.reset(new PmdView(fn));
+			readBones();
+			numberUsefulBones();
+			requestTextures();
 		} catch (std::exception& e) {
 			std::cerr << e.what() << endl;
+			view_.reset();
+			pmx_.reset();
 			return false;
 		}
 		return true;
@@ -98,65 +114,88 @@ public:
 		     std::vector<glm::vec4>& N,
 		     std::vector<glm::vec2>& UV)
 	{
-		size_t nv = model_.GetVertexNum();
+		if (pmx_) {
+			getPmxMesh(V, F, N, UV);
+			return ;
+		}
+		if (!view_) {
+			V.clear(); F.clear(); N.clear(); UV.clear();
+			return ;
+		}
+		const auto& vertices = view_->getVertices();
+		size_t nv = vertices.size();
 		V.resize(nv);
 		N.resize(nv);
 		UV.resize(nv);
 		for (size_t i = 0; i < nv; i++) {
-			const auto& v = model_.GetVertex(i);
-			V[i] = conv(v.GetCoordinate());
-			N[i] = conv(v.GetNormal());
-			UV[i] = conv(v.GetUVCoordinate());
-			N[i][3] = 0.0f;
-			V[i][3] = 1.0f;
+			PmdVertexRecord v = vertices[i];
+			V[i] = conv4(v.position, 1.0f);
+			N[i] = conv4(v.normal, 0.0f);
+			UV[i] = glm::vec2(v.uv[0], v.uv[1]);
 		}
-		size_t nf = model_.GetTriangleNum();
+		const auto& indices = view_->getIndices();
+		size_t nf = indices.size() / 3;
 		F.resize(nf);
 		for (size_t i = 0; i < nf; i++) {
-			const auto& f = model_.GetTriangle(i);
-			F[i] = conv(f);
+			F[i] = glm::uvec3(indices[3 * i], indices[3 * i + 1], indices[3 * i + 2]);
+			if (F[i][0] >= nv || F[i][1] >= nv || F[i][2] >= nv)
+				throw "MMDAdapter: face " + std::to_string(i) + " indexes a missing vertex";
 		}
 	}
 
-	void getMaterial(std::vector<Material>& vm)
+	void getMaterial(std::vector<Material>& vm, bool with_textures)
 	{
-		std::map<std::string, std::shared_ptr<Image>> loaded_tex;
-		vm.resize(model_.GetPartNum());
-		for (size_t i = 0; i < vm.size(); i++) {
-			const auto& part = model_.GetPart(i);
-			const auto& material = part.GetMaterial();
-			vm[i].diffuse = conv(material.GetDiffuseColor());
-			vm[i].ambient = conv(material.GetAmbientColor());
-			vm[i].specular = conv(material.GetSpecularColor());
-			vm[i].shininess = material.GetShininess();
-			vm[i].offset = part.GetBaseShift();
-			vm[i].nfaces = part.GetTriangleNum();
-			const mmd::Texture* tex = material.GetTexture();
-			if (!tex)
-				continue;
-			std::string texfn = mmd::UTF16ToNativeString(tex->GetTexturePath());
-			if (texfn.empty())
-				continue;
-			auto iter = loaded_tex.find(texfn);
-			if (iter != loaded_tex.end()) {
-				vm[i].texture = iter->second;
-				continue;
+		vm.clear();
+		size_t offset = 0;
+		auto add = [&vm, &offset](const float* diffuse, const float* ambient,
+		                          const float* specular, float shininess, uint32_t nindices) {
+			Material m;
+			m.diffuse = conv4(diffuse, diffuse[3]);
+			m.ambient = conv4(ambient, 0.0f);
+			m.specular = conv4(specular, 0.0f);
+			m.shininess = shininess;
+			m.offset = offset;
+			m.nfaces = nindices / 3;
+			offset += m.nfaces;
+			vm.emplace_back(m);
+		};
+		if (pmx_) {
+			for (const auto& material : pmx_->getMaterials())
+				add(material.diffuse, material.ambient, material.specular,
+				    material.shininess, material.nindices);
+		} else if (view_) {
+			const auto& materials = view_->getMaterials();
+			for (size_t i = 0; i < materials.size(); i++) {
+				PmdMaterialRecord material = materials[i];
+				add(material.diffuse, material.ambient, material.specular,
+				    material.shininess, material.nindices);
 			}
-			auto image = std::make_shared<Image>();
-			std::cerr << __func__ << " is trying to load texture " << texfn << std::endl;
-			if (!readBMP(texfn.data(), *image))
+		}
+		size_t nindices = pmx_ ? pmx_->getNIndices() : view_ ? view_->getIndices().size() : 0;
+		if (offset * 3 > nindices)
+			throw "MMDAdapter: materials cover " + std::to_string(offset * 3) +
+			      " indices, the model has " + std::to_string(nindices);
+		if (with_textures)
+			getTextures(vm);
+	}
+
+	void getTextures(std::vector<Material>& vm)
+	{
+		if (!view_ && !pmx_)
+			return ;
+		typedef std::chrono::steady_clock Clock;
+		auto start = Clock::now();
+		for (size_t i = 0; i < std::min(vm.size(), textures_.size()); i++) {
+			if (!textures_[i].valid())
 				continue;
-			std::cerr << __func__ << " successfully loaded texture " << texfn << std::endl;
-#if 0
-			std::cerr << "\t\ttesting RGB ";
-			for (int i = 0; i < 64; i++)
-				std::cerr << int(image->bytes[i]) << ' ';
-			std::cerr << std::endl;
-			//std::cerr << "\t\ttesting RGB " << int(image->bytes[0]) << ' ' << int(image->bytes[1]) << ' ' << int(image->bytes[2]) << ' ' << std::endl;
-			//std::cerr << "\t\ttesting RGB " << int(image->bytes[256]) << ' ' << int(image->bytes[257]) << ' ' << int(image->bytes[258]) << ' ' << std::endl;
-#endif
-			loaded_tex[texfn] = image;
-			vm[i].texture = image;
+			vm[i].texture = textures_[i].get();
+			if (vm[i].texture)
+				vm[i].texture_path = texture_paths_[i];
+		}
+		if (loader_) {
+			double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+			std::cerr << __func__ << ": " << loader_->getNRequests() << " textures, waited "
+			          << ms << " ms for decoding" << endl;
 		}
 	}
 
@@ -165,92 +204,236 @@ public:
 		if (useful_bone_id >= int(useful_bone_to_pmd_bone_.size()) || useful_bone_id < 0)
 			return false;
 		int id = useful_bone_to_pmd_bone_[useful_bone_id];
-		const auto& bone = model_.GetBone(id);
-		size_t mmd_parent = bone.GetParentIndex();
-		if (mmd_parent == mmd::nil) {
+		wcoord = bone_positions_[id];
+		int pmd_parent = bone_parents_[id];
+		if (pmd_parent < 0 || pmd_parent == id)
 			parent = -1;
-			wcoord = glm::vec3(conv(bone.GetPosition()));
-		} else {
-			parent = pmd_bone_to_useful_bone_[int(mmd_parent)];
-			wcoord = glm::vec3(conv(bone.GetPosition()));
-		}
-#if 0
-		std::cerr << "Joint " << id << " type " <<
-			bone.IsChildUseID() << ' ' <<
-		bone.IsRotatable() << ' ' <<
-		bone.IsMovable() << ' ' <<
-		bone.IsVisible() << ' ' <<
-		bone.IsControllable() << ' ' <<
-		bone.IsHasIK() << ' ' <<
-		bone.IsAppendRotate() << ' ' <<  // Remove these bones
-		bone.IsAppendTranslate() << ' ' <<
-		bone.IsRotAxisFixed() << ' ' <<
-		bone.IsUseLocalAxis() << ' ' <<
-		bone.IsPostPhysics() << ' ' <<
-		bone.IsReceiveTransform() << ' ' << std::endl;
-#endif
+		else
+			parent = pmd_bone_to_useful_bone_[pmd_parent];
 		return true;
 	}
 
+	std::string getJointName(int useful_bone_id)
+	{
+		if (useful_bone_id >= int(useful_bone_to_pmd_bone_.size()) || useful_bone_id < 0)
+			return std::string();
+		return bone_names_[useful_bone_to_pmd_bone_[useful_bone_id]];
+	}
+
 	void getJointWeights(std::vector<SparseTuple>& tup)
 	{
-		constexpr int SKINNING_BDEF1 = mmd::Model::SkinningOperator::SKINNING_BDEF1;
-		constexpr int SKINNING_BDEF2 = mmd::Model::SkinningOperator::SKINNING_BDEF2;
-		constexpr int SKINNING_BDEF4 = mmd::Model::SkinningOperator::SKINNING_BDEF4;
-		constexpr int SKINNING_SDEF = mmd::Model::SkinningOperator::SKINNING_SDEF;
-		size_t nv = model_.GetVertexNum();
 		tup.clear();
-		tup.reserve(nv * 2);
+		if (pmx_) {
+			getPmxJointWeights(tup);
+			return ;
+		}
+		if (!view_)
+			return ;
+		// PMD only has two bone skinning (BDEF2)
+		const auto& vertices = view_->getVertices();
+		size_t nbones = bone_parents_.size();
+		size_t nv = vertices.size();
+		tup.reserve(nv);
 		for (size_t i = 0; i < nv; i++) {
-			const auto& v = model_.GetVertex(i);
-			int skt = v.GetSkinningOperator().GetSkinningType();
+			PmdVertexRecord v = vertices[i];
+			if (v.bone[0] < 0 || v.bone[1] < 0 ||
+			    size_t(v.bone[0]) >= nbones || size_t(v.bone[1]) >= nbones)
+				continue;
+			auto bid0 = pmd_bone_to_useful_bone_[v.bone[0]];
+			auto bid1 = pmd_bone_to_useful_bone_[v.bone[1]];
+			if (bid0 >= 0 && bid1 >= 0)
+				tup.emplace_back(i, bid0, bid1, v.weight * 0.01f);
+		}
+	}
+private:
+	void readBones()
+	{
+		bone_positions_.clear();
+		bone_parents_.clear();
+		bone_names_.clear();
+		if (pmx_) {
+			for (const auto& bone : pmx_->getBones()) {
+				bone_positions_.emplace_back(bone.position[0], bone.position[1], bone.position[2]);
+				bone_parents_.emplace_back(bone.parent);
+				bone_names_.emplace_back(bone.name);
+			}
+			return ;
+		}
+		const auto& bones = view_->getBones();
+		for (size_t i = 0; i < bones.size(); i++) {
+			PmdBoneRecord bone = bones[i];
+			bone_positions_.emplace_back(bone.position[0], bone.position[1], bone.position[2]);
+			bone_parents_.emplace_back(bone.parent < int(bones.size()) ? bone.parent : -1);
+			bone_names_.emplace_back(ShiftJisToUtf8(bone.name, sizeof(bone.name)));
+		}
+	}
 
-			switch (skt) {
-				case SKINNING_BDEF1:
-					{
-						const auto& bdef1 = v.GetSkinningOperator().GetBDEF1();
-						auto bid = pmd_bone_to_useful_bone_[bdef1.GetBoneID()];
-						if (bid >= 0)
-							tup.emplace_back(i, bid, -1, 1.0f);
-					}
-					break;
-				case SKINNING_BDEF2:
-					{
-						const auto& bdef2 = v.GetSkinningOperator().GetBDEF2();
-						auto bid0 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(0)];
-						auto bid1 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(1)];
-						if (bid0 >= 0 && bid1 >= 0) {
-							tup.emplace_back(i, bid0, bid1, bdef2.GetBoneWeight());
-						}
-					}
-					break;
-				case SKINNING_BDEF4:
-					{
-						std::cerr << "We are limited to models that each vertex only binds to at most two bones " << std::endl;
-						throw -1;
-						break;
-#if 0
-						const auto& bdef4 = v.GetSkinningOperator().GetBDEF4();
-						for (int i = 0 ; i < 4; i++) {
-							auto bid = pmd_bone_to_useful_bone_[bdef4.GetBoneID(i)];
-							if (bid < 0)
-								continue;
-							tup.emplace_back(bid, i, bdef4.GetBoneWeight(i));
-						}
-#endif
-					}
-					break;
-				case SKINNING_SDEF:
-					std::cerr << "Unexcepted SkinningOperator " << v.GetSkinningOperator().GetSkinningType() << std::endl;
-					throw -1;
-					break;
+	/*
+	 * Number the bones of the tree under bone 0, parents before children.
+	 * PMX does not require parents to come first in the file; for files
+	 * where they do (all PMD files we know of) this is the file order.
+	 */
+	void numberUsefulBones()
+	{
+		size_t nbones = bone_parents_.size();
+		pmd_bone_to_useful_bone_.assign(nbones, -1);
+		useful_bone_to_pmd_bone_.clear();
+		std::vector<bool> useful(nbones);
+		for (size_t i = 0; i < nbones; i++)
+			useful[i] = isBoneHasRoot0(i);
+		bool progress = true;
+		while (progress) {
+			progress = false;
+			for (size_t i = 0; i < nbones; i++) {
+				if (!useful[i] || pmd_bone_to_useful_bone_[i] >= 0)
+					continue;
+				int parent = bone_parents_[i];
+				if (parent >= 0 && parent != int(i) && pmd_bone_to_useful_bone_[parent] < 0)
+					continue;
+				pmd_bone_to_useful_bone_[i] = useful_bone_to_pmd_bone_.size();
+				useful_bone_to_pmd_bone_.emplace_back(i);
+				progress = true;
 			}
-			//std::cerr << bdef2.GetBoneID(0) << "\t" << bdef2.GetBoneID(1) << "\t" << bdef2.GetBoneWeight() << endl;
 		}
 	}
-private:
-	mmd::Model model_;
-	std::unordered_map<int, int> useful_bone_to_pmd_bone_, pmd_bone_to_useful_bone_;
+
+	void getPmxMesh(std::vector<glm::vec4>& V,
+	                std::vector<glm::uvec3>& F,
+	                std::vector<glm::vec4>& N,
+	                std::vector<glm::vec2>& UV)
+	{
+		size_t nv = pmx_->getNVertices();
+		V.resize(nv);
+		N.resize(nv);
+		UV.resize(nv);
+		for (size_t i = 0; i < nv; i++) {
+			PmxVertex v = pmx_->getVertex(i);
+			V[i] = conv4(v.position, 1.0f);
+			N[i] = conv4(v.normal, 0.0f);
+			UV[i] = glm::vec2(v.uv[0], v.uv[1]);
+		}
+		size_t nf = pmx_->getNIndices() / 3;
+		F.resize(nf);
+		for (size_t i = 0; i < nf; i++) {
+			F[i] = glm::uvec3(pmx_->getIndex(3 * i), pmx_->getIndex(3 * i + 1), pmx_->getIndex(3 * i + 2));
+			if (F[i][0] >= nv || F[i][1] >= nv || F[i][2] >= nv)
+				throw "MMDAdapter: face " + std::to_string(i) + " indexes a missing vertex";
+		}
+	}
+
+	/*
+	 * Up to four influences per vertex. Bones outside the tree under bone
+	 * 0 are dropped and the remaining weights renormalized; vertices with
+	 * at most two influences keep the two joint form.
+	 */
+	void getPmxJointWeights(std::vector<SparseTuple>& tup)
+	{
+		size_t nv = pmx_->getNVertices();
+		int nbones = int(bone_parents_.size());
+		tup.reserve(nv);
+		for (size_t i = 0; i < nv; i++) {
+			PmxVertex v = pmx_->getVertex(i);
+			int jid[4];
+			float weight[4];
+			int n = 0;
+			float sum = 0.0f;
+			for (int k = 0; k < 4; k++) {
+				int bone = v.bone[k];
+				if (bone < 0 || bone >= nbones || v.weight[k] <= 0.0f ||
+				    pmd_bone_to_useful_bone_[bone] < 0)
+					continue;
+				int bid = pmd_bone_to_useful_bone_[bone];
+				int same = std::find(jid, jid + n, bid) - jid;
+				if (same < n) {
+					weight[same] += v.weight[k];
+				} else {
+					jid[n] = bid;
+					weight[n] = v.weight[k];
+					n++;
+				}
+				sum += v.weight[k];
+			}
+			if (n == 0)
+				continue;
+			// Heaviest first, so the two joint form keeps the main influences
+			for (int a = 1; a < n; a++)
+				for (int b = a; b > 0 && weight[b] > weight[b - 1]; b--) {
+					std::swap(weight[b], weight[b - 1]);
+					std::swap(jid[b], jid[b - 1]);
+				}
+			for (int k = 0; k < n; k++)
+				weight[k] /= sum;
+			if (n == 1)
+				tup.emplace_back(i, jid[0], -1, 1.0f);
+			else if (n == 2)
+				tup.emplace_back(i, jid[0], jid[1], weight[0]);
+			else {
+				if (n == 3) {
+					jid[3] = -1;
+					weight[3] = 0.0f;
+				}
+				tup.emplace_back(i, jid, weight);
+			}
+		}
+	}
+
+	// Texture names of the materials, without sphere maps, "" for none
+	std::vector<std::string> getTextureNames() const
+	{
+		std::vector<std::string> names;
+		if (pmx_) {
+			const auto& textures = pmx_->getTextures();
+			for (const auto& m : pmx_->getMaterials())
+				names.emplace_back(m.texture >= 0 ? diffuseTextureName(textures[m.texture])
+				                                  : std::string());
+			return names;
+		}
+		const auto& materials = view_->getMaterials();
+		for (size_t i = 0; i < materials.size(); i++) {
+			PmdMaterialRecord m = materials[i];
+			names.emplace_back(diffuseTextureName(
+				std::string(m.texture, strnlen(m.texture, sizeof(m.texture)))));
+		}
+		return names;
+	}
+
+	// Queue every distinct texture of the materials on loader_
+	void requestTextures()
+	{
+		std::vector<std::string> names = getTextureNames();
+		std::string location = pmx_ ? pmx_->getDirectory() : view_->getDirectory();
+		texture_paths_.assign(names.size(), std::string());
+		std::unordered_set<std::string> unique;
+		for (size_t i = 0; i < names.size(); i++) {
+			std::string texfn = names[i];
+			if (texfn.empty())
+				continue;
+			if (fileExists(location + texfn))
+				texfn = location + texfn;
+			texture_paths_[i] = texfn;
+			unique.insert(texfn);
+		}
+		textures_.assign(names.size(), TextureLoader::ImageFuture());
+		if (unique.empty())
+			return ;
+		size_t nthreads = texture_threads_ ? texture_threads_ : std::max(1u, std::thread::hardware_concurrency());
+		nthreads = std::min(unique.size(), nthreads);
+		loader_.reset(new TextureLoader(nthreads));
+		for (size_t i = 0; i < names.size(); i++)
+			if (!texture_paths_[i].empty())
+				textures_[i] = loader_->request(texture_paths_[i]);
+	}
+
+	std::unique_ptr<PmdView> view_;
+	std::unique_ptr<PmxView> pmx_;
+	std::vector<glm::vec3> bone_positions_;
+	std::vector<int> bone_parents_;         // -1: root, always a valid index otherwise
+	std::vector<std::string> bone_names_;   // UTF-8
+	std::vector<std::string> texture_paths_;
+	std::vector<TextureLoader::ImageFuture> textures_;     // Per material
+	std::unique_ptr<TextureLoader> loader_;
+	size_t texture_threads_ = 0;            // 0: hardware threads
+	std::vector<int> useful_bone_to_pmd_bone_, pmd_bone_to_useful_bone_;
 };
 
 MMDReader::MMDReader()
@@ -267,6 +450,11 @@ bool MMDReader::open(const std::string& fn)
 	return d_->open(fn);
 }
 
+void MMDReader::setTextureThreads(size_t nthreads)
+{
+	d_->setTextureThreads(nthreads);
+}
+
 void MMDReader::getMesh(std::vector<glm::vec4>& V,
 		std::vector<glm::uvec3>& F,
 		std::vector<glm::vec4>& N,
@@ -275,9 +463,14 @@ void MMDReader::getMesh(std::vector<glm::vec4>& V,
 	d_->getMesh(V, F, N, UV);
 }
 
-void MMDReader::getMaterial(std::vector<Material>& vm)
+void MMDReader::getMaterial(std::vector<Material>& vm, bool with_textures)
+{
+	d_->getMaterial(vm, with_textures);
+}
+
+void MMDReader::getTextures(std::vector<Material>& vm)
 {
-	d_->getMaterial(vm);
+	d_->getTextures(vm);
 }
 
 bool MMDReader::getJoint(int id, glm::vec3& wcoord, int& parent)
@@ -285,6 +478,11 @@ bool MMDReader::getJoint(int id, glm::vec3& wcoord, int& parent)
 	return d_->getJoint(id, wcoord, parent);
 }
 
+std::string MMDReader::getJointName(int id)
+{
+	return d_->getJointName(id);
+}
+
 void MMDReader::getJointWeights(std::vector<SparseTuple>& tup)
 {
 	d_->getJointWeights(tup);
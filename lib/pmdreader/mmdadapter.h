@@ -12,13 +12,29 @@
 
 class MMDAdapter;
 
+/*
+ * Joints of a vertex, heaviest first. Two joint vertices (PMD, PMX BDEF1,
+ * BDEF2 and SDEF) have jid2 = jid3 = -1 and weight1 = 1 - weight0; a
+ * single joint has jid1 = -1 as well. PMX BDEF4 and QDEF vertices use all
+ * four, jid3 may be -1 with weight3 = 0.
+ */
 struct SparseTuple {
 	int vid;
 	int jid0;
 	int jid1;
+	int jid2 = -1;
+	int jid3 = -1;
 	float weight0;
+	float weight1;
+	float weight2 = 0.0f;
+	float weight3 = 0.0f;
 	SparseTuple(int v, int j0, int j1, float w)
-		: vid(v), jid0(j0), jid1(j1), weight0(w)
+		: vid(v), jid0(j0), jid1(j1), weight0(w), weight1(1.0f - w)
+	{
+	}
+	SparseTuple(int v, const int jid[4], const float weight[4])
+		: vid(v), jid0(jid[0]), jid1(jid[1]), jid2(jid[2]), jid3(jid[3]),
+		  weight0(weight[0]), weight1(weight[1]), weight2(weight[2]), weight3(weight[3])
 	{
 	}
 };
@@ -29,7 +45,7 @@ public:
 	~MMDReader();
 
 	/*
-	 * Open a PMD model file.
+	 * Open a PMD or PMX (2.0, 2.1) model file.
 	 * Input
 	 *      fn: file name
 	 * Return:
@@ -37,6 +53,12 @@ public:
 	 *      false: file failed to open
 	 */
 	bool open(const std::string& fn);
+	/*
+	 * Decode textures on at most nthreads threads (0, the default: the
+	 * hardware threads). Call it before open; batch converters running
+	 * several readers at once pass 1 to bound threads and memory.
+	 */
+	void setTextureThreads(size_t nthreads);
 	/*
 	 * Get mesh data from an opened model file
 	 * Output:
@@ -44,6 +66,7 @@ public:
 	 *      F: list of faces
 	 *      N: list of vertex normals
 	 *      UV: texture UV coordinates for each vertex.
+	 * Throws std::string if a face indexes a missing vertex.
 	 */
 	void getMesh(std::vector<glm::vec4>& V,
 		     std::vector<glm::uvec3>& F,
@@ -52,8 +75,17 @@ public:
 	/*
 	 * Get list of materials
 	 * Check Material struct (in material.h) for details
+	 * Textures are decoded in the background from open() on. Pass
+	 * with_textures = false to return without waiting for them, and call
+	 * getTextures later. Throws std::string if the materials cover more
+	 * indices than the model has.
+	 */
+	void getMaterial(std::vector<Material>&, bool with_textures = true);
+	/*
+	 * Fill in Material::texture and texture_path of the materials returned
+	 * by getMaterial, blocks until their textures are decoded.
 	 */
-	void getMaterial(std::vector<Material>&);
+	void getTextures(std::vector<Material>&);
 	/*
 	 * Get a joint for given ID
 	 * Input:
@@ -72,16 +104,22 @@ public:
 	 *       The bone structure in actual PMD files is a forest.
 	 */
 	bool getJoint(int id, glm::vec3& wcoord, int& parent);
+	/*
+	 * Get the name of a joint, converted to UTF-8 (PMD names are
+	 * Shift-JIS). Return: "" for an invalid Joint ID.
+	 */
+	std::string getJointName(int id);
 	/*
 	 * Get a list of tuples representing the vertex-joint weight.
 	 * See SparseTuple for more details
 	 * Output:
 	 *      tup: an array of SparseTuple object
 	 * 
-	 * Note: if a vertex was binded to two joints, then only one would be
-	 *       placed into tup array, because the other one is supposed to
-	 *       get calculated in shaders on-the-fly, which is cheaper than
-	 *       reading another weight from VRAM.
+	 * Note: if a vertex was binded to two joints, then only one weight
+	 *       is meaningful, the other one is supposed to get calculated in
+	 *       shaders on-the-fly, which is cheaper than reading another
+	 *       weight from VRAM. Vertices bound to no joint of the tree are
+	 *       left out.
 	 */
 	void getJointWeights(std::vector<SparseTuple>& tup);
 private:
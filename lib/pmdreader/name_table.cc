@@ -0,0 +1,46 @@
+#include "name_table.h"
+#include <stdexcept>
+
+const uint32_t NameTable::kNoName;
+
+NameTable& NameTable::instance()
+{
+	static NameTable table;
+	return table;
+}
+
+uint32_t NameTable::intern(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto iter = ids_.find(name);
+	if (iter != ids_.end())
+		return iter->second;
+	uint32_t id = uint32_t(names_.size());
+	names_.emplace_back(name);
+	ids_.emplace(name, id);
+	return id;
+}
+
+uint32_t NameTable::find(const std::string& name) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto iter = ids_.find(name);
+	return iter == ids_.end() ? kNoName : iter->second;
+}
+
+const std::string& NameTable::getName(uint32_t id) const
+{
+	static const std::string empty;
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (id == kNoName)
+		return empty;
+	if (id >= names_.size())
+		throw std::out_of_range("NameTable: unknown name id " + std::to_string(id));
+	return names_[id];
+}
+
+size_t NameTable::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return names_.size();
+}
@@ -0,0 +1,39 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * NameTable: interns bone and morph names (UTF-8) into 32-bit ids.
+ *
+ * There is one table per process, so an id means the same name in every
+ * model and motion, and matching them is an integer comparison. Ids are
+ * dense and never reused. Interning takes a lock, so loaders on worker
+ * threads may share the table.
+ */
+class NameTable {
+public:
+	static const uint32_t kNoName = 0xffffffffu;
+
+	static NameTable& instance();
+
+	/* intern: the id of name, a new one if the name is not known yet */
+	uint32_t intern(const std::string& name);
+	/* find: the id of name, kNoName if it was never interned */
+	uint32_t find(const std::string& name) const;
+	/* getName: the name of id, "" for kNoName. The reference stays valid. */
+	const std::string& getName(uint32_t id) const;
+	size_t size() const;
+private:
+	NameTable() = default;
+
+	mutable std::mutex mutex_;
+	std::deque<std::string> names_;     // Stable addresses, keyed by ids_
+	std::unordered_map<std::string, uint32_t> ids_;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "pmd_view.h"
+
+namespace {
+	// "Pmd", version 1.0f, model name[20], comment[256]
+	const size_t kHeaderSize = 3 + 4 + 20 + 256;
+
+	static_assert(sizeof(PmdVertexRecord) == 38, "PMD vertex records are 38 bytes");
+	static_assert(sizeof(PmdMaterialRecord) == 70, "PMD material records are 70 bytes");
+	static_assert(sizeof(PmdBoneRecord) == 39, "PMD bone records are 39 bytes");
+}
+
+template<typename T>
+T PmdView::readCount(size_t& cursor, const char* name) const
+{
+	T count;
+	memcpy(&count, section(cursor, 1, sizeof(T), name), sizeof(T));
+	return count;
+}
+
+PmdView::PmdView(const std::string& fn)
+	: file_(fn)
+{
+	float version = 0.0f;
+	if (file_.size() >= kHeaderSize)
+		memcpy(&version, file_.data() + 3, sizeof(version));
+	if (version != 1.0f || memcmp(file_.data(), "Pmd", 3) != 0)
+		throw std::runtime_error("PmdView: " + fn + " is not a PMD file");
+
+	size_t cursor = kHeaderSize;
+	size_t nvertices = readCount<uint32_t>(cursor, "vertex");
+	vertices_ = RecordView<PmdVertexRecord>(
+		section(cursor, nvertices, sizeof(PmdVertexRecord), "vertex"), nvertices);
+	size_t nindices = readCount<uint32_t>(cursor, "index");
+	indices_ = RecordView<uint16_t>(
+		section(cursor, nindices, sizeof(uint16_t), "index"), nindices);
+	size_t nmaterials = readCount<uint32_t>(cursor, "material");
+	materials_ = RecordView<PmdMaterialRecord>(
+		section(cursor, nmaterials, sizeof(PmdMaterialRecord), "material"), nmaterials);
+	size_t nbones = readCount<uint16_t>(cursor, "bone");
+	bones_ = RecordView<PmdBoneRecord>(
+		section(cursor, nbones, sizeof(PmdBoneRecord), "bone"), nbones);
+}
+
+const uint8_t* PmdView::section(size_t& cursor, size_t count, size_t size, const char* name) const
+{
+	// count * size cannot overflow with count < file size
+	if (count > file_.size() || cursor + count * size > file_.size())
+		throw std::runtime_error("PmdView: " + file_.getPath() + " is truncated in the " +
+		                         name + " section");
+	const uint8_t* data = file_.data() + cursor;
+	cursor += count * size;
+	return data;
+}
+
+std::string PmdView::getDirectory() const
+{
+	const std::string& path = file_.getPath();
+	size_t pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
@@ -0,0 +1,108 @@
+#ifndef PMD_VIEW_H
+#define PMD_VIEW_H
+
+#include "mapped_file.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/*
+ * RecordView: count packed records of type T in memory owned by someone
+ * else (a MappedFile). Records in a file are not aligned, so they are
+ * returned by value through memcpy, which compiles to plain loads.
+ * Indexing is bounds-checked.
+ */
+template<typename T>
+class RecordView {
+public:
+	RecordView() = default;
+	RecordView(const uint8_t* data, size_t count)
+		: data_(data), count_(count)
+	{
+	}
+
+	size_t size() const { return count_; }
+	bool empty() const { return count_ == 0; }
+	size_t getBytes() const { return count_ * sizeof(T); }
+
+	T operator[](size_t i) const
+	{
+		if (i >= count_)
+			throw std::out_of_range("RecordView: record " + std::to_string(i) +
+			                        " of " + std::to_string(count_));
+		T record;
+		memcpy(&record, data_ + i * sizeof(T), sizeof(T));
+		return record;
+	}
+private:
+	const uint8_t* data_ = nullptr;
+	size_t count_ = 0;
+};
+
+/*
+ * Records of a PMD file as they are stored.
+ */
+#pragma pack(push, 1)
+struct PmdVertexRecord {
+	float position[3];
+	float normal[3];
+	float uv[2];
+	int16_t bone[2];
+	uint8_t weight;         // of bone[0], in percent
+	uint8_t edge_flag;
+};
+
+struct PmdMaterialRecord {
+	float diffuse[4];
+	float shininess;
+	float specular[3];
+	float ambient[3];
+	int8_t toon_id;
+	uint8_t edge_flag;
+	uint32_t nindices;      // 3 per face
+	char texture[20];       // "tex.bmp", "tex.bmp*sphere.sph", not terminated if full
+};
+
+struct PmdBoneRecord {
+	char name[20];          // Shift-JIS
+	int16_t parent;         // -1: root
+	int16_t child;
+	uint8_t type;
+	int16_t ik_bone;
+	float position[3];
+};
+#pragma pack(pop)
+
+/*
+ * PmdView: the vertex, index, material and bone sections of a PMD file,
+ * located in place in a memory mapping. Nothing is copied; the views are
+ * valid as long as the PmdView lives.
+ *
+ * Throws std::runtime_error if the file is not a PMD file or a section
+ * runs past its end.
+ */
+class PmdView {
+public:
+	explicit PmdView(const std::string& fn);
+
+	const RecordView<PmdVertexRecord>& getVertices() const { return vertices_; }
+	const RecordView<uint16_t>& getIndices() const { return indices_; }
+	const RecordView<PmdMaterialRecord>& getMaterials() const { return materials_; }
+	const RecordView<PmdBoneRecord>& getBones() const { return bones_; }
+
+	/* getDirectory: the directory of the file with a trailing separator */
+	std::string getDirectory() const;
+	size_t getFileSize() const { return file_.size(); }
+private:
+	/* section: count records of size bytes at cursor, advances cursor */
+	const uint8_t* section(size_t& cursor, size_t count, size_t size, const char* name) const;
+	template<typename T> T readCount(size_t& cursor, const char* name) const;
+
+	MappedFile file_;
+	RecordView<PmdVertexRecord> vertices_;
+	RecordView<uint16_t> indices_;
+	RecordView<PmdMaterialRecord> materials_;
+	RecordView<PmdBoneRecord> bones_;
+};
+
+#endif
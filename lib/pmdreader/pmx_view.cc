@@ -0,0 +1,281 @@
+#include "pmx_view.h"
+#include "text_decode.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	/*
+	 * Bounds-checked reader over the mapping. Every read past the end
+	 * throws, so a truncated file fails cleanly.
+	 */
+	class Cursor {
+	public:
+		Cursor(const MappedFile& file, size_t pos = 0)
+			: file_(file), pos_(pos)
+		{
+		}
+
+		const uint8_t* take(size_t bytes, const char* what)
+		{
+			if (bytes > file_.size() - pos_)
+				throw std::runtime_error("PmxView: " + file_.getPath() +
+				                         " is truncated in the " + what + " section");
+			const uint8_t* data = file_.data() + pos_;
+			pos_ += bytes;
+			return data;
+		}
+
+		template<typename T>
+		T read(const char* what)
+		{
+			T value;
+			memcpy(&value, take(sizeof(T), what), sizeof(T));
+			return value;
+		}
+
+		void readFloats(float* out, size_t n, const char* what)
+		{
+			memcpy(out, take(n * sizeof(float), what), n * sizeof(float));
+		}
+
+		/* Bone, texture and material indices are signed, -1: none */
+		int32_t readIndex(size_t size, const char* what)
+		{
+			switch (size) {
+				case 1: return read<int8_t>(what);
+				case 2: return read<int16_t>(what);
+				default: return read<int32_t>(what);
+			}
+		}
+
+		int32_t readCount(const char* what)
+		{
+			int32_t count = read<int32_t>(what);
+			// Each record takes at least a byte, which bounds bogus counts
+			if (count < 0 || size_t(count) > file_.size() - pos_)
+				throw std::runtime_error("PmxView: " + file_.getPath() +
+				                         " has a bad " + what + " count");
+			return count;
+		}
+
+		std::string readText(bool utf8, const char* what)
+		{
+			int32_t bytes = readCount(what);
+			const uint8_t* data = take(bytes, what);
+			if (utf8)
+				return std::string((const char*)data, bytes);
+			return Utf16LeToUtf8(data, bytes);
+		}
+
+		void skipText(const char* what)
+		{
+			take(readCount(what), what);
+		}
+
+		size_t getPosition() const { return pos_; }
+		const std::string& getPath() const { return file_.getPath(); }
+	private:
+		const MappedFile& file_;
+		size_t pos_ = 0;
+	};
+
+	/* readVertex: decode the vertex record at the position of in */
+	void readVertex(Cursor& in, PmxVertex& v, size_t extra_uvs, size_t bone_index_size)
+	{
+		in.readFloats(v.position, 3, "vertex");
+		in.readFloats(v.normal, 3, "vertex");
+		in.readFloats(v.uv, 2, "vertex");
+		in.take(extra_uvs * 4 * sizeof(float), "vertex");
+		v.skinning = in.read<uint8_t>("vertex");
+		std::fill(v.bone, v.bone + 4, -1);
+		std::fill(v.weight, v.weight + 4, 0.0f);
+		switch (v.skinning) {
+			case kPmxBdef1:
+				v.bone[0] = in.readIndex(bone_index_size, "vertex");
+				v.weight[0] = 1.0f;
+				break;
+			case kPmxBdef2:
+			case kPmxSdef:
+				v.bone[0] = in.readIndex(bone_index_size, "vertex");
+				v.bone[1] = in.readIndex(bone_index_size, "vertex");
+				v.weight[0] = in.read<float>("vertex");
+				v.weight[1] = 1.0f - v.weight[0];
+				if (v.skinning == kPmxSdef)
+					in.take(9 * sizeof(float), "vertex"); // C, R0, R1
+				break;
+			case kPmxBdef4:
+			case kPmxQdef:
+				for (int j = 0; j < 4; j++)
+					v.bone[j] = in.readIndex(bone_index_size, "vertex");
+				in.readFloats(v.weight, 4, "vertex");
+				break;
+			default:
+				throw std::runtime_error("PmxView: " + in.getPath() + " has unknown skinning type " +
+				                         std::to_string(int(v.skinning)));
+		}
+		in.read<float>("vertex"); // edge scale
+	}
+
+	// Header globals, in file order
+	enum {
+		kEncoding,
+		kExtraUVs,
+		kVertexIndexSize,
+		kTextureIndexSize,
+		kMaterialIndexSize,
+		kBoneIndexSize,
+		kMorphIndexSize,
+		kRigidBodyIndexSize,
+		kNumGlobals
+	};
+
+	const uint16_t kBoneTailIsIndex = 0x0001;
+	const uint16_t kBoneHasIK = 0x0020;
+	const uint16_t kBoneInheritRotation = 0x0100;
+	const uint16_t kBoneInheritTranslation = 0x0200;
+	const uint16_t kBoneFixedAxis = 0x0400;
+	const uint16_t kBoneLocalAxes = 0x0800;
+	const uint16_t kBoneExternalParent = 0x2000;
+}
+
+PmxView::PmxView(const std::string& fn)
+	: file_(fn)
+{
+	Cursor in(file_);
+	if (file_.size() < 9 || memcmp(file_.data(), "PMX ", 4) != 0)
+		throw std::runtime_error("PmxView: " + fn + " is not a PMX file");
+	in.take(4, "header");
+	float version = in.read<float>("header");
+	if (version != 2.0f && version != 2.1f)
+		throw std::runtime_error("PmxView: " + fn + " has unsupported PMX version " +
+		                         std::to_string(version));
+	size_t nglobals = in.read<uint8_t>("header");
+	if (nglobals < kNumGlobals)
+		throw std::runtime_error("PmxView: " + fn + " has a short header");
+	const uint8_t* globals = in.take(nglobals, "header");
+	bool utf8 = globals[kEncoding] != 0;
+	extra_uvs_ = globals[kExtraUVs];
+	vertex_index_size_ = globals[kVertexIndexSize];
+	size_t texture_index_size = globals[kTextureIndexSize];
+	bone_index_size_ = globals[kBoneIndexSize];
+	for (size_t size : { vertex_index_size_, texture_index_size, bone_index_size_ })
+		if (size != 1 && size != 2 && size != 4)
+			throw std::runtime_error("PmxView: " + fn + " has a bad index size");
+	for (int i = 0; i < 4; i++)
+		in.skipText("model info"); // names and comments
+
+	vertex_offsets_.resize(in.readCount("vertex"));
+	PmxVertex v;
+	for (auto& offset : vertex_offsets_) {
+		offset = in.getPosition();
+		readVertex(in, v, extra_uvs_, bone_index_size_);
+	}
+
+	nindices_ = in.readCount("index");
+	indices_ = in.take(nindices_ * vertex_index_size_, "index");
+
+	textures_.resize(in.readCount("texture"));
+	for (auto& path : textures_) {
+		path = in.readText(utf8, "texture");
+		std::replace(path.begin(), path.end(), '\\', '/');
+	}
+
+	materials_.resize(in.readCount("material"));
+	for (auto& m : materials_) {
+		in.skipText("material");
+		in.skipText("material");
+		in.readFloats(m.diffuse, 4, "material");
+		in.readFloats(m.specular, 3, "material");
+		m.shininess = in.read<float>("material");
+		in.readFloats(m.ambient, 3, "material");
+		in.take(1 + 4 * sizeof(float) + sizeof(float), "material"); // flags, edge
+		m.texture = in.readIndex(texture_index_size, "material");
+		in.readIndex(texture_index_size, "material"); // sphere map
+		in.read<uint8_t>("material"); // sphere mode
+		if (in.read<uint8_t>("material") != 0)
+			in.read<uint8_t>("material"); // shared toon
+		else
+			in.readIndex(texture_index_size, "material");
+		in.skipText("material"); // memo
+		m.nindices = in.read<int32_t>("material");
+		if (m.texture >= int32_t(textures_.size()))
+			m.texture = -1;
+	}
+
+	bones_.resize(in.readCount("bone"));
+	for (auto& b : bones_) {
+		b.name = in.readText(utf8, "bone");
+		in.skipText("bone");
+		in.readFloats(b.position, 3, "bone");
+		b.parent = in.readIndex(bone_index_size_, "bone");
+		in.read<int32_t>("bone"); // deform layer
+		uint16_t flags = in.read<uint16_t>("bone");
+		if (flags & kBoneTailIsIndex)
+			in.readIndex(bone_index_size_, "bone");
+		else
+			in.take(3 * sizeof(float), "bone");
+		if (flags & (kBoneInheritRotation | kBoneInheritTranslation)) {
+			in.readIndex(bone_index_size_, "bone");
+			in.read<float>("bone");
+		}
+		if (flags & kBoneFixedAxis)
+			in.take(3 * sizeof(float), "bone");
+		if (flags & kBoneLocalAxes)
+			in.take(6 * sizeof(float), "bone");
+		if (flags & kBoneExternalParent)
+			in.read<int32_t>("bone");
+		if (flags & kBoneHasIK) {
+			in.readIndex(bone_index_size_, "bone"); // target
+			in.take(sizeof(int32_t) + sizeof(float), "bone"); // loops, limit
+			int32_t nlinks = in.readCount("bone");
+			for (int32_t l = 0; l < nlinks; l++) {
+				in.readIndex(bone_index_size_, "bone");
+				if (in.read<uint8_t>("bone") != 0)
+					in.take(6 * sizeof(float), "bone"); // angle limits
+			}
+		}
+		if (b.parent >= int32_t(bones_.size()))
+			b.parent = -1;
+	}
+}
+
+uint32_t PmxView::getIndex(size_t i) const
+{
+	if (i >= nindices_)
+		throw std::out_of_range("PmxView: index " + std::to_string(i) +
+		                        " of " + std::to_string(nindices_));
+	const uint8_t* p = indices_ + i * vertex_index_size_;
+	switch (vertex_index_size_) {
+		case 1:
+			return *p;
+		case 2: {
+			uint16_t index;
+			memcpy(&index, p, sizeof(index));
+			return index;
+		}
+		default: {
+			uint32_t index;
+			memcpy(&index, p, sizeof(index));
+			return index;
+		}
+	}
+}
+
+PmxVertex PmxView::getVertex(size_t i) const
+{
+	if (i >= vertex_offsets_.size())
+		throw std::out_of_range("PmxView: vertex " + std::to_string(i) +
+		                        " of " + std::to_string(vertex_offsets_.size()));
+	Cursor in(file_, vertex_offsets_[i]);
+	PmxVertex v;
+	readVertex(in, v, extra_uvs_, bone_index_size_);
+	return v;
+}
+
+std::string PmxView::getDirectory() const
+{
+	const std::string& path = file_.getPath();
+	size_t pos = path.find_last_of("/\\");
+	return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
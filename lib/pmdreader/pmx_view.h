@@ -0,0 +1,85 @@
+#ifndef PMX_VIEW_H
+#define PMX_VIEW_H
+
+#include "mapped_file.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Skinning types of PMX vertices. SDEF is read as BDEF2 and QDEF (PMX
+ * 2.1, dual quaternion) as BDEF4, both are blended linearly.
+ */
+enum PmxSkinning {
+	kPmxBdef1 = 0,
+	kPmxBdef2 = 1,
+	kPmxBdef4 = 2,
+	kPmxSdef = 3,
+	kPmxQdef = 4,
+};
+
+struct PmxVertex {
+	float position[3];
+	float normal[3];
+	float uv[2];
+	uint8_t skinning;       // PmxSkinning
+	int32_t bone[4];        // -1: unused
+	float weight[4];        // BDEF2/SDEF: weight[1] = 1 - weight[0]
+};
+
+struct PmxMaterial {
+	float diffuse[4];
+	float specular[3];
+	float shininess;
+	float ambient[3];
+	int32_t texture;        // Index in PmxView::getTextures, -1: none
+	uint32_t nindices;      // 3 per face
+};
+
+struct PmxBone {
+	std::string name;       // UTF-8
+	float position[3];
+	int32_t parent;         // -1: root
+};
+
+/*
+ * PmxView: vertices, faces, textures, materials and bones of a PMX 2.0 or
+ * 2.1 file. Vertex records vary in length, so one pass over the memory
+ * mapping validates them and keeps their offsets; getVertex decodes a
+ * record in place when it is asked for. Material and bone records are
+ * decoded in that pass, and indices are fixed-size and read in place.
+ * Morphs, display frames and physics are not read.
+ *
+ * Throws std::runtime_error if the file is not a PMX file or a section
+ * runs past its end.
+ */
+class PmxView {
+public:
+	explicit PmxView(const std::string& fn);
+
+	size_t getNVertices() const { return vertex_offsets_.size(); }
+	PmxVertex getVertex(size_t i) const;
+	size_t getNIndices() const { return nindices_; }
+	uint32_t getIndex(size_t i) const;
+	/* getTextures: paths relative to the model, UTF-8 with '/' separators */
+	const std::vector<std::string>& getTextures() const { return textures_; }
+	const std::vector<PmxMaterial>& getMaterials() const { return materials_; }
+	const std::vector<PmxBone>& getBones() const { return bones_; }
+
+	/* getDirectory: the directory of the file with a trailing separator */
+	std::string getDirectory() const;
+	size_t getFileSize() const { return file_.size(); }
+private:
+	MappedFile file_;
+	std::vector<size_t> vertex_offsets_;   // Record offsets in the file
+	size_t extra_uvs_ = 0;
+	size_t bone_index_size_ = 0;
+	const uint8_t* indices_ = nullptr;
+	size_t nindices_ = 0;
+	size_t vertex_index_size_ = 0;
+	std::vector<std::string> textures_;
+	std::vector<PmxMaterial> materials_;
+	std::vector<PmxBone> bones_;
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "text_decode.h"
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXT_DECODE_SSE2 1
+#endif
+
+namespace {
+	const uint16_t kDoubleByteTable[] = {
+#include "sjis_table.inc"
+	};
+	const size_t kTrailBytes = 189;     // 0x40 - 0xFC
+	static_assert(sizeof(kDoubleByteTable) / sizeof(uint16_t) == 60 * kTrailBytes,
+	              "one row per lead byte");
+
+	bool isLeadByte(uint8_t c)
+	{
+		return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+	}
+
+	void appendUtf8(std::string& out, uint32_t c)
+	{
+		if (c < 0x80) {
+			out += char(c);
+		} else if (c < 0x800) {
+			out += char(0xc0 | (c >> 6));
+			out += char(0x80 | (c & 0x3f));
+		} else if (c < 0x10000) {
+			out += char(0xe0 | (c >> 12));
+			out += char(0x80 | ((c >> 6) & 0x3f));
+			out += char(0x80 | (c & 0x3f));
+		} else {
+			out += char(0xf0 | (c >> 18));
+			out += char(0x80 | ((c >> 12) & 0x3f));
+			out += char(0x80 | ((c >> 6) & 0x3f));
+			out += char(0x80 | (c & 0x3f));
+		}
+	}
+
+	/* Length of the ASCII run at s, stopping at the first NUL or byte >= 0x80 */
+	size_t asciiRun(const uint8_t* s, size_t n)
+	{
+		size_t i = 0;
+#ifdef TEXT_DECODE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			// High bit set or zero byte
+			int stop = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, zero)));
+			if (stop)
+				break;
+		}
+#else
+		for (; i + 8 <= n; i += 8) {
+			uint64_t v;
+			memcpy(&v, s + i, sizeof(v));
+			const uint64_t lo = 0x0101010101010101ull, hi = 0x8080808080808080ull;
+			if ((v | ((v - lo) & ~v)) & hi)
+				break;
+		}
+#endif
+		while (i < n && s[i] != 0 && s[i] < 0x80)
+			i++;
+		return i;
+	}
+
+	uint32_t readUnit(const uint8_t* s)
+	{
+		return s[0] | (s[1] << 8);
+	}
+
+	/*
+	 * Narrow the run of ASCII code units at s (n units) onto out.
+	 * Return: the number of units consumed
+	 */
+	size_t asciiRun16(const uint8_t* s, size_t n, std::string& out)
+	{
+		size_t i = 0;
+#ifdef TEXT_DECODE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i high = _mm_set1_epi16(int16_t(0xff80));
+		char narrow[16];
+		for (; i + 8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 2 * i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, high), zero)) != 0xffff)
+				break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(narrow), _mm_packus_epi16(v, v));
+			out.append(narrow, 8);
+		}
+#else
+		for (; i + 4 <= n; i += 4) {
+			uint64_t v;
+			memcpy(&v, s + 2 * i, sizeof(v));
+			if (v & 0xff80ff80ff80ff80ull)
+				break;
+			for (size_t k = 0; k < 4; k++)
+				out += char(s[2 * (i + k)]);
+		}
+#endif
+		for (; i < n && readUnit(s + 2 * i) < 0x80; i++)
+			out += char(s[2 * i]);
+		return i;
+	}
+}
+
+std::string ShiftJisToUtf8(const char* str, size_t n)
+{
+	const uint8_t* s = reinterpret_cast<const uint8_t*>(str);
+	std::string out;
+	out.reserve(n);
+	size_t i = 0;
+	while (i < n) {
+		size_t run = asciiRun(s + i, n - i);
+		out.append(str + i, run);
+		i += run;
+		if (i >= n || s[i] == 0)
+			break;
+		uint8_t c = s[i];
+		if (c >= 0xa1 && c <= 0xdf) {
+			// Half-width katakana
+			appendUtf8(out, 0xff61 + (c - 0xa1));
+			i++;
+		} else if (isLeadByte(c) && i + 1 < n && s[i + 1] >= 0x40 && s[i + 1] <= 0xfc) {
+			size_t row = c <= 0x9f ? c - 0x81 : c - 0xc1;
+			uint16_t u = kDoubleByteTable[row * kTrailBytes + s[i + 1] - 0x40];
+			appendUtf8(out, u ? u : 0xfffd);
+			i += 2;
+		} else {
+			appendUtf8(out, 0xfffd);
+			i++;
+		}
+	}
+	return out;
+}
+
+std::string Utf16LeToUtf8(const uint8_t* data, size_t bytes)
+{
+	size_t n = bytes / 2;
+	std::string out;
+	out.reserve(n);
+	size_t i = 0;
+	while (i < n) {
+		i += asciiRun16(data + 2 * i, n - i, out);
+		if (i >= n)
+			break;
+		uint32_t c = readUnit(data + 2 * i);
+		i++;
+		if (c >= 0xd800 && c < 0xdc00 && i < n) {
+			uint32_t low = readUnit(data + 2 * i);
+			if (low >= 0xdc00 && low < 0xe000) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				i++;
+			}
+		}
+		if (c >= 0xd800 && c < 0xe000)
+			c = 0xfffd;
+		appendUtf8(out, c);
+	}
+	return out;
+}
@@ -0,0 +1,26 @@
+#ifndef TEXT_DECODE_H
+#define TEXT_DECODE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * ShiftJisToUtf8: decode Shift-JIS (Windows code page 932, which MMD
+ * writes) into UTF-8. Decoding stops at the first NUL or after n bytes,
+ * so fixed-size name fields of PMD and VMD files can be passed as they
+ * are. Invalid sequences become U+FFFD.
+ *
+ * Runs of ASCII are copied 16 bytes at a time (SSE2 where available),
+ * everything else goes through a lookup table.
+ */
+std::string ShiftJisToUtf8(const char* s, size_t n);
+
+/*
+ * Utf16LeToUtf8: decode bytes of little-endian UTF-16 (PMX text) into
+ * UTF-8. A trailing odd byte is ignored, unpaired surrogates become
+ * U+FFFD. ASCII is narrowed 8 code units at a time.
+ */
+std::string Utf16LeToUtf8(const uint8_t* data, size_t bytes);
+
+#endif
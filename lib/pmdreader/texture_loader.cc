@@ -0,0 +1,43 @@
+#include "texture_loader.h"
+#include "bitmap.h"
+#include <exception>
+#include <iostream>
+
+TextureLoader::TextureLoader(size_t nthreads)
+	: pool_(nthreads)
+{
+}
+
+TextureLoader::ImageFuture TextureLoader::request(const std::string& fn)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto iter = requests_.find(fn);
+	if (iter != requests_.end())
+		return iter->second;
+
+	auto promise = std::make_shared<std::promise<std::shared_ptr<Image>>>();
+	ImageFuture future = promise->get_future().share();
+	requests_.emplace(fn, future);
+	pool_.enqueue([fn, promise]() {
+		// Whatever happens the promise is kept, waiters must not hang
+		std::shared_ptr<Image> image;
+		try {
+			image = std::make_shared<Image>();
+			if (!readBMP(fn.c_str(), *image)) {
+				std::cerr << "TextureLoader: cannot read " << fn << std::endl;
+				image = nullptr;
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "TextureLoader: cannot read " << fn << ": " << e.what() << std::endl;
+			image = nullptr;
+		}
+		promise->set_value(image);
+	});
+	return future;
+}
+
+size_t TextureLoader::getNRequests() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return requests_.size();
+}
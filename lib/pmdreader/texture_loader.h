@@ -0,0 +1,38 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <image.h>
+#include <thread_pool.h>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * TextureLoader: decodes texture files on a thread pool. Each path is
+ * decoded once no matter how many materials request it; every request
+ * for it shares the same future.
+ *
+ * A future resolves to null if the file cannot be read, also when decoding
+ * throws (e.g. std::bad_alloc for a huge bitmap). Destroying the
+ * loader waits for the decodes in flight.
+ */
+class TextureLoader {
+public:
+	typedef std::shared_future<std::shared_ptr<Image>> ImageFuture;
+
+	/* nthreads = 0 uses the number of hardware threads */
+	explicit TextureLoader(size_t nthreads = 0);
+
+	ImageFuture request(const std::string& fn);
+	/* wait: block until every requested texture is decoded */
+	void wait() { pool_.wait(); }
+	size_t getNRequests() const;
+private:
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, ImageFuture> requests_;
+	ThreadPool pool_;       // Last, joined before requests_ goes away
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * libmmd is header only and large, it is included by this file alone (see
+ * the notes in mmdadapter.cc). The VMD is read by mmd::VmdReader, and
+ * mmd::BasicMotionPlayer joins and interpolates it for JointPoser, which
+ * stands in for mmd::Poser and only keeps rotations.
+ */
+#include "vmd_player.h"
+#include "name_table.h"
+#include "mmd/mmd.hxx"
+#include <stdexcept>
+
+namespace {
+	class JointPoser {
+	public:
+		JointPoser(const std::vector<uint32_t>& bone_names)
+			: bone_names_(bone_names), rotations_(bone_names.size(), glm::fquat(1.0f, 0.0f, 0.0f, 0.0f))
+		{
+		}
+
+		size_t GetBoneNum() const { return bone_names_.size(); }
+		uint32_t GetBoneNameId(size_t index) const { return bone_names_[index]; }
+		size_t GetMorphNum() const { return 0; }
+		uint32_t GetMorphNameId(size_t) const { return NameTable::kNoName; }
+
+		void SetBonePose(size_t index, const mmd::Motion::BonePose& pose)
+		{
+			const mmd::Quaternionf& q = pose.GetRotation().q;
+			rotations_[index] = glm::normalize(glm::fquat(q.e, q.i, q.j, q.k));
+		}
+		void SetMorphPose(size_t, const mmd::Motion::MorphPose&) {}
+
+		const std::vector<glm::fquat>& getRotations() const { return rotations_; }
+	private:
+		std::vector<uint32_t> bone_names_;
+		std::vector<glm::fquat> rotations_;     // identity until posed
+	};
+}
+
+class VmdMotion {
+public:
+	VmdMotion(const std::string& fn, const std::vector<uint32_t>& bone_names)
+		: poser_(bone_names)
+	{
+		try {
+			mmd::FileReader file(fn);
+			mmd::VmdReader reader(file);
+			reader.ReadMotion(motion_);
+		} catch (const std::exception& e) {
+			throw std::runtime_error("VmdPlayer: cannot read " + fn + ": " + e.what());
+		}
+		player_.reset(new mmd::BasicMotionPlayer<JointPoser>(motion_, poser_));
+		for (uint32_t name : bone_names)
+			if (name != NameTable::kNoName && motion_.IsBoneRegistered(name))
+				nbound_++;
+	}
+
+	mmd::Motion motion_;
+	JointPoser poser_;
+	std::unique_ptr<mmd::BasicMotionPlayer<JointPoser>> player_;
+	size_t nbound_ = 0;
+};
+
+VmdPlayer::VmdPlayer(const std::string& fn, const std::vector<uint32_t>& bone_names)
+	: d_(new VmdMotion(fn, bone_names))
+{
+}
+
+VmdPlayer::~VmdPlayer()
+{
+}
+
+size_t VmdPlayer::getNFrames() const
+{
+	return d_->motion_.GetLength() + 1;
+}
+
+size_t VmdPlayer::getNBoundBones() const
+{
+	return d_->nbound_;
+}
+
+const std::vector<glm::fquat>& VmdPlayer::seekFrame(size_t frame)
+{
+	d_->player_->SeekFrame(frame);
+	return d_->poser_.getRotations();
+}
@@ -0,0 +1,46 @@
+#ifndef VMD_PLAYER_H
+#define VMD_PLAYER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+class VmdMotion;
+
+/*
+ * VmdPlayer: the bone motion of a VMD file, read with libmmd's VmdReader
+ * and played with its MotionPlayer. Motion bones are joined to the bones
+ * passed to the constructor by NameTable id, once.
+ *
+ * Only rotations are played, the skeleton keeps its bone lengths. Morph
+ * keyframes are read but not played.
+ */
+class VmdPlayer {
+public:
+	/*
+	 * Input:
+	 *      fn: the VMD file
+	 *      bone_names: NameTable id of every bone, kNoName for unnamed ones
+	 * Throws std::runtime_error if fn is not a readable VMD file.
+	 */
+	VmdPlayer(const std::string& fn, const std::vector<uint32_t>& bone_names);
+	~VmdPlayer();
+
+	/* getNFrames: frames up to and including the last keyframe */
+	size_t getNFrames() const;
+	/* getNBoundBones: bones of the constructor that have keyframes */
+	size_t getNBoundBones() const;
+	/*
+	 * seekFrame: interpolate the keyframes at frame. Return: the rotation
+	 * of every bone relative to its bind pose, in its parent's frame;
+	 * identity for bones without keyframes.
+	 */
+	const std::vector<glm::fquat>& seekFrame(size_t frame);
+private:
+	std::unique_ptr<VmdMotion> d_;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/*
+ * 64-bit FNV-1a, used as content hash for caches (textures, shader
+ * binaries, models). Not cryptographic, but stable across runs and
+ * platforms.
+ */
+const uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t h = kHashSeed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+inline uint64_t HashString(const std::string& s, uint64_t h = kHashSeed)
+{
+	// Hash the length too so that ("ab", "c") differs from ("a", "bc")
+	uint64_t len = s.size();
+	h = HashBytes(&len, sizeof(len), h);
+	return HashBytes(s.data(), s.size(), h);
+}
+
+template<typename T>
+inline uint64_t HashValue(const T& v, uint64_t h = kHashSeed)
+{
+	return HashBytes(&v, sizeof(T), h);
+}
+
+#endif
@@ -2,10 +2,11 @@
 #define IMAGE_H
 
 #include <vector>
+#include <cstdint>
 
 struct Image {
 	/*
- 	 * Image data in GL_RGB sequence.
+ 	 * Image data in GL_RGB (or GL_RGBA, see channels) sequence.
 	 * Notes: because of some funny alignment problem it's recommended to
 	 * transform the data into GL_RGBA format before calling
 	 * glTexSubImage2D if you want to use the data for texture mapping
@@ -13,7 +14,13 @@ struct Image {
 	std::vector<unsigned char> bytes;
 	int width;
 	int height;
-	int stride; // Stores the actual number of bytes for a scan line, you can ignore this for our current case.
+	int stride = 0; // Stores the actual number of bytes for a scan line, 0 means width * channels.
+	int channels = 3; // 3: GL_RGB, 4: GL_RGBA (e.g. textures from the model cache)
+	/*
+	 * Hash of the pixels, computed by TextureCache on first use, 0: not
+	 * computed yet. Reset it after changing bytes.
+	 */
+	mutable uint64_t hash = 0;
 };
 
 #endif
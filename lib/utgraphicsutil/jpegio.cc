@@ -64,6 +64,7 @@ bool LoadJPEG(const std::string& file_name, Image* image)
 
 	image->width = info.output_width;
 	image->height = info.output_height;
+	image->stride = image->width * 3;
 
 	int channels = info.num_components;
 	long size = image->width * image->height * 3;
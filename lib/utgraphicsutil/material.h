@@ -4,6 +4,7 @@
 #include "image.h"
 #include <glm/glm.hpp>
 #include <memory>
+#include <string>
 
 /*
  * PMD format groups faces according to their materials.
@@ -23,9 +24,16 @@ struct Material {
 	glm::vec4 diffuse, ambient, specular;
 	float shininess;
 	std::shared_ptr<Image> texture; // Texture for current material, can be null.
+	std::string texture_path;       // File of texture, empty if there is none.
 
 	size_t offset; // This material applies to faces starting from offset.
 	size_t nfaces; // This material applies to nfaces faces.
+
+	// Location of the faces in a packed index buffer (see
+	// Mesh::optimize), only valid if the mesh was optimized.
+	size_t index_offset = 0;    // In bytes
+	int base_vertex = 0;        // Added to every index of this material
+	bool short_indices = false; // uint16 indices, otherwise uint32
 };
 
 #endif
@@ -0,0 +1,168 @@
+#include "pixel_convert.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_CONVERT_X86 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXEL_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+void convertRowScalar(const unsigned char* s, unsigned char* d, int x, int width)
+{
+	for (; x < width; x++) {
+		d[x*4 + 0] = s[x*3 + 0];
+		d[x*4 + 1] = s[x*3 + 1];
+		d[x*4 + 2] = s[x*3 + 2];
+		d[x*4 + 3] = 0xFF;
+	}
+}
+
+#ifdef PIXEL_CONVERT_X86
+
+#if defined(__GNUC__)
+__attribute__((target("ssse3")))
+#endif
+void convertRowsSSSE3(const unsigned char* src, int width, int height,
+                      int stride, unsigned char* dst)
+{
+	// Spread 4 RGB pixels (12 bytes) into 4 RGBA pixels, A is filled by OR
+	const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+	                                   6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+	for (int row = 0; row < height; row++) {
+		const unsigned char* s = src + size_t(row) * stride;
+		unsigned char* d = dst + size_t(row) * width * 4;
+		int x = 0;
+		// 16 pixels per iteration: 48 bytes in, 64 bytes out
+		for (; x + 16 <= width; x += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(s + x*3));
+			__m128i b = _mm_loadu_si128((const __m128i*)(s + x*3 + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*)(s + x*3 + 32));
+			__m128i p0 = _mm_shuffle_epi8(a, mask);
+			__m128i p1 = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask);
+			__m128i p2 = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask);
+			__m128i p3 = _mm_shuffle_epi8(_mm_srli_si128(c, 4), mask);
+			_mm_storeu_si128((__m128i*)(d + x*4), _mm_or_si128(p0, alpha));
+			_mm_storeu_si128((__m128i*)(d + x*4 + 16), _mm_or_si128(p1, alpha));
+			_mm_storeu_si128((__m128i*)(d + x*4 + 32), _mm_or_si128(p2, alpha));
+			_mm_storeu_si128((__m128i*)(d + x*4 + 48), _mm_or_si128(p3, alpha));
+		}
+		convertRowScalar(s, d, x, width);
+	}
+}
+
+bool hasSSSE3()
+{
+#if defined(__GNUC__)
+	static const bool ret = __builtin_cpu_supports("ssse3");
+#else
+	static const bool ret = []() {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+	}();
+#endif
+	return ret;
+}
+
+#endif // PIXEL_CONVERT_X86
+
+#ifdef PIXEL_CONVERT_NEON
+
+void convertRowsNEON(const unsigned char* src, int width, int height,
+                     int stride, unsigned char* dst)
+{
+	for (int row = 0; row < height; row++) {
+		const unsigned char* s = src + size_t(row) * stride;
+		unsigned char* d = dst + size_t(row) * width * 4;
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			uint8x16x3_t rgb = vld3q_u8(s + x*3);
+			uint8x16x4_t rgba;
+			rgba.val[0] = rgb.val[0];
+			rgba.val[1] = rgb.val[1];
+			rgba.val[2] = rgb.val[2];
+			rgba.val[3] = vdupq_n_u8(0xFF);
+			vst4q_u8(d + x*4, rgba);
+		}
+		convertRowScalar(s, d, x, width);
+	}
+}
+
+#endif // PIXEL_CONVERT_NEON
+
+}
+
+void ConvertRGBToRGBA(const unsigned char* src,
+                      int width,
+                      int height,
+                      int src_stride,
+                      unsigned char* dst)
+{
+	if (src_stride <= 0)
+		src_stride = width * 3;
+#if defined(PIXEL_CONVERT_X86)
+	if (hasSSSE3()) {
+		convertRowsSSSE3(src, width, height, src_stride, dst);
+		return ;
+	}
+#elif defined(PIXEL_CONVERT_NEON)
+	convertRowsNEON(src, width, height, src_stride, dst);
+	return ;
+#endif
+	for (int row = 0; row < height; row++)
+		convertRowScalar(src + size_t(row) * src_stride,
+		                 dst + size_t(row) * width * 4,
+		                 0, width);
+}
+
+void ImageToRGBA(const Image& image, std::vector<unsigned char>& rgba)
+{
+	rgba.resize(size_t(image.width) * image.height * 4);
+	if (image.channels == 4) {
+		size_t row = size_t(image.width) * 4;
+		size_t stride = image.stride ? image.stride : row;
+		for (int y = 0; y < image.height; y++)
+			std::copy(image.bytes.begin() + y * stride, image.bytes.begin() + y * stride + row,
+			          rgba.begin() + y * row);
+		return ;
+	}
+	ConvertRGBToRGBA(image.bytes.data(), image.width, image.height,
+	                 image.stride, rgba.data());
+}
+
+void ResampleRGBA(const unsigned char* src, int sw, int sh,
+                  unsigned char* dst, int dw, int dh)
+{
+	float sx = float(sw) / dw;
+	float sy = float(sh) / dh;
+	for (int y = 0; y < dh; y++) {
+		float fy = std::max(0.0f, (y + 0.5f) * sy - 0.5f);
+		int y0 = std::min(int(fy), sh - 1);
+		int y1 = std::min(y0 + 1, sh - 1);
+		float ty = fy - y0;
+		for (int x = 0; x < dw; x++) {
+			float fx = std::max(0.0f, (x + 0.5f) * sx - 0.5f);
+			int x0 = std::min(int(fx), sw - 1);
+			int x1 = std::min(x0 + 1, sw - 1);
+			float tx = fx - x0;
+			const unsigned char* p00 = src + (size_t(y0) * sw + x0) * 4;
+			const unsigned char* p01 = src + (size_t(y0) * sw + x1) * 4;
+			const unsigned char* p10 = src + (size_t(y1) * sw + x0) * 4;
+			const unsigned char* p11 = src + (size_t(y1) * sw + x1) * 4;
+			unsigned char* d = dst + (size_t(y) * dw + x) * 4;
+			for (int c = 0; c < 4; c++) {
+				float top = p00[c] + (p01[c] - p00[c]) * tx;
+				float bottom = p10[c] + (p11[c] - p10[c]) * tx;
+				d[c] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+			}
+		}
+	}
+}
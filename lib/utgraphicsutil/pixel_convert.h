@@ -0,0 +1,33 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <vector>
+#include "image.h"
+
+/*
+ * ConvertRGBToRGBA: expand RGB rows into tightly packed RGBA with A = 0xFF.
+ *      src_stride: bytes between two scan lines of src, pass 0 for width * 3
+ *      dst: must hold width * height * 4 bytes
+ *
+ * Uses SSSE3 (x86) or NEON (ARM) when available, otherwise falls back to a
+ * scalar loop.
+ */
+void ConvertRGBToRGBA(const unsigned char* src,
+                      int width,
+                      int height,
+                      int src_stride,
+                      unsigned char* dst);
+
+/*
+ * ImageToRGBA: convert an Image to tightly packed RGBA honoring
+ * Image::stride. RGBA images are copied.
+ */
+void ImageToRGBA(const Image& image, std::vector<unsigned char>& rgba);
+
+/*
+ * ResampleRGBA: bilinear resampling of a tightly packed RGBA image.
+ */
+void ResampleRGBA(const unsigned char* src, int sw, int sh,
+                  unsigned char* dst, int dw, int dh);
+
+#endif
@@ -0,0 +1,73 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <string>
+
+ThreadPool::ThreadPool(size_t nthreads)
+{
+	if (nthreads == 0)
+		nthreads = std::max(1u, std::thread::hardware_concurrency());
+	for (size_t i = 0; i < nthreads; i++)
+		threads_.emplace_back(&ThreadPool::run, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	task_cv_.notify_all();
+	for (auto& t : threads_)
+		t.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.emplace_back(std::move(task));
+		pending_++;
+	}
+	task_cv_.notify_one();
+}
+
+void ThreadPool::wait(size_t max_pending)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_cv_.wait(lock, [this, max_pending]() { return pending_ <= max_pending; });
+}
+
+size_t ThreadPool::getPending() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return pending_;
+}
+
+void ThreadPool::run()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			task_cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+			if (tasks_.empty())
+				return ;
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+		try {
+			task();
+		} catch (const std::string& e) {
+			std::cerr << __func__ << ": task failed: " << e << std::endl;
+		} catch (const std::exception& e) {
+			std::cerr << __func__ << ": task failed: " << e.what() << std::endl;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_--;
+		}
+		done_cv_.notify_all();
+	}
+}
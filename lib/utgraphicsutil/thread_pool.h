@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * ThreadPool: fixed set of worker threads running queued tasks in FIFO
+ * order. Tasks must not touch GL, the context belongs to the main thread.
+ * Exceptions escaping a task are logged and swallowed.
+ */
+class ThreadPool {
+public:
+	/* nthreads = 0 uses the number of hardware threads */
+	explicit ThreadPool(size_t nthreads = 0);
+	/* Runs the remaining tasks, then joins the workers */
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void enqueue(std::function<void()> task);
+	/*
+	 * wait: block until at most max_pending tasks are queued or running,
+	 * wait() returns once the pool is idle.
+	 */
+	void wait(size_t max_pending = 0);
+
+	size_t getPending() const;
+	size_t getNThreads() const { return threads_.size(); }
+private:
+	void run();
+
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> tasks_;
+	mutable std::mutex mutex_;
+	std::condition_variable task_cv_;
+	std::condition_variable done_cv_;
+	size_t pending_ = 0;    // queued + running
+	bool stop_ = false;
+};
+
+#endif
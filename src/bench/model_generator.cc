@@ -0,0 +1,522 @@
+#include "model_generator.h"
+#include <pmd_view.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace {
+	const int kSides = 8;               // vertices per ring
+	const int kChainLength = 8;         // bones per chain from the root
+	const float kSegment = 1.0f;        // bone length
+	const float kRadius = 0.2f;
+	const size_t kMaxPmdVertices = 65536;
+	const size_t kMaxPmdBones = 32767;
+
+	struct GenBone {
+		std::string name;
+		glm::vec3 position;
+		int parent;                 // -1: root
+		int tail;                   // first child, -1: none
+	};
+
+	// A tube around bone from its parent's position to its own
+	struct Tube {
+		int bone;
+		size_t first_vertex;
+		size_t nrings;
+	};
+
+	struct GenVertex {
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 uv;
+		int bone[4];
+		float weight[4];
+	};
+
+	struct GenMaterial {
+		glm::vec4 diffuse;
+		glm::vec3 specular;
+		glm::vec3 ambient;
+		float shininess;
+		int texture;                // -1: none
+		uint32_t nindices;
+	};
+
+	struct GenModel {
+		std::vector<GenBone> bones;
+		std::vector<Tube> tubes;
+		std::vector<GenMaterial> materials;
+		std::vector<std::string> textures;
+		size_t nvertices = 0;
+		size_t nfaces = 0;
+		int nweights = 2;
+	};
+
+	template<typename T>
+	void put(std::ostream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void putFixed(std::ostream& out, const std::string& s, size_t size)
+	{
+		std::vector<char> field(size, 0);
+		memcpy(field.data(), s.data(), std::min(s.size(), size));
+		out.write(field.data(), size);
+	}
+
+	/* PMX text, UTF-16LE. Generated names are ASCII. */
+	void putText(std::ostream& out, const std::string& s)
+	{
+		put<int32_t>(out, int32_t(s.size() * 2));
+		for (char c : s) {
+			put<uint8_t>(out, uint8_t(c));
+			put<uint8_t>(out, 0);
+		}
+	}
+
+	std::string formatIndex(const char* prefix, size_t i, const char* suffix = "")
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%s%04zu%s", prefix, i, suffix);
+		return name;
+	}
+
+	void buildSkeleton(const GeneratorOptions& options, std::mt19937& rng, GenModel& model)
+	{
+		std::uniform_real_distribution<float> jitter(-0.15f, 0.15f);
+		size_t nchains = (options.nbones - 1 + kChainLength - 1) / kChainLength;
+		model.bones.resize(options.nbones);
+		model.bones[0] = { "bone0", glm::vec3(0.0f), -1, -1 };
+		for (size_t i = 1; i < options.nbones; i++) {
+			size_t chain = (i - 1) / kChainLength;
+			size_t link = (i - 1) % kChainLength;
+			// Chains start at points spread over a sphere (Fibonacci lattice)
+			float y = 1.0f - 2.0f * (chain + 0.5f) / nchains;
+			float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+			float phi = 2.39996323f * chain;
+			glm::vec3 dir = glm::vec3(r * std::cos(phi), y, r * std::sin(phi));
+			dir = glm::normalize(dir + glm::vec3(jitter(rng), jitter(rng), jitter(rng)));
+
+			GenBone& bone = model.bones[i];
+			bone.name = "bone" + std::to_string(i);
+			bone.parent = link == 0 ? 0 : int(i - 1);
+			bone.position = model.bones[bone.parent].position + dir * kSegment;
+			bone.tail = -1;
+			if (model.bones[bone.parent].tail < 0)
+				model.bones[bone.parent].tail = int(i);
+		}
+	}
+
+	void buildTubes(const GeneratorOptions& options, GenModel& model)
+	{
+		size_t nrings = options.nvertices / kSides;
+		size_t ntubes = std::min(model.bones.size() - 1, nrings / 2);
+		if (ntubes == 0)
+			throw std::string("generateModel: ") + std::to_string(options.nvertices) +
+			      " vertices are too few, at least " + std::to_string(2 * kSides) + " are needed";
+		size_t first = 0;
+		for (size_t t = 0; t < ntubes; t++) {
+			Tube tube;
+			tube.bone = int(1 + t * (model.bones.size() - 1) / ntubes);
+			tube.first_vertex = first;
+			tube.nrings = nrings / ntubes + (t < nrings % ntubes ? 1 : 0);
+			first += tube.nrings * kSides;
+			model.nfaces += (tube.nrings - 1) * kSides * 2;
+			model.tubes.emplace_back(tube);
+		}
+		model.nvertices = first;
+	}
+
+	void buildMaterials(const GeneratorOptions& options, std::mt19937& rng, GenModel& model)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (size_t i = 0; i < options.ntextures; i++)
+			model.textures.emplace_back(formatIndex("tex", i, ".bmp"));
+		size_t nmaterials = std::max<size_t>(1, std::min(options.nmaterials, model.nfaces));
+		for (size_t m = 0; m < nmaterials; m++) {
+			GenMaterial ma;
+			ma.diffuse = glm::vec4(0.4f + 0.6f * unit(rng), 0.4f + 0.6f * unit(rng),
+			                       0.4f + 0.6f * unit(rng), 1.0f);
+			ma.specular = glm::vec3(0.3f);
+			ma.ambient = glm::vec3(ma.diffuse) * 0.5f;
+			ma.shininess = 5.0f + 45.0f * unit(rng);
+			ma.texture = model.textures.empty() ? -1 : int(m % model.textures.size());
+			size_t begin = m * model.nfaces / nmaterials;
+			size_t end = (m + 1) * model.nfaces / nmaterials;
+			ma.nindices = uint32_t((end - begin) * 3);
+			model.materials.emplace_back(ma);
+		}
+	}
+
+	GenVertex makeVertex(const GenModel& model, const Tube& tube, size_t ring, int side)
+	{
+		const GenBone& bone = model.bones[tube.bone];
+		const GenBone& parent = model.bones[bone.parent];
+		glm::vec3 axis = glm::normalize(bone.position - parent.position);
+		glm::vec3 helper = std::abs(axis.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+		glm::vec3 u = glm::normalize(glm::cross(helper, axis));
+		glm::vec3 v = glm::cross(axis, u);
+
+		float t = float(ring) / (tube.nrings - 1);
+		float angle = 2.0f * 3.14159265f * side / kSides;
+		GenVertex vert;
+		vert.normal = std::cos(angle) * u + std::sin(angle) * v;
+		vert.position = glm::mix(parent.position, bone.position, t) + kRadius * vert.normal;
+		vert.uv = glm::vec2(float(side) / kSides, t);
+
+		float weight[4] = { t, 1.0f - t, 0.0f, 0.0f };
+		int bones[4] = { tube.bone, bone.parent, -1, -1 };
+		if (model.nweights == 4) {
+			weight[0] += 0.25f;
+			weight[1] += 0.25f;
+			bones[2] = parent.parent;
+			bones[3] = bones[2] >= 0 ? model.bones[bones[2]].parent : -1;
+			weight[2] = bones[2] >= 0 ? 0.2f : 0.0f;
+			weight[3] = bones[3] >= 0 ? 0.1f : 0.0f;
+		}
+		float sum = weight[0] + weight[1] + weight[2] + weight[3];
+		for (int k = 0; k < 4; k++) {
+			vert.bone[k] = bones[k];
+			vert.weight[k] = weight[k] / sum;
+		}
+		return vert;
+	}
+
+	template<typename F>
+	void forEachVertex(const GenModel& model, F f)
+	{
+		for (const auto& tube : model.tubes)
+			for (size_t ring = 0; ring < tube.nrings; ring++)
+				for (int side = 0; side < kSides; side++)
+					f(makeVertex(model, tube, ring, side));
+	}
+
+	/* Quads between rings as two triangles, counter-clockwise from outside */
+	template<typename F>
+	void forEachIndex(const GenModel& model, F f)
+	{
+		for (const auto& tube : model.tubes) {
+			for (size_t ring = 0; ring + 1 < tube.nrings; ring++) {
+				size_t base = tube.first_vertex + ring * kSides;
+				for (int side = 0; side < kSides; side++) {
+					size_t a = base + side;
+					size_t b = base + (side + 1) % kSides;
+					size_t c = a + kSides;
+					size_t d = b + kSides;
+					f(a); f(b); f(c);
+					f(b); f(d); f(c);
+				}
+			}
+		}
+	}
+
+	void writePmd(const std::string& fn, const GenModel& model)
+	{
+		std::ofstream out(fn, std::ios::binary);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+		out.write("Pmd", 3);
+		put<float>(out, 1.0f);
+		putFixed(out, "synthetic", 20);
+		putFixed(out, "Generated by skinning-gen", 256);
+
+		put<uint32_t>(out, uint32_t(model.nvertices));
+		forEachVertex(model, [&out](const GenVertex& v) {
+			PmdVertexRecord r;
+			memcpy(r.position, &v.position, sizeof(r.position));
+			memcpy(r.normal, &v.normal, sizeof(r.normal));
+			memcpy(r.uv, &v.uv, sizeof(r.uv));
+			r.bone[0] = int16_t(v.bone[0]);
+			r.bone[1] = int16_t(v.bone[1]);
+			r.weight = uint8_t(std::lround(v.weight[0] * 100.0f));
+			r.edge_flag = 0;
+			put(out, r);
+		});
+
+		put<uint32_t>(out, uint32_t(model.nfaces * 3));
+		forEachIndex(model, [&out](size_t i) { put<uint16_t>(out, uint16_t(i)); });
+
+		put<uint32_t>(out, uint32_t(model.materials.size()));
+		for (const auto& ma : model.materials) {
+			PmdMaterialRecord r;
+			memcpy(r.diffuse, &ma.diffuse, sizeof(r.diffuse));
+			r.shininess = ma.shininess;
+			memcpy(r.specular, &ma.specular, sizeof(r.specular));
+			memcpy(r.ambient, &ma.ambient, sizeof(r.ambient));
+			r.toon_id = -1;
+			r.edge_flag = 0;
+			r.nindices = ma.nindices;
+			memset(r.texture, 0, sizeof(r.texture));
+			if (ma.texture >= 0)
+				memcpy(r.texture, model.textures[ma.texture].data(),
+				       std::min(sizeof(r.texture), model.textures[ma.texture].size()));
+			put(out, r);
+		}
+
+		put<uint16_t>(out, uint16_t(model.bones.size()));
+		for (const auto& bone : model.bones) {
+			PmdBoneRecord r;
+			memset(r.name, 0, sizeof(r.name));
+			memcpy(r.name, bone.name.data(), std::min(sizeof(r.name), bone.name.size()));
+			r.parent = int16_t(bone.parent);
+			r.child = int16_t(bone.tail);
+			r.type = 0;             // rotation
+			r.ik_bone = 0;
+			memcpy(r.position, &bone.position, sizeof(r.position));
+			put(out, r);
+		}
+
+		// No IK, morphs, display groups
+		put<uint16_t>(out, 0);
+		put<uint16_t>(out, 0);
+		put<uint8_t>(out, 0);
+		put<uint8_t>(out, 0);
+		put<uint32_t>(out, 0);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+	}
+
+	void writePmx(const std::string& fn, const GenModel& model)
+	{
+		std::ofstream out(fn, std::ios::binary);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+		out.write("PMX ", 4);
+		put<float>(out, 2.0f);
+		// UTF-16, no extra UVs, every index 4 bytes
+		const uint8_t globals[] = { 0, 0, 4, 4, 4, 4, 4, 4 };
+		put<uint8_t>(out, sizeof(globals));
+		out.write(reinterpret_cast<const char*>(globals), sizeof(globals));
+		putText(out, "synthetic");
+		putText(out, "synthetic");
+		putText(out, "Generated by skinning-gen");
+		putText(out, "Generated by skinning-gen");
+
+		put<int32_t>(out, int32_t(model.nvertices));
+		int nweights = model.nweights;
+		forEachVertex(model, [&out, nweights](const GenVertex& v) {
+			put(out, v.position);
+			put(out, v.normal);
+			put(out, v.uv);
+			if (nweights == 4) {
+				put<uint8_t>(out, 2);   // BDEF4
+				for (int k = 0; k < 4; k++)
+					put<int32_t>(out, v.bone[k]);
+				for (int k = 0; k < 4; k++)
+					put<float>(out, v.weight[k]);
+			} else {
+				put<uint8_t>(out, 1);   // BDEF2
+				put<int32_t>(out, v.bone[0]);
+				put<int32_t>(out, v.bone[1]);
+				put<float>(out, v.weight[0]);
+			}
+			put<float>(out, 1.0f);      // edge scale
+		});
+
+		put<int32_t>(out, int32_t(model.nfaces * 3));
+		forEachIndex(model, [&out](size_t i) { put<uint32_t>(out, uint32_t(i)); });
+
+		put<int32_t>(out, int32_t(model.textures.size()));
+		for (const auto& name : model.textures)
+			putText(out, name);
+
+		put<int32_t>(out, int32_t(model.materials.size()));
+		for (size_t m = 0; m < model.materials.size(); m++) {
+			const GenMaterial& ma = model.materials[m];
+			putText(out, formatIndex("material", m));
+			putText(out, formatIndex("material", m));
+			put(out, ma.diffuse);
+			put(out, ma.specular);
+			put<float>(out, ma.shininess);
+			put(out, ma.ambient);
+			put<uint8_t>(out, 0);           // flags
+			put(out, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			put<float>(out, 1.0f);          // edge size
+			put<int32_t>(out, ma.texture);
+			put<int32_t>(out, -1);          // sphere map
+			put<uint8_t>(out, 0);
+			put<uint8_t>(out, 1);           // shared toon
+			put<uint8_t>(out, 0);
+			putText(out, "");
+			put<int32_t>(out, int32_t(ma.nindices));
+		}
+
+		put<int32_t>(out, int32_t(model.bones.size()));
+		for (const auto& bone : model.bones) {
+			putText(out, bone.name);
+			putText(out, bone.name);
+			put(out, bone.position);
+			put<int32_t>(out, bone.parent);
+			put<int32_t>(out, 0);           // deform layer
+			// Tail is an index, rotatable, visible, enabled
+			put<uint16_t>(out, 0x0001 | 0x0002 | 0x0008 | 0x0010);
+			put<int32_t>(out, bone.tail);
+		}
+
+		// No morphs, display frames, rigid bodies or joints
+		for (int i = 0; i < 4; i++)
+			put<int32_t>(out, 0);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+	}
+
+	/* 24 bit checkerboard of two random colors */
+	void writeBmp(const std::string& fn, int size, std::mt19937& rng)
+	{
+		std::uniform_int_distribution<int> channel(0, 255);
+		uint8_t colors[2][3];
+		for (auto& color : colors)
+			for (auto& c : color)
+				c = uint8_t(channel(rng));
+		size_t stride = (size_t(size) * 3 + 3) / 4 * 4;
+		uint32_t data_bytes = uint32_t(stride * size);
+
+		std::ofstream out(fn, std::ios::binary);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+		out.write("BM", 2);
+		put<uint32_t>(out, 14 + 40 + data_bytes);
+		put<uint32_t>(out, 0);
+		put<uint32_t>(out, 14 + 40);
+		put<uint32_t>(out, 40);
+		put<int32_t>(out, size);
+		put<int32_t>(out, size);
+		put<uint16_t>(out, 1);                  // planes
+		put<uint16_t>(out, 24);
+		put<uint32_t>(out, 0);                  // BI_RGB
+		put<uint32_t>(out, data_bytes);
+		put<int32_t>(out, 2835);                // 72 dpi
+		put<int32_t>(out, 2835);
+		put<uint32_t>(out, 0);
+		put<uint32_t>(out, 0);
+		std::vector<uint8_t> row(stride, 0);
+		int square = std::max(1, size / 8);
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				const uint8_t* c = colors[(x / square + y / square) & 1];
+				// BGR
+				row[3 * x + 0] = c[2];
+				row[3 * x + 1] = c[1];
+				row[3 * x + 2] = c[0];
+			}
+			out.write(reinterpret_cast<const char*>(row.data()), row.size());
+		}
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+	}
+
+	/* A VMD bone keyframe, interpolated linearly to the next one */
+	void putVmdKey(std::ostream& out, const std::string& bone, uint32_t frame, const glm::vec4& rotation)
+	{
+		putFixed(out, bone, 15);
+		put<uint32_t>(out, frame);
+		for (int i = 0; i < 3; i++)
+			put<float>(out, 0.0f);          // translation
+		for (int i = 0; i < 4; i++)
+			put<float>(out, rotation[i]);   // x, y, z, w
+		// Bezier control points (20, 20) and (107, 107) of all four curves
+		const uint8_t row[16] = { 20, 20, 20, 20, 20, 20, 20, 20, 107, 107, 107, 107, 107, 107, 107, 107 };
+		for (int i = 0; i < 4; i++)
+			out.write(reinterpret_cast<const char*>(row), sizeof(row));
+	}
+
+	void writeVmd(const std::string& fn, const GeneratorOptions& options,
+	              std::mt19937& rng, const GenModel& model)
+	{
+		std::ofstream out(fn, std::ios::binary);
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+		// Distinct bones, each with a key pose every nframes frames
+		std::vector<size_t> bones(model.bones.size() - 1);
+		for (size_t i = 0; i < bones.size(); i++)
+			bones[i] = i + 1;
+		std::shuffle(bones.begin(), bones.end(), rng);
+		bones.resize(std::min<size_t>(12, bones.size()));
+		std::uniform_real_distribution<float> angle(-0.8f, 0.8f);
+		std::normal_distribution<float> axis(0.0f, 1.0f);
+
+		putFixed(out, "Vocaloid Motion Data 0002", 30);
+		putFixed(out, "skinning-gen", 20);
+		put<uint32_t>(out, uint32_t(bones.size() * (options.nposes + 1)));
+		for (size_t bone : bones) {
+			putVmdKey(out, model.bones[bone].name, 0, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			for (int p = 1; p <= options.nposes; p++) {
+				glm::vec3 a(axis(rng), axis(rng), axis(rng));
+				if (glm::length(a) < 1e-3f)
+					a = glm::vec3(0, 0, 1);
+				a = glm::normalize(a);
+				float half = 0.5f * angle(rng);
+				putVmdKey(out, model.bones[bone].name, uint32_t(p * options.nframes),
+				          glm::vec4(a * std::sin(half), std::cos(half)));
+			}
+		}
+		put<uint32_t>(out, 0);  // morph keyframes
+		put<uint32_t>(out, 0);  // camera keyframes
+		put<uint32_t>(out, 0);  // light keyframes
+		if (!out.good())
+			throw std::string("generateModel: cannot write ") + fn;
+	}
+
+	uint64_t getFileSize(const std::string& fn)
+	{
+		std::ifstream in(fn, std::ios::binary | std::ios::ate);
+		return in.good() ? uint64_t(in.tellg()) : 0;
+	}
+}
+
+GeneratedModel generateModel(const std::string& fn, const GeneratorOptions& options)
+{
+	size_t dot = fn.find_last_of('.');
+	std::string ext = dot == std::string::npos ? std::string() : fn.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	bool pmx = ext == "pmx";
+	if (!pmx && ext != "pmd")
+		throw std::string("generateModel: ") + fn + " is neither .pmd nor .pmx";
+	if (options.nbones < 2)
+		throw std::string("generateModel: at least 2 bones are needed");
+	if (options.nweights != 2 && options.nweights != 4)
+		throw std::string("generateModel: vertices have 2 or 4 weights");
+	if (!pmx && options.nweights != 2)
+		throw std::string("generateModel: PMD vertices have 2 weights, use .pmx");
+	if (!pmx && options.nvertices > kMaxPmdVertices)
+		throw std::string("generateModel: PMD models have at most ") +
+		      std::to_string(kMaxPmdVertices) + " vertices, use .pmx";
+	if (!pmx && options.nbones > kMaxPmdBones)
+		throw std::string("generateModel: PMD models have at most ") +
+		      std::to_string(kMaxPmdBones) + " bones, use .pmx";
+
+	std::mt19937 rng(options.seed);
+	GenModel model;
+	model.nweights = options.nweights;
+	buildSkeleton(options, rng, model);
+	buildTubes(options, model);
+	buildMaterials(options, rng, model);
+	if (pmx)
+		writePmx(fn, model);
+	else
+		writePmd(fn, model);
+
+	size_t slash = fn.find_last_of("/\\");
+	std::string dir = slash == std::string::npos ? std::string() : fn.substr(0, slash + 1);
+	GeneratedModel result;
+	result.bytes = getFileSize(fn);
+	for (const auto& name : model.textures) {
+		writeBmp(dir + name, options.texture_size, rng);
+		result.bytes += getFileSize(dir + name);
+	}
+	result.motion_path = fn.substr(0, dot) + ".vmd";
+	writeVmd(result.motion_path, options, rng, model);
+
+	result.nvertices = model.nvertices;
+	result.nfaces = model.nfaces;
+	result.nbones = model.bones.size();
+	result.nmaterials = model.materials.size();
+	result.ntextures = model.textures.size();
+	return result;
+}
@@ -0,0 +1,56 @@
+#ifndef MODEL_GENERATOR_H
+#define MODEL_GENERATOR_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Synthetic models for scaling measurements.
+ *
+ * The skeleton is a root with chains of kChainLength bones spreading out
+ * in all directions. Every bone but the root gets a tube of rings from
+ * its parent to its own position, so all bones deform geometry; with
+ * fewer vertices than that only some bones get a tube. Tube vertices are
+ * weighted between the bone and its parent by their position along the
+ * tube, with four weights the grandparents get a share too.
+ *
+ * Faces are split evenly into the materials, material i uses texture
+ * i % ntextures. Textures are 24 bit BMP checkerboards written next to
+ * the model as texNNNN.bmp, so models in the same directory share them.
+ *
+ * The motion is written next to the model as <model>.vmd, for
+ * skinning --motion: up to 12 random bones, named as in the model, turn
+ * from the bind pose through nposes random key poses nframes apart.
+ */
+struct GeneratorOptions {
+	size_t nvertices = 10000;  // rounded down to whole rings
+	size_t nbones = 64;        // at least 2
+	size_t nmaterials = 4;
+	size_t ntextures = 4;      // 0: untextured
+	int texture_size = 256;
+	int nweights = 2;          // joints per vertex, 2 or 4 (PMX only)
+	int nposes = 4;            // key poses after the bind pose
+	int nframes = 30;          // between key poses
+	uint32_t seed = 1;
+};
+
+struct GeneratedModel {
+	std::string motion_path;
+	size_t nvertices = 0;
+	size_t nfaces = 0;
+	size_t nbones = 0;
+	size_t nmaterials = 0;
+	size_t ntextures = 0;
+	uint64_t bytes = 0;        // of the model and its textures
+};
+
+/*
+ * generateModel: write a model to fn, PMD or PMX by its extension, with
+ * its textures and motion.
+ * PMD files are limited to 65536 vertices (16 bit indices), 32767 bones
+ * and two weights per vertex; exceeding them throws a std::string.
+ */
+GeneratedModel generateModel(const std::string& fn, const GeneratorOptions& options);
+
+#endif
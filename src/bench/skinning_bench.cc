@@ -0,0 +1,340 @@
+/*
+ * skinning-bench: how load time, memory and frame time scale with the
+ * vertex, bone, material and texture counts of a model.
+ *
+ * Usage: skinning-bench [--skinning PATH] [--work DIR] [--frames N] [--size WxH]
+ *                       [--only DIMENSION] [--weights 2|4] [--texture-size N]
+ *                       [--max-vertices N] [--max-bones N (up to 128)]
+ *                       [--max-materials N] [--max-textures N]
+ *
+ * One dimension at a time is swept geometrically while the others keep
+ * the base model (100k vertices, 128 bones, 8 materials, 8 textures); in
+ * the texture sweep there are at least as many materials as textures.
+ * Every model is generated as PMX with a VMD motion into
+ * DIR/<dimension>_<value>/ and measured with two runs of
+ * skinning --headless --bench --motion (see headless.h):
+ * the first imports the model into an empty model cache, the second
+ * loads it from the cache and renders the frames. Start from a new DIR;
+ * models cached by an earlier sweep would make the first run warm.
+ *
+ * A table per dimension lists the measurements, followed by the exponent
+ * k of the least squares fit metric ~ value^k: 1 is linear growth.
+ */
+#include "model_generator.h"
+#include "../config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace {
+	enum Dimension {
+		kVertices,
+		kBones,
+		kMaterials,
+		kTextures,
+		kNumDimensions
+	};
+	const char* kDimensionNames[kNumDimensions] = { "vertices", "bones", "materials", "textures" };
+
+	struct BenchOptions {
+		std::string skinning;
+		std::string work_dir = "bench_models";
+		int frames = 120;
+		std::string size = "512x512";
+		bool dimensions[kNumDimensions] = { true, true, true, true };
+		int nweights = 2;
+		int texture_size = 256;
+		// The skinning shaders hold at most kMaxBones joints
+		size_t max[kNumDimensions] = { 5000000, size_t(kMaxBones), 256, 64 };
+	};
+
+	// What skinning --headless --bench printed, by key
+	typedef std::map<std::string, double> BenchResult;
+
+	struct Measurement {
+		size_t value;
+		uint64_t bytes = 0;
+		bool ok = false;
+		BenchResult cold;       // imported into the cache
+		BenchResult cached;     // loaded from the cache
+	};
+
+	bool parseOptions(int argc, char* argv[], BenchOptions& options)
+	{
+		bool only = false;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool has_value = i + 1 < argc;
+			if (arg == "--skinning" && has_value) {
+				options.skinning = argv[++i];
+			} else if (arg == "--work" && has_value) {
+				options.work_dir = argv[++i];
+			} else if (arg == "--frames" && has_value) {
+				options.frames = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--size" && has_value) {
+				options.size = argv[++i];
+			} else if (arg == "--weights" && has_value) {
+				options.nweights = std::atoi(argv[++i]);
+			} else if (arg == "--texture-size" && has_value) {
+				options.texture_size = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--only" && has_value) {
+				std::string name = argv[++i];
+				if (!only)
+					std::fill(options.dimensions, options.dimensions + kNumDimensions, false);
+				only = true;
+				auto d = std::find(kDimensionNames, kDimensionNames + kNumDimensions, name);
+				if (d == kDimensionNames + kNumDimensions) {
+					std::cerr << __func__ << ": unknown dimension " << name << std::endl;
+					return false;
+				}
+				options.dimensions[d - kDimensionNames] = true;
+			} else if (arg.compare(0, 6, "--max-") == 0 && has_value) {
+				std::string name = arg.substr(6);
+				auto d = std::find(kDimensionNames, kDimensionNames + kNumDimensions, name);
+				if (d == kDimensionNames + kNumDimensions) {
+					std::cerr << __func__ << ": unknown option " << arg << std::endl;
+					return false;
+				}
+				options.max[d - kDimensionNames] = std::strtoul(argv[++i], nullptr, 10);
+				if (options.max[kBones] > size_t(kMaxBones)) {
+					std::cerr << __func__ << ": skinning supports at most " << kMaxBones
+					          << " bones, sweeping up to that" << std::endl;
+					options.max[kBones] = size_t(kMaxBones);
+				}
+			} else {
+				std::cerr << __func__ << ": unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/* sweep: first, first * factor, ... while below last, then last */
+	std::vector<size_t> sweep(size_t first, size_t factor, size_t last)
+	{
+		std::vector<size_t> values;
+		for (size_t v = first; v < last; v *= factor)
+			values.emplace_back(v);
+		values.emplace_back(last);
+		return values;
+	}
+
+	GeneratorOptions getBaseModel(const BenchOptions& options)
+	{
+		GeneratorOptions model;
+		model.nvertices = std::min<size_t>(100000, options.max[kVertices]);
+		model.nbones = std::min<size_t>(128, options.max[kBones]);
+		model.nmaterials = std::min<size_t>(8, options.max[kMaterials]);
+		model.ntextures = std::min<size_t>(8, options.max[kTextures]);
+		model.texture_size = options.texture_size;
+		model.nweights = options.nweights;
+		return model;
+	}
+
+	void makeDirectory(const std::string& dir)
+	{
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0755);
+#endif
+	}
+
+	void setEnvironment(const char* name, const std::string& value)
+	{
+#ifdef _WIN32
+		_putenv_s(name, value.c_str());
+#else
+		setenv(name, value.c_str(), 1);
+#endif
+	}
+
+	std::string quote(const std::string& s)
+	{
+		return "\"" + s + "\"";
+	}
+
+	/* run: skinning --headless --bench on model. Return: false on failure */
+	bool run(const BenchOptions& options, const std::string& model,
+	         const std::string& motion, const std::string& log, BenchResult& result)
+	{
+		std::string cmd = quote(options.skinning) + " --headless --bench " +
+		                  std::to_string(options.frames) + " --size " + options.size +
+		                  " --motion " + quote(motion) + " " + quote(model) +
+		                  " > " + quote(log) + " 2>&1";
+#ifdef _WIN32
+		// cmd.exe strips the outer quotes of a command that starts with one
+		cmd = "\"" + cmd + "\"";
+#endif
+		if (std::system(cmd.c_str()) != 0) {
+			std::cerr << __func__ << ": " << model << " failed, see " << log << std::endl;
+			return false;
+		}
+		std::ifstream fin(log);
+		std::string line;
+		while (std::getline(fin, line)) {
+			if (line.compare(0, 7, "bench: ") != 0)
+				continue;
+			std::istringstream ss(line.substr(7));
+			std::string pair;
+			while (ss >> pair) {
+				size_t eq = pair.find('=');
+				if (eq != std::string::npos)
+					result[pair.substr(0, eq)] = std::atof(pair.c_str() + eq + 1);
+			}
+			return true;
+		}
+		std::cerr << __func__ << ": no result for " << model << ", see " << log << std::endl;
+		return false;
+	}
+
+	Measurement measure(const BenchOptions& options, Dimension dimension, size_t value)
+	{
+		GeneratorOptions model = getBaseModel(options);
+		switch (dimension) {
+			case kVertices: model.nvertices = value; break;
+			case kBones: model.nbones = value; break;
+			case kMaterials: model.nmaterials = value; break;
+			case kTextures:
+				model.ntextures = value;
+				model.nmaterials = std::max(model.nmaterials, value);
+				break;
+			default: break;
+		}
+
+		Measurement m;
+		m.value = value;
+		std::string dir = options.work_dir + "/" + kDimensionNames[dimension] + "_" + std::to_string(value);
+		makeDirectory(dir);
+		std::string fn = dir + "/model.pmx";
+		GeneratedModel generated;
+		try {
+			generated = generateModel(fn, model);
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			return m;
+		}
+		m.bytes = generated.bytes;
+
+		// A cache directory of its own, empty for the first run, the second
+		// run hits it
+		setEnvironment("SKINNING_MODEL_CACHE", dir + "/cache");
+		m.ok = run(options, fn, generated.motion_path, dir + "/cold.log", m.cold) &&
+		       run(options, fn, generated.motion_path, dir + "/cached.log", m.cached);
+		return m;
+	}
+
+	/* fitExponent: k of the least squares fit of log y = k log x + c */
+	double fitExponent(const std::vector<double>& x, const std::vector<double>& y)
+	{
+		double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+		size_t n = 0;
+		for (size_t i = 0; i < x.size(); i++) {
+			if (x[i] <= 0.0 || y[i] <= 0.0)
+				continue;
+			double lx = std::log(x[i]), ly = std::log(y[i]);
+			sx += lx;
+			sy += ly;
+			sxx += lx * lx;
+			sxy += lx * ly;
+			n++;
+		}
+		double den = n * sxx - sx * sx;
+		return n < 2 || den == 0.0 ? 0.0 : (n * sxy - sx * sy) / den;
+	}
+
+	void report(Dimension dimension, const std::vector<Measurement>& measurements)
+	{
+		struct Column {
+			const char* title;
+			const char* key;
+			bool cold;
+		};
+		const Column columns[] = {
+			{ "import ms", "load_ms", true },
+			{ "import MiB", "peak_rss_mib", true },
+			{ "load ms", "load_ms", false },
+			{ "upload ms", "upload_ms", false },
+			{ "peak MiB", "peak_rss_mib", false },
+			{ "frame ms", "frame_ms_avg", false },
+			{ "max frame ms", "frame_ms_max", false },
+		};
+		std::cout << std::setw(10) << kDimensionNames[dimension] << std::setw(10) << "file MiB";
+		for (const auto& c : columns)
+			std::cout << std::setw(14) << c.title;
+		std::cout << "\n" << std::fixed << std::setprecision(2);
+
+		std::vector<double> x;
+		std::vector<std::vector<double>> y(sizeof(columns) / sizeof(columns[0]));
+		for (const auto& m : measurements) {
+			std::cout << std::setw(10) << m.value << std::setw(10) << m.bytes / double(1 << 20);
+			if (!m.ok) {
+				std::cout << "  FAILED\n";
+				continue;
+			}
+			x.emplace_back(double(m.value));
+			for (size_t c = 0; c < y.size(); c++) {
+				const BenchResult& r = columns[c].cold ? m.cold : m.cached;
+				auto iter = r.find(columns[c].key);
+				double v = iter == r.end() ? 0.0 : iter->second;
+				y[c].emplace_back(v);
+				std::cout << std::setw(14) << v;
+			}
+			std::cout << "\n";
+		}
+		std::cout << "exponent k of metric ~ " << kDimensionNames[dimension] << "^k: ";
+		for (size_t c = 0; c < y.size(); c++)
+			std::cout << (c ? ", " : "") << columns[c].title << " " << fitExponent(x, y[c]);
+		std::cout << "\n" << std::endl;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	if (!parseOptions(argc, argv, options)) {
+		std::cerr << "Usage: " << argv[0] << " [--skinning PATH] [--work DIR] [--frames N]"
+		          << " [--size WxH] [--only vertices|bones|materials|textures]"
+		          << " [--weights 2|4] [--texture-size N] [--max-vertices N] [--max-bones N]"
+		          << " [--max-materials N] [--max-textures N]" << std::endl;
+		return -1;
+	}
+	if (options.skinning.empty()) {
+		// Next to this executable
+		std::string self = argv[0];
+		size_t slash = self.find_last_of("/\\");
+		options.skinning = (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/skinning";
+#ifdef _WIN32
+		options.skinning += ".exe";
+#endif
+	}
+	makeDirectory(options.work_dir);
+
+	const size_t first[kNumDimensions] = { 10000, 8, 1, 1 };
+	const size_t factor[kNumDimensions] = { 4, 2, 4, 4 };
+	int failed = 0;
+	for (int d = 0; d < kNumDimensions; d++) {
+		if (!options.dimensions[d])
+			continue;
+		Dimension dimension = Dimension(d);
+		std::vector<Measurement> measurements;
+		for (size_t value : sweep(first[d], factor[d], std::max(first[d], options.max[d]))) {
+			std::cerr << "Measuring " << value << " " << kDimensionNames[d] << std::endl;
+			measurements.emplace_back(measure(options, dimension, value));
+			failed += measurements.back().ok ? 0 : 1;
+		}
+		report(dimension, measurements);
+	}
+	return failed ? 1 : 0;
+}
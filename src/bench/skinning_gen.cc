@@ -0,0 +1,99 @@
+/*
+ * skinning-gen: write a synthetic PMD or PMX model with textures and a
+ * random motion, for load and render scaling measurements.
+ *
+ * Usage: skinning-gen [--vertices N] [--bones N] [--materials N]
+ *                     [--textures N] [--texture-size N] [--weights 2|4]
+ *                     [--poses N] [--frames N] [--seed S] <out.pmd or out.pmx>
+ *
+ * Counts take k and M suffixes (--vertices 5M). See model_generator.h for
+ * what is generated; the motion is written to <out>.vmd and plays with
+ * skinning --motion.
+ */
+#include "model_generator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+	/* parseCount: "250", "100k", "5M". Return: false if malformed */
+	bool parseCount(const char* arg, size_t& count)
+	{
+		char* end;
+		double value = std::strtod(arg, &end);
+		if (end == arg || value < 0.0)
+			return false;
+		if (*end == 'k' || *end == 'K')
+			value *= 1e3, end++;
+		else if (*end == 'm' || *end == 'M')
+			value *= 1e6, end++;
+		if (*end != '\0')
+			return false;
+		count = size_t(value);
+		return true;
+	}
+
+	bool parseOptions(int argc, char* argv[], GeneratorOptions& options, std::string& out)
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool has_value = i + 1 < argc;
+			bool ok = true;
+			size_t count;
+			if (arg == "--vertices" && has_value) {
+				ok = parseCount(argv[++i], options.nvertices);
+			} else if (arg == "--bones" && has_value) {
+				ok = parseCount(argv[++i], options.nbones);
+			} else if (arg == "--materials" && has_value) {
+				ok = parseCount(argv[++i], options.nmaterials);
+			} else if (arg == "--textures" && has_value) {
+				ok = parseCount(argv[++i], options.ntextures);
+			} else if (arg == "--texture-size" && has_value) {
+				ok = parseCount(argv[++i], count) && count > 0;
+				options.texture_size = int(count);
+			} else if (arg == "--weights" && has_value) {
+				options.nweights = std::atoi(argv[++i]);
+			} else if (arg == "--poses" && has_value) {
+				options.nposes = std::max(0, std::atoi(argv[++i]));
+			} else if (arg == "--frames" && has_value) {
+				options.nframes = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--seed" && has_value) {
+				options.seed = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+			} else if (arg.compare(0, 1, "-") == 0) {
+				std::cerr << __func__ << ": unknown option " << arg << std::endl;
+				return false;
+			} else {
+				out = arg;
+			}
+			if (!ok) {
+				std::cerr << __func__ << ": bad value for " << arg << std::endl;
+				return false;
+			}
+		}
+		return !out.empty();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	GeneratorOptions options;
+	std::string out;
+	if (!parseOptions(argc, argv, options, out)) {
+		std::cerr << "Usage: " << argv[0] << " [--vertices N] [--bones N] [--materials N]"
+		          << " [--textures N] [--texture-size N] [--weights 2|4] [--poses N]"
+		          << " [--frames N] [--seed S] <out.pmd or out.pmx>" << std::endl;
+		return -1;
+	}
+	try {
+		GeneratedModel model = generateModel(out, options);
+		std::cout << out << ": " << model.nvertices << " vertices, " << model.nfaces << " faces, "
+		          << model.nbones << " bones, " << model.nmaterials << " materials, "
+		          << model.ntextures << " textures, " << model.bytes / double(1 << 20) << " MiB; "
+		          << "motion in " << model.motion_path << std::endl;
+	} catch (const std::string& e) {
+		std::cerr << e << std::endl;
+		return -1;
+	}
+	return 0;
+}
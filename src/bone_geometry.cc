@@ -1,10 +1,16 @@
 #include "config.h"
 #include "bone_geometry.h"
 #include "texture_to_render.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "model_cache.h"
+#include <array>
 #include <fstream>
 #include <queue>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 #include <glm/gtx/io.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -38,6 +44,16 @@ const glm::fquat* Skeleton::collectJointRot() const
 	return cache.rot.data();
 }
 
+int Skeleton::findBone(uint32_t name_id) const
+{
+	if (name_id == NameTable::kNoName)
+		return -1;
+	for (const auto& bone : bones)
+		if (joints[bone.endJoint].name_id == name_id)
+			return bone.boneIndex;
+	return -1;
+}
+
 // FIXME: Implement bone animation.
 
 void Skeleton::refreshCache(Configuration* target)
@@ -63,80 +79,491 @@ Mesh::~Mesh()
 
 void Mesh::loadPmd(const std::string& fn)
 {
+	ModelCache cache;
+	if (cache.load(fn, *this))
+		return ;
+
 	MMDReader mr;
 	mr.open(fn);
+	loadSkeleton(mr);
+	loadGeometry(mr);
+	buildMeshWeights();
+	loadTextures(mr);
+	cache.save(fn, *this);
+}
+
+void Mesh::loadSkeleton(MMDReader& mr)
+{
+	std::vector<glm::vec3> joint_positions;
+	std::vector<int> joint_parents;
+	std::vector<std::string> joint_names;
+	glm::vec3 wcoord;
+	int parentID;
+	while (mr.getJoint(joint_positions.size(), wcoord, parentID)) {
+		joint_names.emplace_back(mr.getJointName(joint_positions.size()));
+		joint_positions.emplace_back(wcoord);
+		joint_parents.emplace_back(parentID);
+	}
+	// The skinning and bone shaders hold kMaxBones joints in their palette
+	if (joint_positions.size() > size_t(kMaxBones))
+		throw __func__ + std::string(": ") + std::to_string(joint_positions.size()) +
+		      " joints, the shaders support at most " + std::to_string(kMaxBones);
+	buildSkeleton(joint_positions, joint_parents, joint_names);
+
+	// Until there are vertices the joints give the extent of the model
+	bounds.min = glm::vec3(std::numeric_limits<float>::max());
+	bounds.max = glm::vec3(-std::numeric_limits<float>::max());
+	for (const auto& p : joint_positions) {
+		bounds.min = glm::min(p, bounds.min);
+		bounds.max = glm::max(p, bounds.max);
+	}
+}
+
+void Mesh::loadGeometry(MMDReader& mr)
+{
 	mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
 	computeBounds();
-	mr.getMaterial(materials);
+	mr.getMaterial(materials, false);
+
+	// init weights
+	std::vector<SparseTuple> tup;
+	mr.getJointWeights(tup);
 
-	// FIXME: load skeleton and blend weights from PMD file,
-	//        initialize std::vectors for the vertex attributes,
-	//        also initialize the skeleton as needed
+	// Vertices without a tuple stay rigidly on the root joint
+	size_t nverts = skeleton.joints.empty() ? 0 : vertices.size();
+	joint0.assign(nverts, 0);
+	joint1.assign(nverts, -1);
+	weight_for_joint0.assign(nverts, 1.0f);
+	vector_from_joint0.resize(nverts);
+	vector_from_joint1.assign(nverts, glm::vec3(0.0f));
+	for (size_t i = 0; i < nverts; i++)
+		vector_from_joint0[i] = glm::vec3(vertices[i]) - skeleton.joints[0].position;
+	bool four_joints = std::any_of(tup.begin(), tup.end(),
+			[](const SparseTuple& t) { return t.jid2 >= 0; });
+	if (four_joints) {
+		joint2.assign(nverts, -1);
+		joint3.assign(nverts, -1);
+		weight_for_joint1.assign(nverts, 0.0f);
+		weight_for_joint2.assign(nverts, 0.0f);
+		weight_for_joint3.assign(nverts, 0.0f);
+	} else {
+		joint2.clear();
+		joint3.clear();
+		weight_for_joint1.clear();
+		weight_for_joint2.clear();
+		weight_for_joint3.clear();
+	}
 
-	// init bones
-	int index = 0;
-	glm::vec3 wcoord;
-	int parentID;
-	while (mr.getJoint(index, wcoord, parentID)) {
-		Joint toAdd = Joint(index, wcoord, parentID);
+	for (const SparseTuple& cur : tup) {
+		if (cur.vid < 0 || size_t(cur.vid) >= nverts)
+			continue;
+		size_t v = cur.vid;
+		joint0[v] = cur.jid0;
+		joint1[v] = cur.jid1;
+		weight_for_joint0[v] = cur.weight0;
+		glm::vec3 vpos = glm::vec3(vertices[v]);
+		vector_from_joint0[v] = vpos - skeleton.joints[cur.jid0].position;
+		if (cur.jid1 >= 0)
+			vector_from_joint1[v] = vpos - skeleton.joints[cur.jid1].position;
+		if (four_joints) {
+			joint2[v] = cur.jid2;
+			joint3[v] = cur.jid3;
+			weight_for_joint1[v] = cur.jid1 >= 0 ? cur.weight1 : 0.0f;
+			weight_for_joint2[v] = cur.weight2;
+			weight_for_joint3[v] = cur.weight3;
+		}
+	}
+
+	optimize();
+	computeJointBounds();
+}
+
+void Mesh::loadTextures(MMDReader& mr)
+{
+	std::vector<Material> textured = materials;
+	mr.getTextures(textured);
+	setTextures(textured);
+}
+
+void Mesh::setTextures(const std::vector<Material>& textured)
+{
+	for (size_t i = 0; i < std::min(textured.size(), materials.size()); i++) {
+		materials[i].texture = textured[i].texture;
+		materials[i].texture_path = textured[i].texture_path;
+	}
+	for (auto& lod : lods) {
+		for (size_t i = 0; i < std::min(textured.size(), lod.size()); i++) {
+			lod[i].texture = textured[i].texture;
+			lod[i].texture_path = textured[i].texture_path;
+		}
+	}
+}
+
+namespace {
+	template<typename T>
+	void release(std::vector<T>& v)
+	{
+		std::vector<T>().swap(v);
+	}
+}
+
+void Mesh::releaseCpuData()
+{
+	size_t before = vertices.size() * (sizeof(glm::vec4) * 2 + sizeof(glm::vec2)) +
+	                joint0.size() * (2 * sizeof(int32_t) + sizeof(float) + 2 * sizeof(glm::vec3)) +
+	                joint2.size() * (2 * sizeof(int32_t) + 3 * sizeof(float)) +
+	                (keep_faces ? 0 : faces.size() + lod_faces.size()) * sizeof(glm::uvec3) +
+	                packed_indices.size() +
+	                skeleton.meshWeights.size() * joint0.size() * sizeof(float);
+	release(vertices);
+	release(vertex_normals);
+	release(face_normals);
+	release(uv_coordinates);
+	release(joint0);
+	release(joint1);
+	release(weight_for_joint0);
+	release(vector_from_joint0);
+	release(vector_from_joint1);
+	release(joint2);
+	release(joint3);
+	release(weight_for_joint1);
+	release(weight_for_joint2);
+	release(weight_for_joint3);
+	if (!keep_faces) {
+		release(faces);
+		release(lod_faces);
+	}
+	release(packed_indices);
+	release(skeleton.meshWeights);
+	std::cerr << __func__ << ": " << before / 1024 << " KiB of geometry uploaded and released" << std::endl;
+}
+
+void Mesh::buildSkeleton(const std::vector<glm::vec3>& positions,
+                         const std::vector<int>& parents,
+                         const std::vector<std::string>& names)
+{
+	skeleton.joints.clear();
+	skeleton.bones.clear();
+	NameTable& name_table = NameTable::instance();
+	for (int index = 0; index < (int)positions.size(); ++index) {
+		int parentID = parents[index];
+		Joint toAdd = Joint(index, positions[index], parentID);
+		if (index < (int)names.size() && !names[index].empty())
+			toAdd.name_id = name_table.intern(names[index]);
 		skeleton.joints.push_back(toAdd);
 		if (parentID >= 0){
-			//Joint* startJoint = &skeleton.joints[parentID];
-			//std::cout << parentID << " " << index << std::endl;
 			Bone newBone = Bone(parentID, index, skeleton.joints[parentID].position, skeleton.joints[index].position, skeleton.bones.size());
 			skeleton.joints[parentID].boneChildren.push_back(newBone);
 			skeleton.bones.emplace_back(newBone);
 		}
-		++index;
 	}
+}
 
-	// init weights
-	std::vector<SparseTuple> tup;
-	mr.getJointWeights(tup);
+void Mesh::buildMeshWeights()
+{
+	size_t nverts = joint0.size();
+	skeleton.meshWeights.assign(skeleton.bones.size(), std::vector<float>(nverts, 0.0f));
+	int jid[4];
+	float weight[4];
+	glm::vec3 offset[4];
+	for (size_t i = 0; i < nverts; ++i) {
+		int n = getInfluences(i, jid, weight, offset);
+		for (int k = 0; k < n; k++)
+			for (const auto& bone : skeleton.joints[jid[k]].boneChildren)
+				skeleton.meshWeights[bone.boneIndex][i] = weight[k];
+	}
+}
+
+int Mesh::getInfluences(size_t i, int jid[4], float weight[4], glm::vec3 offset[4]) const
+{
+	jid[0] = joint0[i];
+	weight[0] = weight_for_joint0[i];
+	offset[0] = vector_from_joint0[i];
+	if (joint1[i] < 0)
+		return 1;
+	jid[1] = joint1[i];
+	offset[1] = vector_from_joint1[i];
+	if (!hasFourJoints()) {
+		weight[1] = 1.0f - weight[0];
+		return 2;
+	}
+	weight[1] = weight_for_joint1[i];
+	int n = 2;
+	glm::vec3 bind = skeleton.joints[jid[0]].position + offset[0];
+	for (int j : { joint2[i], joint3[i] }) {
+		if (j < 0)
+			break;
+		jid[n] = j;
+		weight[n] = n == 2 ? weight_for_joint2[i] : weight_for_joint3[i];
+		offset[n] = bind - skeleton.joints[j].position;
+		n++;
+	}
+	return n;
+}
+
+void Mesh::computeJointBounds()
+{
+	size_t njoints = skeleton.joints.size();
+	joint_bounds.assign(njoints, BoundingBox());
+	for (auto& box : joint_bounds) {
+		box.min = glm::vec3(std::numeric_limits<float>::max());
+		box.max = glm::vec3(-std::numeric_limits<float>::max());
+	}
+	std::vector<std::array<int, 4>> vertex_joints(joint0.size());
+	int jid[4];
+	float weight[4];
+	glm::vec3 offset[4];
+	for (size_t i = 0; i < joint0.size(); i++) {
+		int n = getInfluences(i, jid, weight, offset);
+		vertex_joints[i].fill(-1);
+		for (int k = 0; k < n; k++) {
+			joint_bounds[jid[k]].min = glm::min(joint_bounds[jid[k]].min, offset[k]);
+			joint_bounds[jid[k]].max = glm::max(joint_bounds[jid[k]].max, offset[k]);
+			vertex_joints[i][k] = jid[k];
+		}
+	}
 
+	material_joints.assign(materials.size(), {});
+	std::vector<int> last_material(njoints, -1);
+	for (size_t m = 0; m < materials.size(); m++) {
+		const auto& ma = materials[m];
+		for (size_t f = ma.offset; f < ma.offset + ma.nfaces; f++) {
+			for (int k = 0; k < 3; k++) {
+				uint32_t v = faces[f][k];
+				if (v >= vertex_joints.size())
+					continue;
+				for (int jid : vertex_joints[v]) {
+					if (jid < 0 || last_material[jid] == int(m))
+						continue;
+					last_material[jid] = int(m);
+					material_joints[m].emplace_back(jid);
+				}
+			}
+		}
+	}
+}
 
-	int numBones = skeleton.bones.size();
-	int numVerts = tup.size();
-	skeleton.meshWeights.resize(numBones);
-	for (int i = 0; i < numBones; ++i){
-		skeleton.meshWeights[i].resize(numVerts);
-		for(int j = 0; j < numVerts; ++j){
-			skeleton.meshWeights[i][j] = 0;
+void Mesh::getMaterialBounds(std::vector<BoundingBox>& out) const
+{
+	const auto& trans = getCurrentQ()->transData();
+	const auto& rot = getCurrentQ()->rotData();
+	// Posed bounds of each joint: rotate the box and take the AABB of the
+	// result, which is |R| applied to the half extent.
+	std::vector<BoundingBox> posed(joint_bounds.size());
+	for (size_t j = 0; j < joint_bounds.size() && j < trans.size(); j++) {
+		const auto& box = joint_bounds[j];
+		if (box.min.x > box.max.x)
+			continue;
+		glm::mat3 r = glm::mat3_cast(rot[j]);
+		glm::vec3 center = 0.5f * (box.min + box.max);
+		glm::vec3 half = 0.5f * (box.max - box.min);
+		glm::vec3 c = trans[j] + r * center;
+		glm::vec3 e(0.0f);
+		for (int col = 0; col < 3; col++)
+			e += glm::abs(r[col]) * half[col];
+		posed[j].min = c - e;
+		posed[j].max = c + e;
+	}
+	out.assign(material_joints.size(), BoundingBox());
+	for (size_t m = 0; m < material_joints.size(); m++) {
+		auto& box = out[m];
+		box.min = glm::vec3(std::numeric_limits<float>::max());
+		box.max = glm::vec3(-std::numeric_limits<float>::max());
+		for (int jid : material_joints[m]) {
+			box.min = glm::min(box.min, posed[jid].min);
+			box.max = glm::max(box.max, posed[jid].max);
 		}
 	}
+}
 
-	joint0 = std::vector<int32_t>(tup.size());
-	joint1 = std::vector<int32_t>(tup.size());
-	weight_for_joint0 = std::vector<float>(tup.size());
+void Mesh::optimize()
+{
+	size_t nvertices = vertices.size();
+	float acmr_before = computeACMR(faces, 0, faces.size());
+	for (const auto& ma : materials)
+		optimizeVertexCache(faces, ma.offset, ma.nfaces);
+	float acmr_after = computeACMR(faces, 0, faces.size());
 
-	vector_from_joint0 = std::vector<glm::vec3>(tup.size());
-	vector_from_joint1 = std::vector<glm::vec3>(tup.size());
-	
-	for (int i = 0; i < tup.size(); ++i){
-		SparseTuple cur = tup[i];
-		Joint currentJoint = skeleton.joints[cur.jid0];
+	std::vector<uint32_t> remap = optimizeVertexFetch(faces, nvertices);
+	remapVertices(vertices, remap);
+	remapVertices(vertex_normals, remap);
+	remapVertices(uv_coordinates, remap);
+	remapVertices(joint0, remap);
+	remapVertices(joint1, remap);
+	remapVertices(weight_for_joint0, remap);
+	remapVertices(vector_from_joint0, remap);
+	remapVertices(vector_from_joint1, remap);
+	remapVertices(joint2, remap);
+	remapVertices(joint3, remap);
+	remapVertices(weight_for_joint1, remap);
+	remapVertices(weight_for_joint2, remap);
+	remapVertices(weight_for_joint3, remap);
 
-		joint0[i] = cur.jid0;
-		joint1[i] = cur.jid1;
-		weight_for_joint0[i] = cur.weight0;
-		glm::vec3 vpos = glm::vec3(vertices[cur.vid][0], vertices[cur.vid][1], vertices[cur.vid][2]);
-		vector_from_joint0[i] = vpos - skeleton.joints[cur.jid0].position;
-		vector_from_joint1[i] = glm::vec3(0, 0, 0);
+	buildLods();
+	packIndices();
+	materials = lods.front();
 
-		for (int j = 0; j < currentJoint.boneChildren.size(); ++j){
-			skeleton.meshWeights[currentJoint.boneChildren[j].boneIndex][i] = cur.weight0;
-		}
-		if(cur.jid1 >= 0){
-			Joint currentJoint2 = skeleton.joints[cur.jid1];
-			for (int j = 0; j < currentJoint2.boneChildren.size(); ++j){
-				skeleton.meshWeights[currentJoint2.boneChildren[j].boneIndex][i] = cur.weight0;
+	size_t nshort = 0;
+	for (const auto& ma : materials)
+		if (ma.short_indices)
+			nshort++;
+	std::cerr << __func__ << ": ACMR " << acmr_before << " -> " << acmr_after
+	          << ", " << nshort << "/" << materials.size()
+	          << " materials with 16-bit indices, index buffer "
+	          << packed_indices.size() << " bytes for " << lods.size() << " LODs"
+	          << std::endl;
+}
+
+/*
+ * Simplify each material on its own, each level from the previous one.
+ * Vertices shared by several materials are locked to keep the borders
+ * between materials closed.
+ */
+void Mesh::buildLods()
+{
+	size_t nvertices = vertices.size();
+	std::vector<int> owner(nvertices, -1);
+	std::vector<uint8_t> locked(nvertices, 0);
+	for (size_t m = 0; m < materials.size(); m++) {
+		const auto& ma = materials[m];
+		for (size_t f = ma.offset; f < ma.offset + ma.nfaces; f++) {
+			for (int k = 0; k < 3; k++) {
+				int& o = owner[faces[f][k]];
+				if (o >= 0 && o != int(m))
+					locked[faces[f][k]] = 1;
+				o = int(m);
 			}
+		}
+	}
+	std::vector<glm::ivec4> influence_joints(nvertices, glm::ivec4(-1));
+	std::vector<glm::vec4> influence_weights(nvertices, glm::vec4(0.0f));
+	int jid[4];
+	float weight[4];
+	glm::vec3 offset[4];
+	for (size_t i = 0; i < joint0.size() && i < nvertices; i++) {
+		int n = getInfluences(i, jid, weight, offset);
+		for (int k = 0; k < n; k++) {
+			influence_joints[i][k] = jid[k];
+			influence_weights[i][k] = weight[k];
+		}
+	}
+	SimplifyVertexData data { vertices, influence_joints, influence_weights, locked };
+
+	lods.assign(1, materials);
+	lod_faces.clear();
+	std::vector<std::vector<glm::uvec3>> previous(materials.size());
+	for (size_t m = 0; m < materials.size(); m++) {
+		const auto& ma = materials[m];
+		previous[m].assign(faces.begin() + ma.offset, faces.begin() + ma.offset + ma.nfaces);
+	}
+	float ratio = 1.0f;
+	for (int level = 1; level < kNumLods; level++) {
+		ratio *= kLodTriangleRatio;
+		std::vector<Material> lod(materials);
+		for (size_t m = 0; m < materials.size(); m++) {
+			size_t target = size_t(materials[m].nfaces * ratio);
+			auto simplified = simplifyMesh(previous[m], target, data);
+			optimizeVertexCache(simplified, 0, simplified.size());
+			lod[m].offset = faces.size() + lod_faces.size();
+			lod[m].nfaces = simplified.size();
+			lod_faces.insert(lod_faces.end(), simplified.begin(), simplified.end());
+			previous[m].swap(simplified);
+		}
+		size_t nfaces = 0;
+		for (const auto& ma : lod)
+			nfaces += ma.nfaces;
+		std::cerr << __func__ << ": LOD " << level << " has " << nfaces << " faces" << std::endl;
+		lods.emplace_back(std::move(lod));
+	}
+}
 
-			vector_from_joint1[i] = vpos - skeleton.joints[cur.jid1].position;
+/*
+ * Build packed_indices for all levels of detail. Consecutive materials
+ * share one base vertex and 16-bit indices as long as their vertices
+ * together span less than 64K, so RenderPass::renderAllMaterials can
+ * draw them with one call. Materials that span more use 32-bit indices
+ * and share a run with the following ones that do too.
+ */
+void Mesh::packIndices()
+{
+	const uint32_t kNone = std::numeric_limits<uint32_t>::max();
+	packed_indices.clear();
+	auto getFace = [this](size_t f) -> const glm::uvec3& {
+		return f < faces.size() ? faces[f] : lod_faces[f - faces.size()];
+	};
+	// Empty ranges have vmin > vmax
+	auto fitsShort = [](uint32_t vmin, uint32_t vmax) {
+		return vmin > vmax || vmax - vmin < 65536;
+	};
+	for (auto& lod : lods) {
+		std::vector<uint32_t> vmins(lod.size(), kNone), vmaxs(lod.size(), 0);
+		for (size_t m = 0; m < lod.size(); m++) {
+			for (size_t f = lod[m].offset; f < lod[m].offset + lod[m].nfaces; f++) {
+				for (int k = 0; k < 3; k++) {
+					vmins[m] = std::min(vmins[m], getFace(f)[k]);
+					vmaxs[m] = std::max(vmaxs[m], getFace(f)[k]);
+				}
+			}
+		}
+		size_t first = 0;
+		while (first < lod.size()) {
+			uint32_t vmin = vmins[first], vmax = vmaxs[first];
+			bool short_indices = fitsShort(vmin, vmax);
+			size_t end = first + 1;
+			for (; end < lod.size(); end++) {
+				uint32_t lo = std::min(vmin, vmins[end]), hi = std::max(vmax, vmaxs[end]);
+				if (short_indices ? !fitsShort(lo, hi) : vmins[end] <= vmaxs[end] && fitsShort(vmins[end], vmaxs[end]))
+					break;
+				vmin = lo;
+				vmax = hi;
+			}
+			if (vmin > vmax)
+				vmin = 0;
+			size_t index_size = short_indices ? 2 : 4;
+			// Indices must be aligned to their size
+			packed_indices.resize((packed_indices.size() + index_size - 1) / index_size * index_size);
+			for (size_t m = first; m < end; m++) {
+				Material& ma = lod[m];
+				ma.short_indices = short_indices;
+				ma.base_vertex = int(vmin);
+				ma.index_offset = packed_indices.size();
+				packed_indices.resize(ma.index_offset + ma.nfaces * 3 * index_size);
+				uint8_t* out = packed_indices.data() + ma.index_offset;
+				for (size_t f = ma.offset; f < ma.offset + ma.nfaces; f++) {
+					for (int k = 0; k < 3; k++) {
+						uint32_t index = getFace(f)[k] - vmin;
+						if (short_indices) {
+							uint16_t short_index = uint16_t(index);
+							memcpy(out, &short_index, 2);
+						} else {
+							memcpy(out, &index, 4);
+						}
+						out += index_size;
+					}
+				}
+			}
+			first = end;
 		}
 	}
+}
 
-	//std::cout << "numBones = " << numBones << "numVerts = " << numVerts << std::endl;
+int Mesh::selectLod(const glm::vec3& eye, float fov) const
+{
+	if (lods.size() < 2)
+		return 0;
+	float radius = 0.5f * glm::length(bounds.max - bounds.min);
+	float distance = glm::length(eye - getCenter());
+	if (distance <= radius)
+		return 0;
+	float half_height = distance * std::tan(glm::radians(fov) * 0.5f);
+	float coverage = radius / half_height;
+	int lod = 0;
+	float threshold = kLodScreenHeight;
+	while (lod + 1 < int(lods.size()) && coverage < threshold) {
+		lod++;
+		threshold *= kLodScreenHeight;
+	}
+	return lod;
 }
 
 int Mesh::getNumberOfBones() const
@@ -12,6 +12,7 @@
 #include <glm/gtx/io.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <mmdadapter.h>
+#include <name_table.h>
 #include <cstdlib>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/rotate_vector.hpp>
@@ -91,6 +92,7 @@ struct Joint {
 	
 	int joint_index;
 	int parent_index;
+	uint32_t name_id = NameTable::kNoName;   // bone name, interned
 	glm::vec3 position;             // position of the joint
 	glm::fquat orientation;         // rotation w.r.t. initial configuration
 	glm::fquat rel_orientation;     // rotation w.r.t. it's parent. Used for animation.
@@ -220,6 +222,8 @@ struct Skeleton {
 	void refreshCache(Configuration* cache = nullptr);
 	const glm::vec3* collectJointTrans() const;
 	const glm::fquat* collectJointRot() const;
+	/* findBone: the bone ending at the joint named name_id. Return: -1 if none */
+	int findBone(uint32_t name_id) const;
 
 	// FIXME: create skeleton and bone data structures
 	void initBoneIndicies(std::vector<glm::uvec2>& boneIndicies) {
@@ -299,7 +303,6 @@ struct Mesh {
 	Mesh();
 	~Mesh();
 	std::vector<glm::vec4> vertices;
-	std::vector<glm::vec4> undeformedVertices;
 	/*
 	 * Static per-vertex attrributes for Shaders
 	 */
@@ -308,16 +311,109 @@ struct Mesh {
 	std::vector<float> weight_for_joint0; // weight_for_joint1 can be calculated
 	std::vector<glm::vec3> vector_from_joint0;
 	std::vector<glm::vec3> vector_from_joint1;
+	/*
+	 * Third and fourth joints of four joint (PMX BDEF4) meshes, empty
+	 * otherwise. -1 with weight 0 if the vertex has fewer joints. Their
+	 * weights are stored, including weight_for_joint1, and their offsets
+	 * follow from vector_from_joint0, see getInfluences.
+	 */
+	std::vector<int32_t> joint2;
+	std::vector<int32_t> joint3;
+	std::vector<float> weight_for_joint1;
+	std::vector<float> weight_for_joint2;
+	std::vector<float> weight_for_joint3;
 	std::vector<glm::vec4> vertex_normals;
 	std::vector<glm::vec4> face_normals;
 	std::vector<glm::vec2> uv_coordinates;
 	std::vector<glm::uvec3> faces;
+	// Index buffer with 16-bit indices where a material allows it, the
+	// layout of each material is given by Material::index_offset etc.
+	std::vector<uint8_t> packed_indices;
+	/*
+	 * Levels of detail, lods[0] is the same as materials.
+	 * Each level lists all materials with their own face ranges. Faces of
+	 * levels above 0 are stored in lod_faces, and their Material::offset
+	 * continues after faces, i.e. lod_faces[offset - faces.size()].
+	 * All levels index the same vertices.
+	 */
+	std::vector<std::vector<Material>> lods;
+	std::vector<glm::uvec3> lod_faces;
 
 	std::vector<Material> materials;
 	BoundingBox bounds;
 	Skeleton skeleton;
+	/*
+	 * Bind-space bounds of the offsets from each joint of the vertices it
+	 * influences, and the joints influencing each material.
+	 */
+	std::vector<BoundingBox> joint_bounds;
+	std::vector<std::vector<int>> material_joints;
+	// Keep faces in releaseCpuData for CPU consumers that read them every
+	// frame (the fur pass).
+	bool keep_faces = false;
 
+	/*
+	 * loadPmd: load, optimize and prepare a PMD or PMX model, from the model
+	 * cache when it is up to date (see ModelCache).
+	 */
 	void loadPmd(const std::string& fn);
+	/*
+	 * Loading stages run by loadPmd, in this order, for loaders that
+	 * publish each stage as it completes (see ModelLoader).
+	 * loadSkeleton: the skeleton, bounds enclose the joints. Throws
+	 *               std::string for more than kMaxBones joints.
+	 * loadGeometry: vertices, weights and untextured materials, optimized.
+	 *               Skeleton::meshWeights is left to buildMeshWeights.
+	 * loadTextures: waits for the textures decoded since mr.open.
+	 */
+	void loadSkeleton(MMDReader& mr);
+	void loadGeometry(MMDReader& mr);
+	void loadTextures(MMDReader& mr);
+	/*
+	 * releaseCpuData: free the per-vertex arrays, faces, packed indices
+	 * and Skeleton::meshWeights once they are uploaded. Materials, LODs,
+	 * bounds and the skeleton stay, and faces with keep_faces. Do not call
+	 * it while a CPU consumer (VatClip::bake, picking against vertices)
+	 * still needs the arrays.
+	 */
+	void releaseCpuData();
+	/* setTextures: copy texture and texture_path of textured[i] into material i of every LOD */
+	void setTextures(const std::vector<Material>& textured);
+	/*
+	 * buildSkeleton: create joints and bones from the bind positions and
+	 * parents (-1 for roots) of the joints. names (UTF-8) may be empty.
+	 */
+	void buildSkeleton(const std::vector<glm::vec3>& positions,
+	                   const std::vector<int>& parents,
+	                   const std::vector<std::string>& names = std::vector<std::string>());
+	/* buildMeshWeights: Skeleton::meshWeights from the joints and their weights */
+	void buildMeshWeights();
+	bool hasFourJoints() const { return !joint2.empty(); }
+	/*
+	 * getInfluences: joints, weights and bind-space offsets (vertex minus
+	 * joint position) of vertex i.
+	 * Return: the number of joints, 1 to 4
+	 */
+	int getInfluences(size_t i, int jid[4], float weight[4], glm::vec3 offset[4]) const;
+	/*
+	 * optimize: reorder triangles inside each material for vertex cache
+	 * locality, renumber vertices in first use order, generate the levels
+	 * of detail and build packed_indices. Called by loadPmd.
+	 */
+	void optimize();
+	/*
+	 * selectLod: choose the level of detail by the projected height of
+	 * the bounding sphere, for a camera at eye with vertical fov (in
+	 * degrees).
+	 */
+	int selectLod(const glm::vec3& eye, float fov) const;
+	/*
+	 * getMaterialBounds: conservative bounds of each material under the
+	 * current pose. Skinned vertices are convex combinations of their
+	 * joints' transformed offsets, so they stay inside the union of the
+	 * posed joint bounds.
+	 */
+	void getMaterialBounds(std::vector<BoundingBox>& out) const;
 	int getNumberOfBones() const;
 	glm::vec3 getCenter() const { return 0.5f * glm::vec3(bounds.min + bounds.max); }
 	const Configuration* getCurrentQ() const; // Configuration is abbreviated as Q
@@ -329,6 +425,9 @@ struct Mesh {
 private:
 	void computeBounds();
 	void computeNormals();
+	void buildLods();
+	void computeJointBounds();
+	void packIndices();
 	Configuration currentQ_;
 };
 
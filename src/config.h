@@ -6,7 +6,9 @@
  */
 
 const float kCylinderRadius = 0.25;
-const int kMaxBones = 128;
+const int kMaxBones = 128;     // Joint palette of blending.vert and bone.vert
+const int kMaxMaterials = 256; // Must match MaterialBlock in default.frag
+const int kMaxTextureArrays = 4; // Must match textureArrays in default.frag
 /*
  * Extra credit: what would happen if you set kNear to 1e-5? How to solve it?
  */
@@ -14,6 +16,13 @@ const float kNear = 0.1f;
 const float kFar = 1000.0f;
 const float kFov = 45.0f;
 
+// Mesh levels of detail: level i keeps about kLodTriangleRatio^i of the
+// triangles, and is drawn once the model covers less than
+// kLodScreenHeight^i of the screen height.
+const int kNumLods = 4;
+const float kLodTriangleRatio = 0.5f;
+const float kLodScreenHeight = 0.5f;
+
 // Floor info.
 const float kFloorEps = 0.5 * (0.025 + 0.0175);
 const float kFloorXMin = -100.0f;
@@ -0,0 +1,318 @@
+/*
+ * skinning-convert: preprocess PMD/PMX models into the model cache offline.
+ *
+ * Usage: skinning-convert [-j N] [--memory-budget MiB] [--cache DIR]
+ *                         [--incremental] <file or directory>...
+ *
+ * Directories are walked recursively for .pmd and .pmx files. Every model
+ * goes through the same import as Mesh::loadPmd (skeleton, weights,
+ * vertex cache and fetch reordering, LODs, texture decoding) and is
+ * written to the cache with the RGBA textures, so the viewer starts from
+ * the cache.
+ *
+ * Cache files are named by the model path as given, so pass the paths the
+ * viewer will be started with.
+ *
+ * Models are converted on N threads (the hardware threads by default).
+ * A model is only started while the estimated memory of the models in
+ * flight stays below the budget, one model always runs. Each model
+ * decodes its textures on one thread. A model whose cache cannot be
+ * written counts as failed.
+ */
+#include "../bone_geometry.h"
+#include "../model_cache.h"
+#include <thread_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	enum Stage {
+		kParse,         // MMDReader::open, textures start decoding
+		kSkeleton,
+		kGeometry,      // weights, vertex cache and fetch order, LODs
+		kTextures,      // waiting for the decoder
+		kCache,         // RGBA conversion and writing
+		kNumStages
+	};
+	const char* kStageNames[kNumStages] = { "parse", "skeleton", "geometry", "textures", "cache" };
+
+	// Peak memory of converting a model, in multiples of its file size
+	const uint64_t kMemoryPerFileByte = 16;
+
+	struct ConvertOptions {
+		std::vector<std::string> inputs;
+		std::string cache_dir;
+		size_t nthreads = 0;
+		uint64_t memory_budget = uint64_t(2048) << 20;
+		bool incremental = false;
+	};
+
+	bool isModelFile(const std::string& fn)
+	{
+		size_t dot = fn.find_last_of('.');
+		if (dot == std::string::npos)
+			return false;
+		std::string ext = fn.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		return ext == "pmd" || ext == "pmx";
+	}
+
+	bool isDirectory(const std::string& path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+	}
+
+	uint64_t getFileSize(const std::string& path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_size) : 0;
+	}
+
+	std::vector<std::string> listDirectory(const std::string& dir)
+	{
+		std::vector<std::string> names;
+#ifdef _WIN32
+		_finddata_t data;
+		intptr_t handle = _findfirst((dir + "/*").c_str(), &data);
+		if (handle == -1)
+			return names;
+		do {
+			names.emplace_back(data.name);
+		} while (_findnext(handle, &data) == 0);
+		_findclose(handle);
+#else
+		DIR* d = opendir(dir.c_str());
+		if (!d)
+			return names;
+		while (dirent* entry = readdir(d))
+			names.emplace_back(entry->d_name);
+		closedir(d);
+#endif
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	void collectModels(const std::string& path, std::vector<std::string>& models)
+	{
+		if (!isDirectory(path)) {
+			models.emplace_back(path);
+			return ;
+		}
+		for (const auto& name : listDirectory(path)) {
+			if (name == "." || name == "..")
+				continue;
+			std::string child = path + "/" + name;
+			if (isDirectory(child))
+				collectModels(child, models);
+			else if (isModelFile(name))
+				models.emplace_back(child);
+		}
+	}
+
+	bool parseOptions(int argc, char* argv[], ConvertOptions& options)
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			bool has_value = i + 1 < argc;
+			if (arg == "-j" && has_value) {
+				options.nthreads = std::max(1, std::atoi(argv[++i]));
+			} else if (arg == "--memory-budget" && has_value) {
+				options.memory_budget = uint64_t(std::max(1, std::atoi(argv[++i]))) << 20;
+			} else if (arg == "--cache" && has_value) {
+				options.cache_dir = argv[++i];
+			} else if (arg == "--incremental") {
+				options.incremental = true;
+			} else if (arg.compare(0, 1, "-") == 0) {
+				std::cerr << __func__ << ": unknown option " << arg << std::endl;
+				return false;
+			} else {
+				options.inputs.emplace_back(arg);
+			}
+		}
+		return !options.inputs.empty();
+	}
+
+	/*
+	 * MemoryBudget: admits models while the estimates of those in flight
+	 * fit, or when nothing else runs so that oversized models still go.
+	 */
+	class MemoryBudget {
+	public:
+		explicit MemoryBudget(uint64_t bytes) : budget_(bytes) {}
+
+		void acquire(uint64_t bytes)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [this, bytes]() { return used_ == 0 || used_ + bytes <= budget_; });
+			used_ += bytes;
+		}
+
+		void release(uint64_t bytes)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				used_ -= bytes;
+			}
+			cv_.notify_all();
+		}
+	private:
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		uint64_t budget_;
+		uint64_t used_ = 0;
+	};
+
+	struct Report {
+		enum Result { kConverted, kSkipped, kFailed } result = kFailed;
+		double ms[kNumStages] = {};
+		size_t nvertices = 0;
+		size_t nfaces = 0;
+		size_t nmaterials = 0;
+		std::string error;
+	};
+
+	Report convertModel(const std::string& fn, const ConvertOptions& options)
+	{
+		Report report;
+		ModelCache cache;
+		if (!options.cache_dir.empty())
+			cache.setDirectory(options.cache_dir);
+		if (options.incremental) {
+			Mesh current;
+			if (cache.load(fn, current)) {
+				report.result = Report::kSkipped;
+				return report;
+			}
+		}
+
+		auto last = Clock::now();
+		auto finish = [&report, &last](Stage stage) {
+			auto now = Clock::now();
+			report.ms[stage] = std::chrono::duration<double, std::milli>(now - last).count();
+			last = now;
+		};
+		try {
+			MMDReader mr;
+			// Models already convert in parallel. One decode thread per
+			// model keeps the threads and textures in flight bounded by -j.
+			mr.setTextureThreads(1);
+			if (!mr.open(fn))
+				throw "cannot open " + fn;
+			finish(kParse);
+			Mesh mesh;
+			mesh.loadSkeleton(mr);
+			finish(kSkeleton);
+			mesh.loadGeometry(mr);
+			finish(kGeometry);
+			mesh.loadTextures(mr);
+			finish(kTextures);
+			if (!cache.save(fn, mesh))
+				throw "cannot write the cache of " + fn;
+			finish(kCache);
+			report.nvertices = mesh.vertices.size();
+			report.nfaces = mesh.faces.size();
+			report.nmaterials = mesh.materials.size();
+			report.result = Report::kConverted;
+		} catch (const std::string& e) {
+			report.error = e;
+		} catch (const std::exception& e) {
+			report.error = e.what();
+		}
+		return report;
+	}
+
+	std::string formatReport(const std::string& fn, const Report& report)
+	{
+		std::ostringstream ss;
+		ss << std::fixed << std::setprecision(1) << fn << ": ";
+		if (report.result == Report::kSkipped) {
+			ss << "cache is current";
+		} else if (report.result == Report::kFailed) {
+			ss << "FAILED (" << report.error << ")";
+		} else {
+			double total = 0.0;
+			for (int s = 0; s < kNumStages; s++) {
+				ss << kStageNames[s] << " " << report.ms[s] << " ms, ";
+				total += report.ms[s];
+			}
+			ss << "total " << total << " ms (" << report.nvertices << " vertices, "
+			   << report.nfaces << " faces, " << report.nmaterials << " materials)";
+		}
+		return ss.str();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	ConvertOptions options;
+	if (!parseOptions(argc, argv, options)) {
+		std::cerr << "Usage: " << argv[0] << " [-j N] [--memory-budget MiB] [--cache DIR]"
+		          << " [--incremental] <PMD/PMX file or directory>..." << std::endl;
+		return -1;
+	}
+	std::vector<std::string> models;
+	for (const auto& input : options.inputs)
+		collectModels(input, models);
+	if (models.empty()) {
+		std::cerr << argv[0] << ": no PMD or PMX files found" << std::endl;
+		return -1;
+	}
+
+	auto start = Clock::now();
+	std::mutex report_mutex;
+	double stage_ms[kNumStages] = {};
+	size_t counts[3] = {};
+	MemoryBudget budget(options.memory_budget);
+	{
+		ThreadPool pool(options.nthreads);
+		std::cout << "Converting " << models.size() << " models on "
+		          << pool.getNThreads() << " threads" << std::endl;
+		for (const auto& fn : models) {
+			// Keep the queue short, so the budget is checked right
+			// before a model starts
+			pool.wait(pool.getNThreads());
+			pool.enqueue([&, fn]() {
+				uint64_t estimate = getFileSize(fn) * kMemoryPerFileByte;
+				budget.acquire(estimate);
+				Report report = convertModel(fn, options);
+				budget.release(estimate);
+
+				std::lock_guard<std::mutex> lock(report_mutex);
+				counts[report.result]++;
+				for (int s = 0; s < kNumStages; s++)
+					stage_ms[s] += report.ms[s];
+				std::cout << formatReport(fn, report) << std::endl;
+			});
+		}
+		pool.wait();
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::cout << std::fixed << std::setprecision(1)
+	          << counts[Report::kConverted] << " converted, "
+	          << counts[Report::kSkipped] << " current, "
+	          << counts[Report::kFailed] << " failed in " << seconds << " s; thread time";
+	for (int s = 0; s < kNumStages; s++)
+		std::cout << " " << kStageNames[s] << " " << stage_ms[s] / 1000.0 << " s";
+	std::cout << std::endl;
+	return counts[Report::kFailed] ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+#include <GL/glew.h>
+#include "crowd.h"
+#include "bone_geometry.h"
+#include <debuggl.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <glm/gtc/matrix_transform.hpp>
+
+const int Crowd::kHeaderTexels;
+
+Crowd::Crowd(size_t ninstances, size_t njoints, float spacing)
+	: njoints_(njoints), width_(kHeaderTexels + 2 * int(njoints))
+{
+	GLint max_size = 0;
+	CHECK_GL_ERROR(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+	if (width_ > max_size)
+		throw __func__+std::string(": ")+std::to_string(njoints)+" joints do not fit in one palette row";
+	if (ninstances > size_t(max_size)) {
+		std::cerr << __func__ << ": " << ninstances << " instances exceed GL_MAX_TEXTURE_SIZE, using "
+		          << max_size << std::endl;
+		ninstances = max_size;
+	}
+	ninstances = std::max<size_t>(ninstances, 1);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	int columns = int(std::ceil(std::sqrt(float(ninstances))));
+	float origin = -0.5f * (columns - 1) * spacing;
+	instances_.resize(ninstances);
+	for (size_t i = 0; i < ninstances; i++) {
+		auto& inst = instances_[i];
+		glm::vec3 pos(origin + (i % columns) * spacing, 0.0f, origin + (i / columns) * spacing);
+		float heading = (unit(rng) - 0.5f) * float(M_PI) * 0.5f;
+		inst.transform = glm::rotate(glm::translate(glm::mat4(1.0f), pos),
+		                             heading, glm::vec3(0.0f, 1.0f, 0.0f));
+		inst.time_offset = unit(rng) * 2.0f * float(M_PI);
+		inst.speed = 0.75f + 0.5f * unit(rng);
+	}
+
+	palette_.resize(size_t(width_) * ninstances);
+	texture_ = GLResourcePool::instance().createTexture(palette_.size() * sizeof(glm::vec4));
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, texture_.get()));
+	// Only read with texelFetch, but the texture must be complete
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width_, ninstances, 0,
+	                            GL_RGBA, GL_FLOAT, nullptr));
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+void Crowd::update(float time, const PoseSampler& sample,
+                   const glm::vec3& eye, float far_distance)
+{
+	order_.resize(instances_.size());
+	for (size_t i = 0; i < order_.size(); i++)
+		order_[i] = i;
+	auto is_near = [this, &eye, far_distance](size_t i) {
+		return glm::distance(glm::vec3(instances_[i].transform[3]), eye) < far_distance;
+	};
+	nnear_ = std::stable_partition(order_.begin(), order_.end(), is_near) - order_.begin();
+
+	Configuration q;
+	for (size_t r = 0; r < order_.size(); r++) {
+		const auto& inst = instances_[order_[r]];
+		float t = inst.time_offset + time * inst.speed;
+		glm::vec4* row = &palette_[r * width_];
+		for (int c = 0; c < 4; c++)
+			row[c] = inst.transform[c];
+		row[4] = glm::vec4(t, 0.0f, 0.0f, 0.0f);
+		if (r >= nnear_)
+			continue;
+		sample(t, q);
+		size_t n = std::min(njoints_, std::min(q.trans.size(), q.rot.size()));
+		for (size_t j = 0; j < n; j++) {
+			row[kHeaderTexels + 2 * j] = glm::vec4(q.trans[j], 0.0f);
+			const glm::fquat& rot = q.rot[j];
+			row[kHeaderTexels + 2 * j + 1] = glm::vec4(rot.x, rot.y, rot.z, rot.w);
+		}
+	}
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, texture_.get()));
+	if (nnear_ > 0)
+		CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, nnear_,
+		                               GL_RGBA, GL_FLOAT, palette_.data()));
+	if (nnear_ < instances_.size()) {
+		// Far rows only need their header
+		CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ROW_LENGTH, width_));
+		CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, nnear_, kHeaderTexels,
+		                               instances_.size() - nnear_, GL_RGBA, GL_FLOAT,
+		                               palette_.data() + nnear_ * width_));
+		CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+	}
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+void Crowd::blendPoses(const Configuration& from, const Configuration& to,
+                       float w, Configuration& out)
+{
+	size_t n = std::min(from.trans.size(), to.trans.size());
+	out.trans.resize(n);
+	out.rot.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		out.trans[i] = glm::mix(from.trans[i], to.trans[i], w);
+		out.rot[i] = glm::slerp(from.rot[i], to.rot[i], w);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <vector>
+#include <functional>
+#include <limits>
+#include <glm/glm.hpp>
+#include "gl_resource.h"
+
+struct Configuration;
+
+/*
+ * Crowd: per-instance state for drawing many copies of one model with a
+ * single instanced draw per material (blending.vert compiled with CROWD).
+ *
+ * Row i of the RGBA32F palette texture describes instance i:
+ *      texels 0-3: instance transform (columns)
+ *      texel 4: animation time in x
+ *      texels 5 + 2j, 6 + 2j: translation and rotation of joint j
+ *
+ * Rows are sorted by level of detail: the getNNear() instances within the
+ * far distance of the eye come first and are skinned with their joints.
+ * The rows of the other instances only hold the header, they are drawn
+ * from a baked clip (vat.vert, starting at row getNNear()).
+ */
+class Crowd {
+public:
+	static const int kHeaderTexels = 5;
+
+	struct Instance {
+		glm::mat4 transform;
+		float time_offset;
+		float speed;
+	};
+	/* PoseSampler: write the pose of the model at time t into q */
+	typedef std::function<void(float t, Configuration& q)> PoseSampler;
+
+	/*
+	 * Constructor: place ninstances copies on a square grid with the given
+	 * spacing around the origin, each with a random heading, time offset
+	 * and playback speed (fixed seed, so runs are reproducible).
+	 */
+	Crowd(size_t ninstances, size_t njoints, float spacing);
+
+	/*
+	 * update: sample the pose of every instance closer to eye than
+	 * far_distance at time and upload the palette.
+	 */
+	void update(float time, const PoseSampler& sample,
+	            const glm::vec3& eye = glm::vec3(0.0f),
+	            float far_distance = std::numeric_limits<float>::max());
+
+	unsigned getPaletteTexture() const { return texture_.get(); }
+	size_t getNInstances() const { return instances_.size(); }
+	size_t getNNear() const { return nnear_; }
+	const std::vector<Instance>& getInstances() const { return instances_; }
+
+	/*
+	 * blendPoses: interpolate between two poses, translations linearly and
+	 * rotations with slerp.
+	 */
+	static void blendPoses(const Configuration& from, const Configuration& to,
+	                       float w, Configuration& out);
+private:
+	size_t njoints_;
+	int width_;
+	std::vector<Instance> instances_;
+	std::vector<size_t> order_; // palette row -> instance
+	size_t nnear_ = 0;
+	std::vector<glm::vec4> palette_;
+	GLResource texture_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include <GL/glew.h>
+#include "frame_capture.h"
+#include <debuggl.h>
+#include <jpegio.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace {
+
+// Frames waiting for an encoder per encoder thread, bounds the memory
+// held by a recording that encodes slower than it renders.
+const size_t kPendingEncodesPerThread = 2;
+const GLuint64 kFenceTimeout = 1000000000ull; // ns
+
+}
+
+FrameCapture::FrameCapture(size_t nbuffers, size_t nthreads)
+	: slots_(std::max<size_t>(nbuffers, 1)), nfailed_(0), encoders_(nthreads)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+	finish();
+	for (auto& slot : slots_)
+		if (slot.fence)
+			glDeleteSync((GLsync)slot.fence);
+}
+
+void FrameCapture::requestScreenshot(const std::string& filename)
+{
+	screenshot_ = filename;
+}
+
+void FrameCapture::startRecording(const std::string& prefix)
+{
+	recording_ = true;
+	record_prefix_ = prefix;
+	record_frame_ = 0;
+	std::cerr << __func__ << ": recording to " << prefix << "_*.jpg" << std::endl;
+}
+
+void FrameCapture::stopRecording()
+{
+	if (recording_)
+		std::cerr << __func__ << ": recorded " << record_frame_ << " frames" << std::endl;
+	recording_ = false;
+}
+
+void FrameCapture::capture(int width, int height)
+{
+	if (screenshot_.empty() && !recording_) {
+		collect(false);
+		return ;
+	}
+	if (width <= 0 || height <= 0)
+		return ;
+
+	Slot& slot = slots_[next_];
+	if (!screenshot_.empty()) {
+		slot.filename = screenshot_;
+		screenshot_.clear();
+	} else {
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), "_%05zu.jpg", record_frame_++);
+		slot.filename = record_prefix_ + suffix;
+	}
+	slot.width = width;
+	slot.height = height;
+
+	size_t bytes = size_t(width) * height * 3;
+	if (slot.pbo.getCapacity() < bytes) {
+		slot.pbo = GLResourcePool::instance().acquireBuffer(bytes);
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo.get()));
+		CHECK_GL_ERROR(glBufferData(GL_PIXEL_PACK_BUFFER, slot.pbo.getCapacity(),
+					nullptr, GL_STREAM_READ));
+	} else {
+		CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo.get()));
+	}
+	CHECK_GL_ERROR(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+	CHECK_GL_ERROR(glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0));
+	CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	next_ = (next_ + 1) % slots_.size();
+	in_flight_++;
+	ncaptured_++;
+	// Map the oldest slot only, so the GPU has N-1 frames to finish it
+	if (in_flight_ == slots_.size())
+		collect(true, slots_.size() - 1);
+}
+
+void FrameCapture::finish()
+{
+	while (in_flight_ > 0)
+		collect(true);
+	encoders_.wait();
+}
+
+void FrameCapture::collect(bool wait_oldest, size_t keep)
+{
+	while (in_flight_ > keep) {
+		Slot& slot = slots_[oldest_];
+		GLsync fence = (GLsync)slot.fence;
+		GLuint64 timeout = wait_oldest ? kFenceTimeout : 0;
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED && wait_oldest)
+			continue;
+		if (status == GL_TIMEOUT_EXPIRED)
+			return ;
+		if (status == GL_WAIT_FAILED)
+			std::cerr << __func__ << ": waiting for " << slot.filename << " failed" << std::endl;
+		glDeleteSync(fence);
+		slot.fence = nullptr;
+		encode(slot);
+		oldest_ = (oldest_ + 1) % slots_.size();
+		in_flight_--;
+		wait_oldest = false;
+	}
+}
+
+void FrameCapture::encode(Slot& slot)
+{
+	size_t bytes = size_t(slot.width) * slot.height * 3;
+	// The pixels are copied out so the buffer can be reused right away,
+	// mapped memory must not be touched by other threads.
+	std::shared_ptr<std::vector<unsigned char>> pixels(new std::vector<unsigned char>(bytes));
+	CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo.get()));
+	void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (data) {
+		memcpy(pixels->data(), data, bytes);
+		CHECK_GL_ERROR(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+	} else {
+		std::cerr << __func__ << ": cannot map the pixels of " << slot.filename << std::endl;
+	}
+	CHECK_GL_ERROR(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	if (!data) {
+		nfailed_++;
+		return ;
+	}
+
+	encoders_.wait(encoders_.getNThreads() * kPendingEncodesPerThread);
+	std::string filename = slot.filename;
+	int width = slot.width, height = slot.height;
+	encoders_.enqueue([this, pixels, filename, width, height]() {
+		if (!SaveJPEG(filename, width, height, pixels->data())) {
+			std::cerr << "FrameCapture: cannot write " << filename << std::endl;
+			nfailed_++;
+		}
+	});
+}
@@ -0,0 +1,73 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread_pool.h> // header from utgraphicsutil
+#include "gl_resource.h"
+
+/*
+ * FrameCapture: asynchronous screenshots and frame recording.
+ *
+ * capture() starts glReadPixels into the next pixel buffer object of a
+ * ring and returns without waiting. A fence marks when the copy is done.
+ * Once the ring is full, capture() maps the oldest buffer, N-1 frames
+ * behind the one it just queued, copies the pixels out and hands them to
+ * a pool of threads running SaveJPEG. Buffers left when capturing stops
+ * are collected by later calls without waiting.
+ *
+ * Nothing is dropped: if the oldest copy is not done yet it is waited
+ * for, and if the encoders fall behind, capture() waits for them.
+ */
+class FrameCapture {
+public:
+	FrameCapture(size_t nbuffers = 3, size_t nthreads = 0);
+	/* Calls finish(), the GL context must still be current */
+	~FrameCapture();
+
+	/* requestScreenshot: save the next captured frame to filename */
+	void requestScreenshot(const std::string& filename);
+	/* startRecording: save every frame to <prefix>_<frame>.jpg */
+	void startRecording(const std::string& prefix);
+	void stopRecording();
+	bool isRecording() const { return recording_; }
+
+	/*
+	 * capture: call once per frame after drawing, reads the current read
+	 * framebuffer if a screenshot is requested or recording is on.
+	 */
+	void capture(int width, int height);
+	/* finish: wait for all readbacks and encodes */
+	void finish();
+
+	size_t getNCaptured() const { return ncaptured_; }
+	size_t getNFailed() const { return nfailed_; }
+	size_t getNPendingEncodes() const { return encoders_.getPending(); }
+private:
+	struct Slot {
+		GLResource pbo;
+		void* fence = nullptr;  // GLsync
+		int width = 0, height = 0;
+		std::string filename;
+	};
+	/* collect: encode finished readbacks, oldest first, until keep are left */
+	void collect(bool wait_oldest, size_t keep = 0);
+	void encode(Slot& slot);
+
+	std::vector<Slot> slots_;
+	size_t next_ = 0;       // slot of the next readback
+	size_t oldest_ = 0;     // oldest slot in flight
+	size_t in_flight_ = 0;
+
+	std::string screenshot_;
+	bool recording_ = false;
+	std::string record_prefix_;
+	size_t record_frame_ = 0;
+
+	size_t ncaptured_ = 0;
+	std::atomic<size_t> nfailed_;
+	ThreadPool encoders_;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include "frustum.h"
+#include <glm/gtc/matrix_access.hpp>
+
+/*
+ * Gribb and Hartmann: the planes are sums and differences of the rows of
+ * the clip matrix.
+ */
+Frustum::Frustum(const glm::mat4& view_projection)
+{
+	glm::vec4 r0 = glm::row(view_projection, 0);
+	glm::vec4 r1 = glm::row(view_projection, 1);
+	glm::vec4 r2 = glm::row(view_projection, 2);
+	glm::vec4 r3 = glm::row(view_projection, 3);
+	planes[0] = r3 + r0; // left
+	planes[1] = r3 - r0; // right
+	planes[2] = r3 + r1; // bottom
+	planes[3] = r3 - r1; // top
+	planes[4] = r3 + r2; // near
+	planes[5] = r3 - r2; // far
+}
+
+bool Frustum::intersects(const glm::vec3& min, const glm::vec3& max) const
+{
+	for (const auto& plane : planes) {
+		// The corner furthest along the plane normal
+		glm::vec3 p(plane.x > 0.0f ? max.x : min.x,
+		            plane.y > 0.0f ? max.y : min.y,
+		            plane.z > 0.0f ? max.z : min.z);
+		if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
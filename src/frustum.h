@@ -0,0 +1,22 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+/*
+ * Frustum: the six clip planes of a view-projection matrix, normals
+ * pointing inwards.
+ */
+struct Frustum {
+	glm::vec4 planes[6];
+
+	Frustum() = default;
+	explicit Frustum(const glm::mat4& view_projection);
+	/*
+	 * intersects: conservative box test, may return true for boxes that
+	 * are near a corner of the frustum but outside of it.
+	 */
+	bool intersects(const glm::vec3& min, const glm::vec3& max) const;
+};
+
+#endif
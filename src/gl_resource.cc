@@ -0,0 +1,255 @@
+#include <GL/glew.h>
+#include "gl_resource.h"
+#include <debuggl.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+namespace {
+	const size_t kMinBufferSize = 256;
+	const size_t kLargeBufferStep = 1 << 20;
+	// Pooled buffers beyond this are deleted rather than kept
+	const size_t kMaxPooledBufferBytes = 64 << 20;
+	const size_t kMaxPooledVAOs = 4096;
+}
+
+GLResource::GLResource(GLResourceType type, unsigned id, size_t bytes)
+	: type_(type), id_(id), bytes_(bytes)
+{
+}
+
+GLResource::GLResource(GLResource&& other)
+	: type_(other.type_), id_(other.id_), bytes_(other.bytes_)
+{
+	other.id_ = 0;
+	other.bytes_ = 0;
+}
+
+GLResource& GLResource::operator=(GLResource&& other)
+{
+	if (this != &other) {
+		reset();
+		type_ = other.type_;
+		id_ = other.id_;
+		bytes_ = other.bytes_;
+		other.id_ = 0;
+		other.bytes_ = 0;
+	}
+	return *this;
+}
+
+void GLResource::reset()
+{
+	if (!id_)
+		return ;
+	GLResourcePool::instance().release(type_, id_, bytes_);
+	id_ = 0;
+	bytes_ = 0;
+}
+
+GLResourcePool& GLResourcePool::instance()
+{
+	static GLResourcePool pool;
+	return pool;
+}
+
+size_t GLResourcePool::getSizeClass(size_t bytes)
+{
+	if (bytes >= kLargeBufferStep)
+		return (bytes + kLargeBufferStep - 1) / kLargeBufferStep * kLargeBufferStep;
+	size_t size = kMinBufferSize;
+	while (size < bytes)
+		size <<= 1;
+	return size;
+}
+
+GLResource GLResourcePool::acquireBuffer(size_t bytes)
+{
+	size_t capacity = getSizeClass(bytes);
+	Stats& stats = stats_[kGLBuffer];
+	stats.live++;
+	stats.live_bytes += capacity;
+
+	auto iter = free_buffers_.find(capacity);
+	if (iter != free_buffers_.end() && !iter->second.empty()) {
+		unsigned id = iter->second.back();
+		iter->second.pop_back();
+		stats.pooled--;
+		stats.pooled_bytes -= capacity;
+		stats.reused++;
+		return GLResource(kGLBuffer, id, capacity);
+	}
+	// Storage is allocated by the first upload()
+	GLuint id = 0;
+	CHECK_GL_ERROR(glGenBuffers(1, &id));
+	stats.created++;
+	return GLResource(kGLBuffer, id, capacity);
+}
+
+GLResource GLResourcePool::acquireVertexArray()
+{
+	Stats& stats = stats_[kGLVertexArray];
+	stats.live++;
+	if (!free_vaos_.empty()) {
+		unsigned id = free_vaos_.back();
+		free_vaos_.pop_back();
+		stats.pooled--;
+		stats.reused++;
+		return GLResource(kGLVertexArray, id);
+	}
+	GLuint id = 0;
+	CHECK_GL_ERROR(glGenVertexArrays(1, &id));
+	stats.created++;
+	return GLResource(kGLVertexArray, id);
+}
+
+GLResource GLResourcePool::createTexture(size_t bytes)
+{
+	GLuint id = 0;
+	CHECK_GL_ERROR(glGenTextures(1, &id));
+	stats_[kGLTexture].created++;
+	track(kGLTexture, bytes);
+	return GLResource(kGLTexture, id, bytes);
+}
+
+GLResource GLResourcePool::createSampler()
+{
+	GLuint id = 0;
+	CHECK_GL_ERROR(glGenSamplers(1, &id));
+	stats_[kGLSampler].created++;
+	track(kGLSampler, 0);
+	return GLResource(kGLSampler, id);
+}
+
+void GLResourcePool::upload(const GLResource& buffer, unsigned target,
+                            const void* data, size_t bytes)
+{
+	if (bytes > buffer.getCapacity())
+		throw __func__+std::string(": upload of ")+std::to_string(bytes)+" bytes exceeds buffer capacity "+std::to_string(buffer.getCapacity());
+	CHECK_GL_ERROR(glBindBuffer(target, buffer.get()));
+	CHECK_GL_ERROR(glBufferData(target, buffer.getCapacity(), nullptr, GL_STATIC_DRAW));
+	if (data && bytes > 0)
+		CHECK_GL_ERROR(glBufferSubData(target, 0, bytes, data));
+}
+
+void GLResourcePool::fill(const GLResource& buffer, unsigned target, size_t bytes,
+                          const std::function<void(void*)>& write)
+{
+	upload(buffer, target, nullptr, 0);
+	if (bytes == 0)
+		return ;
+	void* dst = nullptr;
+	CHECK_GL_ERROR(dst = glMapBufferRange(target, 0, bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	GLboolean intact = GL_FALSE;
+	if (dst) {
+		write(dst);
+		CHECK_GL_ERROR(intact = glUnmapBuffer(target));
+	}
+	if (!intact) {
+		// Mapping failed or the storage was lost (e.g. a mode switch)
+		std::cerr << __func__ << ": mapping " << bytes << " bytes failed, uploading a copy" << std::endl;
+		std::vector<uint8_t> data(bytes);
+		write(data.data());
+		upload(buffer, target, data.data(), bytes);
+	}
+}
+
+void GLResourcePool::track(GLResourceType type, size_t bytes)
+{
+	stats_[type].live++;
+	stats_[type].live_bytes += bytes;
+}
+
+void GLResourcePool::untrack(GLResourceType type, size_t bytes)
+{
+	stats_[type].live--;
+	stats_[type].live_bytes -= bytes;
+}
+
+void GLResourcePool::release(GLResourceType type, unsigned id, size_t bytes)
+{
+	untrack(type, bytes);
+	Stats& stats = stats_[type];
+	GLuint name = id;
+	switch (type) {
+	case kGLBuffer:
+		if (stats.pooled_bytes + bytes <= kMaxPooledBufferBytes) {
+			free_buffers_[bytes].emplace_back(id);
+			stats.pooled++;
+			stats.pooled_bytes += bytes;
+		} else {
+			CHECK_GL_ERROR(glDeleteBuffers(1, &name));
+		}
+		break;
+	case kGLVertexArray:
+		if (free_vaos_.size() < kMaxPooledVAOs) {
+			free_vaos_.emplace_back(id);
+			stats.pooled++;
+		} else {
+			CHECK_GL_ERROR(glDeleteVertexArrays(1, &name));
+		}
+		break;
+	case kGLTexture:
+		CHECK_GL_ERROR(glDeleteTextures(1, &name));
+		break;
+	case kGLSampler:
+		CHECK_GL_ERROR(glDeleteSamplers(1, &name));
+		break;
+	case kGLProgram:
+		CHECK_GL_ERROR(glDeleteProgram(name));
+		break;
+	default:
+		break;
+	}
+}
+
+void GLResourcePool::trim()
+{
+	for (auto& sizeclass : free_buffers_) {
+		auto& names = sizeclass.second;
+		if (!names.empty())
+			CHECK_GL_ERROR(glDeleteBuffers(names.size(), names.data()));
+	}
+	free_buffers_.clear();
+	if (!free_vaos_.empty())
+		CHECK_GL_ERROR(glDeleteVertexArrays(free_vaos_.size(), free_vaos_.data()));
+	free_vaos_.clear();
+	for (auto& stats : stats_) {
+		stats.pooled = 0;
+		stats.pooled_bytes = 0;
+	}
+}
+
+const char* GLResourcePool::getTypeName(GLResourceType type)
+{
+	switch (type) {
+	case kGLBuffer: return "buffer";
+	case kGLVertexArray: return "vertex array";
+	case kGLTexture: return "texture";
+	case kGLSampler: return "sampler";
+	case kGLProgram: return "program";
+	default: return "unknown";
+	}
+}
+
+void GLResourcePool::report(std::ostream& out) const
+{
+	out << std::left << std::setw(14) << "type"
+	    << std::right << std::setw(8) << "live"
+	    << std::setw(14) << "live bytes"
+	    << std::setw(8) << "pooled"
+	    << std::setw(14) << "pooled bytes"
+	    << std::setw(10) << "created"
+	    << std::setw(10) << "reused" << std::endl;
+	for (int i = 0; i < kGLNumResourceTypes; i++) {
+		const Stats& stats = stats_[i];
+		out << std::left << std::setw(14) << getTypeName(GLResourceType(i))
+		    << std::right << std::setw(8) << stats.live
+		    << std::setw(14) << stats.live_bytes
+		    << std::setw(8) << stats.pooled
+		    << std::setw(14) << stats.pooled_bytes
+		    << std::setw(10) << stats.created
+		    << std::setw(10) << stats.reused << std::endl;
+	}
+}
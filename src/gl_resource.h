@@ -0,0 +1,110 @@
+#ifndef GL_RESOURCE_H
+#define GL_RESOURCE_H
+
+#include <vector>
+#include <map>
+#include <ostream>
+#include <cstddef>
+#include <functional>
+
+enum GLResourceType {
+	kGLBuffer = 0,
+	kGLVertexArray,
+	kGLTexture,
+	kGLSampler,
+	kGLProgram,
+	kGLNumResourceTypes
+};
+
+/*
+ * GLResource: move-only owner of one GL object.
+ * The object goes back to GLResourcePool when the handle is destroyed or
+ * reset().
+ */
+class GLResource {
+public:
+	GLResource() = default;
+	GLResource(GLResourceType type, unsigned id, size_t bytes = 0);
+	~GLResource() { reset(); }
+	GLResource(GLResource&& other);
+	GLResource& operator=(GLResource&& other);
+	GLResource(const GLResource&) = delete;
+	GLResource& operator=(const GLResource&) = delete;
+
+	unsigned get() const { return id_; }
+	/* Size of the storage in bytes, for buffers it may exceed the request */
+	size_t getCapacity() const { return bytes_; }
+	explicit operator bool() const { return id_ != 0; }
+	void reset();
+private:
+	GLResourceType type_ = kGLBuffer;
+	unsigned id_ = 0;
+	size_t bytes_ = 0;
+};
+
+/*
+ * GLResourcePool: creates, recycles and accounts all GL objects.
+ *
+ * Buffers are allocated in size classes (powers of two up to 1 MiB, then
+ * multiples of 1 MiB) and VAOs are kept on a free list, so objects that
+ * are recreated every frame (e.g. the fur passes) reuse old names and
+ * storage instead of going through the driver's allocator.
+ *
+ * Objects owned by other caches (textures in TextureCache, programs in
+ * ProgramCache) are only accounted with track()/untrack().
+ */
+class GLResourcePool {
+public:
+	static GLResourcePool& instance();
+
+	/*
+	 * acquireBuffer: get a buffer whose storage is at least bytes large.
+	 * The content is undefined, fill it with GLResourcePool::upload.
+	 */
+	GLResource acquireBuffer(size_t bytes);
+	GLResource acquireVertexArray();
+	GLResource createTexture(size_t bytes = 0);
+	GLResource createSampler();
+
+	/*
+	 * upload: replace the first bytes of buffer with data.
+	 * The old storage is orphaned first, so the upload does not wait for
+	 * draws still reading the buffer.
+	 */
+	static void upload(const GLResource& buffer, unsigned target,
+	                   const void* data, size_t bytes);
+	/*
+	 * fill: like upload, but write produces the bytes straight into the
+	 * mapped storage, so the caller needs no copy of them in memory.
+	 */
+	static void fill(const GLResource& buffer, unsigned target, size_t bytes,
+	                 const std::function<void(void*)>& write);
+
+	void track(GLResourceType type, size_t bytes);
+	void untrack(GLResourceType type, size_t bytes);
+	void release(GLResourceType type, unsigned id, size_t bytes);
+
+	struct Stats {
+		size_t live = 0;        // objects in use
+		size_t live_bytes = 0;
+		size_t pooled = 0;      // objects waiting on the free lists
+		size_t pooled_bytes = 0;
+		size_t created = 0;     // total objects created by the driver
+		size_t reused = 0;      // total acquisitions served by the pool
+	};
+	const Stats& getStats(GLResourceType type) const { return stats_[type]; }
+	void report(std::ostream& out) const;
+	/* trim: delete all pooled objects */
+	void trim();
+
+	static const char* getTypeName(GLResourceType type);
+	static size_t getSizeClass(size_t bytes);
+private:
+	GLResourcePool() = default;
+
+	Stats stats_[kGLNumResourceTypes];
+	std::map<size_t, std::vector<unsigned>> free_buffers_; // size class -> names
+	std::vector<unsigned> free_vaos_;
+};
+
+#endif
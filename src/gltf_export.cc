@@ -0,0 +1,535 @@
+#include "gltf_export.h"
+#include "bone_geometry.h"
+#include <jpegio.h>
+#include <name_table.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+
+namespace {
+	const uint32_t kGlbMagic = 0x46546c67;  // "glTF"
+	const uint32_t kJsonChunk = 0x4e4f534a; // "JSON"
+	const uint32_t kBinChunk = 0x004e4942;  // "BIN\0"
+	const int kUnsignedShort = 5123;
+	const int kUnsignedInt = 5125;
+	const int kFloat = 5126;
+	const int kArrayBuffer = 34962;
+	const int kElementArrayBuffer = 34963;
+	const size_t kCopyBytes = 1 << 16;
+
+	uint64_t align4(uint64_t bytes)
+	{
+		return (bytes + 3) & ~uint64_t(3);
+	}
+
+	std::string escape(const std::string& s)
+	{
+		std::string out;
+		for (char c : s) {
+			if (c == '"' || c == '\\') {
+				out += '\\';
+				out += c;
+			} else if (uint8_t(c) < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				out += code;
+			} else {
+				out += c;
+			}
+		}
+		return out;
+	}
+
+	struct View {
+		uint64_t offset;
+		uint64_t bytes;
+		int target;             // 0: none
+		int stride;             // 0: tightly packed
+	};
+
+	struct Accessor {
+		int view;
+		uint64_t offset;
+		int component;
+		size_t count;
+		const char* type;
+		std::string min, max;   // JSON arrays, empty: not written
+	};
+
+	/*
+	 * ChunkWriter: writes buffer views into the binary chunk starting at
+	 * base in out, at the offsets planned for them.
+	 */
+	class ChunkWriter {
+	public:
+		ChunkWriter(std::ofstream& out, uint64_t base, const std::string& fn)
+			: out_(out), base_(base), fn_(fn)
+		{
+		}
+
+		void seek(const View& view, uint64_t offset = 0)
+		{
+			out_.seekp(std::streamoff(base_ + view.offset + offset));
+		}
+
+		void write(const void* data, size_t bytes)
+		{
+			out_.write(static_cast<const char*>(data), bytes);
+		}
+
+		/* finish: move to the end of view and pad it to 4 bytes */
+		void finish(const View& view)
+		{
+			seek(view, view.bytes);
+			static const char zeros[4] = {};
+			write(zeros, align4(view.bytes) - view.bytes);
+			if (!out_.good())
+				throw std::string("GlbExporter: cannot write ") + fn_;
+		}
+
+		/* writeRecords: count records of size bytes made by fill(i, dst) */
+		template<typename F>
+		void writeRecords(const View& view, size_t count, size_t size, F fill)
+		{
+			seek(view);
+			std::vector<uint8_t> buffer(std::max(size, kCopyBytes / size * size));
+			size_t per_buffer = buffer.size() / size;
+			for (size_t first = 0; first < count; first += per_buffer) {
+				size_t n = std::min(per_buffer, count - first);
+				for (size_t i = 0; i < n; i++)
+					fill(first + i, buffer.data() + i * size);
+				write(buffer.data(), n * size);
+			}
+			finish(view);
+		}
+	private:
+		std::ofstream& out_;
+		uint64_t base_;
+		std::string fn_;
+	};
+
+	/* Temporary JPEG files of the textures, removed with this object */
+	struct TempFiles {
+		std::vector<std::string> paths;
+		~TempFiles()
+		{
+			for (const auto& path : paths)
+				std::remove(path.c_str());
+		}
+	};
+
+	uint64_t getFileSize(const std::string& path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 ? uint64_t(st.st_size) : 0;
+	}
+
+	/* saveTexture: image as a JPEG file, rows bottom-up like the image */
+	bool saveTexture(const Image& image, const std::string& fn)
+	{
+		int stride = image.stride ? image.stride : image.width * image.channels;
+		std::vector<unsigned char> rgb(size_t(image.width) * image.height * 3);
+		for (int y = 0; y < image.height; y++) {
+			const unsigned char* src = image.bytes.data() + size_t(y) * stride;
+			unsigned char* dst = rgb.data() + size_t(y) * image.width * 3;
+			for (int x = 0; x < image.width; x++)
+				memcpy(dst + 3 * x, src + image.channels * x, 3);
+		}
+		return SaveJPEG(fn, image.width, image.height, rgb.data());
+	}
+
+	void writeFloats(std::ostream& json, const float* v, int n)
+	{
+		json << "[";
+		for (int i = 0; i < n; i++)
+			json << (i ? "," : "") << v[i];
+		json << "]";
+	}
+}
+
+const int GlbExporter::kFrameBlock;
+
+GlbExporter::GlbExporter(const Mesh& mesh)
+	: mesh_(mesh)
+{
+}
+
+void GlbExporter::addClip(const std::string& name, int nframes, float fps, const FrameSampler& sample)
+{
+	clips_.push_back({ name, std::max(nframes, 1), fps > 0.0f ? fps : 30.0f, sample });
+}
+
+void GlbExporter::write(const std::string& fn)
+{
+	const auto& joints = mesh_.skeleton.joints;
+	size_t nvertices = mesh_.vertices.size();
+	size_t njoints = joints.size();
+	if (nvertices == 0 || mesh_.joint0.size() != nvertices)
+		throw std::string("GlbExporter: the mesh has no vertex data, export before releasing it");
+	if (njoints == 0 || njoints > std::numeric_limits<uint16_t>::max())
+		throw std::string("GlbExporter: cannot export ") + std::to_string(njoints) + " joints";
+
+	// Textures shared by several materials are stored once
+	TempFiles jpegs;
+	std::map<const Image*, int> texture_ids;
+	std::vector<int> material_textures;
+	for (const auto& ma : mesh_.materials) {
+		int id = -1;
+		if (ma.texture) {
+			auto iter = texture_ids.find(ma.texture.get());
+			if (iter != texture_ids.end()) {
+				id = iter->second;
+			} else {
+				std::string path = fn + ".tex" + std::to_string(jpegs.paths.size()) + ".jpg";
+				if (!saveTexture(*ma.texture, path))
+					throw std::string("GlbExporter: cannot write ") + path;
+				id = jpegs.paths.size();
+				jpegs.paths.emplace_back(path);
+				texture_ids[ma.texture.get()] = id;
+			}
+		}
+		material_textures.emplace_back(id);
+	}
+
+	// Plan the binary chunk
+	std::vector<View> views;
+	uint64_t bin_bytes = 0;
+	auto addView = [&views, &bin_bytes](uint64_t bytes, int target, int stride = 0) {
+		views.push_back({ bin_bytes, bytes, target, stride });
+		bin_bytes += align4(bytes);
+		return int(views.size() - 1);
+	};
+	std::vector<Accessor> accessors;
+	auto addAccessor = [&accessors](int view, uint64_t offset, int component, size_t count, const char* type) {
+		accessors.push_back({ view, offset, component, count, type, "", "" });
+		return int(accessors.size() - 1);
+	};
+
+	glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+	for (const auto& v : mesh_.vertices) {
+		lo = glm::min(lo, glm::vec3(v));
+		hi = glm::max(hi, glm::vec3(v));
+	}
+	int position_view = addView(nvertices * 12, kArrayBuffer);
+	int normal_view = addView(nvertices * 12, kArrayBuffer);
+	int uv_view = addView(nvertices * 8, kArrayBuffer);
+	// JOINTS_0 and WEIGHTS_0 interleaved, both come from one getInfluences
+	int skin_view = addView(nvertices * 24, kArrayBuffer, 24);
+	int index_view = addView(mesh_.faces.size() * 12, kElementArrayBuffer);
+	int ibm_view = addView(njoints * 64, 0);
+	int position_accessor = addAccessor(position_view, 0, kFloat, nvertices, "VEC3");
+	std::ostringstream bounds;
+	bounds << std::setprecision(9);
+	writeFloats(bounds, &lo[0], 3);
+	accessors.back().min = bounds.str();
+	bounds.str("");
+	writeFloats(bounds, &hi[0], 3);
+	accessors.back().max = bounds.str();
+	int normal_accessor = addAccessor(normal_view, 0, kFloat, nvertices, "VEC3");
+	int uv_accessor = addAccessor(uv_view, 0, kFloat, nvertices, "VEC2");
+	int joint_accessor = addAccessor(skin_view, 0, kUnsignedShort, nvertices, "VEC4");
+	int weight_accessor = addAccessor(skin_view, 8, kFloat, nvertices, "VEC4");
+	int ibm_accessor = addAccessor(ibm_view, 0, kFloat, njoints, "MAT4");
+	std::vector<int> index_accessors;
+	for (const auto& ma : mesh_.materials)
+		index_accessors.emplace_back(ma.nfaces == 0 ? -1 :
+			addAccessor(index_view, ma.offset * 12, kUnsignedInt, ma.nfaces * 3, "SCALAR"));
+
+	std::vector<int> image_views;
+	for (const auto& path : jpegs.paths)
+		image_views.emplace_back(addView(getFileSize(path), 0));
+
+	struct ClipLayout {
+		int time_view, translation_view, rotation_view;
+		int time_accessor;
+		int first_output;       // translation then rotation accessor per joint
+	};
+	std::vector<ClipLayout> clip_layouts;
+	for (const auto& clip : clips_) {
+		ClipLayout layout;
+		size_t nframes = clip.nframes;
+		layout.time_view = addView(nframes * 4, 0);
+		layout.translation_view = addView(njoints * nframes * 12, 0);
+		layout.rotation_view = addView(njoints * nframes * 16, 0);
+		layout.time_accessor = addAccessor(layout.time_view, 0, kFloat, nframes, "SCALAR");
+		std::ostringstream ss;
+		ss << std::setprecision(9) << "[" << (nframes - 1) / clip.fps << "]";
+		accessors.back().min = "[0]";
+		accessors.back().max = ss.str();
+		layout.first_output = accessors.size();
+		for (size_t j = 0; j < njoints; j++) {
+			addAccessor(layout.translation_view, j * nframes * 12, kFloat, nframes, "VEC3");
+			addAccessor(layout.rotation_view, j * nframes * 16, kFloat, nframes, "VEC4");
+		}
+		clip_layouts.emplace_back(layout);
+	}
+
+	// JSON chunk
+	std::ostringstream json;
+	json << std::setprecision(9);
+	json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"skinning\"},\"scene\":0,";
+	std::vector<std::vector<int>> children(njoints);
+	std::vector<int> roots;
+	for (size_t j = 0; j < njoints; j++) {
+		if (joints[j].parent_index >= 0)
+			children[joints[j].parent_index].emplace_back(j);
+		else
+			roots.emplace_back(j);
+	}
+	json << "\"scenes\":[{\"nodes\":[";
+	for (int root : roots)
+		json << root << ",";
+	json << njoints << "]}],";
+
+	json << "\"nodes\":[";
+	const NameTable& names = NameTable::instance();
+	for (size_t j = 0; j < njoints; j++) {
+		const Joint& joint = joints[j];
+		glm::vec3 t = joint.init_position;
+		if (joint.parent_index >= 0)
+			t -= joints[joint.parent_index].init_position;
+		std::string name = names.getName(joint.name_id);
+		if (name.empty())
+			name = "joint" + std::to_string(j);
+		json << "{\"name\":\"" << escape(name) << "\",\"translation\":";
+		writeFloats(json, &t[0], 3);
+		if (!children[j].empty()) {
+			json << ",\"children\":[";
+			for (size_t c = 0; c < children[j].size(); c++)
+				json << (c ? "," : "") << children[j][c];
+			json << "]";
+		}
+		json << "},";
+	}
+	json << "{\"name\":\"model\",\"mesh\":0,\"skin\":0}],";
+
+	json << "\"meshes\":[{\"primitives\":[";
+	bool first = true;
+	for (size_t m = 0; m < mesh_.materials.size(); m++) {
+		if (index_accessors[m] < 0)
+			continue;
+		json << (first ? "" : ",") << "{\"attributes\":{\"POSITION\":" << position_accessor
+		     << ",\"NORMAL\":" << normal_accessor << ",\"TEXCOORD_0\":" << uv_accessor
+		     << ",\"JOINTS_0\":" << joint_accessor << ",\"WEIGHTS_0\":" << weight_accessor
+		     << "},\"indices\":" << index_accessors[m] << ",\"material\":" << m << "}";
+		first = false;
+	}
+	json << "]}],";
+
+	json << "\"skins\":[{\"inverseBindMatrices\":" << ibm_accessor << ",\"joints\":[";
+	for (size_t j = 0; j < njoints; j++)
+		json << (j ? "," : "") << j;
+	json << "]";
+	if (roots.size() == 1)
+		json << ",\"skeleton\":" << roots.front();
+	json << "}],";
+
+	json << "\"materials\":[";
+	for (size_t m = 0; m < mesh_.materials.size(); m++) {
+		const Material& ma = mesh_.materials[m];
+		// Textures replace the diffuse color in default.frag
+		glm::vec4 color = material_textures[m] >= 0 ? glm::vec4(1.0f, 1.0f, 1.0f, ma.diffuse.a) : ma.diffuse;
+		float roughness = std::sqrt(2.0f / (ma.shininess + 2.0f));
+		json << (m ? "," : "") << "{\"name\":\"material" << m << "\",\"pbrMetallicRoughness\":{\"baseColorFactor\":";
+		writeFloats(json, &color[0], 4);
+		json << ",\"metallicFactor\":0,\"roughnessFactor\":" << std::min(roughness, 1.0f);
+		if (material_textures[m] >= 0)
+			json << ",\"baseColorTexture\":{\"index\":" << material_textures[m] << "}";
+		json << "}";
+		if (color.a < 1.0f)
+			json << ",\"alphaMode\":\"BLEND\"";
+		json << "}";
+	}
+	json << "],";
+
+	if (!jpegs.paths.empty()) {
+		json << "\"samplers\":[{\"magFilter\":9729,\"minFilter\":9987,\"wrapS\":10497,\"wrapT\":10497}],";
+		json << "\"textures\":[";
+		for (size_t t = 0; t < jpegs.paths.size(); t++)
+			json << (t ? "," : "") << "{\"sampler\":0,\"source\":" << t << "}";
+		json << "],\"images\":[";
+		for (size_t t = 0; t < jpegs.paths.size(); t++)
+			json << (t ? "," : "") << "{\"bufferView\":" << image_views[t] << ",\"mimeType\":\"image/jpeg\"}";
+		json << "],";
+	}
+
+	if (!clips_.empty()) {
+		json << "\"animations\":[";
+		for (size_t c = 0; c < clips_.size(); c++) {
+			const ClipLayout& layout = clip_layouts[c];
+			json << (c ? "," : "") << "{\"name\":\"" << escape(clips_[c].name) << "\",\"samplers\":[";
+			for (size_t s = 0; s < 2 * njoints; s++)
+				json << (s ? "," : "") << "{\"input\":" << layout.time_accessor << ",\"output\":"
+				     << layout.first_output + s << ",\"interpolation\":\"LINEAR\"}";
+			json << "],\"channels\":[";
+			for (size_t s = 0; s < 2 * njoints; s++)
+				json << (s ? "," : "") << "{\"sampler\":" << s << ",\"target\":{\"node\":" << s / 2
+				     << ",\"path\":\"" << (s % 2 ? "rotation" : "translation") << "\"}}";
+			json << "]}";
+		}
+		json << "],";
+	}
+
+	json << "\"accessors\":[";
+	for (size_t a = 0; a < accessors.size(); a++) {
+		const Accessor& acc = accessors[a];
+		json << (a ? "," : "") << "{\"bufferView\":" << acc.view << ",\"byteOffset\":" << acc.offset
+		     << ",\"componentType\":" << acc.component << ",\"count\":" << acc.count
+		     << ",\"type\":\"" << acc.type << "\"";
+		if (!acc.min.empty())
+			json << ",\"min\":" << acc.min << ",\"max\":" << acc.max;
+		json << "}";
+	}
+	json << "],\"bufferViews\":[";
+	for (size_t v = 0; v < views.size(); v++) {
+		json << (v ? "," : "") << "{\"buffer\":0,\"byteOffset\":" << views[v].offset
+		     << ",\"byteLength\":" << views[v].bytes;
+		if (views[v].stride)
+			json << ",\"byteStride\":" << views[v].stride;
+		if (views[v].target)
+			json << ",\"target\":" << views[v].target;
+		json << "}";
+	}
+	json << "],\"buffers\":[{\"byteLength\":" << bin_bytes << "}]}";
+
+	std::string json_text = json.str();
+	json_text.resize(align4(json_text.size()), ' ');
+	uint64_t total = 12 + 8 + json_text.size() + 8 + bin_bytes;
+	if (total > std::numeric_limits<uint32_t>::max())
+		throw std::string("GlbExporter: ") + fn + " would be " + std::to_string(total >> 20) +
+		      " MiB, over the 4 GiB limit of .glb files";
+
+	std::ofstream out(fn, std::ios::binary);
+	if (!out.good())
+		throw std::string("GlbExporter: cannot write ") + fn;
+	uint32_t header[5] = { kGlbMagic, 2, uint32_t(total), uint32_t(json_text.size()), kJsonChunk };
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	out.write(json_text.data(), json_text.size());
+	uint32_t bin_header[2] = { uint32_t(bin_bytes), kBinChunk };
+	out.write(reinterpret_cast<const char*>(bin_header), sizeof(bin_header));
+	ChunkWriter writer(out, 12 + 8 + json_text.size() + 8, fn);
+
+	// Vertex attributes, straight from the mesh
+	writer.writeRecords(views[position_view], nvertices, 12, [this](size_t i, uint8_t* dst) {
+		memcpy(dst, &mesh_.vertices[i][0], 12);
+	});
+	writer.writeRecords(views[normal_view], nvertices, 12, [this](size_t i, uint8_t* dst) {
+		glm::vec3 n(mesh_.vertex_normals[i]);
+		float len = glm::length(n);
+		if (len > 0.0f)
+			n /= len;
+		memcpy(dst, &n[0], 12);
+	});
+	writer.writeRecords(views[uv_view], nvertices, 8, [this](size_t i, uint8_t* dst) {
+		memcpy(dst, &mesh_.uv_coordinates[i][0], 8);
+	});
+	// glTF needs weights that sum to 1, PMX BDEF4/QDEF weights often do
+	// not (blending.vert normalizes them as well)
+	writer.writeRecords(views[skin_view], nvertices, 24, [this](size_t i, uint8_t* dst) {
+		int jid[4];
+		float weight[4];
+		glm::vec3 offset[4];
+		int n = mesh_.getInfluences(i, jid, weight, offset);
+		uint16_t packed_joints[4] = {};
+		float packed_weights[4] = {};
+		float sum = 0.0f;
+		for (int k = 0; k < n; k++) {
+			packed_joints[k] = uint16_t(jid[k]);
+			packed_weights[k] = std::max(weight[k], 0.0f);
+			sum += packed_weights[k];
+		}
+		if (sum > 0.0f) {
+			for (int k = 0; k < n; k++)
+				packed_weights[k] /= sum;
+		} else {
+			packed_weights[0] = 1.0f;
+		}
+		memcpy(dst, packed_joints, 8);
+		memcpy(dst + 8, packed_weights, 16);
+	});
+	writer.writeRecords(views[index_view], mesh_.faces.size(), 12, [this](size_t i, uint8_t* dst) {
+		uint32_t face[3] = { mesh_.faces[i][0], mesh_.faces[i][1], mesh_.faces[i][2] };
+		memcpy(dst, face, 12);
+	});
+	// Joints have no bind rotation, the inverse bind matrix moves the joint to the origin
+	writer.writeRecords(views[ibm_view], njoints, 64, [&joints](size_t j, uint8_t* dst) {
+		float m[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+		m[12] = -joints[j].init_position.x;
+		m[13] = -joints[j].init_position.y;
+		m[14] = -joints[j].init_position.z;
+		memcpy(dst, m, 64);
+	});
+
+	std::vector<char> copy(kCopyBytes);
+	for (size_t t = 0; t < jpegs.paths.size(); t++) {
+		const View& view = views[image_views[t]];
+		std::ifstream in(jpegs.paths[t], std::ios::binary);
+		writer.seek(view);
+		uint64_t left = view.bytes;
+		while (left > 0 && in.read(copy.data(), std::min<uint64_t>(left, copy.size())))
+			writer.write(copy.data(), in.gcount()), left -= in.gcount();
+		if (left > 0)
+			throw std::string("GlbExporter: cannot read ") + jpegs.paths[t];
+		writer.finish(view);
+	}
+
+	// Animations: a block of frames is sampled, then every joint's part of
+	// it goes to that joint's accessors
+	Configuration q;
+	std::vector<float> translations(size_t(kFrameBlock) * njoints * 3);
+	std::vector<float> rotations(size_t(kFrameBlock) * njoints * 4);
+	for (size_t c = 0; c < clips_.size(); c++) {
+		const Clip& clip = clips_[c];
+		const ClipLayout& layout = clip_layouts[c];
+		writer.writeRecords(views[layout.time_view], clip.nframes, 4, [&clip](size_t f, uint8_t* dst) {
+			float t = f / clip.fps;
+			memcpy(dst, &t, 4);
+		});
+		for (int first_frame = 0; first_frame < clip.nframes; first_frame += kFrameBlock) {
+			int n = std::min(kFrameBlock, clip.nframes - first_frame);
+			for (int k = 0; k < n; k++) {
+				clip.sample(first_frame + k, q);
+				if (q.trans.size() != njoints || q.rot.size() != njoints)
+					throw std::string("GlbExporter: clip ") + clip.name + " has a wrong joint count";
+				for (size_t j = 0; j < njoints; j++) {
+					int parent = joints[j].parent_index;
+					glm::vec3 t = q.trans[j];
+					glm::fquat r = q.rot[j];
+					if (parent >= 0) {
+						glm::fquat inv = glm::inverse(q.rot[parent]);
+						t = inv * (q.trans[j] - q.trans[parent]);
+						r = inv * r;
+					}
+					r = glm::normalize(r);
+					float* dt = &translations[(j * kFrameBlock + k) * 3];
+					float* dr = &rotations[(j * kFrameBlock + k) * 4];
+					dt[0] = t.x, dt[1] = t.y, dt[2] = t.z;
+					dr[0] = r.x, dr[1] = r.y, dr[2] = r.z, dr[3] = r.w;
+				}
+			}
+			for (size_t j = 0; j < njoints; j++) {
+				size_t frame = j * clip.nframes + first_frame;
+				writer.seek(views[layout.translation_view], frame * 12);
+				writer.write(&translations[j * kFrameBlock * 3], n * 12);
+				writer.seek(views[layout.rotation_view], frame * 16);
+				writer.write(&rotations[j * kFrameBlock * 4], n * 16);
+			}
+		}
+		writer.finish(views[layout.translation_view]);
+		writer.finish(views[layout.rotation_view]);
+	}
+	out.close();
+	if (!out)
+		throw std::string("GlbExporter: cannot write ") + fn;
+	std::cerr << __func__ << ": wrote " << fn << " (" << (total >> 10) << " KiB, "
+	          << nvertices << " vertices, " << njoints << " joints, "
+	          << clips_.size() << " clips)" << std::endl;
+}
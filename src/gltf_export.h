@@ -0,0 +1,56 @@
+#ifndef GLTF_EXPORT_H
+#define GLTF_EXPORT_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+struct Mesh;
+struct Configuration;
+
+/*
+ * GlbExporter: write a skinned Mesh and sampled animation clips as one
+ * glTF 2.0 binary (.glb).
+ *
+ * The file has a node per joint (bind translations relative to the
+ * parent), one mesh with a primitive per material, a skin whose inverse
+ * bind matrices undo the bind translation of each joint (joints have no
+ * bind rotation, see Joint::orientation), and an animation per clip with
+ * a linear translation and rotation channel for every joint. Skin
+ * attributes are JOINTS_0 (unsigned short) and WEIGHTS_0 (normalized),
+ * interleaved, from Mesh::getInfluences. Textures are embedded as JPEG.
+ *
+ * The layout of the binary chunk is computed from the counts before
+ * anything is written, then every buffer view is streamed to the file.
+ * Clips are sampled kFrameBlock frames at a time and scattered into their
+ * per-joint accessors, so memory does not grow with the clip length.
+ *
+ * The mesh must still have its CPU data (see Mesh::releaseCpuData).
+ */
+class GlbExporter {
+public:
+	static const int kFrameBlock = 64;
+
+	/* FrameSampler: write the joint positions and rotations of frame into q */
+	typedef std::function<void(int frame, Configuration& q)> FrameSampler;
+
+	explicit GlbExporter(const Mesh& mesh);
+
+	/* addClip: an animation of nframes frames at fps, sampled during write */
+	void addClip(const std::string& name, int nframes, float fps, const FrameSampler& sample);
+
+	/* write: throws std::string if the mesh cannot be exported or fn cannot be written */
+	void write(const std::string& fn);
+private:
+	struct Clip {
+		std::string name;
+		int nframes;
+		float fps;
+		FrameSampler sample;
+	};
+
+	const Mesh& mesh_;
+	std::vector<Clip> clips_;
+};
+
+#endif
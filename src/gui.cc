@@ -2,8 +2,9 @@
 #include "config.h"
 #include "ray.h"
 #include <glm/gtx/io.hpp>
-#include <jpegio.h>
 #include "bone_geometry.h"
+#include "frame_capture.h"
+#include "profiler.h"
 #include <iostream>
 #include <algorithm>
 #include <debuggl.h>
@@ -21,13 +22,18 @@ namespace {
 GUI::GUI(GLFWwindow* window, int view_width, int view_height, int preview_height)
 	:window_(window), preview_height_(preview_height)
 {
-	glfwSetWindowUserPointer(window_, this);
-	glfwSetKeyCallback(window_, KeyCallback);
-	glfwSetCursorPosCallback(window_, MousePosCallback);
-	glfwSetMouseButtonCallback(window_, MouseButtonCallback);
-	glfwSetScrollCallback(window_, MouseScrollCallback);
-
-	glfwGetWindowSize(window_, &window_width_, &window_height_);
+	if (window_) {
+		glfwSetWindowUserPointer(window_, this);
+		glfwSetKeyCallback(window_, KeyCallback);
+		glfwSetCursorPosCallback(window_, MousePosCallback);
+		glfwSetMouseButtonCallback(window_, MouseButtonCallback);
+		glfwSetScrollCallback(window_, MouseScrollCallback);
+
+		glfwGetWindowSize(window_, &window_width_, &window_height_);
+	} else {
+		window_width_ = view_width;
+		window_height_ = view_height;
+	}
 	if (view_width < 0 || view_height < 0) {
 		view_width_ = window_width_;
 		view_height_ = window_height_;
@@ -60,15 +66,14 @@ void GUI::keyCallback(int key, int scancode, int action, int mods)
 		return ;
 	}
 	if (key == GLFW_KEY_J && action == GLFW_RELEASE) {
-		//FIXME save out a screenshot using SaveJPEG
-		int width = window_width_;
-		int height = window_height_;
-		unsigned char *data = new unsigned char[3 * width * height];
-		if( data ) {
-			glReadPixels(0, 0, window_width_, window_height_, GL_RGB, GL_UNSIGNED_BYTE, data);
-		}
-		SaveJPEG("screenshot.jpg", window_width_, window_height_, data);
-
+		if (capture_)
+			capture_->requestScreenshot("screenshot.jpg");
+	}
+	if (key == GLFW_KEY_K && action == GLFW_RELEASE && capture_) {
+		if (capture_->isRecording())
+			capture_->stopRecording();
+		else
+			capture_->startRecording("capture");
 	}
 	if (key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL)) {
 		if (action == GLFW_RELEASE)
@@ -173,6 +178,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y)
 	}
 
 	// FIXME: highlight bones that have been moused over
+	ScopedCpuZone zone("picking");
 	//std::cout << "x = " << current_x_ << " y = " << current_y_ << std::endl;
 	glm::vec3 clickPos1 = glm::vec3(current_x_, current_y_, 0.0);
 	glm::vec3 clickPos2 = glm::vec3(current_x_, current_y_, 1.0);
@@ -270,6 +276,21 @@ void GUI::updateMatrices()
 	model_matrix_ = glm::mat4(1.0f);
 }
 
+void GUI::setCamera(const glm::vec3& eye, const glm::vec3& center)
+{
+	fps_mode_ = false;
+	camera_distance_ = glm::length(center - eye);
+	look_ = glm::normalize(center - eye);
+	up_ = glm::vec3(0.0f, 1.0f, 0.0f);
+	if (std::abs(glm::dot(look_, up_)) > 0.999f)
+		up_ = glm::vec3(0.0f, 0.0f, -1.0f);
+	tangent_ = glm::normalize(glm::cross(look_, up_));
+	up_ = glm::cross(tangent_, look_);
+	orientation_ = glm::mat3(tangent_, up_, look_);
+	center_ = center;
+	updateMatrices();
+}
+
 MatrixPointers GUI::getMatrixPointers() const
 {
 	MatrixPointers ret;
@@ -6,6 +6,7 @@
 #include <GLFW/glfw3.h>
 
 struct Mesh;
+class FrameCapture;
 
 /*
  * Hint: call glUniformMatrix4fv on thest pointers
@@ -14,11 +15,17 @@ struct MatrixPointers {
 	const glm::mat4 *projection, *model, *view;
 };
 
+/*
+ * The window may be null for headless rendering, view_width and
+ * view_height are required then.
+ */
 class GUI {
 public:
 	GUI(GLFWwindow*, int view_width = -1, int view_height = -1, int preview_height = -1);
 	~GUI();
 	void assignMesh(Mesh*);
+	/* J saves a screenshot and K toggles recording through capture */
+	void assignCapture(FrameCapture* capture) { capture_ = capture; }
 
 	void keyCallback(int key, int scancode, int action, int mods);
 	void mousePosCallback(double mouse_x, double mouse_y);
@@ -37,6 +44,11 @@ public:
 	const glm::vec3& getCameraDirection() const { return look_; }
 	bool isPoseDirty() const { return pose_changed_; }
 	void clearPose() { pose_changed_ = false; }
+	void markPoseDirty() { pose_changed_ = true; }
+	/*
+	 * setCamera: look from eye at center, used by headless rendering.
+	 */
+	void setCamera(const glm::vec3& eye, const glm::vec3& center);
 	const float* getLightPositionPtr() const { return &light_position_[0]; }
 	
 	int getCurrentBone() const { return current_bone_; }
@@ -50,6 +62,7 @@ public:
 private:
 	GLFWwindow* window_;
 	Mesh* mesh_;
+	FrameCapture* capture_ = nullptr;
 
 	int window_width_, window_height_;
 	int view_width_, view_height_;
@@ -0,0 +1,514 @@
+#include <GL/glew.h>
+#include "headless.h"
+#include "bone_geometry.h"
+#include "config.h"
+#include "gui.h"
+#include "frame_capture.h"
+#include "profiler.h"
+#include <vmd_player.h>
+#include <debuggl.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#ifdef SKINNING_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+bool parseOptions(int argc, char* argv[], HeadlessOptions& options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--headless") {
+			options.enabled = true;
+		} else if (arg == "--size" && has_value) {
+			if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 ||
+			    options.width <= 0 || options.height <= 0)
+				return false;
+		} else if (arg == "--poses" && has_value) {
+			options.poses_file = argv[++i];
+		} else if (arg == "--motion" && has_value) {
+			options.motion_file = argv[++i];
+		} else if (arg == "--cameras" && has_value) {
+			options.cameras_file = argv[++i];
+		} else if (arg == "--out" && has_value) {
+			options.output_dir = argv[++i];
+		} else if (arg == "--shader" && has_value) {
+			options.shader = std::atoi(argv[++i]);
+		} else if (arg == "--time" && has_value) {
+			options.time = std::atof(argv[++i]);
+		} else if (arg == "--crowd" && has_value) {
+			options.crowd = std::max(0, std::atoi(argv[++i]));
+		} else if (arg == "--vat" && has_value) {
+			options.vat_file = argv[++i];
+		} else if (arg == "--bake-vat" && has_value) {
+			options.bake_vat_file = argv[++i];
+		} else if (arg == "--vat-frames" && has_value) {
+			options.vat_frames = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--vat-distance" && has_value) {
+			options.vat_distance = std::atof(argv[++i]);
+		} else if (arg == "--bench" && has_value) {
+			options.bench_frames = std::max(1, std::atoi(argv[++i]));
+		} else if (arg == "--export-glb" && has_value) {
+			options.export_glb_file = argv[++i];
+		} else if (arg == "--export-fps" && has_value) {
+			options.export_fps = std::max(1.0, std::atof(argv[++i]));
+		} else if (arg.compare(0, 2, "--") == 0) {
+			std::cerr << __func__ << ": unknown option " << arg << std::endl;
+			return false;
+		} else {
+			options.model = arg;
+		}
+	}
+	return !options.model.empty();
+}
+
+std::vector<Pose> loadPoses(const std::string& fn)
+{
+	std::ifstream fin(fn);
+	if (!fin.good())
+		throw __func__+std::string(": cannot open ")+fn;
+	std::vector<Pose> poses;
+	std::string line;
+	int lineno = 0;
+	while (std::getline(fin, line)) {
+		lineno++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream ss(line);
+		std::string cmd;
+		if (!(ss >> cmd))
+			continue;
+		bool ok = true;
+		if (cmd == "pose") {
+			poses.emplace_back();
+			ok = bool(ss >> poses.back().name);
+		} else if (poses.empty()) {
+			ok = false;
+		} else if (cmd == "frames") {
+			ok = (ss >> poses.back().nframes) && poses.back().nframes > 0;
+		} else if (cmd == "rotate") {
+			PoseRotation r;
+			std::string bone;
+			ok = bool(ss >> bone >> r.angle >> r.axis.x >> r.axis.y >> r.axis.z);
+			if (ok && bone.find_first_not_of("0123456789") == std::string::npos)
+				ok = bool(std::istringstream(bone) >> r.bone);
+			else if (ok)
+				r.bone_name = NameTable::instance().intern(bone);
+			if (ok)
+				poses.back().rotations.emplace_back(r);
+		} else {
+			ok = false;
+		}
+		if (!ok)
+			throw __func__+std::string(": syntax error at ")+fn+":"+std::to_string(lineno);
+	}
+	return poses;
+}
+
+std::vector<CameraPreset> loadCameraPresets(const std::string& fn)
+{
+	std::ifstream fin(fn);
+	if (!fin.good())
+		throw __func__+std::string(": cannot open ")+fn;
+	std::vector<CameraPreset> presets;
+	std::string line;
+	int lineno = 0;
+	while (std::getline(fin, line)) {
+		lineno++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream ss(line);
+		CameraPreset c;
+		if (!(ss >> c.name))
+			continue;
+		if (!(ss >> c.eye.x >> c.eye.y >> c.eye.z >> c.center.x >> c.center.y >> c.center.z))
+			throw __func__+std::string(": syntax error at ")+fn+":"+std::to_string(lineno);
+		presets.emplace_back(c);
+	}
+	return presets;
+}
+
+std::vector<CameraPreset> getDefaultCameraPresets(const Mesh& mesh)
+{
+	// Fit the bounding sphere into the vertical field of view.
+	glm::vec3 center = mesh.getCenter();
+	float radius = 0.5f * glm::length(mesh.bounds.max - mesh.bounds.min);
+	float distance = radius / std::sin(0.5f * kFov * float(M_PI) / 180.0f);
+	float d = distance * std::sqrt(0.5f);
+	return {
+		{ "front", center + glm::vec3(0.0f, 0.0f, distance), center },
+		{ "side", center + glm::vec3(distance, 0.0f, 0.0f), center },
+		{ "back", center - glm::vec3(0.0f, 0.0f, distance), center },
+		{ "three_quarter", center + glm::vec3(d, 0.25f * distance, d), center },
+	};
+}
+
+#ifdef SKINNING_HAVE_EGL
+
+HeadlessContext::HeadlessContext()
+{
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+		eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		throw __func__+std::string(": cannot initialize EGL");
+	display_ = display;
+
+	// Prefer a pbuffer config, the surfaceless platform may have none.
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint nconfigs = 0;
+	bool pbuffer = eglChooseConfig(display, config_attribs, &config, 1, &nconfigs) && nconfigs > 0;
+	if (!pbuffer) {
+		config_attribs[1] = 0;
+		if (!eglChooseConfig(display, config_attribs, &config, 1, &nconfigs) || nconfigs == 0)
+			throw __func__+std::string(": no OpenGL capable EGL config");
+	}
+	if (!eglBindAPI(EGL_OPENGL_API))
+		throw __func__+std::string(": EGL does not support desktop OpenGL");
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT)
+		throw __func__+std::string(": cannot create an OpenGL 3.3 core context");
+	context_ = context;
+
+	// Everything is drawn into an OffscreenTarget, the surface is only
+	// there for implementations without EGL_KHR_surfaceless_context.
+	EGLSurface surface = EGL_NO_SURFACE;
+	if (pbuffer) {
+		const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+		surface_ = surface;
+	}
+	if (!eglMakeCurrent(display, surface, surface, context))
+		throw __func__+std::string(": cannot make the context current");
+
+	// GLEW built for GLX reports a missing X display after it loaded the
+	// GL entry points.
+	glewExperimental = GL_TRUE;
+	GLenum err = glewInit();
+	if (err != GLEW_OK && err != GLEW_ERROR_NO_GLX_DISPLAY)
+		throw __func__+std::string(": glewInit failed: ")+(const char*)glewGetErrorString(err);
+	glGetError();  // clear the error set by glewInit
+	std::cout << "Renderer: " << glGetString(GL_RENDERER) << "\n";
+	std::cout << "OpenGL version supported:" << glGetString(GL_VERSION) << "\n";
+}
+
+HeadlessContext::~HeadlessContext()
+{
+	EGLDisplay display = (EGLDisplay)display_;
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (surface_)
+		eglDestroySurface(display, (EGLSurface)surface_);
+	if (context_)
+		eglDestroyContext(display, (EGLContext)context_);
+	eglTerminate(display);
+}
+
+#else
+
+HeadlessContext::HeadlessContext()
+{
+	throw __func__+std::string(": built without EGL, headless rendering is not available");
+}
+
+HeadlessContext::~HeadlessContext()
+{
+}
+
+#endif
+
+OffscreenTarget::OffscreenTarget(int width, int height)
+	: width_(width), height_(height)
+{
+	CHECK_GL_ERROR(glGenRenderbuffers(1, &color_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, color_));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width_, height_));
+	CHECK_GL_ERROR(glGenRenderbuffers(1, &depth_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, depth_));
+	CHECK_GL_ERROR(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width_, height_));
+	CHECK_GL_ERROR(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+
+	CHECK_GL_ERROR(glGenFramebuffers(1, &fbo_));
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, fbo_));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_RENDERBUFFER, color_));
+	CHECK_GL_ERROR(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+				GL_RENDERBUFFER, depth_));
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		throw __func__+std::string(": incomplete framebuffer ")+std::to_string(status);
+}
+
+OffscreenTarget::~OffscreenTarget()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo_);
+	glDeleteRenderbuffers(1, &color_);
+	glDeleteRenderbuffers(1, &depth_);
+}
+
+void OffscreenTarget::bind()
+{
+	CHECK_GL_ERROR(glBindFramebuffer(GL_FRAMEBUFFER, fbo_));
+}
+
+void applyPose(Mesh& mesh, const Pose& pose, float fraction)
+{
+	for (const auto& r : pose.rotations) {
+		int bone = r.bone;
+		if (r.bone_name != NameTable::kNoName) {
+			bone = mesh.skeleton.findBone(r.bone_name);
+			if (bone < 0) {
+				std::cerr << __func__ << ": pose " << pose.name << " skips unknown bone "
+				          << NameTable::instance().getName(r.bone_name) << std::endl;
+				continue;
+			}
+		}
+		if (bone < 0 || bone >= (int)mesh.skeleton.bones.size()) {
+			std::cerr << __func__ << ": pose " << pose.name
+			          << " skips invalid bone " << bone << std::endl;
+			continue;
+		}
+		mesh.skeleton.transformChildren(bone, fraction * r.angle, glm::normalize(r.axis));
+	}
+}
+
+namespace {
+	/*
+	 * Rotate the bones starting at joint by its rotation, then recurse.
+	 * world is the rotation the subtree already got from the joints above,
+	 * so the joint's own rotation turns about its axis carried into the
+	 * world frame.
+	 */
+	void applyMotionBelow(Skeleton& skeleton, int joint, const glm::fquat& world,
+	                      const std::vector<glm::fquat>& rotations)
+	{
+		const glm::fquat& local = rotations[joint];
+		float angle = glm::angle(local);
+		glm::vec3 axis = world * glm::axis(local);
+		for (const auto& child : skeleton.joints[joint].boneChildren) {
+			if (angle > 1e-6f)
+				skeleton.transformChildren(child.boneIndex, angle, axis);
+			applyMotionBelow(skeleton, child.endJoint, world * local, rotations);
+		}
+	}
+
+	/*
+	 * loadMotion: the VMD motion of options joined to the joints of mesh
+	 * (the bones of the model file), as the only clip in poses.
+	 * Return: nullptr without --motion.
+	 */
+	std::unique_ptr<VmdPlayer> loadMotion(const HeadlessOptions& options, const Mesh& mesh,
+	                                      std::vector<Pose>& poses)
+	{
+		if (options.motion_file.empty())
+			return nullptr;
+		const Skeleton& skeleton = mesh.skeleton;
+		std::vector<uint32_t> joint_names(skeleton.joints.size());
+		for (size_t i = 0; i < joint_names.size(); i++)
+			joint_names[i] = skeleton.joints[i].name_id;
+		std::unique_ptr<VmdPlayer> motion;
+		try {
+			motion.reset(new VmdPlayer(options.motion_file, joint_names));
+		} catch (const std::runtime_error& e) {
+			throw std::string(e.what());
+		}
+		std::cerr << __func__ << ": " << options.motion_file << " moves "
+		          << motion->getNBoundBones() << " of " << joint_names.size() << " bones in "
+		          << motion->getNFrames() << " frames" << std::endl;
+		poses.assign(1, Pose());
+		poses.back().name = "motion";
+		poses.back().nframes = int(motion->getNFrames());
+		return motion;
+	}
+}
+
+void applyMotion(Mesh& mesh, const std::vector<glm::fquat>& rotations)
+{
+	if (!mesh.skeleton.joints.empty())
+		applyMotionBelow(mesh.skeleton, 0, glm::fquat(1.0f, 0.0f, 0.0f, 0.0f), rotations);
+}
+
+int renderBatch(const HeadlessOptions& options,
+                Mesh& mesh,
+                GUI& gui,
+                const std::function<void(int, int)>& draw)
+{
+	std::vector<Pose> poses;
+	if (!options.poses_file.empty())
+		poses = loadPoses(options.poses_file);
+	if (poses.empty()) {
+		poses.emplace_back();
+		poses.back().name = "bind";
+	}
+	std::unique_ptr<VmdPlayer> motion = loadMotion(options, mesh, poses);
+	std::vector<CameraPreset> cameras;
+	if (!options.cameras_file.empty())
+		cameras = loadCameraPresets(options.cameras_file);
+	if (cameras.empty())
+		cameras = getDefaultCameraPresets(mesh);
+
+	OffscreenTarget target(options.width, options.height);
+	// Readback and JPEG encoding overlap with rendering the next images.
+	FrameCapture capture;
+	const Skeleton bind_skeleton = mesh.skeleton;
+	size_t nimages = 0;
+
+	typedef std::chrono::steady_clock Clock;
+	auto start = Clock::now();
+	for (const auto& pose : poses) {
+		for (int frame = 0; frame < pose.nframes; frame++) {
+			float fraction = pose.nframes > 1 ? float(frame) / (pose.nframes - 1) : 1.0f;
+			mesh.skeleton = bind_skeleton;
+			if (motion)
+				applyMotion(mesh, motion->seekFrame(frame));
+			else
+				applyPose(mesh, pose, fraction);
+			gui.markPoseDirty();
+			for (const auto& camera : cameras) {
+				Profiler::instance().beginFrame();
+				gui.setCamera(camera.eye, camera.center);
+				target.bind();
+				draw(target.getWidth(), target.getHeight());
+
+				char suffix[32];
+				snprintf(suffix, sizeof(suffix), "_%04d.jpg", frame);
+				capture.requestScreenshot(options.output_dir + "/" + pose.name + "_" + camera.name + suffix);
+				capture.capture(target.getWidth(), target.getHeight());
+				Profiler::instance().endFrame();
+				nimages++;
+			}
+		}
+	}
+	double render_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	capture.finish();
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	mesh.skeleton = bind_skeleton;
+
+	std::cout << "Rendered " << nimages << " images of "
+	          << options.width << "x" << options.height << " in " << seconds << " s: "
+	          << nimages / seconds << " fps, "
+	          << nimages / render_seconds << " fps without waiting for JPEG encoding\n";
+	std::vector<Profiler::ZoneStats> stats;
+	Profiler::instance().getStats(stats);
+	for (const auto& zone : stats)
+		std::cout << (zone.gpu ? "GPU " : "CPU ") << zone.name
+		          << ": avg " << zone.avg_ms << " ms, max " << zone.max_ms << " ms\n";
+	return capture.getNFailed() > 0 ? 1 : 0;
+}
+
+int renderBenchmark(const HeadlessOptions& options,
+                    Mesh& mesh,
+                    GUI& gui,
+                    const std::function<void(int, int)>& draw,
+                    const BenchmarkTimes& times)
+{
+	std::vector<Pose> poses;
+	if (!options.poses_file.empty())
+		poses = loadPoses(options.poses_file);
+	if (poses.empty()) {
+		poses.emplace_back();
+		poses.back().name = "bind";
+	}
+	std::unique_ptr<VmdPlayer> motion = loadMotion(options, mesh, poses);
+	std::vector<CameraPreset> cameras;
+	if (!options.cameras_file.empty())
+		cameras = loadCameraPresets(options.cameras_file);
+	if (cameras.empty())
+		cameras = getDefaultCameraPresets(mesh);
+
+	OffscreenTarget target(options.width, options.height);
+	gui.setCamera(cameras.front().eye, cameras.front().center);
+	const Skeleton bind_skeleton = mesh.skeleton;
+
+	typedef std::chrono::steady_clock Clock;
+	double total_ms = 0.0, max_ms = 0.0;
+	size_t pose_index = 0;
+	int frame = 0;
+	for (int i = 0; i < options.bench_frames; i++) {
+		const Pose& pose = poses[pose_index];
+		int pose_frame = frame;
+		float fraction = pose.nframes > 1 ? float(frame) / (pose.nframes - 1) : 1.0f;
+		if (++frame >= pose.nframes) {
+			frame = 0;
+			pose_index = (pose_index + 1) % poses.size();
+		}
+
+		auto start = Clock::now();
+		Profiler::instance().beginFrame();
+		mesh.skeleton = bind_skeleton;
+		if (motion)
+			applyMotion(mesh, motion->seekFrame(pose_frame));
+		else
+			applyPose(mesh, pose, fraction);
+		gui.markPoseDirty();
+		target.bind();
+		draw(target.getWidth(), target.getHeight());
+		CHECK_GL_ERROR(glFinish());
+		Profiler::instance().endFrame();
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		total_ms += ms;
+		max_ms = std::max(max_ms, ms);
+	}
+	mesh.skeleton = bind_skeleton;
+
+	std::cout << "bench: load_ms=" << times.load_ms
+	          << " upload_ms=" << times.upload_ms
+	          << " peak_rss_mib=" << getPeakMemory() / double(1 << 20)
+	          << " frame_ms_avg=" << total_ms / options.bench_frames
+	          << " frame_ms_max=" << max_ms << std::endl;
+	return 0;
+}
+
+size_t getPeakMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);         // bytes
+#else
+	return size_t(usage.ru_maxrss) * 1024;  // kilobytes
+#endif
+#endif
+}
@@ -0,0 +1,177 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <name_table.h>
+
+struct Mesh;
+class GUI;
+
+/*
+ * Headless batch rendering, selected with --headless:
+ *
+ *      skinning --headless [--size WxH] [--poses FILE | --motion FILE.vmd]
+ *               [--cameras FILE] [--shader N] [--time T] [--crowd N] [--out DIR]
+ *               <PMD or PMX file>
+ *      skinning --headless --bench N [--size WxH] [--poses FILE | --motion FILE.vmd]
+ *               <PMD or PMX file>
+ *
+ * Every pose is rendered from every camera preset into an offscreen
+ * framebuffer and written to DIR/<pose>_<camera>_<frame>.jpg. A VMD
+ * motion is played as one clip named "motion" instead of the poses.
+ *
+ * With --bench N no images are written. The pose clips are played in a
+ * loop from the first camera for N frames, and one line with the load
+ * time, upload time, peak memory and frame times is printed (see
+ * renderBenchmark); skinning-bench parses it.
+ */
+struct HeadlessOptions {
+	bool enabled = false;
+	int width = 800;
+	int height = 600;
+	std::string model;
+	std::string poses_file;
+	std::string motion_file;   // --motion FILE: a VMD motion, replaces the poses
+	std::string cameras_file;
+	std::string output_dir = ".";
+	int shader = 0;         // shaderNum bits, see main.cc
+	float time = 0.0f;      // time_since_start, fixed for reproducible images
+	int crowd = 0;          // --crowd N: draw N instances, also without --headless
+	// Far crowd instances drawn from a vertex animation texture, see VatClip
+	std::string vat_file;      // --vat FILE: load a baked clip
+	std::string bake_vat_file; // --bake-vat FILE: bake the clip, save it and exit
+	int vat_frames = 32;       // --vat-frames N
+	float vat_distance = 0.0f; // --vat-distance D: > 0 bakes at startup if no file
+	int bench_frames = 0;      // --bench N: time N frames instead of writing images
+	std::string export_glb_file; // --export-glb FILE: write a .glb and exit
+	float export_fps = 30.0f;    // --export-fps N: frame rate of the exported clips
+};
+
+/*
+ * parseOptions: parse the command line into options.
+ * Return: false if the arguments are malformed or the model is missing.
+ */
+bool parseOptions(int argc, char* argv[], HeadlessOptions& options);
+
+/*
+ * Pose file format, one statement per line, '#' starts a comment:
+ *      pose <name>                             start a new pose
+ *      frames <n>                              make the pose a clip
+ *      rotate <bone> <radians> <ax> <ay> <az>  rotate a bone and its children
+ * <bone> is a bone index or the name (UTF-8) of the joint the bone ends
+ * at, as in the model file; names are matched when the pose is applied.
+ * A clip of n frames ramps every rotation from 0 to its full angle.
+ * Without a pose file the bind pose is rendered.
+ */
+struct PoseRotation {
+	int bone = -1;
+	uint32_t bone_name = NameTable::kNoName; // interned, overrides bone
+	float angle;
+	glm::vec3 axis;
+};
+
+struct Pose {
+	std::string name;
+	int nframes = 1;
+	std::vector<PoseRotation> rotations;
+};
+
+std::vector<Pose> loadPoses(const std::string& fn);
+/* applyPose: rotate the bones of pose by fraction of their angles */
+void applyPose(Mesh& mesh, const Pose& pose, float fraction);
+/*
+ * applyMotion: turn the bones starting at every joint by the joint's
+ * rotation relative to its parent, as VmdPlayer::seekFrame returns them,
+ * indexed by joint (a bone of the model file, as in MMD).
+ */
+void applyMotion(Mesh& mesh, const std::vector<glm::fquat>& rotations);
+
+/*
+ * Camera file format, one preset per line:
+ *      <name> <eye x y z> <center x y z>
+ * Without a camera file, front, side, back and three quarter views framing
+ * the model are used.
+ */
+struct CameraPreset {
+	std::string name;
+	glm::vec3 eye;
+	glm::vec3 center;
+};
+
+std::vector<CameraPreset> loadCameraPresets(const std::string& fn);
+std::vector<CameraPreset> getDefaultCameraPresets(const Mesh& mesh);
+
+/*
+ * HeadlessContext: an OpenGL 3.3 core context without window system,
+ * created through EGL on the surfaceless platform (or a pbuffer of the
+ * default display), so it runs on Mesa llvmpipe without a GPU or X server.
+ */
+class HeadlessContext {
+public:
+	HeadlessContext();
+	~HeadlessContext();
+private:
+	void* display_ = nullptr;
+	void* context_ = nullptr;
+	void* surface_ = nullptr;
+};
+
+/*
+ * OffscreenTarget: framebuffer object with color and depth renderbuffers.
+ */
+class OffscreenTarget {
+public:
+	OffscreenTarget(int width, int height);
+	~OffscreenTarget();
+
+	/* bind: draw into and read from this target */
+	void bind();
+
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+private:
+	int width_, height_;
+	unsigned fbo_ = 0;
+	unsigned color_ = 0;
+	unsigned depth_ = 0;
+};
+
+/*
+ * renderBatch: render every pose and clip frame from every camera preset.
+ *      draw: draws the scene into the bound framebuffer with the given
+ *            viewport size
+ * Return: 0 on success, non-zero if an image could not be written.
+ */
+int renderBatch(const HeadlessOptions& options,
+                Mesh& mesh,
+                GUI& gui,
+                const std::function<void(int, int)>& draw);
+
+/*
+ * BenchmarkTimes: what happened before the first frame, in milliseconds.
+ */
+struct BenchmarkTimes {
+	double load_ms = 0.0;   // Mesh::loadPmd, from the model cache if it is current
+	double upload_ms = 0.0; // buffers, textures and passes of the first sync
+};
+
+/*
+ * renderBenchmark: draw options.bench_frames frames and print
+ *      bench: load_ms=L upload_ms=U peak_rss_mib=M frame_ms_avg=A frame_ms_max=X
+ * Every frame ends with glFinish, so the frame times include the GPU.
+ * Return: 0
+ */
+int renderBenchmark(const HeadlessOptions& options,
+                    Mesh& mesh,
+                    GUI& gui,
+                    const std::function<void(int, int)>& draw,
+                    const BenchmarkTimes& times);
+
+/* getPeakMemory: the peak resident set size of the process in bytes, 0 if unknown */
+size_t getPeakMemory();
+
+#endif
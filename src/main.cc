@@ -3,6 +3,18 @@
 #include "bone_geometry.h"
 #include "procedure_geometry.h"
 #include "render_pass.h"
+#include "gl_resource.h"
+#include "texture_upload.h"
+#include "vertex_layout.h"
+#include "frustum.h"
+#include "skin_cache.h"
+#include "headless.h"
+#include "frame_capture.h"
+#include "profiler.h"
+#include "crowd.h"
+#include "vat.h"
+#include "gltf_export.h"
+#include "model_loader.h"
 #include "config.h"
 #include "gui.h"
 #include "imgui.h"
@@ -10,8 +22,11 @@
 #include "imgui_impl_opengl3.h"
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -73,6 +88,10 @@ const char* fur_fragment_shader =
 #include "shaders/fur.frag"
 ;
 
+const char* vat_vertex_shader =
+#include "shaders/vat.vert"
+;
+
 
 
 // FIXME: Add more shaders here.
@@ -82,7 +101,11 @@ void ErrorCallback(int error, const char* description) {
 }
 
 
-// Does the math for changing the shader_num flag with a button press
+// shaderNum bits of the effects that move vertices in blending.vert:
+// sphericalize, rave, bounce, walk cycle and loooong
+const int kDeformingShaders = (1 << 0) | (1 << 4) | (1 << 5) | (1 << 6) | (1 << 11);
+
+// Does the math for changing the shaderNum flags with a button press
 void shaderButton(int button_index, int &shaderNum){
 	int index = pow(2, button_index);
 	if ((shaderNum % (index * 2))/index != 0) {
@@ -93,6 +116,162 @@ void shaderButton(int button_index, int &shaderNum){
 			std::cout << shaderNum << std::endl;
 }
 
+// The crowd sways between the bind pose and a target pose with this period
+const float kSwayPeriod = 2.0f * float(M_PI);
+
+Crowd::PoseSampler makeSwaySampler(const Configuration& bind_pose, const Configuration* target)
+{
+	return [&bind_pose, target](float t, Configuration& q) {
+		Crowd::blendPoses(bind_pose, *target, 0.5f - 0.5f * std::cos(t), q);
+	};
+}
+
+/*
+ * Bake the sway clip of the crowd towards the first pose of the pose file
+ * (or the bind pose) into a vertex animation texture, without a GL context.
+ */
+int bakeVatFile(const HeadlessOptions& options)
+{
+	Mesh mesh;
+	mesh.loadPmd(options.model);
+	Configuration bind_pose, target;
+	mesh.skeleton.refreshCache(&bind_pose);
+	std::vector<Pose> poses;
+	if (!options.poses_file.empty())
+		poses = loadPoses(options.poses_file);
+	if (!poses.empty())
+		applyPose(mesh, poses.front(), 1.0f);
+	mesh.skeleton.refreshCache(&target);
+
+	VatClip clip;
+	clip.bake(mesh, makeSwaySampler(bind_pose, &target), kSwayPeriod, options.vat_frames);
+	clip.report(std::cerr, std::max(options.crowd, 1));
+	return clip.save(options.bake_vat_file) ? 0 : -1;
+}
+
+/*
+ * Delete the GL objects held by the static caches while the context is
+ * still current, their destructors run after it is gone.
+ */
+void releaseGLCaches()
+{
+	TextureCache::instance().clear();
+	GLResourcePool::instance().trim();
+}
+
+/*
+ * Export the model and one animation per pose of the pose file (the bind
+ * pose without one) as a .glb, without a GL context.
+ */
+int exportGlbFile(const HeadlessOptions& options)
+{
+	Mesh mesh;
+	mesh.loadPmd(options.model);
+	std::vector<Pose> poses;
+	if (!options.poses_file.empty())
+		poses = loadPoses(options.poses_file);
+	if (poses.empty()) {
+		poses.emplace_back();
+		poses.back().name = "bind";
+	}
+
+	const Skeleton bind_skeleton = mesh.skeleton;
+	GlbExporter exporter(mesh);
+	for (const auto& pose : poses) {
+		exporter.addClip(pose.name, pose.nframes, options.export_fps,
+			[&mesh, &bind_skeleton, &pose](int frame, Configuration& q) {
+				float fraction = pose.nframes > 1 ? float(frame) / (pose.nframes - 1) : 1.0f;
+				mesh.skeleton = bind_skeleton;
+				applyPose(mesh, pose, fraction);
+				mesh.skeleton.refreshCache(&q);
+			});
+	}
+	exporter.write(options.export_glb_file);
+	return 0;
+}
+
+/*
+ * Pack the per-vertex skinning attributes of the object pass:
+ *      jids: 2 (4 for four joint meshes) x uint8 (uint16 for more than 256 joints)
+ *      weights: 1 (4) x unorm16, the weight of jids.y is 1 - weights
+ *               for two joints
+ *      vector_from_joint0/1 (/2/3): float3
+ *      normal: snorm 10:10:10:2
+ * Missing joints (-1) are stored as jid0 with weight 0 and the offset
+ * from jid0. blending.vert needs FOUR_JOINTS for four joint meshes.
+ * data is getStride() * mesh.joint0.size() bytes, usually a mapped buffer.
+ */
+VertexLayout makeObjectLayout(const Mesh& mesh)
+{
+	int id_type = mesh.getNumberOfBones() <= 256 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+	int njoints = mesh.hasFourJoints() ? 4 : 2;
+	VertexLayout layout;
+	layout.add(0, "jids", njoints, id_type)
+	      .add(1, "weights", njoints == 4 ? 4 : 1, GL_UNSIGNED_SHORT, true)
+	      .add(3, "vector_from_joint0", 3, GL_FLOAT)
+	      .add(4, "vector_from_joint1", 3, GL_FLOAT)
+	      .add(5, "normal", 4, GL_INT_2_10_10_10_REV, true);
+	if (njoints == 4)
+		layout.add(8, "vector_from_joint2", 3, GL_FLOAT)
+		      .add(9, "vector_from_joint3", 3, GL_FLOAT);
+	return layout;
+}
+
+void packObjectVertices(const Mesh& mesh, const VertexLayout& layout, uint8_t* data)
+{
+	bool small_ids = mesh.getNumberOfBones() <= 256;
+	int njoints = mesh.hasFourJoints() ? 4 : 2;
+	size_t nvertices = mesh.joint0.size();
+	memset(data, 0, nvertices * layout.getStride());
+	auto jids = layout.getField(0);
+	auto weights = layout.getField(1);
+	auto vector0 = layout.getField(3);
+	auto vector1 = layout.getField(4);
+	auto normal = layout.getField(5);
+	VertexLayout::Field vector2, vector3;
+	if (njoints == 4) {
+		vector2 = layout.getField(8);
+		vector3 = layout.getField(9);
+	}
+	int jid[4];
+	float weight[4];
+	glm::vec3 offset[4];
+	for (size_t i = 0; i < nvertices; i++) {
+		int n = mesh.getInfluences(i, jid, weight, offset);
+		for (int k = n; k < njoints; k++) {
+			jid[k] = jid[0];
+			weight[k] = 0.0f;
+			offset[k] = offset[0];
+		}
+		if (njoints == 4) {
+			if (small_ids) {
+				uint8_t ids[4] = { uint8_t(jid[0]), uint8_t(jid[1]), uint8_t(jid[2]), uint8_t(jid[3]) };
+				layout.write(data, i, jids, ids);
+			} else {
+				uint16_t ids[4] = { uint16_t(jid[0]), uint16_t(jid[1]), uint16_t(jid[2]), uint16_t(jid[3]) };
+				layout.write(data, i, jids, ids);
+			}
+			uint16_t w[4] = { packUnorm16(weight[0]), packUnorm16(weight[1]),
+			                  packUnorm16(weight[2]), packUnorm16(weight[3]) };
+			layout.write(data, i, weights, w);
+			layout.write(data, i, vector2, offset[2]);
+			layout.write(data, i, vector3, offset[3]);
+		} else {
+			if (small_ids) {
+				uint8_t ids[2] = { uint8_t(jid[0]), uint8_t(jid[1]) };
+				layout.write(data, i, jids, ids);
+			} else {
+				uint16_t ids[2] = { uint16_t(jid[0]), uint16_t(jid[1]) };
+				layout.write(data, i, jids, ids);
+			}
+			layout.write(data, i, weights, packUnorm16(weight[0]));
+		}
+		layout.write(data, i, vector0, offset[0]);
+		layout.write(data, i, vector1, offset[1]);
+		layout.write(data, i, normal, packNormal(mesh.vertex_normals[i]));
+	}
+}
+
 GLFWwindow* init_glefw()
 {
 	if (!glfwInit())
@@ -120,13 +299,49 @@ GLFWwindow* init_glefw()
 
 int main(int argc, char* argv[])
 {
-	if (argc < 2) {
+	HeadlessOptions options;
+	if (!parseOptions(argc, argv, options)) {
 		std::cerr << "Input model file is missing" << std::endl;
-		std::cerr << "Usage: " << argv[0] << " <PMD file>" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " <PMD or PMX file>" << std::endl;
+		std::cerr << "       " << argv[0] << " --headless [--size WxH] [--poses FILE | --motion FILE.vmd]"
+		          << " [--cameras FILE] [--shader N] [--time T] [--crowd N] [--out DIR] <PMD or PMX file>" << std::endl;
+		std::cerr << "       " << argv[0] << " --headless --bench N [--size WxH] [--poses FILE | --motion FILE.vmd]"
+		          << " <PMD or PMX file>" << std::endl;
+		std::cerr << "       " << argv[0] << " --bake-vat FILE [--vat-frames N] [--poses FILE] <PMD or PMX file>" << std::endl;
+		std::cerr << "       " << argv[0] << " --export-glb FILE [--export-fps N] [--poses FILE] <PMD or PMX file>" << std::endl;
 		return -1;
 	}
-	GLFWwindow *window = init_glefw();
-	GUI gui(window);
+	if (!options.export_glb_file.empty()) {
+		try {
+			return exportGlbFile(options);
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			return -1;
+		}
+	}
+	if (!options.bake_vat_file.empty()) {
+		try {
+			return bakeVatFile(options);
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			return -1;
+		}
+	}
+	GLFWwindow *window = nullptr;
+	std::unique_ptr<HeadlessContext> headless;
+	if (options.enabled) {
+		try {
+			headless.reset(new HeadlessContext());
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			return -1;
+		}
+		window_width = options.width;
+		window_height = options.height;
+	} else {
+		window = init_glefw();
+	}
+	GUI gui(window, options.enabled ? window_width : -1, options.enabled ? window_height : -1);
 
 	clock_t start_time;
   	start_time = clock();
@@ -156,16 +371,27 @@ int main(int argc, char* argv[])
 	outline_indicies.push_back(glm::uvec2(4,5));
 	outline_indicies.push_back(glm::uvec2(5,3));
 
+	// Headless rendering needs the whole model up front. The viewer loads
+	// it in stages and starts drawing once the skeleton is there, the rest
+	// is picked up at the start of every frame (see sync_model).
 	Mesh mesh;
-	mesh.loadPmd(argv[1]);
-	std::cout << "Loaded object  with  " << mesh.vertices.size()
-		<< " vertices and " << mesh.faces.size() << " faces.\n";
-
-	glm::vec4 mesh_center = glm::vec4(0.0f);
-	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
-		mesh_center += mesh.vertices[i];
+	// The fur pass (shader bit 4096) can be turned on at any time and
+	// reads the faces on the CPU
+	mesh.keep_faces = true;
+	std::unique_ptr<ModelLoader> loader;
+	ModelLoader::Stage model_stage = ModelLoader::kTextures;  // Adopted into mesh
+	ModelLoader::Stage built_stage = ModelLoader::kSkeleton;  // Reflected by the passes
+	BenchmarkTimes bench_times;
+	if (options.enabled) {
+		auto load_start = std::chrono::steady_clock::now();
+		mesh.loadPmd(options.model);
+		bench_times.load_ms = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - load_start).count();
+	} else {
+		loader.reset(new ModelLoader(options.model));
+		loader->wait(ModelLoader::kSkeleton);
+		model_stage = loader->adopt(mesh);
 	}
-	mesh_center /= mesh.vertices.size();
 
 	/*
 	 * GUI object needs the mesh object for bone manipulation.
@@ -256,8 +482,9 @@ int main(int argc, char* argv[])
 	};
 
 	// setup for choosing different shaders
-	int shaderNum = 0; // uses bit shifting as flags for different shaders
-	std::function<int()> shader_num = [&shaderNum]() { return shaderNum; };
+	// uses bit shifting as flags for different shaders, each combination is
+	// compiled as a shader variant, see RenderPass::useVariant
+	int shaderNum = 0;
 
 	std::function<float()> time_since_start = [&since_start]() {return since_start; };
 
@@ -275,7 +502,6 @@ int main(int argc, char* argv[])
 	auto bone_transform = make_uniform("bone_transform", b_transform);
 	//auto fur_transform = make_uniform("bone_transform", f_transform);
 
-	auto shaderNumUni = make_uniform("shader_num", shader_num);
 	auto timeSinceStart = make_uniform("time_since_start", time_since_start);
 	auto triRot = make_uniform("tri_rot", tri_rot);
 
@@ -294,7 +520,6 @@ int main(int argc, char* argv[])
 	std::function<std::vector<glm::fquat>()> rot_data = [&mesh](){ return mesh.getCurrentQ()->rotData(); };
 	auto joint_trans = make_uniform("joint_trans", trans_data);
 	auto joint_rot = make_uniform("joint_rot", rot_data);
-	auto deform_inv = make_uniform("deform_inv", deformed_inv);
 	// FIXME: define more ShaderUniforms for RenderPass if you want to use it.
 	//        Otherwise, do whatever you like here
 
@@ -309,36 +534,200 @@ int main(int argc, char* argv[])
 			{ "fragment_color" }
 			);
 
+	// PMD Model skin pass
+	// Skinning attributes are interleaved and packed in one buffer.
+	// "vert" is only read by the sphericalize variant, so it lives in its
+	// own buffer and is not fetched otherwise.
+	// The attributes are written straight into mapped GL buffers, which
+	// the crowd and VAT passes share.
+	size_t nvertices = 0;
+	VertexLayout skin_layout;
+	std::unique_ptr<SkinCache> skin;
+	bool skin_dirty = true;
+	bool vat_dirty = true;
+
 	// PMD Model render pass
-	// FIXME: initialize the input data at Mesh::loadPmd
-	std::vector<glm::vec2>& uv_coordinates = mesh.uv_coordinates;
-	RenderDataInput object_pass_input;
-	object_pass_input.assign(0, "jid0", mesh.joint0.data(), mesh.joint0.size(), 1, GL_INT);
-	object_pass_input.assign(1, "jid1", mesh.joint1.data(), mesh.joint1.size(), 1, GL_INT);
-	object_pass_input.assign(2, "w0", mesh.weight_for_joint0.data(), mesh.weight_for_joint0.size(), 1, GL_FLOAT);
-	object_pass_input.assign(3, "vector_from_joint0", mesh.vector_from_joint0.data(), mesh.vector_from_joint0.size(), 3, GL_FLOAT);
-	object_pass_input.assign(4, "vector_from_joint1", mesh.vector_from_joint1.data(), mesh.vector_from_joint1.size(), 3, GL_FLOAT);
-	object_pass_input.assign(5, "normal", mesh.vertex_normals.data(), mesh.vertex_normals.size(), 4, GL_FLOAT);
-	object_pass_input.assign(6, "uv", uv_coordinates.data(), uv_coordinates.size(), 2, GL_FLOAT);
-	// TIPS: You won't need vertex position in your solution.
-	//       This only serves the stub shader.
-	object_pass_input.assign(7, "vert", mesh.vertices.data(), mesh.vertices.size(), 4, GL_FLOAT);
-	object_pass_input.assignIndex(mesh.faces.data(), mesh.faces.size(), 3);
-	object_pass_input.useMaterials(mesh.materials);
-	RenderPass object_pass(-1,
-			object_pass_input,
-			{
-			  blending_shader,
-			  geometry_shader,
-			  fragment_shader
-			},
-			{ std_model, std_view, std_proj,
-			  std_light,
-			  std_camera, object_alpha,
-			  joint_trans, joint_rot, deform_inv, shaderNumUni, timeSinceStart
-			},
-			{ "fragment_color" }
-			);
+	// Positions and normals come from the skin cache, so the deformed mesh
+	// is shared by every pass that draws the model.
+	std::unique_ptr<RenderPass> object_pass;
+
+	// Crowd render pass
+	// blending.vert compiled with CROWD skins every instance with its own
+	// row of the joint palette, instead of going through the skin cache.
+	// Instances beyond vat_distance play a baked clip with vat.vert.
+	std::unique_ptr<Crowd> crowd;
+	std::unique_ptr<RenderPass> crowd_pass;
+	std::unique_ptr<RenderPass> vat_pass;
+
+	// Fur render pass
+	// Every fur face gets a copy of the triangle mesh. Their attributes are
+	// refreshed every frame and drawn at once; the pass is only rebuilt
+	// when it needs room for more faces.
+	std::unique_ptr<RenderPass> fur_pass;
+	size_t fur_capacity = 0; // In faces
+	std::vector<glm::vec4> fur_vertices, fur_pos;
+	std::vector<glm::fquat> fur_rot;
+	std::vector<glm::vec3> fur_color;
+	std::vector<glm::uvec3> fur_faces;
+	std::string skin_shader;
+	std::string crowd_shader;
+	Configuration bind_pose;
+	mesh.skeleton.refreshCache(&bind_pose);
+	// Sway between the bind pose and the pose edited in the GUI
+	Crowd::PoseSampler crowd_sampler = makeSwaySampler(bind_pose, mesh.getCurrentQ());
+	VatClip vat;
+	float vat_distance = std::numeric_limits<float>::max();
+	bool vat_rebake = false; // bake the GUI pose, again after every change
+
+	// Create the passes that draw the model, once its geometry is in mesh.
+	// Afterwards the CPU copies of the geometry are released, unless the
+	// VAT baker still needs them.
+	// Throws std::string if the baked clip does not fit the model.
+	auto build_model_passes = [&]() {
+		std::cout << "Loaded object  with  " << mesh.vertices.size()
+			<< " vertices and " << mesh.faces.size() << " faces.\n";
+		if (mesh.vertices.empty())
+			return ;
+		nvertices = mesh.joint0.size();
+		RenderDataInput skin_input;
+		skin_layout = makeObjectLayout(mesh);
+		skin_input.assignInterleaved(skin_layout, [&mesh, &skin_layout](void* dst) {
+				packObjectVertices(mesh, skin_layout, static_cast<uint8_t*>(dst));
+			}, nvertices);
+		skin_input.assign(7, "vert", [&mesh](void* dst) {
+				glm::vec3* positions = static_cast<glm::vec3*>(dst);
+				for (size_t i = 0; i < mesh.vertices.size(); i++)
+					positions[i] = glm::vec3(mesh.vertices[i]);
+			}, mesh.vertices.size(), 3, GL_FLOAT);
+		skin_shader = blending_shader;
+		if (mesh.hasFourJoints())
+			skin_shader = RenderPass::addDefine(blending_shader, "FOUR_JOINTS");
+		crowd_shader = RenderPass::addDefine(skin_shader.c_str(), "CROWD");
+		skin.reset(new SkinCache(skin_input, nvertices, skin_shader.c_str(),
+				{ joint_trans, joint_rot, timeSinceStart }));
+		skin_dirty = true;
+
+		RenderDataInput object_pass_input;
+		object_pass_input.assignBuffer(0, "vertex_position", skin->getBuffer(), nvertices, 4, GL_FLOAT,
+				SkinCache::kStride, SkinCache::kPositionOffset);
+		object_pass_input.assignBuffer(1, "normal", skin->getBuffer(), nvertices, 4, GL_FLOAT,
+				SkinCache::kStride, SkinCache::kNormalOffset);
+		object_pass_input.assign(2, "uv", [&](void* dst) {
+				uint32_t* uvs = static_cast<uint32_t*>(dst);
+				for (size_t i = 0; i < nvertices; i++) {
+					glm::vec2 uv = i < mesh.uv_coordinates.size() ? mesh.uv_coordinates[i] : glm::vec2(0.0f);
+					uvs[i] = packHalf2(uv);
+				}
+			}, nvertices, 2, GL_HALF_FLOAT);
+		object_pass_input.assignPackedIndex(mesh.packed_indices.data(), mesh.packed_indices.size());
+		object_pass_input.useLods(mesh.lods);
+		object_pass.reset(new RenderPass(-1,
+				object_pass_input,
+				{
+				  vertex_shader,
+				  geometry_shader,
+				  fragment_shader
+				},
+				{ std_model, std_view, std_proj,
+				  std_light,
+				  std_camera, object_alpha,
+				  timeSinceStart
+				},
+				{ "fragment_color" }
+				));
+
+		unsigned uv_buffer = object_pass->getBuffer(2);
+
+		if (options.crowd <= 0) {
+			mesh.releaseCpuData();
+			return ;
+		}
+		glm::vec3 extent = mesh.bounds.max - mesh.bounds.min;
+		float spacing = 1.25f * std::max(extent.x, extent.z);
+		crowd.reset(new Crowd(options.crowd, mesh.skeleton.joints.size(), spacing));
+		RenderDataInput crowd_input;
+		crowd_input.assignInterleavedBuffer(skin_layout, skin->getInputBuffer(0), nvertices);
+		crowd_input.assignBuffer(6, "uv", uv_buffer, nvertices, 2, GL_HALF_FLOAT);
+		crowd_input.assignBuffer(7, "vert", skin->getInputBuffer(7), nvertices, 3, GL_FLOAT);
+		crowd_input.assignPackedIndex(mesh.packed_indices.data(), mesh.packed_indices.size());
+		crowd_input.useLods(mesh.lods);
+		std::function<unsigned()> no_sampler = []() { return 0u; };
+		std::function<unsigned()> palette_data = [&crowd]() { return crowd->getPaletteTexture(); };
+		auto joint_palette = make_texture("joint_palette", no_sampler, 2, palette_data);
+		crowd_pass.reset(new RenderPass(-1,
+				crowd_input,
+				{ crowd_shader.c_str(), geometry_shader, fragment_shader },
+				{ std_model, std_view, std_proj,
+				  std_light, std_camera, object_alpha,
+				  joint_palette
+				},
+				{ "fragment_color" }
+				));
+		crowd_pass->setInstances(crowd->getNInstances());
+
+		if (!options.vat_file.empty()) {
+			vat.load(options.vat_file);
+			if (vat.getNVertices() != (int)nvertices)
+				throw options.vat_file+" was baked from another model";
+			vat.upload();
+			vat.report(std::cerr, crowd->getNInstances());
+		} else if (options.vat_distance > 0.0f) {
+			vat_rebake = true;
+		}
+		if (!vat.empty() || vat_rebake) {
+			vat_distance = options.vat_distance > 0.0f ? options.vat_distance : 4.0f * spacing;
+			RenderDataInput vat_input;
+			vat_input.assignBuffer(0, "uv", uv_buffer, nvertices, 2, GL_HALF_FLOAT);
+			vat_input.assignPackedIndex(mesh.packed_indices.data(), mesh.packed_indices.size());
+			vat_input.useLods(mesh.lods);
+			std::function<unsigned()> vat_positions = [&vat]() { return vat.getPositionTexture(); };
+			std::function<unsigned()> vat_normals = [&vat]() { return vat.getNormalTexture(); };
+			std::function<int()> vat_width = [&vat]() { return vat.getWidth(); };
+			std::function<int()> vat_rows = [&vat]() { return vat.getRows(); };
+			std::function<int()> vat_nframes = [&vat]() { return vat.getNFrames(); };
+			std::function<float()> vat_duration = [&vat]() { return vat.getDuration(); };
+			std::function<glm::vec3()> vat_origin = [&vat]() { return vat.getOrigin(); };
+			std::function<int()> instance_base = [&crowd]() { return int(crowd->getNNear()); };
+			vat_pass.reset(new RenderPass(-1,
+					vat_input,
+					{ vat_vertex_shader, geometry_shader, fragment_shader },
+					{ std_model, std_view, std_proj,
+					  std_light, std_camera, object_alpha,
+					  joint_palette,
+					  make_texture("vat_positions", no_sampler, 3, vat_positions),
+					  make_texture("vat_normals", no_sampler, 4, vat_normals),
+					  make_uniform("vat_width", vat_width),
+					  make_uniform("vat_rows", vat_rows),
+					  make_uniform("vat_nframes", vat_nframes),
+					  make_uniform("vat_duration", vat_duration),
+					  make_uniform("vat_origin", vat_origin),
+					  make_uniform("instance_base", instance_base)
+					},
+					{ "fragment_color" }
+					));
+		}
+		// Baking the GUI pose skins on the CPU
+		if (!vat_rebake)
+			mesh.releaseCpuData();
+	};
+
+	// Adopt the stages the loader published since the last frame and
+	// bring the passes up to date. Passes built after the textures arrived
+	// already have them.
+	auto sync_model = [&]() {
+		if (loader)
+			model_stage = loader->adopt(mesh);
+		if (built_stage == model_stage)
+			return ;
+		if (built_stage < ModelLoader::kGeometry && model_stage >= ModelLoader::kGeometry) {
+			build_model_passes();
+		} else if (model_stage >= ModelLoader::kTextures) {
+			for (auto* pass : { object_pass.get(), crowd_pass.get(), vat_pass.get() })
+				if (pass)
+					pass->updateTextures(mesh.materials);
+		}
+		built_stage = model_stage;
+	};
 
 	// Setup the render pass for drawing bones
 	// FIXME: You won't see the bones until Skeleton::joints were properly
@@ -380,34 +769,19 @@ int main(int argc, char* argv[])
 	float aspect = 0.0f;
 	std::cout << "center = " << mesh.getCenter() << "\n";
 
+	std::vector<BoundingBox> material_bounds;
+	std::vector<uint8_t> material_visible;
+	int culled_materials = 0;
+
 	bool draw_floor = true;
 	bool draw_skeleton = true;
 	bool draw_object = true;
 	bool draw_cylinder = true;
 
-	// init undeformedVertices
-	for (int i = 0; i < mesh.vertices.size(); i++){
-		mesh.undeformedVertices.emplace_back(mesh.vertices[i]);
-	}
-
-	// imgui initalization
-	// Application init: create a dear imgui context, setup some options, load fonts
-     ImGui::CreateContext();
-     ImGuiIO& io = ImGui::GetIO();
-     // TODO: Set optional io.ConfigFlags values, e.g. 'io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard' to enable keyboard controls.
-     // TODO: Fill optional fields of the io structure later.
-     // TODO: Load TTF/OTF fonts if you don't want to use the default font.
-
-     // Initialize helper Platform and Renderer bindings (here we are using imgui_impl_win32.cpp and imgui_impl_dx11.cpp)
-
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
-	const char* glsl_version = "#version 130";
-	ImGui_ImplOpenGL3_Init(glsl_version);
-
-	while (!glfwWindowShouldClose(window)) {
-		// Setup some basic window stuff.
-		glfwGetFramebufferSize(window, &window_width, &window_height);
-		glViewport(0, 0, window_width, window_height);
+	// Draw the scene into the bound framebuffer, shared by the window and
+	// headless rendering.
+	auto draw_scene = [&](int width, int height) {
+		glViewport(0, 0, width, height);
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 		glEnable(GL_DEPTH_TEST);
 		glEnable(GL_MULTISAMPLE);
@@ -426,28 +800,30 @@ int main(int argc, char* argv[])
 		std_model->bind(0);
 #endif
 
-		since_start = ((float)clock() - (float)start_time)/CLOCKS_PER_SEC;
-
 		if (gui.isPoseDirty()) {
-			if (draw_object) {
-				/*
-				for(int i = 0; i < mesh.vertices.size(); ++i){
-					glm::vec4 newVertex = glm::vec4(0,0,0,0);
-					for (int j = 0; j < mesh.skeleton.bones.size(); ++j) {
-						newVertex += mesh.skeleton.meshWeights[j][i] * mesh.skeleton.bones[j].deformedOrientation * mesh.skeleton.bones[j].invRefPose * mesh.undeformedVertices[i];
-					}
-					mesh.vertices[i] = newVertex;
-				}
-				*/
+			{
+				ScopedCpuZone zone("updateAnimation");
+				mesh.updateAnimation();
 			}
-			mesh.updateAnimation();
 			gui.clearPose();
+			skin_dirty = true;
+			vat_dirty = true;
+		}
+
+		// Skin once per pose change; time dependent deformations skin
+		// every frame.
+		int skin_variant = shaderNum & kDeformingShaders;
+		if (skin && ((draw_object && !crowd) || (shaderNum % 8192)/4096 == 1)) {
+			ScopedGpuZone zone("skin");
+			skin->update(skin_dirty, skin_variant, skin_variant != 0);
+			skin_dirty = false;
 		}
 
 		int current_bone = gui.getCurrentBone();
 
-		// Draw bones first.
-		if (draw_skeleton && gui.isTransparent()) {
+		// Draw bones first, they stand in for the model while it loads.
+		if (draw_skeleton && (gui.isTransparent() || !object_pass)) {
+			ScopedGpuZone zone("bones");
 			bone_pass.setup();
 			// Draw our lines.
 			// FIXME: you need setup skeleton.joints properly in
@@ -459,7 +835,7 @@ int main(int argc, char* argv[])
 		draw_cylinder = (current_bone != -1 && gui.isTransparent());
 
 		if (draw_cylinder) {
-
+			ScopedGpuZone zone("cylinder");
 			cylinder_pass.setup();
 			
 			CHECK_GL_ERROR(glDrawElements(GL_LINES,
@@ -468,98 +844,86 @@ int main(int argc, char* argv[])
 		}
 
 		// setup for fur render pass
-		if ((shaderNum % 8192)/4096 == 1 && mesh.materials.size() > 1) {
+		if (skin && (shaderNum % 8192)/4096 == 1 && mesh.materials.size() > 1 && !mesh.faces.empty()) {
+			ScopedCpuZone cpu_zone("fur");
+			ScopedGpuZone gpu_zone("fur");
+			const std::vector<glm::vec4>& skinned_vertices = skin->getPositions();
+			const std::vector<glm::vec4>& skinned_normals = skin->getNormals();
+			const Material& fur_material = mesh.materials[1];
+			size_t max_triangles = (fur_material.nfaces + 4) / 5;
+			if (max_triangles > fur_capacity) {
+				fur_capacity = max_triangles;
+				size_t nverts = triangle_vertices.size();
+				fur_vertices.clear();
+				fur_faces.clear();
+				for (size_t k = 0; k < fur_capacity; k++) {
+					fur_vertices.insert(fur_vertices.end(), triangle_vertices.begin(), triangle_vertices.end());
+					for (const auto& face : triangle_faces)
+						fur_faces.emplace_back(face + glm::uvec3(k * nverts));
+				}
+				fur_pos.assign(fur_vertices.size(), glm::vec4(0.0f));
+				fur_rot.assign(fur_vertices.size(), glm::fquat(1.0f, 0.0f, 0.0f, 0.0f));
+				fur_color.assign(fur_vertices.size(), glm::vec3(0.0f));
+				RenderDataInput fur_pass_input;
+				fur_pass_input.assign(0, "vertex position", fur_vertices.data(), fur_vertices.size(), 4, GL_FLOAT);
+				fur_pass_input.assignIndex(fur_faces.data(), fur_faces.size(), 3);
+				fur_pass_input.assign(3, "color", fur_color.data(), fur_color.size(), 3, GL_FLOAT);
+				fur_pass_input.assign(4, "face_pos", fur_pos.data(), fur_pos.size(), 4, GL_FLOAT);
+				fur_pass_input.assign(5, "face_rot", fur_rot.data(), fur_rot.size(), 4, GL_FLOAT);
+				fur_pass.reset(new RenderPass(-1, fur_pass_input,
+						{ fur_vertex_shader, fur_geometry_shader, fur_fragment_shader},
+						{ std_model, std_view, std_proj, std_light, triRot },
+						{ "fragment_color" }
+						));
+			}
+			fur_pos.clear();
+			fur_rot.clear();
+			fur_color.clear();
+
+			//v + 2.0 * cross(cross(v, q.xyz) - q.w*v, q.xyz) qtransform
+			glm::fquat rot1 = mesh.skeleton.rotationBetweenVectors(glm::vec3(0,0,-1), gui.getCameraDirection());
+			glm::vec3 up = glm::vec3(0,1,0);
+			up = up + 2.0f * glm::cross(glm::cross(up, glm::vec3(rot1[0], rot1[1], rot1[2])) - rot1[3] * up, glm::vec3(rot1[0], rot1[1], rot1[2]));
 			int numtriangles = 0;
-			for(int i = mesh.materials[1].offset; i < (mesh.materials[1].offset + mesh.materials[1].nfaces); i+=5){
+			for(int i = fur_material.offset; i < (fur_material.offset + fur_material.nfaces); i+=5){
 				//int i = 0;
-				glm::vec4 face_normal = mesh.vertex_normals[mesh.faces[i][0]];
-				face_normal += mesh.vertex_normals[mesh.faces[i][1]];
-				face_normal += mesh.vertex_normals[mesh.faces[i][2]];
+				glm::vec4 face_normal = skinned_normals[mesh.faces[i][0]];
+				face_normal += skinned_normals[mesh.faces[i][1]];
+				face_normal += skinned_normals[mesh.faces[i][2]];
 				face_normal = (1.0f/3.0f) * face_normal;
 				glm::vec3 face_normal2 = glm::normalize(glm::vec3(face_normal[0], face_normal[1], face_normal[2]));
 
 				if (glm::dot(glm::normalize(gui.getCameraDirection()), face_normal2) < 0.000000001)
 				{
 					numtriangles++;
-					glm::vec4 pos = mesh.vertices[mesh.faces[i][0]];
-					pos += mesh.vertices[mesh.faces[i][1]];
-					pos += mesh.vertices[mesh.faces[i][2]];
+					glm::vec4 pos = skinned_vertices[mesh.faces[i][0]];
+					pos += skinned_vertices[mesh.faces[i][1]];
+					pos += skinned_vertices[mesh.faces[i][2]];
 					//std::cout<< "pos = " << pos << " averaged " << ((1.0f/3.0f) * pos) << std::endl;
 					pos = (1.0f/3.0f) * pos;
-					glm::vec3 color = glm::vec3(0,0,0);
-					for (const auto& ma : mesh.materials) {
-						//std::cerr << "Use Material from " << ma.offset << " size: " << ma.nfaces << std::endl;
-						if (i >= ma.offset && i < ma.offset + ma.nfaces){
-							color = ma.diffuse;
-							break;
-						}
-					}
-					std::vector<glm::vec4> facePos = std::vector<glm::vec4>();
-					std::vector<glm::fquat> faceRot = std::vector<glm::fquat>();
-					std::vector<glm::vec3> color_data = std::vector<glm::vec3>();
-					
+					glm::fquat rot2 = mesh.skeleton.rotationBetweenVectors(up, face_normal2);
 					for(int j = 0; j < triangle_vertices.size(); ++j){
-						//triangle_vertices[j] += pos;
-						facePos.emplace_back(pos);
-
-						//v + 2.0 * cross(cross(v, q.xyz) - q.w*v, q.xyz) qtransform
-						glm::fquat rot1 = mesh.skeleton.rotationBetweenVectors(glm::vec3(0,0,-1), gui.getCameraDirection());
-						glm::vec3 up = glm::vec3(0,1,0);
-						up = up + 2.0f * glm::cross(glm::cross(up, glm::vec3(rot1[0], rot1[1], rot1[2])) - rot1[3] * up, glm::vec3(rot1[0], rot1[1], rot1[2]));
-						glm::fquat rot2 = mesh.skeleton.rotationBetweenVectors(up, face_normal2);
-						
-						faceRot.emplace_back(rot2);
-						color_data.emplace_back(color);
+						fur_pos.emplace_back(pos);
+						fur_rot.emplace_back(rot2);
+						fur_color.emplace_back(glm::vec3(fur_material.diffuse));
 					}
-
-					
-					//glm::lookAt()
-					RenderDataInput fur_pass_input;
-					fur_pass_input.assign(0, "vertex position", triangle_vertices.data(), triangle_vertices.size(), 4, GL_FLOAT);
-					fur_pass_input.assignIndex(triangle_faces.data(), triangle_faces.size(), 3);
-					fur_pass_input.assign(3, "color", color_data.data(), color_data.size(), 3, GL_FLOAT);
-					fur_pass_input.assign(4, "face_pos", facePos.data(), facePos.size(), 4, GL_FLOAT);
-					fur_pass_input.assign(5, "face_rot", faceRot.data(), faceRot.size(), 4, GL_FLOAT);
-					RenderPass fur_pass(-1, fur_pass_input,
-							{ fur_vertex_shader, fur_geometry_shader, fur_fragment_shader},
-							{ std_model, std_view, std_proj, std_light, triRot },
-							{ "fragment_color" }
-							);
-					
-					fur_pass.setup();
-					/*
-					// outline for fur pass
-					RenderDataInput fur_outline_pass_input;
-					fur_outline_pass_input.assign(0, "vertex position", triangle_vertices.data(), triangle_vertices.size(), 4, GL_FLOAT);
-					fur_outline_pass_input.assignIndex(outline_indicies.data(), outline_indicies.size(), 2);
-					fur_outline_pass_input.assign(3, "color", color_data.data(), color_data.size(), 3, GL_FLOAT);
-					fur_outline_pass_input.assign(4, "face_pos", facePos.data(), facePos.size(), 4, GL_FLOAT);
-					fur_outline_pass_input.assign(5, "face_rot", faceRot.data(), faceRot.size(), 4, GL_FLOAT);
-					RenderPass fur_outline_pass(-1, fur_outline_pass_input,
-							{ fur_vertex_shader, nullptr, bone_fragment_shader},
-							{ std_model, std_view, std_proj, std_light, triRot },
-							{ "fragment_color" }
-							);
-					fur_outline_pass.setup();
-
-					*/
-					
-					
-					CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
-												triangle_faces.size() * 3,
-												GL_UNSIGNED_INT, 0));
-
-					/*CHECK_GL_ERROR(glDrawElements(GL_LINES,
-			                              outline_indicies.size() * 2,
-			                              GL_UNSIGNED_INT, 0));*/
-												
 				}
 			}
+			if (numtriangles > 0) {
+				fur_pass->updateVBO(3, fur_color.data(), fur_color.size());
+				fur_pass->updateVBO(4, fur_pos.data(), fur_pos.size());
+				fur_pass->updateVBO(5, fur_rot.data(), fur_rot.size());
+				fur_pass->setup();
+				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
+				                              numtriangles * triangle_faces.size() * 3,
+				                              GL_UNSIGNED_INT, 0));
+			}
 			//std::cout<<"Num triangles: " << numtriangles << std::endl;
 		}
 
 		// Then draw floor.
 		if (draw_floor) {
+			ScopedGpuZone zone("floor");
 			floor_pass.setup();
 			// Draw our triangles.
 			CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
@@ -567,19 +931,134 @@ int main(int argc, char* argv[])
 			                              GL_UNSIGNED_INT, 0));
 		}
 
-		// Draw the model
-		if (draw_object) {
+		// Draw the crowd instead of the single model
+		if (draw_object && crowd) {
+			if (vat_rebake && vat_dirty) {
+				ScopedCpuZone zone("vat bake");
+				vat.bake(mesh, crowd_sampler, kSwayPeriod, options.vat_frames);
+				vat.upload();
+				vat.report(std::cerr, crowd->getNInstances() - crowd->getNNear());
+				vat_dirty = false;
+			}
+			{
+				ScopedCpuZone cpu_zone("crowd poses");
+				crowd->update(since_start, crowd_sampler, gui.getCamera(), vat_distance);
+			}
+			int lod = mesh.selectLod(gui.getCamera(), kFov);
+			if (crowd->getNNear() > 0) {
+				ScopedGpuZone zone("crowd");
+				crowd_pass->setInstances(crowd->getNNear());
+				crowd_pass->useVariant(shaderNum);
+				crowd_pass->setLod(lod);
+				crowd_pass->setup();
+				crowd_pass->renderAllMaterials();
+			}
+			if (vat_pass && crowd->getNNear() < crowd->getNInstances()) {
+				ScopedGpuZone zone("crowd vat");
+				vat_pass->setInstances(crowd->getNInstances() - crowd->getNNear());
+				// Far instances always use the coarsest level of detail,
+				// whatever the level of the near ones
+				vat_pass->setLod(int(mesh.lods.size()) - 1);
+				vat_pass->setup();
+				vat_pass->renderAllMaterials();
+			}
+		}
 
-			object_pass.setup();
-			int mid = 0;
-			while (object_pass.renderWithMaterial(mid))
-				mid++;
+		// Draw the model
+		if (draw_object && object_pass && !crowd) {
+
+			object_pass->useVariant(shaderNum);
+			object_pass->setLod(mesh.selectLod(gui.getCamera(), kFov));
+			// Bounds are computed from the skinned pose only, effects
+			// that move vertices further disable culling.
+			if (shaderNum & kDeformingShaders) {
+				object_pass->setMaterialVisibility({});
+				culled_materials = 0;
+			} else {
+				ScopedCpuZone zone("culling");
+				Frustum frustum(*mats.projection * *mats.view * *mats.model);
+				mesh.getMaterialBounds(material_bounds);
+				material_visible.resize(material_bounds.size());
+				culled_materials = 0;
+				for (size_t i = 0; i < material_bounds.size(); i++) {
+					material_visible[i] = frustum.intersects(material_bounds[i].min,
+					                                         material_bounds[i].max);
+					if (!material_visible[i])
+						culled_materials++;
+				}
+				object_pass->setMaterialVisibility(material_visible);
+			}
+			ScopedGpuZone zone("object");
+			object_pass->setup();
+			object_pass->renderAllMaterials();
 #if 0
 			// For debugging also
 			if (mid == 0) // Fallback
 				CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mesh.faces.size() * 3, GL_UNSIGNED_INT, 0));
 #endif
 		}
+	};
+
+	if (options.enabled) {
+		shaderNum = options.shader;
+		since_start = options.time;
+		int ret;
+		try {
+			auto upload_start = std::chrono::steady_clock::now();
+			sync_model();
+			CHECK_GL_ERROR(glFinish());
+			bench_times.upload_ms = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - upload_start).count();
+			if (options.bench_frames > 0)
+				ret = renderBenchmark(options, mesh, gui, draw_scene, bench_times);
+			else
+				ret = renderBatch(options, mesh, gui, draw_scene);
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			ret = -1;
+		}
+		GLResourcePool::instance().report(std::cerr);
+		releaseGLCaches();
+		return ret;
+	}
+
+	// imgui initalization
+	// Application init: create a dear imgui context, setup some options, load fonts
+     ImGui::CreateContext();
+     ImGuiIO& io = ImGui::GetIO();
+     // TODO: Set optional io.ConfigFlags values, e.g. 'io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard' to enable keyboard controls.
+     // TODO: Fill optional fields of the io structure later.
+     // TODO: Load TTF/OTF fonts if you don't want to use the default font.
+
+     // Initialize helper Platform and Renderer bindings (here we are using imgui_impl_win32.cpp and imgui_impl_dx11.cpp)
+
+	FrameCapture capture;
+	gui.assignCapture(&capture);
+
+	ImGui_ImplGlfw_InitForOpenGL(window, true);
+	const char* glsl_version = "#version 130";
+	ImGui_ImplOpenGL3_Init(glsl_version);
+
+	Profiler& profiler = Profiler::instance();
+	std::vector<Profiler::ZoneStats> zone_stats;
+
+	int exit_code = EXIT_SUCCESS;
+	while (!glfwWindowShouldClose(window)) {
+		profiler.beginFrame();
+		try {
+			ScopedCpuZone zone("model stages");
+			sync_model();
+		} catch (const std::string& e) {
+			std::cerr << e << std::endl;
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+		// Setup some basic window stuff.
+		glfwGetFramebufferSize(window, &window_width, &window_height);
+		since_start = ((float)clock() - (float)start_time)/CLOCKS_PER_SEC;
+		draw_scene(window_width, window_height);
+		// Capture before the UI is drawn on top
+		capture.capture(window_width, window_height);
 
 		// Feed inputs to dear imgui, start new frame
 		ImGui_ImplOpenGL3_NewFrame();
@@ -630,6 +1109,52 @@ int main(int argc, char* argv[])
 			shaderButton(12, shaderNum);
 		}
 
+		ImGui::Separator();
+		if (loader && built_stage < ModelLoader::kTextures) {
+			static const char* kStageNames[] = { "nothing", "skeleton", "geometry", "textures" };
+			ImGui::Text("Loading the model, %s ready", kStageNames[built_stage]);
+		} else if (loader) {
+			ImGui::Text("Model loaded (ms): skeleton %.0f, geometry %.0f, textures %.0f",
+			            loader->getStageTime(ModelLoader::kSkeleton) * 1000.0,
+			            loader->getStageTime(ModelLoader::kGeometry) * 1000.0,
+			            loader->getStageTime(ModelLoader::kTextures) * 1000.0);
+		}
+		ImGui::Text("Model LOD: %d, culled materials: %d/%zu",
+		            object_pass ? object_pass->getLod() : 0, culled_materials, mesh.materials.size());
+		ImGui::Text("Skin passes: %zu", skin ? skin->getNSkinned() : size_t(0));
+		if (crowd)
+			ImGui::Text("Crowd: %zu instances, %zu from the baked clip",
+			            crowd->getNInstances(), crowd->getNInstances() - crowd->getNNear());
+		if (vat.isUploaded())
+			ImGui::Text("Baked clip: %d frames, %.1f MiB, %.1f KiB per instance per frame",
+			            vat.getNFrames(), vat.getTextureBytes() / 1048576.0,
+			            vat.getNVertices() * vat.getFetchBytes() / 1024.0);
+		ImGui::Text("Captured frames: %zu%s, encoding: %zu",
+		            capture.getNCaptured(), capture.isRecording() ? " (recording)" : "",
+		            capture.getNPendingEncodes());
+		ImGui::Separator();
+		ImGui::Text("Frame time (ms, last / avg / max of %d frames):", Profiler::kHistory);
+		profiler.getStats(zone_stats);
+		for (const auto& zone : zone_stats)
+			ImGui::Text("%s %-16s %6.2f %6.2f %6.2f", zone.gpu ? "GPU" : "CPU",
+			            zone.name.c_str(), zone.last_ms, zone.avg_ms, zone.max_ms);
+		if (ImGui::Button(profiler.isTracing() ? "Save trace" : "Start trace")) {
+			if (profiler.isTracing())
+				profiler.stopTrace("trace.json");
+			else
+				profiler.startTrace();
+		}
+		ImGui::Separator();
+		ImGui::Text("GPU resources (live / pooled):");
+		const auto& gl_pool = GLResourcePool::instance();
+		for (int i = 0; i < kGLNumResourceTypes; i++) {
+			const auto& stats = gl_pool.getStats(GLResourceType(i));
+			ImGui::Text("%s: %zu (%.1f MiB) / %zu (%.1f MiB)",
+			            GLResourcePool::getTypeName(GLResourceType(i)),
+			            stats.live, stats.live_bytes / 1048576.0,
+			            stats.pooled, stats.pooled_bytes / 1048576.0);
+		}
+
     
 
 		// Render dear imgui into screen
@@ -638,17 +1163,25 @@ int main(int argc, char* argv[])
 		//g_pSwapChain->Present(1, 0);
 
 		// Poll and swap.
-		glfwPollEvents();
+		{
+			ScopedCpuZone zone("events");
+			glfwPollEvents();
+		}
 		glfwSwapBuffers(window);
+		profiler.endFrame();
 	}
 
 	// Shutdown
+	loader.reset(); // The worker may still be writing the model cache
+	capture.finish();
+	GLResourcePool::instance().report(std::cerr);
+	releaseGLCaches();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui::DestroyContext();
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
-	exit(EXIT_SUCCESS);
+	exit(exit_code);
 }
 
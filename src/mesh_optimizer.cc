@@ -0,0 +1,192 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+
+float computeACMR(const std::vector<glm::uvec3>& faces,
+                  size_t offset,
+                  size_t nfaces,
+                  int cache_size)
+{
+	if (nfaces == 0)
+		return 0.0f;
+	std::vector<uint32_t> fifo(cache_size, ~0u);
+	size_t head = 0;
+	size_t misses = 0;
+	for (size_t f = offset; f < offset + nfaces; f++) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = faces[f][k];
+			if (std::find(fifo.begin(), fifo.end(), v) != fifo.end())
+				continue;
+			fifo[head] = v;
+			head = (head + 1) % cache_size;
+			misses++;
+		}
+	}
+	return float(misses) / float(nfaces);
+}
+
+namespace {
+	const float kCacheDecayPower = 1.5f;
+	const float kLastTriScore = 0.75f;
+	const float kValenceBoostScale = 2.0f;
+	const float kValenceBoostPower = 0.5f;
+
+	float vertexScore(int cache_position, int remaining)
+	{
+		if (remaining == 0)
+			return -1.0f; // No triangle needs this vertex
+		float score = 0.0f;
+		if (cache_position >= 0) {
+			if (cache_position < 3) {
+				// The last triangle's vertices are penalized a bit so
+				// the algorithm does not keep drawing fans
+				score = kLastTriScore;
+			} else {
+				const float scaler = 1.0f / (kVertexCacheSize - 3);
+				score = 1.0f - (cache_position - 3) * scaler;
+				score = std::pow(score, kCacheDecayPower);
+			}
+		}
+		// Boost vertices with few remaining triangles to finish them off
+		score += kValenceBoostScale * std::pow(float(remaining), -kValenceBoostPower);
+		return score;
+	}
+}
+
+void optimizeVertexCache(std::vector<glm::uvec3>& faces,
+                         size_t offset,
+                         size_t nfaces)
+{
+	if (nfaces < 2)
+		return ;
+	// Number the vertices of the range from 0 so the per-vertex arrays
+	// only cover them
+	std::vector<uint32_t> vertices;
+	vertices.reserve(nfaces * 3);
+	for (size_t f = 0; f < nfaces; f++)
+		for (int k = 0; k < 3; k++)
+			vertices.emplace_back(faces[offset + f][k]);
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+	size_t nvertices = vertices.size();
+	std::vector<glm::uvec3> local(nfaces);
+	for (size_t f = 0; f < nfaces; f++)
+		for (int k = 0; k < 3; k++)
+			local[f][k] = uint32_t(std::lower_bound(vertices.begin(), vertices.end(),
+			                                        faces[offset + f][k]) - vertices.begin());
+
+	// Vertex -> triangles adjacency in CSR form, local to the range
+	std::vector<uint32_t> first(nvertices + 1, 0);
+	for (size_t f = 0; f < nfaces; f++)
+		for (int k = 0; k < 3; k++)
+			first[local[f][k] + 1]++;
+	for (size_t v = 0; v < nvertices; v++)
+		first[v + 1] += first[v];
+	std::vector<uint32_t> adjacency(first[nvertices]);
+	std::vector<uint32_t> fill(first.begin(), first.end() - 1);
+	for (size_t f = 0; f < nfaces; f++)
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[local[f][k]]++] = uint32_t(f);
+
+	std::vector<int> remaining(nvertices, 0);
+	std::vector<int> cache_position(nvertices, -1);
+	std::vector<float> score(nvertices, 0.0f);
+	for (size_t v = 0; v < nvertices; v++) {
+		remaining[v] = int(first[v + 1] - first[v]);
+		score[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> tri_score(nfaces);
+	std::vector<bool> emitted(nfaces, false);
+	for (size_t f = 0; f < nfaces; f++) {
+		const auto& tri = local[f];
+		tri_score[f] = score[tri[0]] + score[tri[1]] + score[tri[2]];
+	}
+
+	std::vector<glm::uvec3> out;
+	out.reserve(nfaces);
+	std::vector<uint32_t> cache, next_cache;
+	size_t scan = 0; // Fallback scan position when the cache has no candidates
+	long best = -1;
+	while (out.size() < nfaces) {
+		if (best < 0) {
+			// Pick the best triangle over all remaining ones. This only
+			// happens when the cache runs dry, e.g. between disconnected
+			// pieces, so a linear scan stays cheap in practice.
+			float best_score = -1.0f;
+			for (size_t f = scan; f < nfaces; f++) {
+				if (emitted[f])
+					continue;
+				if (best < 0)
+					scan = f;
+				if (tri_score[f] > best_score) {
+					best_score = tri_score[f];
+					best = long(f);
+				}
+			}
+		}
+		const glm::uvec3 tri = local[best];
+		out.emplace_back(glm::uvec3(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]));
+		emitted[best] = true;
+
+		// New LRU cache: triangle vertices first, then the old content
+		next_cache.assign(&tri[0], &tri[0] + 3);
+		for (uint32_t v : cache)
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				next_cache.emplace_back(v);
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = tri[k];
+			remaining[v]--;
+			// Remove the triangle from the adjacency of v
+			for (uint32_t i = first[v]; i < first[v] + remaining[v] + 1; i++) {
+				if (adjacency[i] == uint32_t(best)) {
+					std::swap(adjacency[i], adjacency[first[v] + remaining[v]]);
+					break;
+				}
+			}
+		}
+		for (size_t i = 0; i < next_cache.size(); i++) {
+			uint32_t v = next_cache[i];
+			cache_position[v] = i < size_t(kVertexCacheSize) ? int(i) : -1;
+		}
+		for (uint32_t v : next_cache)
+			score[v] = vertexScore(cache_position[v], remaining[v]);
+		if (next_cache.size() > size_t(kVertexCacheSize))
+			next_cache.resize(kVertexCacheSize);
+		cache.swap(next_cache);
+
+		// Only triangles touching the cache changed their score
+		best = -1;
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t i = first[v]; i < first[v] + remaining[v]; i++) {
+				uint32_t f = adjacency[i];
+				const auto& t = local[f];
+				tri_score[f] = score[t[0]] + score[t[1]] + score[t[2]];
+				if (tri_score[f] > best_score) {
+					best_score = tri_score[f];
+					best = long(f);
+				}
+			}
+		}
+	}
+	std::copy(out.begin(), out.end(), faces.begin() + offset);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(std::vector<glm::uvec3>& faces,
+                                          size_t nvertices)
+{
+	std::vector<uint32_t> remap(nvertices, ~0u);
+	uint32_t next = 0;
+	for (auto& tri : faces) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t& v = remap[tri[k]];
+			if (v == ~0u)
+				v = next++;
+			tri[k] = v;
+		}
+	}
+	for (auto& v : remap)
+		if (v == ~0u)
+			v = next++;
+	return remap;
+}
@@ -0,0 +1,62 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+/*
+ * Load-time mesh optimization.
+ *
+ * Triangles are reordered inside ranges only, so material ranges
+ * (Material::offset and Material::nfaces) remain valid.
+ */
+
+/* Size of the simulated post-transform cache */
+const int kVertexCacheSize = 32;
+
+/*
+ * computeACMR: average cache miss ratio (transformed vertices per
+ * triangle) of faces [offset, offset + nfaces) with a FIFO cache.
+ * 0.5 is the optimum for a regular grid, 3 is the worst case.
+ */
+float computeACMR(const std::vector<glm::uvec3>& faces,
+                  size_t offset,
+                  size_t nfaces,
+                  int cache_size = kVertexCacheSize);
+
+/*
+ * optimizeVertexCache: reorder faces [offset, offset + nfaces) for
+ * post-transform cache locality, with Tom Forsyth's linear-speed
+ * algorithm. Per-vertex state covers only the vertices of the range.
+ */
+void optimizeVertexCache(std::vector<glm::uvec3>& faces,
+                         size_t offset,
+                         size_t nfaces);
+
+/*
+ * optimizeVertexFetch: renumber vertices in the order they are first
+ * referenced by faces, and rewrite faces accordingly.
+ * Return: remap table, new index = remap[old index]. Unreferenced vertices
+ * are moved to the end.
+ */
+std::vector<uint32_t> optimizeVertexFetch(std::vector<glm::uvec3>& faces,
+                                          size_t nvertices);
+
+/*
+ * remapVertices: apply the table from optimizeVertexFetch to a per-vertex
+ * array.
+ */
+template<typename T>
+void remapVertices(std::vector<T>& data, const std::vector<uint32_t>& remap)
+{
+	if (data.size() != remap.size())
+		return ;
+	std::vector<T> ret(data.size());
+	for (size_t i = 0; i < data.size(); i++)
+		ret[remap[i]] = data[i];
+	data.swap(ret);
+}
+
+#endif
@@ -0,0 +1,304 @@
+#include "mesh_simplify.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+	// Maximal difference of w0 for vertices to be merged
+	const float kMaxWeightDifference = 0.2f;
+	// Minimal cosine between a triangle normal before and after a collapse
+	const double kMinNormalCosine = 0.2;
+
+	/*
+	 * Quadric: symmetric 4x4 matrix stored as its upper triangle
+	 */
+	struct Quadric {
+		double a[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+		void addPlane(double nx, double ny, double nz, double d, double w)
+		{
+			a[0] += w * nx * nx; a[1] += w * nx * ny; a[2] += w * nx * nz; a[3] += w * nx * d;
+			a[4] += w * ny * ny; a[5] += w * ny * nz; a[6] += w * ny * d;
+			a[7] += w * nz * nz; a[8] += w * nz * d;
+			a[9] += w * d * d;
+		}
+		Quadric& operator+=(const Quadric& q)
+		{
+			for (int i = 0; i < 10; i++)
+				a[i] += q.a[i];
+			return *this;
+		}
+		double evaluate(double x, double y, double z) const
+		{
+			return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+			     + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+			     + a[7] * z * z + 2 * a[8] * z
+			     + a[9];
+		}
+	};
+
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t from_stamp, to_stamp;
+		bool operator<(const Collapse& other) const { return cost > other.cost; } // min-heap
+	};
+
+	uint64_t edgeKey(uint32_t a, uint32_t b)
+	{
+		if (a > b)
+			std::swap(a, b);
+		return (uint64_t(a) << 32) | b;
+	}
+
+	void triangleNormal(const std::vector<glm::vec4>& pos,
+	                    uint32_t i0, uint32_t i1, uint32_t i2,
+	                    double n[3])
+	{
+		double e1[3], e2[3];
+		for (int k = 0; k < 3; k++) {
+			e1[k] = double(pos[i1][k]) - double(pos[i0][k]);
+			e2[k] = double(pos[i2][k]) - double(pos[i0][k]);
+		}
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	/* getWeight: the weight of joint j in the influences of vertex v, 0 if none */
+	float getWeight(const SimplifyVertexData& data, uint32_t v, int j)
+	{
+		for (int k = 0; k < 4; k++)
+			if (data.joints[v][k] == j)
+				return data.weights[v][k];
+		return 0.0f;
+	}
+
+	/* isSkinCompatible: u and v have the same weighted joints, all with similar weights */
+	bool isSkinCompatible(const SimplifyVertexData& data, uint32_t u, uint32_t v)
+	{
+		for (uint32_t a : { u, v }) {
+			uint32_t b = a == u ? v : u;
+			for (int k = 0; k < 4; k++) {
+				int j = data.joints[a][k];
+				float w = data.weights[a][k];
+				if (j < 0 || w == 0.0f)
+					continue;
+				float other = getWeight(data, b, j);
+				if (other == 0.0f || std::abs(w - other) > kMaxWeightDifference)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+	 * simplifyLocal: simplifyMesh on faces whose indices are 0 .. size of
+	 * the vertex data, so the scratch arrays only cover these vertices.
+	 */
+	std::vector<glm::uvec3> simplifyLocal(const std::vector<glm::uvec3>& faces,
+	                                      size_t target_faces,
+	                                      const SimplifyVertexData& data)
+	{
+		const auto& pos = data.positions;
+		size_t nvertices = pos.size();
+
+		std::vector<glm::uvec3> tris(faces);
+		std::vector<uint8_t> tri_alive(tris.size(), 1);
+		std::vector<std::vector<uint32_t>> vtris(nvertices);
+		std::vector<Quadric> quadrics(nvertices);
+		std::vector<uint8_t> locked(nvertices, 0);
+		std::vector<uint8_t> removed(nvertices, 0);
+		std::vector<uint32_t> stamp(nvertices, 0);
+
+		// Count triangles per edge to find open edges
+		std::unordered_map<uint64_t, int> edge_count;
+		for (size_t t = 0; t < tris.size(); t++) {
+			const auto& tri = tris[t];
+			for (int k = 0; k < 3; k++) {
+				vtris[tri[k]].emplace_back(uint32_t(t));
+				edge_count[edgeKey(tri[k], tri[(k + 1) % 3])]++;
+			}
+			double n[3];
+			triangleNormal(pos, tri[0], tri[1], tri[2], n);
+			double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (len == 0.0)
+				continue;
+			double area = 0.5 * len;
+			n[0] /= len; n[1] /= len; n[2] /= len;
+			double d = -(n[0] * pos[tri[0]].x + n[1] * pos[tri[0]].y + n[2] * pos[tri[0]].z);
+			for (int k = 0; k < 3; k++)
+				quadrics[tri[k]].addPlane(n[0], n[1], n[2], d, area);
+		}
+		for (const auto& edge : edge_count) {
+			if (edge.second == 1) {
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xFFFFFFFFu] = 1;
+			}
+		}
+		for (size_t v = 0; v < nvertices; v++)
+			if (v < data.locked.size() && data.locked[v])
+				locked[v] = 1;
+
+		std::priority_queue<Collapse> heap;
+		auto push = [&](uint32_t from, uint32_t to) {
+			if (locked[from] || !isSkinCompatible(data, from, to))
+				return;
+			Quadric q = quadrics[from];
+			q += quadrics[to];
+			double cost = q.evaluate(pos[to].x, pos[to].y, pos[to].z);
+			heap.push({cost, from, to, stamp[from], stamp[to]});
+		};
+		for (const auto& edge : edge_count) {
+			uint32_t a = uint32_t(edge.first >> 32), b = uint32_t(edge.first & 0xFFFFFFFFu);
+			push(a, b);
+			push(b, a);
+		}
+
+		size_t nalive = tris.size();
+		std::vector<uint32_t> neighbors_u, neighbors_v;
+		auto collectNeighbors = [&](uint32_t v, std::vector<uint32_t>& out) {
+			out.clear();
+			for (uint32_t t : vtris[v]) {
+				if (!tri_alive[t])
+					continue;
+				for (int k = 0; k < 3; k++)
+					if (tris[t][k] != v)
+						out.emplace_back(tris[t][k]);
+			}
+			std::sort(out.begin(), out.end());
+			out.erase(std::unique(out.begin(), out.end()), out.end());
+		};
+
+		while (nalive > target_faces && !heap.empty()) {
+			Collapse c = heap.top();
+			heap.pop();
+			uint32_t u = c.from, v = c.to;
+			if (removed[u] || removed[v] || stamp[u] != c.from_stamp || stamp[v] != c.to_stamp)
+				continue;
+
+			// Link condition: u and v may only share the neighbors opposite
+			// to their common triangles, otherwise the collapse would create
+			// non-manifold geometry.
+			collectNeighbors(u, neighbors_u);
+			collectNeighbors(v, neighbors_v);
+			if (!std::binary_search(neighbors_u.begin(), neighbors_u.end(), v))
+				continue;
+			size_t nshared_tris = 0;
+			for (uint32_t t : vtris[u]) {
+				if (!tri_alive[t])
+					continue;
+				const auto& tri = tris[t];
+				if (tri[0] == v || tri[1] == v || tri[2] == v)
+					nshared_tris++;
+			}
+			std::vector<uint32_t> common;
+			std::set_intersection(neighbors_u.begin(), neighbors_u.end(),
+			                      neighbors_v.begin(), neighbors_v.end(),
+			                      std::back_inserter(common));
+			if (common.size() != nshared_tris)
+				continue;
+
+			// Reject collapses that flip or degenerate a remaining triangle
+			bool flips = false;
+			for (uint32_t t : vtris[u]) {
+				if (!tri_alive[t])
+					continue;
+				glm::uvec3 tri = tris[t];
+				if (tri[0] == v || tri[1] == v || tri[2] == v)
+					continue;
+				double before[3], after[3];
+				triangleNormal(pos, tri[0], tri[1], tri[2], before);
+				for (int k = 0; k < 3; k++)
+					if (tri[k] == u)
+						tri[k] = v;
+				triangleNormal(pos, tri[0], tri[1], tri[2], after);
+				double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+				double lb = std::sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+				double la = std::sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+				if (la == 0.0 || dot < kMinNormalCosine * lb * la) {
+					flips = true;
+					break;
+				}
+			}
+			if (flips)
+				continue;
+
+			for (uint32_t t : vtris[u]) {
+				if (!tri_alive[t])
+					continue;
+				auto& tri = tris[t];
+				if (tri[0] == v || tri[1] == v || tri[2] == v) {
+					tri_alive[t] = 0;
+					nalive--;
+					continue;
+				}
+				for (int k = 0; k < 3; k++)
+					if (tri[k] == u)
+						tri[k] = v;
+				vtris[v].emplace_back(t);
+			}
+			vtris[u].clear();
+			removed[u] = 1;
+			quadrics[v] += quadrics[u];
+			stamp[v]++;
+
+			collectNeighbors(v, neighbors_v);
+			for (uint32_t n : neighbors_v) {
+				push(n, v);
+				push(v, n);
+			}
+		}
+
+		std::vector<glm::uvec3> ret;
+		ret.reserve(nalive);
+		for (size_t t = 0; t < tris.size(); t++)
+			if (tri_alive[t])
+				ret.emplace_back(tris[t]);
+		return ret;
+	}
+}
+
+std::vector<glm::uvec3> simplifyMesh(const std::vector<glm::uvec3>& faces,
+                                     size_t target_faces,
+                                     const SimplifyVertexData& data)
+{
+	if (faces.size() <= target_faces)
+		return faces;
+
+	// The vertices of faces, numbered from 0
+	std::vector<uint32_t> vertices;
+	vertices.reserve(faces.size() * 3);
+	for (const auto& tri : faces)
+		for (int k = 0; k < 3; k++)
+			vertices.emplace_back(tri[k]);
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+	auto toLocal = [&vertices](uint32_t v) {
+		return uint32_t(std::lower_bound(vertices.begin(), vertices.end(), v) - vertices.begin());
+	};
+
+	size_t nlocal = vertices.size();
+	std::vector<glm::vec4> positions(nlocal);
+	std::vector<glm::ivec4> joints(nlocal);
+	std::vector<glm::vec4> weights(nlocal);
+	std::vector<uint8_t> locked(nlocal, 0);
+	for (size_t i = 0; i < nlocal; i++) {
+		uint32_t v = vertices[i];
+		positions[i] = data.positions[v];
+		joints[i] = data.joints[v];
+		weights[i] = data.weights[v];
+		if (v < data.locked.size())
+			locked[i] = data.locked[v];
+	}
+	std::vector<glm::uvec3> local_faces(faces.size());
+	for (size_t f = 0; f < faces.size(); f++)
+		local_faces[f] = glm::uvec3(toLocal(faces[f][0]), toLocal(faces[f][1]), toLocal(faces[f][2]));
+
+	SimplifyVertexData local { positions, joints, weights, locked };
+	std::vector<glm::uvec3> ret = simplifyLocal(local_faces, target_faces, local);
+	for (auto& tri : ret)
+		tri = glm::uvec3(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+	return ret;
+}
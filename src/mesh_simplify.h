@@ -0,0 +1,45 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+/*
+ * SimplifyVertexData: per-vertex data that constrains the simplification.
+ *      joints, weights: up to four influences (Mesh::getInfluences),
+ *                       unused joints are -1
+ *      locked: non-zero if the vertex must be kept, e.g. vertices shared
+ *              between materials
+ */
+struct SimplifyVertexData {
+	const std::vector<glm::vec4>& positions;
+	const std::vector<glm::ivec4>& joints;
+	const std::vector<glm::vec4>& weights;
+	const std::vector<uint8_t>& locked;
+};
+
+/*
+ * simplifyMesh: reduce faces to about target_faces triangles with
+ * quadric error metrics (Garland and Heckbert).
+ *
+ * Only half-edge collapses are performed (a vertex is merged into one of
+ * its neighbors), so the result indexes the original vertex buffers and
+ * every level of detail can share them. Scratch memory covers only the
+ * vertices referenced by faces, not the whole vertex buffer.
+ *
+ * The following vertices are never removed:
+ *      - vertices on open edges, which include UV seams since PMD splits
+ *        seam vertices, and material borders since each material is
+ *        simplified on its own
+ *      - vertices marked in data.locked
+ * A vertex is only merged into a neighbor with the same skin binding
+ * (the same set of weighted joints, each with a similar weight), and collapses that flip a triangle are
+ * rejected.
+ */
+std::vector<glm::uvec3> simplifyMesh(const std::vector<glm::uvec3>& faces,
+                                     size_t target_faces,
+                                     const SimplifyVertexData& data);
+
+#endif
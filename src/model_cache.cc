@@ -0,0 +1,648 @@
+#include "model_cache.h"
+#include "bone_geometry.h"
+#include "config.h"
+#include <hash.h>
+#include <mapped_file.h>
+#include <pixel_convert.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace {
+	const uint32_t kCacheMagic = 0x434d4b53; // "SKMC"
+	const size_t kSectionAlignment = 16;
+
+	enum CacheSection {
+		kVertices,
+		kNormals,
+		kUVs,
+		kFaces,
+		kLodFaces,
+		kPackedIndices,
+		kJoint0,
+		kJoint1,
+		kWeights,
+		kFromJoint0,
+		kFromJoint1,
+		kJoint2,            // Four joint meshes only, like the next three
+		kJoint3,
+		kWeights1,
+		kWeights2,
+		kWeights3,
+		kJointPositions,
+		kJointParents,
+		kMaterials,         // nlods x nmaterials MaterialRecord
+		kBounds,            // min, max
+		kJointBounds,       // min, max per joint
+		kMaterialJointCounts,
+		kMaterialJoints,
+		kTextures,          // TextureRecord
+		kTexels,            // RGBA of every texture
+		kStrings,           // texture paths
+		kJointNames,        // UTF-8, each terminated by NUL
+		kNumSections
+	};
+
+	struct SectionEntry {
+		uint64_t offset;
+		uint64_t bytes;
+	};
+
+	struct CacheHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t source_size;
+		int64_t source_mtime;
+		uint64_t source_hash;
+		uint32_t nlods;
+		uint32_t nmaterials;
+		SectionEntry sections[kNumSections];
+	};
+
+	struct MaterialRecord {
+		glm::vec4 diffuse, ambient, specular;
+		float shininess;
+		int32_t texture;        // index in kTextures, -1: none
+		uint64_t offset;
+		uint64_t nfaces;
+		uint64_t index_offset;
+		int32_t base_vertex;
+		int32_t short_indices;
+	};
+
+	struct TextureRecord {
+		int32_t width;
+		int32_t height;
+		uint64_t texel_offset;  // in kTexels
+		uint32_t path_offset;   // in kStrings
+		uint32_t path_length;
+		uint64_t file_size;     // of the image file, for validation
+		int64_t file_mtime;
+	};
+
+	bool statFile(const std::string& fn, uint64_t& size, int64_t& mtime)
+	{
+		struct stat st;
+		if (stat(fn.c_str(), &st) != 0)
+			return false;
+		size = uint64_t(st.st_size);
+		mtime = int64_t(st.st_mtime);
+		return true;
+	}
+
+	uint64_t hashFile(const std::string& fn)
+	{
+		MappedFile file(fn);
+		return HashBytes(file.data(), file.size());
+	}
+
+	void makeDirectory(const std::string& dir)
+	{
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0755);
+#endif
+	}
+
+	class SectionWriter {
+	public:
+		SectionWriter() : data_(sizeof(CacheHeader), 0) {}
+
+		template<typename T>
+		void add(CacheSection id, const T* values, size_t count)
+		{
+			data_.resize((data_.size() + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment, 0);
+			header_.sections[id].offset = data_.size();
+			header_.sections[id].bytes = count * sizeof(T);
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(values);
+			data_.insert(data_.end(), bytes, bytes + count * sizeof(T));
+		}
+		template<typename T>
+		void add(CacheSection id, const std::vector<T>& values)
+		{
+			add(id, values.data(), values.size());
+		}
+
+		CacheHeader& getHeader() { return header_; }
+		const std::vector<uint8_t>& finish()
+		{
+			memcpy(data_.data(), &header_, sizeof(header_));
+			return data_;
+		}
+	private:
+		CacheHeader header_ = {};
+		std::vector<uint8_t> data_;
+	};
+
+	class SectionReader {
+	public:
+		SectionReader(const MappedFile& file, const CacheHeader& header)
+			: file_(file), header_(header)
+		{
+		}
+
+		template<typename T>
+		void get(CacheSection id, std::vector<T>& out) const
+		{
+			const SectionEntry& s = header_.sections[id];
+			if (s.offset > file_.size() || s.bytes > file_.size() - s.offset ||
+			    s.bytes % sizeof(T) != 0)
+				throw std::runtime_error("section " + std::to_string(id) + " is out of bounds");
+			out.resize(s.bytes / sizeof(T));
+			if (s.bytes > 0)
+				memcpy(out.data(), file_.data() + s.offset, s.bytes);
+		}
+	private:
+		const MappedFile& file_;
+		const CacheHeader& header_;
+	};
+
+	template<typename T>
+	void checkSize(const std::vector<T>& v, size_t n, const char* name)
+	{
+		if (v.size() != n)
+			throw std::runtime_error(std::string(name) + " has " + std::to_string(v.size()) +
+			                         " entries, expected " + std::to_string(n));
+	}
+
+	/*
+	 * The packed indices of r must lie in packed and, offset by its base
+	 * vertex, address vertices that exist. r.nfaces is already bounded by
+	 * the face count.
+	 */
+	void checkPackedIndices(const MaterialRecord& r, const std::vector<uint8_t>& packed,
+	                        size_t nvertices)
+	{
+		size_t index_size = r.short_indices ? 2 : 4;
+		uint64_t nindices = r.nfaces * 3;
+		if (r.index_offset % index_size != 0 || r.index_offset > packed.size() ||
+		    nindices * index_size > packed.size() - r.index_offset)
+			throw std::runtime_error("material indices out of bounds");
+		if (r.base_vertex < 0 || (nindices > 0 && size_t(r.base_vertex) >= nvertices))
+			throw std::runtime_error("material base vertex out of range");
+		const uint8_t* p = packed.data() + r.index_offset;
+		size_t limit = nvertices - r.base_vertex;
+		for (uint64_t i = 0; i < nindices; i++, p += index_size) {
+			uint32_t index;
+			if (r.short_indices) {
+				uint16_t short_index;
+				memcpy(&short_index, p, 2);
+				index = short_index;
+			} else {
+				memcpy(&index, p, 4);
+			}
+			if (index >= limit)
+				throw std::runtime_error("material index out of range");
+		}
+	}
+
+	/*
+	 * Add the sections that do not depend on textures: vertices, indices,
+	 * weights, skeleton, bounds and the joints of each material.
+	 */
+	void addGeometry(SectionWriter& writer, const Mesh& mesh)
+	{
+		writer.add(kVertices, mesh.vertices);
+		writer.add(kNormals, mesh.vertex_normals);
+		writer.add(kUVs, mesh.uv_coordinates);
+		writer.add(kFaces, mesh.faces);
+		writer.add(kLodFaces, mesh.lod_faces);
+		writer.add(kPackedIndices, mesh.packed_indices);
+		writer.add(kJoint0, mesh.joint0);
+		writer.add(kJoint1, mesh.joint1);
+		writer.add(kWeights, mesh.weight_for_joint0);
+		writer.add(kFromJoint0, mesh.vector_from_joint0);
+		writer.add(kFromJoint1, mesh.vector_from_joint1);
+		writer.add(kJoint2, mesh.joint2);
+		writer.add(kJoint3, mesh.joint3);
+		writer.add(kWeights1, mesh.weight_for_joint1);
+		writer.add(kWeights2, mesh.weight_for_joint2);
+		writer.add(kWeights3, mesh.weight_for_joint3);
+
+		std::vector<glm::vec3> joint_positions;
+		std::vector<int32_t> joint_parents;
+		std::vector<char> joint_names;
+		NameTable& name_table = NameTable::instance();
+		for (const auto& joint : mesh.skeleton.joints) {
+			joint_positions.emplace_back(joint.init_position);
+			joint_parents.emplace_back(joint.parent_index);
+			const std::string& name = name_table.getName(joint.name_id);
+			joint_names.insert(joint_names.end(), name.begin(), name.end());
+			joint_names.emplace_back('\0');
+		}
+		writer.add(kJointPositions, joint_positions);
+		writer.add(kJointParents, joint_parents);
+		writer.add(kJointNames, joint_names);
+
+		std::vector<glm::vec3> bounds = { mesh.bounds.min, mesh.bounds.max };
+		std::vector<glm::vec3> joint_bounds;
+		for (const auto& box : mesh.joint_bounds) {
+			joint_bounds.emplace_back(box.min);
+			joint_bounds.emplace_back(box.max);
+		}
+		writer.add(kBounds, bounds);
+		writer.add(kJointBounds, joint_bounds);
+
+		std::vector<uint32_t> counts;
+		std::vector<int32_t> material_joints;
+		for (const auto& joints : mesh.material_joints) {
+			counts.emplace_back(joints.size());
+			material_joints.insert(material_joints.end(), joints.begin(), joints.end());
+		}
+		writer.add(kMaterialJointCounts, counts);
+		writer.add(kMaterialJoints, material_joints);
+	}
+}
+
+/* Sections serialized by beginSave, finished by save */
+struct ModelCache::PendingSave {
+	SectionWriter writer;
+};
+
+const uint32_t ModelCache::kModelCacheVersion;
+
+ModelCache::ModelCache()
+{
+	const char* dir = getenv("SKINNING_MODEL_CACHE");
+	dir_ = dir ? dir : "model_cache";
+}
+
+ModelCache::~ModelCache()
+{
+}
+
+std::string ModelCache::getPath(const std::string& model_fn) const
+{
+	std::ostringstream ss;
+	ss << dir_ << "/" << std::hex << std::setw(16) << std::setfill('0')
+	   << HashString(model_fn) << ".model";
+	return ss.str();
+}
+
+bool ModelCache::load(const std::string& model_fn, Mesh& mesh)
+{
+	typedef std::chrono::steady_clock Clock;
+	auto start = Clock::now();
+	std::string path = getPath(model_fn);
+	uint64_t source_size, cache_size;
+	int64_t source_mtime, cache_mtime;
+	if (!statFile(path, cache_size, cache_mtime) ||
+	    !statFile(model_fn, source_size, source_mtime))
+		return false;
+
+	bool touched = false; // same content, new mtime
+	try {
+		MappedFile file(path);
+		CacheHeader header;
+		if (file.size() < sizeof(header))
+			throw std::runtime_error("truncated header");
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != kCacheMagic || header.version != kModelCacheVersion) {
+			std::cerr << __func__ << ": " << path << " has another format, rebuilding" << std::endl;
+			return false;
+		}
+		if (header.source_size != source_size) {
+			std::cerr << __func__ << ": " << model_fn << " changed, rebuilding the cache" << std::endl;
+			return false;
+		}
+		if (header.source_mtime != source_mtime) {
+			if (hashFile(model_fn) != header.source_hash) {
+				std::cerr << __func__ << ": " << model_fn << " changed, rebuilding the cache" << std::endl;
+				return false;
+			}
+			touched = true;
+		}
+
+		SectionReader reader(file, header);
+		std::vector<TextureRecord> textures;
+		std::vector<char> strings;
+		reader.get(kTextures, textures);
+		reader.get(kStrings, strings);
+		std::vector<std::string> texture_paths;
+		for (const auto& tex : textures) {
+			if (uint64_t(tex.path_offset) + tex.path_length > strings.size())
+				throw std::runtime_error("texture path out of bounds");
+			texture_paths.emplace_back(strings.data() + tex.path_offset, tex.path_length);
+			uint64_t size;
+			int64_t mtime;
+			if (!statFile(texture_paths.back(), size, mtime) ||
+			    size != tex.file_size || mtime != tex.file_mtime) {
+				std::cerr << __func__ << ": texture " << texture_paths.back()
+				          << " changed, rebuilding the cache" << std::endl;
+				return false;
+			}
+		}
+
+		Mesh loaded;
+		reader.get(kVertices, loaded.vertices);
+		size_t nvertices = loaded.vertices.size();
+		reader.get(kNormals, loaded.vertex_normals);
+		reader.get(kUVs, loaded.uv_coordinates);
+		reader.get(kFaces, loaded.faces);
+		reader.get(kLodFaces, loaded.lod_faces);
+		reader.get(kPackedIndices, loaded.packed_indices);
+		reader.get(kJoint0, loaded.joint0);
+		reader.get(kJoint1, loaded.joint1);
+		reader.get(kWeights, loaded.weight_for_joint0);
+		reader.get(kFromJoint0, loaded.vector_from_joint0);
+		reader.get(kFromJoint1, loaded.vector_from_joint1);
+		reader.get(kJoint2, loaded.joint2);
+		reader.get(kJoint3, loaded.joint3);
+		reader.get(kWeights1, loaded.weight_for_joint1);
+		reader.get(kWeights2, loaded.weight_for_joint2);
+		reader.get(kWeights3, loaded.weight_for_joint3);
+		checkSize(loaded.vertex_normals, nvertices, "normals");
+		checkSize(loaded.uv_coordinates, nvertices, "uv");
+		checkSize(loaded.joint0, nvertices, "joint0");
+		checkSize(loaded.joint1, nvertices, "joint1");
+		checkSize(loaded.weight_for_joint0, nvertices, "weights");
+		checkSize(loaded.vector_from_joint0, nvertices, "vector_from_joint0");
+		checkSize(loaded.vector_from_joint1, nvertices, "vector_from_joint1");
+		if (loaded.hasFourJoints()) {
+			checkSize(loaded.joint2, nvertices, "joint2");
+			checkSize(loaded.joint3, nvertices, "joint3");
+			checkSize(loaded.weight_for_joint1, nvertices, "weights1");
+			checkSize(loaded.weight_for_joint2, nvertices, "weights2");
+			checkSize(loaded.weight_for_joint3, nvertices, "weights3");
+		}
+		for (const auto& face : loaded.faces)
+			if (face[0] >= nvertices || face[1] >= nvertices || face[2] >= nvertices)
+				throw std::runtime_error("face index out of range");
+		for (const auto& face : loaded.lod_faces)
+			if (face[0] >= nvertices || face[1] >= nvertices || face[2] >= nvertices)
+				throw std::runtime_error("LOD face index out of range");
+
+		std::vector<glm::vec3> joint_positions;
+		std::vector<int32_t> joint_parents;
+		std::vector<char> joint_name_chars;
+		reader.get(kJointPositions, joint_positions);
+		reader.get(kJointParents, joint_parents);
+		reader.get(kJointNames, joint_name_chars);
+		size_t njoints = joint_positions.size();
+		checkSize(joint_parents, njoints, "joint parents");
+		if (njoints > size_t(kMaxBones))
+			throw std::runtime_error("more joints than the shaders support");
+		std::vector<std::string> joint_names;
+		for (size_t begin = 0; begin < joint_name_chars.size(); ) {
+			auto end = std::find(joint_name_chars.begin() + begin, joint_name_chars.end(), '\0');
+			if (end == joint_name_chars.end())
+				throw std::runtime_error("unterminated joint name");
+			joint_names.emplace_back(joint_name_chars.data() + begin);
+			begin = end - joint_name_chars.begin() + 1;
+		}
+		checkSize(joint_names, njoints, "joint names");
+		for (size_t j = 0; j < njoints; j++)
+			if (joint_parents[j] >= int(j))
+				throw std::runtime_error("joint parent out of order");
+		for (size_t i = 0; i < nvertices; i++)
+			if (loaded.joint0[i] < 0 || loaded.joint0[i] >= int(njoints) ||
+			    loaded.joint1[i] >= int(njoints))
+				throw std::runtime_error("joint index out of range");
+		for (size_t i = 0; i < loaded.joint2.size(); i++)
+			if (loaded.joint2[i] >= int(njoints) || loaded.joint3[i] >= int(njoints))
+				throw std::runtime_error("joint index out of range");
+
+		std::vector<glm::vec3> bounds, joint_bounds;
+		reader.get(kBounds, bounds);
+		reader.get(kJointBounds, joint_bounds);
+		checkSize(bounds, 2, "bounds");
+		checkSize(joint_bounds, 2 * njoints, "joint bounds");
+		loaded.bounds.min = bounds[0];
+		loaded.bounds.max = bounds[1];
+		loaded.joint_bounds.resize(njoints);
+		for (size_t j = 0; j < njoints; j++) {
+			loaded.joint_bounds[j].min = joint_bounds[2 * j];
+			loaded.joint_bounds[j].max = joint_bounds[2 * j + 1];
+		}
+
+		std::vector<uint8_t> texels;
+		reader.get(kTexels, texels);
+		std::vector<std::shared_ptr<Image>> images;
+		for (const auto& tex : textures) {
+			auto image = std::make_shared<Image>();
+			image->width = tex.width;
+			image->height = tex.height;
+			image->channels = 4;
+			size_t bytes = size_t(tex.width) * tex.height * 4;
+			if (tex.width < 0 || tex.height < 0 || tex.texel_offset > texels.size() ||
+			    bytes > texels.size() - tex.texel_offset)
+				throw std::runtime_error("texture out of bounds");
+			image->bytes.assign(texels.begin() + tex.texel_offset,
+			                    texels.begin() + tex.texel_offset + bytes);
+			images.emplace_back(image);
+		}
+
+		std::vector<MaterialRecord> materials;
+		reader.get(kMaterials, materials);
+		checkSize(materials, size_t(header.nlods) * header.nmaterials, "materials");
+		if (header.nlods == 0)
+			throw std::runtime_error("no levels of detail");
+		size_t nfaces = loaded.faces.size() + loaded.lod_faces.size();
+		loaded.lods.assign(header.nlods, std::vector<Material>(header.nmaterials));
+		for (size_t i = 0; i < materials.size(); i++) {
+			const MaterialRecord& r = materials[i];
+			Material& ma = loaded.lods[i / header.nmaterials][i % header.nmaterials];
+			if (r.offset > nfaces || r.nfaces > nfaces - r.offset ||
+			    r.texture >= int(images.size()))
+				throw std::runtime_error("material out of range");
+			checkPackedIndices(r, loaded.packed_indices, nvertices);
+			ma.diffuse = r.diffuse;
+			ma.ambient = r.ambient;
+			ma.specular = r.specular;
+			ma.shininess = r.shininess;
+			if (r.texture >= 0) {
+				ma.texture = images[r.texture];
+				ma.texture_path = texture_paths[r.texture];
+			}
+			ma.offset = r.offset;
+			ma.nfaces = r.nfaces;
+			ma.index_offset = r.index_offset;
+			ma.base_vertex = r.base_vertex;
+			ma.short_indices = r.short_indices != 0;
+		}
+		loaded.materials = loaded.lods.front();
+
+		std::vector<uint32_t> counts;
+		std::vector<int32_t> material_joints;
+		reader.get(kMaterialJointCounts, counts);
+		reader.get(kMaterialJoints, material_joints);
+		checkSize(counts, header.nmaterials, "material joint counts");
+		size_t next = 0;
+		loaded.material_joints.resize(counts.size());
+		for (size_t m = 0; m < counts.size(); m++) {
+			if (counts[m] > material_joints.size() - next)
+				throw std::runtime_error("material joints out of bounds");
+			loaded.material_joints[m].assign(material_joints.begin() + next,
+			                                  material_joints.begin() + next + counts[m]);
+			next += counts[m];
+		}
+		for (int jid : material_joints)
+			if (jid < 0 || jid >= int(njoints))
+				throw std::runtime_error("material joint out of range");
+
+		std::vector<int> parents(joint_parents.begin(), joint_parents.end());
+		mesh.vertices.swap(loaded.vertices);
+		mesh.vertex_normals.swap(loaded.vertex_normals);
+		mesh.uv_coordinates.swap(loaded.uv_coordinates);
+		mesh.faces.swap(loaded.faces);
+		mesh.lod_faces.swap(loaded.lod_faces);
+		mesh.packed_indices.swap(loaded.packed_indices);
+		mesh.joint0.swap(loaded.joint0);
+		mesh.joint1.swap(loaded.joint1);
+		mesh.weight_for_joint0.swap(loaded.weight_for_joint0);
+		mesh.vector_from_joint0.swap(loaded.vector_from_joint0);
+		mesh.vector_from_joint1.swap(loaded.vector_from_joint1);
+		mesh.joint2.swap(loaded.joint2);
+		mesh.joint3.swap(loaded.joint3);
+		mesh.weight_for_joint1.swap(loaded.weight_for_joint1);
+		mesh.weight_for_joint2.swap(loaded.weight_for_joint2);
+		mesh.weight_for_joint3.swap(loaded.weight_for_joint3);
+		mesh.lods.swap(loaded.lods);
+		mesh.materials.swap(loaded.materials);
+		mesh.bounds = loaded.bounds;
+		mesh.joint_bounds.swap(loaded.joint_bounds);
+		mesh.material_joints.swap(loaded.material_joints);
+		mesh.buildSkeleton(joint_positions, parents, joint_names);
+		mesh.buildMeshWeights();
+	} catch (const std::exception& e) {
+		std::cerr << __func__ << ": " << path << " is corrupt (" << e.what() << "), rebuilding" << std::endl;
+		return false;
+	}
+
+	if (touched) {
+		// Record the new time so the next launch skips the hash
+		FILE* f = fopen(path.c_str(), "r+b");
+		if (f) {
+			fseek(f, offsetof(CacheHeader, source_mtime), SEEK_SET);
+			fwrite(&source_mtime, sizeof(source_mtime), 1, f);
+			fclose(f);
+		}
+	}
+	double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	std::cerr << __func__ << ": " << model_fn << " from " << path << " in " << ms << " ms" << std::endl;
+	return true;
+}
+
+void ModelCache::beginSave(const Mesh& mesh)
+{
+	pending_.reset(new PendingSave);
+	addGeometry(pending_->writer, mesh);
+}
+
+bool ModelCache::save(const std::string& model_fn, const Mesh& mesh)
+{
+	std::unique_ptr<PendingSave> pending = std::move(pending_);
+	PendingSave fresh;
+	SectionWriter& writer = pending ? pending->writer : fresh.writer;
+	CacheHeader& header = writer.getHeader();
+	header.magic = kCacheMagic;
+	header.version = kModelCacheVersion;
+	try {
+		header.source_hash = hashFile(model_fn);
+	} catch (const std::exception& e) {
+		std::cerr << __func__ << ": " << e.what() << std::endl;
+		return false;
+	}
+	if (!statFile(model_fn, header.source_size, header.source_mtime))
+		return false;
+	header.nlods = mesh.lods.size();
+	header.nmaterials = mesh.lods.empty() ? 0 : mesh.lods.front().size();
+
+	if (!pending)
+		addGeometry(writer, mesh);
+
+	// Textures shared by several materials are stored once
+	std::map<const Image*, int> texture_ids;
+	std::vector<TextureRecord> textures;
+	std::vector<uint8_t> texels;
+	std::vector<char> strings;
+	std::vector<unsigned char> rgba;
+	std::vector<MaterialRecord> materials;
+	for (const auto& lod : mesh.lods) {
+		for (const auto& ma : lod) {
+			MaterialRecord r = {};
+			r.diffuse = ma.diffuse;
+			r.ambient = ma.ambient;
+			r.specular = ma.specular;
+			r.shininess = ma.shininess;
+			r.texture = -1;
+			r.offset = ma.offset;
+			r.nfaces = ma.nfaces;
+			r.index_offset = ma.index_offset;
+			r.base_vertex = ma.base_vertex;
+			r.short_indices = ma.short_indices ? 1 : 0;
+			if (ma.texture && !ma.texture_path.empty()) {
+				auto iter = texture_ids.find(ma.texture.get());
+				if (iter != texture_ids.end()) {
+					r.texture = iter->second;
+				} else {
+					TextureRecord tex = {};
+					if (!statFile(ma.texture_path, tex.file_size, tex.file_mtime)) {
+						std::cerr << __func__ << ": cannot find " << ma.texture_path
+						          << ", not caching " << model_fn << std::endl;
+						return false;
+					}
+					tex.width = ma.texture->width;
+					tex.height = ma.texture->height;
+					tex.texel_offset = texels.size();
+					tex.path_offset = strings.size();
+					tex.path_length = ma.texture_path.size();
+					ImageToRGBA(*ma.texture, rgba);
+					texels.insert(texels.end(), rgba.begin(), rgba.end());
+					strings.insert(strings.end(), ma.texture_path.begin(), ma.texture_path.end());
+					r.texture = textures.size();
+					texture_ids[ma.texture.get()] = r.texture;
+					textures.emplace_back(tex);
+				}
+			}
+			materials.emplace_back(r);
+		}
+	}
+	writer.add(kMaterials, materials);
+
+	writer.add(kTextures, textures);
+	writer.add(kTexels, texels);
+	writer.add(kStrings, strings);
+
+	const std::vector<uint8_t>& data = writer.finish();
+	makeDirectory(dir_);
+	// Write to a temporary file first so a crash never leaves a truncated
+	// cache behind.
+	std::string path = getPath(model_fn);
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (!f) {
+		std::cerr << __func__ << ": cannot write " << tmp << std::endl;
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+	if (fclose(f) != 0)
+		ok = false;
+#ifdef _WIN32
+	// rename does not replace an existing file on Windows
+	remove(path.c_str());
+#endif
+	// Elsewhere it replaces the old cache atomically
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		remove(tmp.c_str());
+		std::cerr << __func__ << ": cannot write " << path << std::endl;
+		return false;
+	}
+	std::cerr << __func__ << ": cached " << model_fn << " in " << path << " ("
+	          << data.size() / 1048576.0 << " MiB)" << std::endl;
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <string>
+#include <cstdint>
+#include <memory>
+
+struct Mesh;
+
+/*
+ * ModelCache: binary snapshot of a loaded and optimized Mesh, so the next
+ * launch skips parsing, BMP decoding, skeleton and weight construction,
+ * vertex cache optimization and LOD generation.
+ *
+ * One file per model (named by the hash of its path) in ./model_cache, or
+ * $SKINNING_MODEL_CACHE. It holds the per-vertex arrays, the packed index
+ * buffer, the flattened skeleton (joint positions, parents and names), the
+ * material tables of every LOD and the textures converted to RGBA. Every
+ * section is 16-byte aligned and stored in its in-memory layout, so the
+ * file is memory mapped and copied out without any conversion.
+ *
+ * A cache file is used only if its format version matches and the model
+ * file and every texture have the recorded size and modification time.
+ * If only the time differs, the content hash of the model decides. Bump
+ * kModelCacheVersion whenever loading or optimizing produces different
+ * data.
+ */
+class ModelCache {
+public:
+	static const uint32_t kModelCacheVersion = 4;
+
+	ModelCache();
+	~ModelCache();
+
+	/* load: fill mesh from the cache of model_fn. Return: false on a miss */
+	bool load(const std::string& model_fn, Mesh& mesh);
+	/*
+	 * beginSave: serialize everything of mesh but its materials and
+	 * textures now, so a loader can hand the geometry on before the
+	 * textures are decoded. The next save uses it instead of mesh's.
+	 */
+	void beginSave(const Mesh& mesh);
+	/* save: write the cache of model_fn. Return: false (logged) if it was not written */
+	bool save(const std::string& model_fn, const Mesh& mesh);
+
+	void setDirectory(const std::string& dir) { dir_ = dir; }
+	std::string getPath(const std::string& model_fn) const;
+private:
+	struct PendingSave;
+
+	std::string dir_;
+	std::unique_ptr<PendingSave> pending_;
+};
+
+#endif
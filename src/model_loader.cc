@@ -0,0 +1,174 @@
+#include "model_loader.h"
+#include "model_cache.h"
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	const char* getStageName(ModelLoader::Stage stage)
+	{
+		switch (stage) {
+			case ModelLoader::kSkeleton: return "skeleton";
+			case ModelLoader::kGeometry: return "geometry";
+			case ModelLoader::kTextures: return "textures";
+			default: return "nothing";
+		}
+	}
+}
+
+ModelLoader::ModelLoader(const std::string& fn)
+	: fn_(fn)
+{
+	worker_ = std::thread(&ModelLoader::run, this);
+}
+
+ModelLoader::~ModelLoader()
+{
+	worker_.join();
+}
+
+ModelLoader::Stage ModelLoader::getStage() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return published_;
+}
+
+void ModelLoader::wait(Stage stage)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	published_cv_.wait(lock, [this, stage]() { return published_ >= stage; });
+}
+
+double ModelLoader::getStageTime(Stage stage) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return stage_times_[stage];
+}
+
+void ModelLoader::run()
+{
+	auto start = Clock::now();
+	auto finish_stage = [this, start](Mesh& work, Stage stage) {
+		publish(work, stage);
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stage_times_[stage] = seconds;
+		}
+		std::cerr << "ModelLoader: " << getStageName(stage) << " of " << fn_
+		          << " after " << seconds * 1000.0 << " ms" << std::endl;
+	};
+
+	Mesh work;
+	ModelCache cache;
+	if (cache.load(fn_, work)) {
+		finish_stage(work, kTextures);
+		return ;
+	}
+	Stage done = kNothing;
+	try {
+		MMDReader mr;
+		mr.open(fn_);
+		work.loadSkeleton(mr);
+		finish_stage(work, done = kSkeleton);
+		work.loadGeometry(mr);
+		// The geometry moves to the render thread, the cache keeps a copy
+		cache.beginSave(work);
+		finish_stage(work, done = kGeometry);
+		work.loadTextures(mr);
+		finish_stage(work, done = kTextures);
+	} catch (const std::string& e) {
+		std::cerr << "ModelLoader: " << e << std::endl;
+	} catch (const std::exception& e) {
+		std::cerr << "ModelLoader: " << e.what() << std::endl;
+	}
+	if (done < kTextures) {
+		// Publish the rest empty so nobody waits forever
+		Mesh empty;
+		finish_stage(empty, kTextures);
+		return ;
+	}
+	cache.save(fn_, work);
+}
+
+/*
+ * Move what the stages up to stage added to work into staged_. Stages are
+ * cumulative, so publishing kTextures alone publishes the whole model.
+ * The skeleton, bounds and material tables are copied: later stages of
+ * the worker build on them.
+ */
+void ModelLoader::publish(Mesh& work, Stage stage)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (published_ < kSkeleton && stage >= kSkeleton) {
+		staged_.skeleton = work.skeleton;
+		staged_.bounds = work.bounds;
+	}
+	if (published_ < kGeometry && stage >= kGeometry) {
+		staged_.vertices = std::move(work.vertices);
+		staged_.vertex_normals = std::move(work.vertex_normals);
+		staged_.uv_coordinates = std::move(work.uv_coordinates);
+		staged_.faces = std::move(work.faces);
+		staged_.lod_faces = std::move(work.lod_faces);
+		staged_.packed_indices = std::move(work.packed_indices);
+		staged_.joint0 = std::move(work.joint0);
+		staged_.joint1 = std::move(work.joint1);
+		staged_.weight_for_joint0 = std::move(work.weight_for_joint0);
+		staged_.vector_from_joint0 = std::move(work.vector_from_joint0);
+		staged_.vector_from_joint1 = std::move(work.vector_from_joint1);
+		staged_.joint2 = std::move(work.joint2);
+		staged_.joint3 = std::move(work.joint3);
+		staged_.weight_for_joint1 = std::move(work.weight_for_joint1);
+		staged_.weight_for_joint2 = std::move(work.weight_for_joint2);
+		staged_.weight_for_joint3 = std::move(work.weight_for_joint3);
+		staged_.lods = work.lods;
+		staged_.materials = work.materials;
+		staged_.bounds = work.bounds;
+		staged_.joint_bounds = std::move(work.joint_bounds);
+		staged_.material_joints = std::move(work.material_joints);
+	}
+	if (stage >= kTextures)
+		staged_.setTextures(work.materials);
+	published_ = stage;
+	published_cv_.notify_all();
+}
+
+ModelLoader::Stage ModelLoader::adopt(Mesh& mesh)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (adopted_ < kSkeleton && published_ >= kSkeleton) {
+		mesh.skeleton = std::move(staged_.skeleton);
+		mesh.bounds = staged_.bounds;
+		mesh.updateAnimation();
+	}
+	if (adopted_ < kGeometry && published_ >= kGeometry) {
+		mesh.vertices.swap(staged_.vertices);
+		mesh.vertex_normals.swap(staged_.vertex_normals);
+		mesh.uv_coordinates.swap(staged_.uv_coordinates);
+		mesh.faces.swap(staged_.faces);
+		mesh.lod_faces.swap(staged_.lod_faces);
+		mesh.packed_indices.swap(staged_.packed_indices);
+		mesh.joint0.swap(staged_.joint0);
+		mesh.joint1.swap(staged_.joint1);
+		mesh.weight_for_joint0.swap(staged_.weight_for_joint0);
+		mesh.vector_from_joint0.swap(staged_.vector_from_joint0);
+		mesh.vector_from_joint1.swap(staged_.vector_from_joint1);
+		mesh.joint2.swap(staged_.joint2);
+		mesh.joint3.swap(staged_.joint3);
+		mesh.weight_for_joint1.swap(staged_.weight_for_joint1);
+		mesh.weight_for_joint2.swap(staged_.weight_for_joint2);
+		mesh.weight_for_joint3.swap(staged_.weight_for_joint3);
+		mesh.lods = staged_.lods;       // Kept for the textures
+		mesh.materials = staged_.materials;
+		mesh.bounds = staged_.bounds;
+		mesh.joint_bounds.swap(staged_.joint_bounds);
+		mesh.material_joints.swap(staged_.material_joints);
+		mesh.buildMeshWeights();
+	}
+	if (adopted_ < kTextures && published_ >= kTextures)
+		mesh.setTextures(staged_.materials);
+	adopted_ = published_;
+	return adopted_;
+}
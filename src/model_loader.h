@@ -0,0 +1,67 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "bone_geometry.h"
+
+/*
+ * ModelLoader: loads a model on a worker thread and publishes it in
+ * stages, so the viewer can draw something long before the whole model
+ * is ready:
+ *      kSkeleton: the skeleton, bounds enclose the joints
+ *      kGeometry: vertices, weights, LODs and untextured materials
+ *      kTextures: the material textures, the model is complete
+ *
+ * The worker loads into its own Mesh and moves each stage out when it is
+ * complete; only the skeleton and the material tables, which later stages
+ * still need, are copied. The render thread polls getStage() and moves
+ * published stages into its Mesh with adopt(), which never waits for the
+ * worker.
+ * A model cache hit publishes every stage at once.
+ */
+class ModelLoader {
+public:
+	enum Stage {
+		kNothing,
+		kSkeleton,
+		kGeometry,
+		kTextures,
+	};
+
+	/* Starts loading fn right away */
+	explicit ModelLoader(const std::string& fn);
+	/* Waits for the worker */
+	~ModelLoader();
+	ModelLoader(const ModelLoader&) = delete;
+	ModelLoader& operator=(const ModelLoader&) = delete;
+
+	/* getStage: the last stage published */
+	Stage getStage() const;
+	/* wait: block until stage is published */
+	void wait(Stage stage);
+	/*
+	 * adopt: move every stage published since the last call into mesh.
+	 * The pose of mesh.skeleton is kept once it was adopted.
+	 * Return: the last stage adopted
+	 */
+	Stage adopt(Mesh& mesh);
+	/* getStageTime: seconds from the start until stage was published */
+	double getStageTime(Stage stage) const;
+private:
+	void run();
+	void publish(Mesh& work, Stage stage);
+
+	std::string fn_;
+	mutable std::mutex mutex_;
+	std::condition_variable published_cv_;
+	Stage published_ = kNothing;
+	Stage adopted_ = kNothing;
+	Mesh staged_;           // Published, not yet adopted
+	double stage_times_[kTextures + 1] = {};
+	std::thread worker_;    // Last, it reads the members above
+};
+
+#endif
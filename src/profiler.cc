@@ -0,0 +1,245 @@
+#include <GL/glew.h>
+#include "profiler.h"
+#include <debuggl.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const size_t kMaxTraceEvents = 1 << 20;
+
+void writeJsonString(std::ostream& out, const std::string& s)
+{
+	out << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			out << '\\';
+		out << c;
+	}
+	out << '"';
+}
+
+}
+
+const int Profiler::kQueryLatency;
+const int Profiler::kHistory;
+
+void Profiler::Zone::push(float ms)
+{
+	if (history.empty())
+		history.resize(kHistory, 0.0f);
+	history[next] = ms;
+	next = (next + 1) % history.size();
+	count = std::min(count + 1, history.size());
+}
+
+Profiler& Profiler::instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Profiler()
+	: epoch_(Clock::now())
+{
+}
+
+Profiler::~Profiler()
+{
+	// Query objects die with the GL context.
+}
+
+double Profiler::now() const
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - epoch_).count();
+}
+
+int Profiler::getZone(const char* name, bool gpu)
+{
+	auto& index = zone_index_[gpu ? 1 : 0];
+	auto iter = index.find(name);
+	if (iter != index.end())
+		return iter->second;
+	int id = zones_.size();
+	zones_.emplace_back();
+	zones_.back().name = name;
+	zones_.back().gpu = gpu;
+	index[name] = id;
+	return id;
+}
+
+void Profiler::beginFrame()
+{
+	frame_index_++;
+	resolveQueries(frame_queries_[frame_index_ % kQueryLatency]);
+	if (frame_zone_ < 0)
+		frame_zone_ = getZone("frame", false);
+	frame_start_ = now();
+}
+
+void Profiler::endFrame()
+{
+	double end = now();
+	Zone& frame = zones_[frame_zone_];
+	frame.frame_ms = (end - frame_start_) / 1000.0;
+	frame.touched = true;
+	if (tracing_ && events_.size() < kMaxTraceEvents)
+		events_.push_back({ frame_zone_, frame_start_, end - frame_start_ });
+	for (auto& zone : zones_) {
+		if (zone.gpu)
+			continue;
+		zone.push(zone.touched ? zone.frame_ms : 0.0f);
+		zone.frame_ms = 0.0f;
+		zone.touched = false;
+	}
+	if (!cpu_stack_.empty()) {
+		std::cerr << __func__ << ": " << cpu_stack_.size() << " CPU zones still open" << std::endl;
+		cpu_stack_.clear();
+	}
+}
+
+void Profiler::beginCpuZone(const char* name)
+{
+	cpu_stack_.emplace_back(getZone(name, false), now());
+}
+
+void Profiler::endCpuZone()
+{
+	if (cpu_stack_.empty())
+		return ;
+	double end = now();
+	int id = cpu_stack_.back().first;
+	double start = cpu_stack_.back().second;
+	cpu_stack_.pop_back();
+	Zone& zone = zones_[id];
+	zone.frame_ms += (end - start) / 1000.0;
+	zone.touched = true;
+	if (tracing_ && events_.size() < kMaxTraceEvents)
+		events_.push_back({ id, start, end - start });
+}
+
+void Profiler::beginGpuZone(const char* name)
+{
+	if (gpu_depth_++ > 0)
+		return ;
+	unsigned query;
+	if (free_queries_.empty()) {
+		CHECK_GL_ERROR(glGenQueries(1, &query));
+	} else {
+		query = free_queries_.back();
+		free_queries_.pop_back();
+	}
+	gpu_query_ = { query, getZone(name, true), now() };
+	CHECK_GL_ERROR(glBeginQuery(GL_TIME_ELAPSED, query));
+}
+
+void Profiler::endGpuZone()
+{
+	if (gpu_depth_ == 0 || --gpu_depth_ > 0)
+		return ;
+	CHECK_GL_ERROR(glEndQuery(GL_TIME_ELAPSED));
+	frame_queries_[frame_index_ % kQueryLatency].push_back(gpu_query_);
+}
+
+void Profiler::resolveQueries(std::vector<PendingQuery>& queries)
+{
+	if (queries.empty())
+		return ;
+	for (auto& zone : zones_)
+		if (zone.gpu)
+			zone.touched = false;
+	for (const auto& pending : queries) {
+		GLint available = 0;
+		CHECK_GL_ERROR(glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available));
+		if (available) {
+			GLuint64 ns = 0;
+			CHECK_GL_ERROR(glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &ns));
+			Zone& zone = zones_[pending.zone];
+			if (!zone.touched)
+				zone.frame_ms = 0.0f;
+			zone.frame_ms += ns / 1e6;
+			zone.touched = true;
+			if (tracing_ && events_.size() < kMaxTraceEvents)
+				events_.push_back({ pending.zone, pending.start_us, ns / 1e3 });
+		} else {
+			lost_queries_++;
+		}
+		free_queries_.push_back(pending.query);
+	}
+	queries.clear();
+	for (auto& zone : zones_) {
+		if (!zone.gpu || !zone.touched)
+			continue;
+		zone.push(zone.frame_ms);
+		zone.frame_ms = 0.0f;
+		zone.touched = false;
+	}
+}
+
+void Profiler::getStats(std::vector<ZoneStats>& stats) const
+{
+	stats.clear();
+	for (int gpu = 0; gpu < 2; gpu++) {
+		for (const auto& zone : zones_) {
+			if (zone.gpu != (gpu == 1) || zone.count == 0)
+				continue;
+			ZoneStats s;
+			s.name = zone.name;
+			s.gpu = zone.gpu;
+			s.last_ms = zone.history[(zone.next + zone.history.size() - 1) % zone.history.size()];
+			s.avg_ms = 0.0f;
+			s.max_ms = 0.0f;
+			for (size_t i = 0; i < zone.count; i++) {
+				float ms = zone.history[(zone.next + zone.history.size() - 1 - i) % zone.history.size()];
+				s.avg_ms += ms;
+				s.max_ms = std::max(s.max_ms, ms);
+			}
+			s.avg_ms /= zone.count;
+			stats.emplace_back(s);
+		}
+	}
+}
+
+void Profiler::startTrace()
+{
+	events_.clear();
+	tracing_ = true;
+}
+
+bool Profiler::stopTrace(const std::string& fn)
+{
+	tracing_ = false;
+	std::ofstream fout(fn);
+	if (!fout.good()) {
+		std::cerr << __func__ << ": cannot write " << fn << std::endl;
+		return false;
+	}
+	writeChromeTrace(fout);
+	std::cerr << __func__ << ": wrote " << events_.size() << " events to " << fn;
+	if (events_.size() >= kMaxTraceEvents)
+		std::cerr << " (truncated)";
+	if (lost_queries_ > 0)
+		std::cerr << ", " << lost_queries_ << " GPU queries were not ready in time";
+	std::cerr << std::endl;
+	events_.clear();
+	return fout.good();
+}
+
+void Profiler::writeChromeTrace(std::ostream& out) const
+{
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+	out.precision(3);
+	out << std::fixed;
+	for (const auto& e : events_) {
+		const Zone& zone = zones_[e.zone];
+		out << ",\n{\"name\":";
+		writeJsonString(out, zone.name);
+		out << ",\"cat\":\"" << (zone.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\""
+		    << ",\"ts\":" << e.start_us << ",\"dur\":" << e.duration_us
+		    << ",\"pid\":1,\"tid\":" << (zone.gpu ? 2 : 1) << "}";
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,122 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <ostream>
+
+/*
+ * Profiler: CPU and GPU time per named zone.
+ *
+ * CPU zones are timed with a steady clock and may nest. GPU zones wrap
+ * draws in GL_TIME_ELAPSED queries, which cannot nest; a GPU zone started
+ * inside another one is ignored. Query results are read kQueryLatency
+ * frames later, so reading them never waits for the GPU.
+ *
+ * Each zone keeps the per-frame total of its last kHistory frames. While
+ * tracing, every zone instance is also recorded for writeChromeTrace().
+ */
+class Profiler {
+public:
+	static const int kQueryLatency = 3;
+	static const int kHistory = 120;
+
+	static Profiler& instance();
+
+	void beginFrame();
+	void endFrame();
+
+	void beginCpuZone(const char* name);
+	void endCpuZone();
+	void beginGpuZone(const char* name);
+	void endGpuZone();
+
+	struct ZoneStats {
+		std::string name;
+		bool gpu;
+		float last_ms;  // last complete frame
+		float avg_ms;   // average over the history
+		float max_ms;
+	};
+	/* getStats: CPU zones first, in order of first use */
+	void getStats(std::vector<ZoneStats>& stats) const;
+
+	void startTrace();
+	/*
+	 * stopTrace: write the events recorded since startTrace() as Chrome
+	 * trace event JSON (chrome://tracing, Perfetto). GPU events are placed
+	 * at the time their draws were submitted.
+	 */
+	bool stopTrace(const std::string& fn);
+	bool isTracing() const { return tracing_; }
+	void writeChromeTrace(std::ostream& out) const;
+private:
+	Profiler();
+	~Profiler();
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Zone {
+		std::string name;
+		bool gpu;
+		float frame_ms = 0.0f;  // total of the frame being measured
+		bool touched = false;
+		std::vector<float> history;
+		size_t next = 0;
+		size_t count = 0;
+		void push(float ms);
+	};
+	struct Event {
+		int zone;
+		double start_us;
+		double duration_us;
+	};
+	struct PendingQuery {
+		unsigned query;
+		int zone;
+		double start_us;
+	};
+
+	int getZone(const char* name, bool gpu);
+	double now() const;
+	void resolveQueries(std::vector<PendingQuery>& queries);
+
+	Clock::time_point epoch_;
+	std::vector<Zone> zones_;
+	std::map<std::string, int> zone_index_[2]; // [gpu]
+
+	std::vector<std::pair<int, double>> cpu_stack_;
+	int frame_zone_ = -1;
+	double frame_start_ = 0.0;
+
+	int gpu_zone_ = -1;
+	int gpu_depth_ = 0;
+	PendingQuery gpu_query_;
+	std::vector<PendingQuery> frame_queries_[kQueryLatency];
+	std::vector<unsigned> free_queries_;
+	size_t frame_index_ = 0;
+	size_t lost_queries_ = 0;
+
+	bool tracing_ = false;
+	std::vector<Event> events_;
+};
+
+/*
+ * ScopedCpuZone/ScopedGpuZone: time the enclosing scope.
+ * name must outlive the zone, use string literals.
+ */
+class ScopedCpuZone {
+public:
+	explicit ScopedCpuZone(const char* name) { Profiler::instance().beginCpuZone(name); }
+	~ScopedCpuZone() { Profiler::instance().endCpuZone(); }
+};
+
+class ScopedGpuZone {
+public:
+	explicit ScopedGpuZone(const char* name) { Profiler::instance().beginGpuZone(name); }
+	~ScopedGpuZone() { Profiler::instance().endGpuZone(); }
+};
+
+#endif
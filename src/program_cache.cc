@@ -0,0 +1,194 @@
+#include <GL/glew.h>
+#include "program_cache.h"
+#include <debuggl.h>
+#include <hash.h>
+#include "gl_resource.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+	const uint32_t kBinaryMagic = 0x42504b53; // "SKPB"
+	const uint32_t kBinaryVersion = 1;
+
+	struct BinaryHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	std::string glString(GLenum name)
+	{
+		const GLubyte* str = glGetString(name);
+		return str ? std::string((const char*)str) : std::string();
+	}
+
+	void makeDirectory(const std::string& dir)
+	{
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		mkdir(dir.c_str(), 0755);
+#endif
+	}
+}
+
+ProgramCache& ProgramCache::instance()
+{
+	static ProgramCache cache;
+	return cache;
+}
+
+ProgramCache::ProgramCache()
+{
+	const char* dir = getenv("SKINNING_SHADER_CACHE");
+	dir_ = dir ? dir : "shader_cache";
+}
+
+bool ProgramCache::isBinarySupported() const
+{
+	if (binary_supported_ < 0) {
+		GLint nformats = 0;
+		if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+			CHECK_GL_ERROR(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats));
+		binary_supported_ = nformats > 0 ? 1 : 0;
+	}
+	return binary_supported_ == 1;
+}
+
+uint64_t ProgramCache::makeKey(const std::vector<const char*>& shaders,
+                               const std::vector<std::pair<int, std::string>>& attribs,
+                               const std::vector<const char*>& outputs,
+                               const std::vector<const char*>& feedback) const
+{
+	uint64_t h = kHashSeed;
+	for (const char* src : shaders)
+		h = HashString(src ? std::string(src) : std::string(), h);
+	for (const auto& attrib : attribs) {
+		h = HashValue(attrib.first, h);
+		h = HashString(attrib.second, h);
+	}
+	for (const char* out : outputs)
+		h = HashString(out, h);
+	// Keep programs with and without feedback apart
+	h = HashValue(feedback.size(), h);
+	for (const char* varying : feedback)
+		h = HashString(varying, h);
+	if (!driver_hash_) {
+		driver_hash_ = HashString(glString(GL_VENDOR));
+		driver_hash_ = HashString(glString(GL_RENDERER), driver_hash_);
+		driver_hash_ = HashString(glString(GL_VERSION), driver_hash_);
+	}
+	return HashValue(driver_hash_, h);
+}
+
+unsigned ProgramCache::find(uint64_t key)
+{
+	auto iter = programs_.find(key);
+	if (iter != programs_.end())
+		return iter->second;
+	unsigned program = loadBinary(key);
+	if (program) {
+		programs_[key] = program;
+		GLResourcePool::instance().track(kGLProgram, 0);
+	}
+	return program;
+}
+
+void ProgramCache::store(uint64_t key, unsigned program)
+{
+	programs_[key] = program;
+	GLResourcePool::instance().track(kGLProgram, 0);
+	saveBinary(key, program);
+}
+
+void ProgramCache::prepareForLink(unsigned program) const
+{
+	if (isBinarySupported())
+		CHECK_GL_ERROR(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+}
+
+std::string ProgramCache::getPath(uint64_t key) const
+{
+	std::ostringstream ss;
+	ss << dir_ << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+	return ss.str();
+}
+
+unsigned ProgramCache::loadBinary(uint64_t key)
+{
+	if (!isBinarySupported())
+		return 0;
+	FILE* f = fopen(getPath(key).c_str(), "rb");
+	if (!f)
+		return 0;
+	BinaryHeader header;
+	std::vector<char> blob;
+	bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+	             header.magic == kBinaryMagic &&
+	             header.version == kBinaryVersion &&
+	             header.key == key;
+	if (valid) {
+		blob.resize(header.length);
+		valid = fread(blob.data(), 1, blob.size(), f) == blob.size();
+	}
+	fclose(f);
+	if (!valid)
+		return 0;
+
+	GLuint program = 0;
+	CHECK_GL_ERROR(program = glCreateProgram());
+	// A driver update may reject old binaries, which is not an error.
+	glProgramBinary(program, header.format, blob.data(), blob.size());
+	glGetError();
+	GLint status = GL_FALSE;
+	CHECK_GL_ERROR(glGetProgramiv(program, GL_LINK_STATUS, &status));
+	if (status != GL_TRUE) {
+		std::cerr << __func__ << ": stale program binary " << getPath(key) << std::endl;
+		CHECK_GL_ERROR(glDeleteProgram(program));
+		return 0;
+	}
+	return program;
+}
+
+void ProgramCache::saveBinary(uint64_t key, unsigned program)
+{
+	if (!isBinarySupported())
+		return ;
+	GLint length = 0;
+	CHECK_GL_ERROR(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+	if (length <= 0)
+		return ;
+	std::vector<char> blob(length);
+	GLenum format = 0;
+	CHECK_GL_ERROR(glGetProgramBinary(program, length, nullptr, &format, blob.data()));
+
+	makeDirectory(dir_);
+	// Write to a temporary file first so a crash never leaves a truncated
+	// binary behind.
+	std::string path = getPath(key);
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (!f) {
+		std::cerr << __func__ << ": cannot write " << tmp << std::endl;
+		return ;
+	}
+	BinaryHeader header = { kBinaryMagic, kBinaryVersion, key, format, uint32_t(length) };
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+	          fwrite(blob.data(), 1, blob.size(), f) == blob.size();
+	fclose(f);
+	remove(path.c_str());
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		remove(tmp.c_str());
+		std::cerr << __func__ << ": cannot write " << path << std::endl;
+	}
+}
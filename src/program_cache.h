@@ -0,0 +1,64 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+
+/*
+ * ProgramCache: cache of linked GLSL programs.
+ *
+ * Programs are keyed by a hash of everything that affects linking: shader
+ * sources, attribute locations, fragment output locations, transform
+ * feedback varyings and the driver identification strings.
+ *
+ * Linked programs are shared in-process. If the driver supports
+ * ARB_get_program_binary, the program binaries are also stored on disk (in
+ * ./shader_cache, or $SKINNING_SHADER_CACHE) so that the next launch can
+ * skip compiling and linking with glProgramBinary.
+ */
+class ProgramCache {
+public:
+	static ProgramCache& instance();
+
+	/*
+	 * makeKey: hash the program description
+	 *      shaders: sources in VS, GS, FS order, nullptr if absent
+	 *      attribs: (location, name) pairs for glBindAttribLocation
+	 *      outputs: names for glBindFragDataLocation, in location order
+	 *      feedback: transform feedback varyings
+	 */
+	uint64_t makeKey(const std::vector<const char*>& shaders,
+	                 const std::vector<std::pair<int, std::string>>& attribs,
+	                 const std::vector<const char*>& outputs,
+	                 const std::vector<const char*>& feedback = {}) const;
+	/*
+	 * find: return the linked program for key, or 0 on a miss.
+	 * Checks the in-process cache first, then the disk cache.
+	 */
+	unsigned find(uint64_t key);
+	/*
+	 * store: record a freshly linked program. The program should be linked
+	 * with prepareForLink() called beforehand so its binary is retrievable.
+	 */
+	void store(uint64_t key, unsigned program);
+	void prepareForLink(unsigned program) const;
+
+	bool isBinarySupported() const;
+	void setDirectory(const std::string& dir) { dir_ = dir; }
+private:
+	ProgramCache();
+
+	std::string getPath(uint64_t key) const;
+	unsigned loadBinary(uint64_t key);
+	void saveBinary(uint64_t key, unsigned program);
+
+	std::string dir_;
+	std::map<uint64_t, unsigned> programs_;
+	mutable int binary_supported_ = -1; // -1: not queried yet
+	mutable uint64_t driver_hash_ = 0;
+};
+
+#endif
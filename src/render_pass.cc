@@ -1,6 +1,12 @@
 #include <GL/glew.h>
 #include "render_pass.h"
+#include "config.h"
+#include "texture_upload.h"
+#include "program_cache.h"
+#include "gl_resource.h"
+#include "vertex_layout.h"
 #include <iostream>
+#include <algorithm>
 #include <debuggl.h>
 #include <map>
 
@@ -23,8 +29,15 @@ struct RenderInputMeta {
 	size_t nelements = 0;
 	size_t element_length = 0;
 	int element_type = 0;
+	bool normalized = false;
+	int slot = -1;      // GL buffer that holds the data, shared by interleaved attributes
+	size_t stride = 0;  // 0: tightly packed
+	size_t offset = 0;
+	unsigned external_buffer = 0; // Buffer given by assignBuffer, not owned
+	RenderDataInput::Writer writer; // Writes the data instead of data, see assign
 
 	size_t getElementSize() const; // simple check: return 12 (3 * 4 bytes) for float3 
+	size_t getVertexSize() const { return stride ? stride : getElementSize(); }
 	RenderInputMeta();
 	RenderInputMeta(int _position,
 	            const std::string& _name,
@@ -41,7 +54,11 @@ RenderInputMeta::RenderInputMeta()
 
 bool RenderInputMeta::isInteger() const
 {
-	return element_type == GL_INT || element_type == GL_UNSIGNED_INT;
+	if (normalized)
+		return false;
+	return element_type == GL_INT || element_type == GL_UNSIGNED_INT ||
+	       element_type == GL_SHORT || element_type == GL_UNSIGNED_SHORT ||
+	       element_type == GL_BYTE || element_type == GL_UNSIGNED_BYTE;
 }
 
 RenderInputMeta::RenderInputMeta(int _position,
@@ -56,6 +73,26 @@ RenderInputMeta::RenderInputMeta(int _position,
 {
 }
 
+/*
+ * MaterialBlockEntry: one element of the MaterialBlock UBO declared in
+ *                     default.frag, laid out according to std140.
+ */
+struct MaterialBlockEntry {
+	glm::vec4 diffuse;
+	glm::vec4 ambient;
+	glm::vec4 specular;
+	float shininess;
+	int texture_array;
+	int texture_layer;
+	float padding;
+};
+static_assert(sizeof(MaterialBlockEntry) == 64, "MaterialBlockEntry must follow std140 layout");
+
+/*
+ * Binding point of MaterialBlock. We only have one UBO so far.
+ */
+constexpr unsigned kMaterialBlockBinding = 0;
+
 RenderDataInput::RenderDataInput()
 	: index_meta_(new RenderInputMeta)
 {
@@ -69,196 +106,339 @@ RenderPass::RenderPass(int vao, // -1: create new VAO, otherwise use given VAO
                        const RenderDataInput& input,
                        const std::vector<const char*> shaders, // Order: VS, GS, FS 
                        const std::vector<ShaderUniformPtr> uniforms,
-                       const std::vector<const char*> output // Order: 0, 1, 2...
+                       const std::vector<const char*> output, // Order: 0, 1, 2...
+                       const std::vector<const char*> feedback
                       )
-	: vao_(vao), input_(input), uniforms_(uniforms)
+	: vao_(vao), input_(input), uniforms_(uniforms),
+	  shaders_(shaders), output_(output), feedback_(feedback)
 {
+	auto& pool = GLResourcePool::instance();
 	if (vao_ < 0) {
-		CHECK_GL_ERROR(glGenVertexArrays(1, (GLuint*)&vao_));
+		own_vao_ = pool.acquireVertexArray();
+		vao_ = int(own_vao_.get());
 	}
 	CHECK_GL_ERROR(glBindVertexArray(vao_));
 
 	// Program first
-	vs_ = compileShader(shaders[0], GL_VERTEX_SHADER);
-	gs_ = compileShader(shaders[1], GL_GEOMETRY_SHADER);
-	fs_ = compileShader(shaders[2], GL_FRAGMENT_SHADER);
-	CHECK_GL_ERROR(sp_ = glCreateProgram());
-	glAttachShader(sp_, vs_);
-	glAttachShader(sp_, fs_);
-	if (shaders[1])
-		glAttachShader(sp_, gs_);
+	for (int i = 0; i < input.getNBuffers(); i++) {
+		auto meta = input.getBufferMeta(i);
+		attribs_.emplace_back(meta.position, meta.name);
+	}
+	sp_ = linkProgram(variant_);
+	variant_programs_[variant_] = sp_;
 
 	// ... and then buffers
-	size_t nbuffer = input.getNBuffers();
-	if (input.hasIndex())
-		nbuffer++;
-	glbuffers_.resize(nbuffer);
-	CHECK_GL_ERROR(glGenBuffers(nbuffer, glbuffers_.data()));
 	for (int i = 0; i < input.getNBuffers(); i++) {
 		auto meta = input.getBufferMeta(i);
-		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
-		CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				meta.getElementSize() * meta.nelements,
-				meta.data,
-				GL_STATIC_DRAW));
-		if (meta.isInteger()) {
-			CHECK_GL_ERROR(glVertexAttribIPointer(meta.position,
-						meta.element_length,
-						meta.element_type,
-						0, 0));
-		} else {
-			CHECK_GL_ERROR(glVertexAttribPointer(meta.position,
-						meta.element_length,
-						meta.element_type,
-						GL_FALSE, 0, 0));
+		if (meta.slot >= int(glbuffers_.size()) && meta.external_buffer) {
+			glbuffers_.emplace_back();
+		} else if (meta.slot >= int(glbuffers_.size())) {
+			// First attribute of the slot uploads the whole buffer
+			size_t bytes = meta.getVertexSize() * meta.nelements;
+			glbuffers_.emplace_back(pool.acquireBuffer(bytes));
+			if (meta.writer)
+				GLResourcePool::fill(glbuffers_.back(), GL_ARRAY_BUFFER,
+						bytes, meta.writer);
+			else
+				GLResourcePool::upload(glbuffers_.back(), GL_ARRAY_BUFFER,
+						meta.data, bytes);
 		}
+		unsigned buffer = meta.external_buffer ? meta.external_buffer : glbuffers_[meta.slot].get();
+		CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer));
+		setAttribPointer(meta);
 		CHECK_GL_ERROR(glEnableVertexAttribArray(meta.position));
-		// ... because we need program to bind location
-		CHECK_GL_ERROR(glBindAttribLocation(sp_, meta.position, meta.name.c_str()));
 	}
-	// .. bind output position
-	for (size_t i = 0; i < output.size(); i++) {
-		CHECK_GL_ERROR(glBindFragDataLocation(sp_, i, output[i]));
-	}
-	// ... then we can link
-	glLinkProgram(sp_);
-	CHECK_GL_PROGRAM_ERROR(sp_);
 
 	if (input.hasIndex()) {
 		auto meta = input.getIndexMeta();
-		CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-					glbuffers_.back()
-					));
-		CHECK_GL_ERROR(glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-					meta.getElementSize() * meta.nelements,
-					meta.data, GL_STATIC_DRAW));
-	}
-	// after linking uniform locations can be determined
-	unilocs_.resize(uniforms.size());
-	for (size_t i = 0; i < uniforms.size(); i++) {
-		CHECK_GL_ERROR(unilocs_[i] = glGetUniformLocation(sp_, uniforms[i]->name.c_str()));
-		//std::cerr << "Uniform " << uniforms[i]->name << " has location " << unilocs_[i] << std::endl;
+		size_t bytes = meta.getElementSize() * meta.nelements;
+		glbuffers_.emplace_back(pool.acquireBuffer(bytes));
+		// The element buffer binding is recorded in the VAO
+		GLResourcePool::upload(glbuffers_.back(), GL_ELEMENT_ARRAY_BUFFER,
+				meta.data, bytes);
 	}
 	if (input_.hasMaterial()) {
 		createMaterialTexture();
+		createMaterialBuffer();
 		initMaterialUniform();
 	}
+	initUniformLocations();
+}
+
+/*
+ * Query the uniform locations of sp_. Must be called again whenever sp_
+ * changes since different variants may assign different locations.
+ */
+void RenderPass::initUniformLocations()
+{
+	unilocs_.resize(uniforms_.size());
+	for (size_t i = 0; i < uniforms_.size(); i++) {
+		CHECK_GL_ERROR(unilocs_[i] = glGetUniformLocation(sp_, uniforms_[i]->name.c_str()));
+		//std::cerr << "Uniform " << uniforms_[i]->name << " has location " << unilocs_[i] << std::endl;
+	}
+	if (!input_.hasMaterial())
+		return ;
+
+	malocs_.clear();
+	for (const auto& uni : material_uniforms_)
+		CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, uni->name.c_str())));
+	CHECK_GL_ERROR(face_base_loc_ = glGetUniformLocation(sp_, "face_base"));
+
+	GLuint block = GL_INVALID_INDEX;
+	CHECK_GL_ERROR(block = glGetUniformBlockIndex(sp_, "MaterialBlock"));
+	if (block != GL_INVALID_INDEX)
+		CHECK_GL_ERROR(glUniformBlockBinding(sp_, block, kMaterialBlockBinding));
+}
+
+void RenderPass::useVariant(int variant)
+{
+	if (variant == variant_)
+		return ;
+	auto iter = variant_programs_.find(variant);
+	if (iter != variant_programs_.end()) {
+		sp_ = iter->second;
+	} else {
+		sp_ = linkProgram(variant);
+		variant_programs_[variant] = sp_;
+	}
+	variant_ = variant;
+	initUniformLocations();
 }
 
 void RenderPass::initMaterialUniform()
 {
+	unsigned facetex = face_material_tex_.get();
+	unsigned sam = sampler2d_.get();
+	std::function<unsigned()> sampler_data = [sam]() {
+		return sam;
+	};
+	std::function<unsigned()> face_data = [facetex]() {
+		return facetex;
+	};
+	std::function<unsigned()> no_sampler = []() {
+		return 0u;
+	};
 	material_uniforms_.clear();
-	for (size_t i = 0; i < input_.getNMaterials(); i++) {
-		auto& ma = input_.getMaterial(i);
-		using V4F = std::function<glm::vec4 ()>;
-		using IF = std::function<int()>;
-		using FF = std::function<float()>;
-		V4F diffuse_data = [&ma]() {
-			return ma.diffuse;
-		};
-		V4F ambient_data = [&ma]() {
-			return ma.ambient;
-		};
-		V4F specular_data = [&ma]() {
-			return ma.specular;
+	// Every element of textureArrays gets its own unit, unused ones
+	// are left empty.
+	for (int i = 0; i < kMaxTextureArrays; i++) {
+		unsigned texarray = i < int(texarrays_.size()) ? texarrays_[i] : 0;
+		std::function<unsigned()> texture_data = [texarray]() {
+			return texarray;
 		};
-		FF shininess_data = [&ma]() {
-			return ma.shininess;
-		};
-		int texid = matexids_[i];
-		int sam = sampler2d_;
-		IF texture_data = [texid]() {
-			return texid;
-		};
-		IF sampler_data = [sam]() {
-			return sam;
-		};
-		auto diffuse = make_uniform("diffuse", diffuse_data);
-		auto ambient = make_uniform("ambient", ambient_data);
-		auto specular = make_uniform("specular", specular_data);
-		auto shininess = make_uniform("shininess", shininess_data);
-		auto texture = make_texture("textureSampler", sampler_data, 0, texture_data);
-		std::vector<ShaderUniformPtr> munis =
-			{diffuse, ambient, specular, shininess, texture};
-		material_uniforms_.emplace_back(munis);
+		material_uniforms_.emplace_back(make_texture("textureArrays[" + std::to_string(i) + "]",
+		                                             sampler_data, i, texture_data,
+		                                             GL_TEXTURE_2D_ARRAY));
 	}
-	malocs_.clear();
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "diffuse")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "ambient")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "specular")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "shininess")));
-	CHECK_GL_ERROR(malocs_.emplace_back(glGetUniformLocation(sp_, "textureSampler")));
-	std::cerr << "textureSampler location: " << malocs_.back() << std::endl;
+	material_uniforms_.emplace_back(make_texture("face_material", no_sampler,
+	                                             kMaxTextureArrays, face_data,
+	                                             GL_TEXTURE_BUFFER));
 }
 
 /*
- * Create textures to gltextures_
- * and assign material specified textures to matexids_
- * 
- * Different materials may share textures
+ * Textures arrive after the geometry when a model is loaded in stages, so
+ * the texture array and the layers in the material block are rebuilt
+ * here. Face ranges do not change.
+ */
+void RenderPass::updateTextures(const std::vector<Material>& materials)
+{
+	if (!input_.hasMaterial())
+		return ;
+	for (size_t i = 0; i < std::min(materials.size(), input_.getNMaterials()); i++) {
+		input_.getMaterial(i).texture = materials[i].texture;
+		input_.getMaterial(i).texture_path = materials[i].texture_path;
+	}
+	for (unsigned texarray : texarrays_)
+		TextureCache::instance().release(texarray);
+	texarrays_.clear();
+	createMaterialTexture();
+	createMaterialBuffer();
+	initMaterialUniform();
+}
+
+/*
+ * Get texture arrays to texarrays_ from TextureCache, with one layer per
+ * distinct texture, and record the array and layer of each material to
+ * matslots_.
+ *
+ * Different materials may share textures.
+ * Layers of a texture array must have the same size, so textures go to one
+ * array per width and height. Once all kMaxTextureArrays are taken, the
+ * textures of the remaining sizes go to the last array and are resampled
+ * to the largest size in it.
  */
 void RenderPass::createMaterialTexture()
 {
-	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + 0));
-	matexids_.clear();
-	std::map<Image*, unsigned> tex2id;
+	matslots_.clear();
+	std::map<Image*, TextureSlot> tex2slot;
+	std::map<std::pair<int, int>, int> size2array;
+	std::vector<std::vector<std::shared_ptr<const Image>>> arrays;
+	std::vector<std::pair<int, int>> sizes; // Of each array
+	bool merged = false;
 	for (size_t i = 0; i < input_.getNMaterials(); i++) {
 		auto& ma = input_.getMaterial(i);
 #if 0
 		std::cerr << __func__ << " Material " << i << " has texture pointer " << ma.texture.get() << std::endl;
 #endif
 		if (!ma.texture) {
-			matexids_.emplace_back(0);
+			matslots_.emplace_back();
 			continue;
 		}
-		// Do not create multiple texture for the same data.
-		auto iter = tex2id.find(ma.texture.get());
-		if (iter != tex2id.end()) {
-			matexids_.emplace_back(iter->second);
+		// Do not create multiple layers for the same data.
+		auto iter = tex2slot.find(ma.texture.get());
+		if (iter != tex2slot.end()) {
+			matslots_.emplace_back(iter->second);
 			continue;
 		}
+		auto size = std::make_pair(ma.texture->width, ma.texture->height);
+		auto array_iter = size2array.find(size);
+		int array;
+		if (array_iter != size2array.end()) {
+			array = array_iter->second;
+		} else if (int(arrays.size()) < kMaxTextureArrays) {
+			array = int(arrays.size());
+			arrays.emplace_back();
+			sizes.emplace_back(size);
+			size2array[size] = array;
+		} else {
+			array = kMaxTextureArrays - 1;
+			sizes[array].first = std::max(sizes[array].first, size.first);
+			sizes[array].second = std::max(sizes[array].second, size.second);
+			size2array[size] = array;
+			merged = true;
+		}
+		TextureSlot slot;
+		slot.array = array;
+		slot.layer = int(arrays[array].size());
+		arrays[array].emplace_back(ma.texture);
+		tex2slot[ma.texture.get()] = slot;
+		matslots_.emplace_back(slot);
+	}
+	if (merged)
+		std::cerr << __func__ << ": textures have more than kMaxTextureArrays ("
+		          << kMaxTextureArrays << ") sizes, the rest are resampled to "
+		          << sizes.back().first << " x " << sizes.back().second << std::endl;
+
+	sampler2d_ = GLResourcePool::instance().createSampler();
+	unsigned sam = sampler2d_.get();
+	CHECK_GL_ERROR(glSamplerParameteri(sam, GL_TEXTURE_WRAP_S, GL_REPEAT));
+	CHECK_GL_ERROR(glSamplerParameteri(sam, GL_TEXTURE_WRAP_T, GL_REPEAT));
+	CHECK_GL_ERROR(glSamplerParameteri(sam, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+	CHECK_GL_ERROR(glSamplerParameteri(sam, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
 
-		// Now create and upload texture data
-		int w = ma.texture->width;
-		int h = ma.texture->height;
-		// TODO: enable stride
-		// Translate RGB to RGBA for alignment
-		std::vector<unsigned int> dummy(w*h);
-		const unsigned char* bytes = ma.texture->bytes.data();
-		for (int row = 0; row < h; row++) {
-			for (int col = 0; col < w; col++) {
-				unsigned r = bytes[row*w*3 + col*3];
-				unsigned g = bytes[row*w*3 + col*3 + 1];
-				unsigned b = bytes[row*w*3 + col*3 + 1];
-				dummy[row*w+col] = r | (g << 8) | (b << 16) | (0xFF << 24);
-			}
+	if (arrays.empty())
+		return;
+
+	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + 0));
+	for (size_t i = 0; i < arrays.size(); i++)
+		texarrays_.emplace_back(TextureCache::instance().acquireArray(arrays[i],
+		                        sizes[i].first, sizes[i].second));
+}
+
+/*
+ * Pack all materials into material_ubo_, and create a buffer texture that
+ * maps each face to its material so the geometry shader can forward the
+ * material index to the fragment shader.
+ */
+void RenderPass::createMaterialBuffer()
+{
+	size_t nmaterials = input_.getNMaterials();
+	if (nmaterials > size_t(kMaxMaterials)) {
+		std::cerr << __func__ << ": " << nmaterials << " materials exceed kMaxMaterials ("
+		          << kMaxMaterials << "), materials past it will not be drawn" << std::endl;
+		nmaterials = kMaxMaterials;
+	}
+	std::vector<MaterialBlockEntry> entries(nmaterials);
+	for (size_t i = 0; i < nmaterials; i++) {
+		const auto& ma = input_.getMaterial(i);
+		entries[i].diffuse = ma.diffuse;
+		entries[i].ambient = ma.ambient;
+		entries[i].specular = ma.specular;
+		entries[i].shininess = ma.shininess;
+		entries[i].texture_array = matslots_[i].array;
+		entries[i].texture_layer = matslots_[i].layer;
+	}
+	auto& pool = GLResourcePool::instance();
+	// The block is declared with kMaxMaterials entries, the rest is unused
+	material_ubo_ = pool.acquireBuffer(sizeof(MaterialBlockEntry) * kMaxMaterials);
+	GLResourcePool::upload(material_ubo_, GL_UNIFORM_BUFFER,
+			entries.data(),
+			sizeof(MaterialBlockEntry) * entries.size());
+	CHECK_GL_ERROR(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+
+	// Face ranges of all levels of detail are disjoint, so one buffer
+	// serves them all.
+	size_t nfaces = 0;
+	for (size_t lod = 0; lod < input_.getNLods(); lod++)
+		for (const auto& ma : input_.getLod(lod))
+			nfaces = std::max(nfaces, ma.offset + ma.nfaces);
+	std::vector<uint16_t> face_material(std::max<size_t>(nfaces, 1), 0);
+	for (size_t lod = 0; lod < input_.getNLods(); lod++) {
+		const auto& lod_materials = input_.getLod(lod);
+		for (size_t i = 0; i < std::min(nmaterials, lod_materials.size()); i++) {
+			const auto& ma = lod_materials[i];
+			std::fill(face_material.begin() + ma.offset,
+			          face_material.begin() + ma.offset + ma.nfaces,
+			          uint16_t(i));
 		}
-		GLuint tex = 0;
-		CHECK_GL_ERROR(glGenTextures(1, &tex));
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
-		CHECK_GL_ERROR(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8,
-					w,
-					h));
-		CHECK_GL_ERROR(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h,
-					GL_RGBA, GL_UNSIGNED_BYTE,
-					dummy.data()));
-		//CHECK_GL_ERROR(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
-		std::cerr << __func__ << " load data into texture " << tex <<
-			" dim: " << w << " x " << h << std::endl;
-		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
-		matexids_.emplace_back(tex);
-		tex2id[ma.texture.get()] = tex;
 	}
-	CHECK_GL_ERROR(glGenSamplers(1, &sampler2d_));
-	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_WRAP_S, GL_REPEAT));
-	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_WRAP_T, GL_REPEAT));
-	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-	CHECK_GL_ERROR(glSamplerParameteri(sampler2d_, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	size_t bytes = sizeof(uint16_t) * face_material.size();
+	face_material_buffer_ = pool.acquireBuffer(bytes);
+	GLResourcePool::upload(face_material_buffer_, GL_TEXTURE_BUFFER,
+			face_material.data(), bytes);
+	face_material_tex_ = pool.createTexture();
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, face_material_tex_.get()));
+	CHECK_GL_ERROR(glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, face_material_buffer_.get()));
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, 0));
+	CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
 }
 
+/*
+ * Buffers, samplers and the VAO go back to GLResourcePool with their
+ * handles. A recycled VAO must not keep our attribute setup, so it is
+ * reset here. The program is shared through ProgramCache and stays alive.
+ */
 RenderPass::~RenderPass()
 {
-	// TODO: Free resources
+	if (own_vao_) {
+		CHECK_GL_ERROR(glBindVertexArray(vao_));
+		for (int i = 0; i < input_.getNBuffers(); i++)
+			CHECK_GL_ERROR(glDisableVertexAttribArray(input_.getBufferMeta(i).position));
+		CHECK_GL_ERROR(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+		CHECK_GL_ERROR(glBindVertexArray(0));
+	}
+	for (unsigned texarray : texarrays_)
+		TextureCache::instance().release(texarray);
+}
+
+void RenderPass::setAttribPointer(const RenderInputMeta& meta)
+{
+	const void* offset = reinterpret_cast<const void*>(meta.offset);
+	if (meta.isInteger()) {
+		CHECK_GL_ERROR(glVertexAttribIPointer(meta.position,
+					meta.element_length,
+					meta.element_type,
+					meta.stride, offset));
+	} else {
+		CHECK_GL_ERROR(glVertexAttribPointer(meta.position,
+					meta.element_length,
+					meta.element_type,
+					meta.normalized ? GL_TRUE : GL_FALSE,
+					meta.stride, offset));
+	}
+}
+
+unsigned RenderPass::getBuffer(int position) const
+{
+	for (int i = 0; i < input_.getNBuffers(); i++) {
+		const auto& meta = input_.getBufferMeta(i);
+		if (meta.position != position)
+			continue;
+		if (meta.external_buffer)
+			return meta.external_buffer;
+		return meta.slot < int(glbuffers_.size()) ? glbuffers_[meta.slot].get() : 0;
+	}
+	return 0;
 }
 
 void RenderPass::updateVBO(int position, const void* data, size_t size)
@@ -274,10 +454,22 @@ void RenderPass::updateVBO(int position, const void* data, size_t size)
 	if (bufferid < 0)
 		throw __func__+std::string(": error, can't find buffer with position ")+std::to_string(position);
 	auto meta = input_.getBufferMeta(bufferid);
-	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[bufferid]));
-	CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-				size * meta.getElementSize(),
-				data, GL_STATIC_DRAW));
+	if (meta.external_buffer)
+		throw __func__+std::string(": error, buffer at position ")+std::to_string(position)+" is not owned by the RenderPass";
+	// For interleaved attributes this replaces all attributes in the slot
+	size_t bytes = size * meta.getVertexSize();
+	auto& buffer = glbuffers_[meta.slot];
+	if (bytes > buffer.getCapacity()) {
+		// Grow to the next size class and point the attributes to it
+		buffer = GLResourcePool::instance().acquireBuffer(bytes);
+		GLResourcePool::upload(buffer, GL_ARRAY_BUFFER, data, bytes);
+		CHECK_GL_ERROR(glBindVertexArray(vao_));
+		for (int i = 0; i < input_.getNBuffers(); i++)
+			if (input_.getBufferMeta(i).slot == meta.slot)
+				setAttribPointer(input_.getBufferMeta(i));
+		return ;
+	}
+	GLResourcePool::upload(buffer, GL_ARRAY_BUFFER, data, bytes);
 }
 
 void RenderPass::setup()
@@ -288,26 +480,93 @@ void RenderPass::setup()
 	CHECK_GL_ERROR(glUseProgram(sp_));
 
 	bindUniformsTo(uniforms_, unilocs_);
+	if (input_.hasMaterial()) {
+		bindUniformsTo(material_uniforms_, malocs_);
+		CHECK_GL_ERROR(glBindBufferBase(GL_UNIFORM_BUFFER,
+					kMaterialBlockBinding,
+					material_ubo_.get()));
+	}
 }
 
 bool RenderPass::renderWithMaterial(int mid)
 {
-	if (mid >= int(material_uniforms_.size()) || mid < 0)
+	// Past kMaxMaterials there is no MaterialBlock entry to shade with
+	if (mid >= int(input_.getNMaterials()) || mid >= kMaxMaterials || mid < 0)
 		return false;
-	const auto& mat = input_.getMaterial(mid);
-#if 0
-	if (!mat.texture)
-		return true;
-#endif
-	auto& matuni = material_uniforms_[mid];
-	bindUniformsTo(matuni, malocs_);
-	CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, mat.nfaces * 3,
-	                              GL_UNSIGNED_INT,
-	                              (const void*)(mat.offset * 3 * 4)) // Offset is in bytes
-	              );
+	drawFaces(getDrawRange(input_.getLod(lod_)[mid]));
 	return true;
 }
 
+void RenderPass::setLod(int lod)
+{
+	lod_ = std::max(0, std::min(lod, int(input_.getNLods()) - 1));
+}
+
+int RenderPass::renderAllMaterials()
+{
+	std::vector<DrawRange> ranges;
+	const auto& lod_materials = input_.getLod(lod_);
+	size_t nmaterials = std::min(lod_materials.size(), size_t(kMaxMaterials));
+	for (size_t i = 0; i < nmaterials; i++) {
+		const auto& mat = lod_materials[i];
+		if (i < visible_.size() && !visible_[i])
+			continue;
+		if (mat.nfaces > 0)
+			ranges.emplace_back(getDrawRange(mat));
+	}
+	std::sort(ranges.begin(), ranges.end(),
+	          [](const DrawRange& a, const DrawRange& b) { return a.offset < b.offset; });
+	int ndraws = 0;
+	size_t i = 0;
+	while (i < ranges.size()) {
+		DrawRange run = ranges[i];
+		size_t index_size = run.short_indices ? 2 : 4;
+		// Merge all following parts that start where this one ends, and
+		// whose indices follow in the same format.
+		for (i++; i < ranges.size(); i++) {
+			const auto& next = ranges[i];
+			if (next.offset != run.offset + run.nfaces ||
+			    next.short_indices != run.short_indices ||
+			    next.base_vertex != run.base_vertex ||
+			    next.index_offset != run.index_offset + run.nfaces * 3 * index_size)
+				break;
+			run.nfaces += next.nfaces;
+		}
+		drawFaces(run);
+		ndraws++;
+	}
+	return ndraws;
+}
+
+RenderPass::DrawRange RenderPass::getDrawRange(const Material& ma) const
+{
+	DrawRange range;
+	range.offset = ma.offset;
+	range.nfaces = ma.nfaces;
+	if (input_.hasPackedIndex()) {
+		range.index_offset = ma.index_offset;
+		range.short_indices = ma.short_indices;
+		range.base_vertex = ma.base_vertex;
+	} else {
+		range.index_offset = ma.offset * 3 * 4;
+	}
+	return range;
+}
+
+void RenderPass::drawFaces(const DrawRange& range)
+{
+	CHECK_GL_ERROR(bindUniform(face_base_loc_, int(range.offset)));
+	GLenum type = range.short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	const void* indices = (const void*)range.index_offset; // Offset is in bytes
+	if (ninstances_ > 1) {
+		CHECK_GL_ERROR(glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.nfaces * 3,
+		                              type, indices, ninstances_, range.base_vertex));
+	} else {
+		CHECK_GL_ERROR(glDrawElementsBaseVertex(GL_TRIANGLES, range.nfaces * 3,
+		                              type, indices, range.base_vertex));
+	}
+}
+
 void RenderPass::bindUniformsTo(std::vector<ShaderUniformPtr>& uniforms,
                                 const std::vector<unsigned>& unilocs)
 {
@@ -317,23 +576,101 @@ void RenderPass::bindUniformsTo(std::vector<ShaderUniformPtr>& uniforms,
 	}
 }
 
-unsigned RenderPass::compileShader(const char* source_ptr, int type)
+/*
+ * Get the program of the given variant from ProgramCache, or compile and
+ * link it on a miss.
+ *
+ * Attribute and output locations are part of the cache key since they are
+ * baked into the linked program.
+ */
+unsigned RenderPass::linkProgram(int variant)
+{
+	std::vector<std::string> sources;
+	std::vector<const char*> source_ptrs;
+	for (const char* shader : shaders_)
+		sources.emplace_back(shader ? getVariantSource(shader, variant) : std::string());
+	for (size_t i = 0; i < shaders_.size(); i++)
+		source_ptrs.emplace_back(shaders_[i] ? sources[i].c_str() : nullptr);
+
+	auto& cache = ProgramCache::instance();
+	uint64_t key = cache.makeKey(source_ptrs, attribs_, output_, feedback_);
+	unsigned sp = cache.find(key);
+	if (sp)
+		return sp;
+
+	vs_ = compileShader(shaders_[0], GL_VERTEX_SHADER, variant);
+	gs_ = compileShader(shaders_[1], GL_GEOMETRY_SHADER, variant);
+	fs_ = compileShader(shaders_[2], GL_FRAGMENT_SHADER, variant);
+	CHECK_GL_ERROR(sp = glCreateProgram());
+	glAttachShader(sp, vs_);
+	if (shaders_[2])
+		glAttachShader(sp, fs_);
+	if (shaders_[1])
+		glAttachShader(sp, gs_);
+	for (const auto& attrib : attribs_)
+		CHECK_GL_ERROR(glBindAttribLocation(sp, attrib.first, attrib.second.c_str()));
+	for (size_t i = 0; i < output_.size(); i++) {
+		CHECK_GL_ERROR(glBindFragDataLocation(sp, i, output_[i]));
+	}
+	if (!feedback_.empty())
+		CHECK_GL_ERROR(glTransformFeedbackVaryings(sp, feedback_.size(),
+					feedback_.data(), GL_INTERLEAVED_ATTRIBS));
+	cache.prepareForLink(sp);
+	glLinkProgram(sp);
+	CHECK_GL_PROGRAM_ERROR(sp);
+	cache.store(key, sp);
+	return sp;
+}
+
+std::string RenderPass::getVariantSource(const char* source, int variant)
+{
+	if (variant == 0)
+		return std::string(source);
+	return addDefine(source, "SHADER_NUM " + std::to_string(variant));
+}
+
+/*
+ * The #define goes right after the #version directive, which must stay
+ * the first statement of a GLSL shader.
+ */
+std::string RenderPass::addDefine(const char* source, const std::string& macro)
+{
+	std::string ret(source);
+	std::string define = "#define " + macro + "\n";
+	size_t pos = ret.find("#version");
+	if (pos == std::string::npos) {
+		ret.insert(0, define);
+		return ret;
+	}
+	pos = ret.find('\n', pos);
+	if (pos == std::string::npos) {
+		ret += "\n" + define;
+		return ret;
+	}
+	ret.insert(pos + 1, define);
+	return ret;
+}
+
+unsigned RenderPass::compileShader(const char* source_ptr, int type, int variant)
 {
 	if (!source_ptr)
 		return 0;
-	auto iter = shader_cache_.find(source_ptr);
+	auto key = std::make_pair(source_ptr, variant);
+	auto iter = shader_cache_.find(key);
 	if (iter != shader_cache_.end()) {
 		return iter->second;
 	}
+	std::string source = getVariantSource(source_ptr, variant);
+	const char* source_str = source.c_str();
 	GLuint ret = 0;
 	CHECK_GL_ERROR(ret = glCreateShader(type));
 #if 0
-	std::cerr << __func__ << " shader id " << ret << " type " << type << "\tsource:\n" << source_ptr << std::endl;
+	std::cerr << __func__ << " shader id " << ret << " type " << type << "\tsource:\n" << source_str << std::endl;
 #endif
-	CHECK_GL_ERROR(glShaderSource(ret, 1, &source_ptr, nullptr));
+	CHECK_GL_ERROR(glShaderSource(ret, 1, &source_str, nullptr));
 	glCompileShader(ret);
 	CHECK_GL_SHADER_ERROR(ret);
-	shader_cache_[source_ptr] = ret;
+	shader_cache_[key] = ret;
 	return ret;
 }
 
@@ -345,6 +682,74 @@ void RenderDataInput::assign(int position,
                              int element_type)
 {
 	meta_.emplace_back(position, name, data, nelements, element_length, element_type);
+	meta_.back().slot = nslots_++;
+}
+
+void RenderDataInput::assign(int position,
+                             const std::string& name,
+                             const Writer& fill,
+                             size_t nelements,
+                             size_t element_length,
+                             int element_type)
+{
+	assign(position, name, static_cast<const void*>(nullptr), nelements, element_length, element_type);
+	meta_.back().writer = fill;
+}
+
+void RenderDataInput::assignInterleaved(const VertexLayout& layout,
+                                        const Writer& fill,
+                                        size_t nvertices)
+{
+	// Only the first attribute of the slot writes the buffer
+	size_t first = meta_.size();
+	assignInterleaved(layout, static_cast<const void*>(nullptr), nvertices);
+	if (first < meta_.size())
+		meta_[first].writer = fill;
+}
+
+void RenderDataInput::assignInterleavedBuffer(const VertexLayout& layout,
+                                              unsigned buffer,
+                                              size_t nvertices)
+{
+	for (const auto& attr : layout.getAttributes()) {
+		assignBuffer(attr.position, attr.name, buffer, nvertices,
+		             attr.element_length, attr.element_type,
+		             layout.getStride(), attr.offset);
+		meta_.back().normalized = attr.normalized;
+	}
+}
+
+void RenderDataInput::assignInterleaved(const VertexLayout& layout,
+                                        const void *data,
+                                        size_t nvertices)
+{
+	for (const auto& attr : layout.getAttributes()) {
+		meta_.emplace_back(attr.position, attr.name, data, nvertices,
+		                   attr.element_length, attr.element_type);
+		auto& meta = meta_.back();
+		meta.normalized = attr.normalized;
+		meta.slot = nslots_;
+		meta.stride = layout.getStride();
+		meta.offset = attr.offset;
+	}
+	nslots_++;
+}
+
+void RenderDataInput::assignBuffer(int position,
+                                   const std::string& name,
+                                   unsigned buffer,
+                                   size_t nelements,
+                                   size_t element_length,
+                                   int element_type,
+                                   size_t stride,
+                                   size_t offset)
+{
+	meta_.emplace_back(position, name, nullptr, nelements, element_length, element_type);
+	auto& meta = meta_.back();
+	meta.slot = nslots_++;
+	meta.stride = stride;
+	meta.offset = offset;
+	meta.external_buffer = buffer;
 }
 
 void RenderDataInput::assignIndex(const void *data, size_t nelements, size_t element_length)
@@ -353,6 +758,21 @@ void RenderDataInput::assignIndex(const void *data, size_t nelements, size_t ele
 	*index_meta_ = {-1, "", data, nelements, element_length, GL_UNSIGNED_INT};
 }
 
+void RenderDataInput::assignPackedIndex(const void *data, size_t bytes)
+{
+	has_index_ = true;
+	packed_index_ = true;
+	*index_meta_ = {-1, "", data, bytes, 1, GL_UNSIGNED_BYTE};
+}
+
+void RenderDataInput::useLods(const std::vector<std::vector<Material>>& lods)
+{
+	if (lods.empty())
+		return ;
+	useMaterials(lods.front());
+	lods_ = lods;
+}
+
 int RenderDataInput::getNBuffers() const
 {
 	return int(meta_.size());
@@ -374,14 +794,7 @@ RenderDataInput::getBufferMeta(int i) const
 
 size_t RenderInputMeta::getElementSize() const
 {
-	size_t element_size = 4;
-	if (element_type == GL_FLOAT)
-		element_size = 4;
-	else if (element_type == GL_UNSIGNED_INT)
-		element_size = 4;
-	else if (element_type == GL_INT)
-		element_size = 4;
-	return element_size * element_length;
+	return getGLTypeSize(element_type, element_length);
 }
 
-std::map<const char*, unsigned> RenderPass::shader_cache_;
+std::map<std::pair<const char*, int>, unsigned> RenderPass::shader_cache_;
@@ -14,12 +14,15 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <functional>
 #include <material.h> // header from utgraphicsutil
 #include "shader_uniform.h"
+#include "gl_resource.h"
 
 struct RenderInputMeta;
+class VertexLayout;
 
 /*
  * RenderDataInput: describe per-vertex attribute buffers used by RenderPass
@@ -29,6 +32,13 @@ public:
 	RenderDataInput();
 	~RenderDataInput();
 
+	/*
+	 * Writer: produces the data of a buffer into the mapped GL buffer
+	 * (see GLResourcePool::fill). It runs once, while the RenderPass is
+	 * constructed, so it may capture locals of the caller by reference.
+	 */
+	typedef std::function<void(void* dst)> Writer;
+
 	/*
 	 * assign: assign per-vertex attribute data
 	 *      position: glVertexAttribPointer position 
@@ -36,6 +46,7 @@ public:
 	 *      nelements: number of elements
 	 *      element_length: element dimension, e.g. for vec3 it's 3
 	 *      element_type: GL_FLOAT or GL_UNSIGNED_INT
+	 * Each assign() call creates its own GL buffer.
 	 */
 	void assign(int position,
 	            const std::string& name,
@@ -43,6 +54,44 @@ public:
 	            size_t nelements,
 	            size_t element_length,
 	            int element_type);
+	/* assign: the same, with the data written by fill, no CPU copy is kept */
+	void assign(int position,
+	            const std::string& name,
+	            const Writer& fill,
+	            size_t nelements,
+	            size_t element_length,
+	            int element_type);
+	/*
+	 * assignInterleaved: assign one buffer holding every attribute of
+	 * layout, nvertices * layout.getStride() bytes in total.
+	 */
+	void assignInterleaved(const VertexLayout& layout,
+	                       const void *data,
+	                       size_t nvertices);
+	void assignInterleaved(const VertexLayout& layout,
+	                       const Writer& fill,
+	                       size_t nvertices);
+	/*
+	 * assignInterleavedBuffer: the attributes of layout in an existing GL
+	 * buffer, e.g. one already uploaded by another RenderPass (see
+	 * RenderPass::getBuffer).
+	 */
+	void assignInterleavedBuffer(const VertexLayout& layout,
+	                             unsigned buffer,
+	                             size_t nvertices);
+	/*
+	 * assignBuffer: use an existing GL buffer, e.g. the output of a
+	 * transform feedback pass, as per-vertex attribute. RenderPass neither
+	 * owns nor uploads it.
+	 */
+	void assignBuffer(int position,
+	                  const std::string& name,
+	                  unsigned buffer,
+	                  size_t nelements,
+	                  size_t element_length,
+	                  int element_type,
+	                  size_t stride = 0,
+	                  size_t offset = 0);
 	/*
 	 * assign_index: assign the index buffer for vertices
 	 * This will bind the data to GL_ELEMENT_ARRAY_BUFFER
@@ -53,6 +102,21 @@ public:
 	 * useMaterials: assign materials to the input data
 	 */
 	void useMaterials(const std::vector<Material>& );
+	/*
+	 * assignPackedIndex: assign an index buffer with mixed 16 and 32-bit
+	 * indices. Its layout is given by Material::index_offset,
+	 * Material::base_vertex and Material::short_indices, so materials must
+	 * be used as well.
+	 */
+	void assignPackedIndex(const void *data, size_t bytes);
+	bool hasPackedIndex() const { return packed_index_; }
+	/*
+	 * useLods: assign materials with one set of face ranges per level of
+	 * detail, lods[0] being the full mesh (see Mesh::lods).
+	 */
+	void useLods(const std::vector<std::vector<Material>>& lods);
+	size_t getNLods() const { return std::max<size_t>(lods_.size(), 1); }
+	const std::vector<Material>& getLod(size_t lod) const { return lods_.empty() ? materials_ : lods_[lod]; }
 
 	int getNBuffers() const;
 	const RenderInputMeta& getBufferMeta(int i) const;
@@ -65,9 +129,12 @@ public:
 	Material& getMaterial(size_t id) { return materials_[id]; }
 private:
 	std::vector<RenderInputMeta> meta_;
+	int nslots_ = 0;
 	std::vector<Material> materials_;
+	std::vector<std::vector<Material>> lods_;
 	std::shared_ptr<RenderInputMeta> index_meta_;
 	bool has_index_ = false;
+	bool packed_index_ = false;
 };
 
 class RenderPass {
@@ -79,6 +146,9 @@ public:
 	 *      shaders: array of shaders, leave the second as nullptr if no GS present
 	 *      uniforms: array of ShaderUniform objects
 	 *      output: the FS output variable name.
+	 *      feedback: varyings captured by transform feedback, interleaved
+	 *                in one buffer. Leave the FS as nullptr for a pass
+	 *                that only captures vertices.
 	 * RenderPass does not support render-to-texture or multi-target
 	 * rendering for now (and you also don't need it).
 	 */
@@ -86,13 +156,33 @@ public:
 	           const RenderDataInput& input,
 	           const std::vector<const char*> shaders, // Order: VS, GS, FS 
 	           const std::vector<ShaderUniformPtr> uniforms,
-	           const std::vector<const char*> output // Order: 0, 1, 2...
+	           const std::vector<const char*> output, // Order: 0, 1, 2...
+	           const std::vector<const char*> feedback = {}
 		  );
 	~RenderPass();
 
 	unsigned getVAO() const { return unsigned(vao_); }
+	/*
+	 * getBuffer: the GL buffer holding the attribute at position, for
+	 * other passes to share with assignBuffer. 0 if there is none.
+	 */
+	unsigned getBuffer(int position) const;
 	void updateVBO(int position, const void* data, size_t nelement);
 	void setup();
+	/*
+	 * useVariant: switch to the program compiled with
+	 *         #define SHADER_NUM variant
+	 * injected after the #version line of every shader. Variants are
+	 * compiled on first use and kept for the lifetime of the RenderPass.
+	 * The default variant 0 uses the shader sources unmodified.
+	 */
+	void useVariant(int variant);
+	int getVariant() const { return variant_; }
+	/*
+	 * addDefine: return source with "#define macro" inserted after the
+	 * #version line, for shaders that are compiled in several modes.
+	 */
+	static std::string addDefine(const char* source, const std::string& macro);
 	/*
  	 * Note: here we don't have an unified render() function, because the
 	 * reference solution renders with different primitives
@@ -102,27 +192,100 @@ public:
 	 */
 
 	/*
-	 * renderWithMaterial: render a part of vertex buffer, after binding
-	 * corresponding uniforms for Phong shading.
+	 * renderWithMaterial: render a part of vertex buffer. Phong shading
+	 * parameters are fetched by the shader from the material UBO, hence
+	 * only the first face of the part is passed as an uniform.
 	 */
 	bool renderWithMaterial(int i); // return false if material id is invalid
+	/*
+	 * renderAllMaterials: render all parts with as few draw calls as
+	 * possible. Parts that are adjacent in the index buffer and share
+	 * their base vertex and index format are merged into one submission;
+	 * Mesh::packIndices lays out the parts of a level that way.
+	 * Return: the number of draw calls issued.
+	 */
+	int renderAllMaterials();
+	/*
+	 * setLod: choose the level of detail used by renderWithMaterial and
+	 * renderAllMaterials. Clamped to the available levels.
+	 */
+	void setLod(int lod);
+	int getLod() const { return lod_; }
+	/*
+	 * setMaterialVisibility: materials with visible[i] == 0 are skipped
+	 * by renderAllMaterials. Pass an empty vector to draw all materials.
+	 */
+	void setMaterialVisibility(const std::vector<uint8_t>& visible) { visible_ = visible; }
+	/*
+	 * setInstances: draw every part n times with one instanced draw call,
+	 * the shaders tell the copies apart by gl_InstanceID.
+	 */
+	void setInstances(int n) { ninstances_ = std::max(n, 1); }
+	int getInstances() const { return ninstances_; }
+	/*
+	 * updateTextures: take Material::texture of materials[i] for material
+	 * i, e.g. once a model loaded in stages has its textures.
+	 */
+	void updateTextures(const std::vector<Material>& materials);
 private:
+	void initUniformLocations();
 	void initMaterialUniform();
 	void createMaterialTexture();
+	void createMaterialBuffer();
+	/*
+	 * DrawRange: faces [offset, offset + nfaces) and where their indices
+	 * are in the index buffer.
+	 */
+	struct DrawRange {
+		size_t offset = 0;
+		size_t nfaces = 0;
+		size_t index_offset = 0; // In bytes
+		bool short_indices = false;
+		int base_vertex = 0;
+	};
+	DrawRange getDrawRange(const Material& ma) const;
+	void drawFaces(const DrawRange& range);
+	void setAttribPointer(const RenderInputMeta& meta);
 
 	int vao_;
 	RenderDataInput input_;
 	std::vector<ShaderUniformPtr> uniforms_;
-	std::vector<std::vector<ShaderUniformPtr>> material_uniforms_;
+	std::vector<ShaderUniformPtr> material_uniforms_;
 
-	std::vector<unsigned> glbuffers_, unilocs_, malocs_;
-	std::vector<unsigned> gltextures_, matexids_;
-	unsigned sampler2d_;
+	GLResource own_vao_; // Empty if the VAO was given by the caller
+	std::vector<GLResource> glbuffers_; // One per slot, then the index buffer
+	std::vector<unsigned> unilocs_, malocs_;
+	/*
+	 * TextureSlot: where the texture of a material is, -1: none.
+	 * Layers of a texture array share one size, so textures are grouped
+	 * into one array per size.
+	 */
+	struct TextureSlot {
+		int array = -1;
+		int layer = -1;
+	};
+	std::vector<TextureSlot> matslots_; // One per material
+	std::vector<unsigned> texarrays_; // Owned by TextureCache
+	GLResource material_ubo_;
+	GLResource face_material_buffer_, face_material_tex_;
+	int face_base_loc_ = -1;
+	int lod_ = 0;
+	std::vector<uint8_t> visible_;
+	int ninstances_ = 1;
+	GLResource sampler2d_;
 	unsigned vs_ = 0, gs_ = 0, fs_ = 0;
 	unsigned sp_ = 0;
+	int variant_ = 0;
+	std::map<int, unsigned> variant_programs_;
+	std::vector<const char*> shaders_;
+	std::vector<std::pair<int, std::string>> attribs_;
+	std::vector<const char*> output_;
+	std::vector<const char*> feedback_;
 	
-	static unsigned compileShader(const char*, int type);
-	static std::map<const char*, unsigned> shader_cache_;
+	unsigned linkProgram(int variant);
+	static std::string getVariantSource(const char* source, int variant);
+	static unsigned compileShader(const char*, int type, int variant = 0);
+	static std::map<std::pair<const char*, int>, unsigned> shader_cache_;
 
 	static void bindUniformsTo(std::vector<ShaderUniformPtr>& uniforms,
 	                           const std::vector<unsigned>& unilocs);
@@ -69,7 +69,7 @@ void TextureCombo::bind(unsigned loc)
 	// Assign texture object to texture unit
 	unsigned tex = texture_source();
 	CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + texture_unit));
-	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
+	CHECK_GL_ERROR(glBindTexture(target, tex));
 
 	// Set the OpenGL sampler used by the texture unit
 	unsigned sam = sampler_source();
@@ -83,12 +83,15 @@ std::shared_ptr<TextureCombo>
 make_texture(const std::string& name,
              std::function<unsigned()> sampler_source,
              unsigned texture_unit,
-             std::function<unsigned()> texture_source)
+             std::function<unsigned()> texture_source,
+             unsigned target)
 {
 	auto ret = std::make_shared<TextureCombo>();
+	ret->name = name;
 	ret->sampler_source = sampler_source;
 	ret->texture_unit = texture_unit;
 	ret->texture_source = texture_source;
+	ret->target = target;
 	return ret;
 }
 
@@ -80,6 +80,7 @@ struct TextureCombo : public ShaderUniformBase {
 	std::function<unsigned()> sampler_source;
 	unsigned texture_unit;
 	std::function<unsigned()> texture_source;
+	unsigned target = GL_TEXTURE_2D; // e.g. GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER
 	virtual void bind(unsigned loc) override;
 };
 
@@ -87,6 +88,7 @@ std::shared_ptr<TextureCombo>
 make_texture(const std::string& name,
              std::function<unsigned()> sampler_source,
              unsigned texture_unit,
-             std::function<unsigned()> texture_source);
+             std::function<unsigned()> texture_source,
+             unsigned target = GL_TEXTURE_2D);
 
 #endif
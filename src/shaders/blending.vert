@@ -1,51 +1,92 @@
 R"zzz(
 #version 330 core
+// SHADER_NUM is injected by RenderPass::useVariant, one bit per effect.
+#ifndef SHADER_NUM
+#define SHADER_NUM 0
+#endif
+// Skin pass: the result is captured with transform feedback by SkinCache
+// and drawn with default.vert.
+// With CROWD defined this draws instances directly instead: each row
+// gl_InstanceID of joint_palette holds the instance transform (texels 0-3),
+// its animation time (texel 4), then translation and rotation of every
+// joint (see Crowd).
+// With FOUR_JOINTS every vertex has up to four joints (PMX BDEF4), sorted
+// by weight, and vertices with only two of them skip the other two.
+#ifdef CROWD
+uniform sampler2D joint_palette;
 uniform vec4 light_position;
 uniform vec3 camera_position;
+float time_since_start;
 
+vec4 paletteFetch(int x) {
+	return texelFetch(joint_palette, ivec2(x, gl_InstanceID), 0);
+}
+#define JOINT_TRANS(j) paletteFetch(5 + 2 * int(j)).xyz
+#define JOINT_ROT(j) paletteFetch(6 + 2 * int(j))
+#else
+// kMaxBones in config.h, Mesh::loadSkeleton rejects larger skeletons
 uniform vec3 joint_trans[128];
 uniform vec4 joint_rot[128];
-uniform mat4 deform_inv[128];
-uniform int shader_num;
 uniform float time_since_start;
+#define JOINT_TRANS(j) joint_trans[j]
+#define JOINT_ROT(j) joint_rot[j]
+#endif
 
-in int jid0;
-in int jid1;
-in float w0;
+#ifdef FOUR_JOINTS
+in uvec4 jids;
+in vec4 weights;
+in vec3 vector_from_joint2;
+in vec3 vector_from_joint3;
+#else
+in uvec2 jids;
+in float weights;
+#endif
 in vec3 vector_from_joint0;
 in vec3 vector_from_joint1;
 in vec4 normal;
-in vec2 uv;
 in vec4 vert;
 
+#ifdef CROWD
+in vec2 uv;
 out vec4 vs_light_direction;
 out vec4 vs_normal;
 out vec2 vs_uv;
 out vec4 vs_camera_direction;
+#else
+out vec4 skinned_position;
+out vec4 skinned_normal;
+#endif
 
 vec3 qtransform(vec4 q, vec3 v) {
 	return v + 2.0 * cross(cross(v, q.xyz) - q.w*v, q.xyz);
 }
 
 void main() {
-	// FIXME: Implement linear skinning here
-	float w1 = 1 - w0;
-	vec3 newv_from_j0 = qtransform(joint_rot[jid0], vector_from_joint0);
-	vec3 pos1 = joint_trans[jid0] + newv_from_j0;
-	gl_Position = vec4(pos1.x * w0, pos1.y * w0, pos1.z *w0, 1);
-	
-	if (jid1 >= 0){
-		vec3 newv_from_j1 = qtransform(joint_rot[jid1], vector_from_joint1);
-		vec3 pos2 = joint_trans[jid1] + newv_from_j1;
-		gl_Position += vec4(pos2.x * w1, pos2.y * w1, pos2.z * w1, 1);
+#ifdef CROWD
+	time_since_start = paletteFetch(4).x;
+#endif
+#ifdef FOUR_JOINTS
+	// unorm16 weights do not add up to exactly one
+	vec4 w = weights / dot(weights, vec4(1.0));
+#else
+	vec2 w = vec2(weights, 1 - weights);
+#endif
+	vec3 pos = w.x * (JOINT_TRANS(jids.x) + qtransform(JOINT_ROT(jids.x), vector_from_joint0));
+	// Single joint vertices have jids.y == jids.x and w.y == 0
+	pos += w.y * (JOINT_TRANS(jids.y) + qtransform(JOINT_ROT(jids.y), vector_from_joint1));
+	vec3 n = w.x * qtransform(JOINT_ROT(jids.x), normal.xyz) +
+	         w.y * qtransform(JOINT_ROT(jids.y), normal.xyz);
+#ifdef FOUR_JOINTS
+	if (w.z > 0.0) {
+		pos += w.z * (JOINT_TRANS(jids.z) + qtransform(JOINT_ROT(jids.z), vector_from_joint2));
+		n += w.z * qtransform(JOINT_ROT(jids.z), normal.xyz);
+		if (w.w > 0.0) {
+			pos += w.w * (JOINT_TRANS(jids.w) + qtransform(JOINT_ROT(jids.w), vector_from_joint3));
+			n += w.w * qtransform(JOINT_ROT(jids.w), normal.xyz);
+		}
 	}
-	
-	gl_Position.w = 1;
-	
-	vs_normal = normal;
-	vs_light_direction = light_position - gl_Position;
-	vs_camera_direction = vec4(camera_position, 1.0) - gl_Position;
-	vs_uv = uv;
+#endif
+	gl_Position = vec4(pos, 1);
 
 	float factor = sin(time_since_start);
 	factor = factor + 1;
@@ -53,7 +94,8 @@ void main() {
 	float factor_inv = 1 - factor;
 
 	// sphere deformation shader
-	if (shader_num % 2 == 1){
+#if SHADER_NUM % 2 == 1
+	{
 		vec3 center = vec3(0,13, 0);
 		vec3 pos = vec3(vert.x, vert.y, vert.z);
 		vec3 dir = pos - center;
@@ -62,9 +104,10 @@ void main() {
 		vec3 newPos = (center + dir);
 		gl_Position = (factor_inv * gl_Position) + (factor * vec4(newPos.x, newPos.y, newPos.z, 1));
 	}
+#endif
 
 	// cube deformation shader
-	/*if ((shader_num % 512)/256 == 1){
+	/*if ((SHADER_NUM % 512)/256 == 1){
 		vec3 center = vec3(0,13, 0);
 		vec3 pos = vec3(vert.x, vert.y, vert.z);
 		vec3 dir = pos - center;
@@ -78,23 +121,42 @@ void main() {
 	}*/
 
 	// wiggly shader
-	if ((shader_num % 32)/16 != 0){
+#if (SHADER_NUM % 32)/16 != 0
+	{
 		gl_Position.y = gl_Position.y + sin(gl_Position.x + time_since_start * 5);
 	}
+#endif
 
 	//miku miku bounce (wiggly in the z direction)
-	if ((shader_num % 64)/32 != 0){
+#if (SHADER_NUM % 64)/32 != 0
+	{
 		gl_Position.y = gl_Position.y + sin(gl_Position.z + time_since_start * 5);
 	}
+#endif
 
 	//"Walk cycle" shader
-	if ((shader_num % 128)/64 != 0){
+#if (SHADER_NUM % 128)/64 != 0
+	{
 		gl_Position.y = gl_Position.y + sin(gl_Position.x) * sin(time_since_start * 3);
 	}
+#endif
 
-	if ((shader_num % 4096)/2048 != 0){
+#if (SHADER_NUM % 4096)/2048 != 0
+	{
 		gl_Position.y = gl_Position.y + gl_Position.y * (.5 + .5 * sin(time_since_start * 3));
 	}
-
+#endif
+#ifdef CROWD
+	mat4 instance_model = mat4(paletteFetch(0), paletteFetch(1),
+	                           paletteFetch(2), paletteFetch(3));
+	gl_Position = instance_model * gl_Position;
+	vs_normal = vec4(normalize(mat3(instance_model) * n), normal.w);
+	vs_light_direction = light_position - gl_Position;
+	vs_camera_direction = vec4(camera_position, 1.0) - gl_Position;
+	vs_uv = uv;
+#else
+	skinned_position = gl_Position;
+	skinned_normal = vec4(normalize(n), normal.w);
+#endif
 }
 )zzz"
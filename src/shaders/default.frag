@@ -1,25 +1,59 @@
 R"zzz(
 #version 330 core
+// SHADER_NUM is injected by RenderPass::useVariant, one bit per effect.
+#ifndef SHADER_NUM
+#define SHADER_NUM 0
+#endif
 in vec4 face_normal;
 in vec4 vertex_normal;
 in vec4 light_direction;
 in vec4 camera_direction;
 in vec2 uv_coords;
-uniform vec4 diffuse;
-uniform vec4 ambient;
-uniform vec4 specular;
-uniform float shininess;
+flat in int material_index;
+struct MaterialData {
+	vec4 diffuse;
+	vec4 ambient;
+	vec4 specular;
+	float shininess;
+	int texture_array;
+	int texture_layer;
+};
+layout(std140) uniform MaterialBlock {
+	MaterialData materials[256]; // kMaxMaterials
+};
 uniform float alpha;
-uniform sampler2D textureSampler;
-uniform int shader_num;
+uniform sampler2DArray textureArrays[4]; // kMaxTextureArrays, one per texture size
 uniform float time_since_start;
 out vec4 fragment_color;
 
+// GLSL 3.30 only indexes sampler arrays with constant expressions
+vec3 sampleTexture(int array, int layer)
+{
+	vec3 coords = vec3(uv_coords, layer);
+	if (array == 0)
+		return texture(textureArrays[0], coords).xyz;
+	else if (array == 1)
+		return texture(textureArrays[1], coords).xyz;
+	else if (array == 2)
+		return texture(textureArrays[2], coords).xyz;
+	else if (array == 3)
+		return texture(textureArrays[3], coords).xyz;
+	return vec3(0.0);
+}
+
 float rand(vec2 co){
     return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453);
 }
 void main() {
-	vec3 texcolor = texture(textureSampler, uv_coords).xyz;
+	vec4 diffuse = materials[material_index].diffuse;
+	vec4 ambient = materials[material_index].ambient;
+	vec4 specular = materials[material_index].specular;
+	float shininess = materials[material_index].shininess;
+	int texture_array = materials[material_index].texture_array;
+	int texture_layer = materials[material_index].texture_layer;
+	vec3 texcolor = vec3(0.0);
+	if (texture_layer >= 0)
+		texcolor = sampleTexture(texture_array, texture_layer);
 	float intensity = dot(vertex_normal, camera_direction);
 
 	float is = 0.5f;
@@ -37,7 +71,8 @@ void main() {
 	}
 
 	// metal shader (failed toon shader)
-	if ((shader_num % 16)/8 == 1){
+#if (SHADER_NUM % 16)/8 == 1
+	{
 		vec3 temp_color = vec3(fragment_color);
 		//temp_color = temp_color * 0.1;
 		
@@ -53,9 +88,11 @@ void main() {
 		}
 		fragment_color = vec4(temp_color.x, temp_color.y, temp_color.z, fragment_color.w);
 	}
+#endif
 
 	// toon shader 
-	if ((shader_num % 256)/128 == 1){
+#if (SHADER_NUM % 256)/128 == 1
+	{
 		vec3 temp_color = vec3(diffuse);
 		//temp_color = temp_color * 0.1;
 		
@@ -71,9 +108,11 @@ void main() {
 		}
 		fragment_color = vec4(temp_color.x, temp_color.y, temp_color.z, fragment_color.w);
 	}
+#endif
 
 	// iradescent shader
-	if ((shader_num % 1024)/512 != 0){
+#if (SHADER_NUM % 1024)/512 != 0
+	{
 		float t_lambertian = dot(camera_direction, vertex_normal);
 		vec4 a = vec4(0, 1, 0.6, alpha);
 		vec4 b = vec4(0.96, 0.86, 0.3, alpha);
@@ -82,24 +121,31 @@ void main() {
 		fragment_color = a + b * cos(2 * 3.141592645 * (c * t_lambertian + d) + time_since_start * 3);
 		fragment_color.w = alpha;
 	}
+#endif
 
 	// flat shader
-	if ((shader_num % 2048)/1024 != 0 || ((shader_num % 8192)/4096 != 0)){
+#if (SHADER_NUM % 2048)/1024 != 0 || ((SHADER_NUM % 8192)/4096 != 0)
+	{
 		fragment_color = vec4(diffuse.x, diffuse.y, diffuse.z, fragment_color.w);
 	}
+#endif
 
 	// black and white shader
 	float color_mag = fragment_color.x + fragment_color.y + fragment_color.z;
-	if ((shader_num % 4)/2 != 0){
+#if (SHADER_NUM % 4)/2 != 0
+	{
 		fragment_color = vec4(color_mag/3, color_mag/3, color_mag/3, alpha);
 	}
+#endif
 
 	// outline shader
-	if ((shader_num % 8)/4 != 0){
+#if (SHADER_NUM % 8)/4 != 0
+	{
 		if (dot(camera_direction, vertex_normal) < 0.2)
 		{
 			fragment_color = vec4(1, 1, 1, alpha);
 		}
 	}
+#endif
 }
 )zzz"
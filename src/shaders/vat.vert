@@ -0,0 +1,52 @@
+R"zzz(
+#version 330 core
+// Vertex animation texture playback for far crowd instances (see VatClip):
+// every vertex was skinned per frame on the CPU, so a vertex costs two
+// fetches per texture and a lerp. Frame f of vertex v is the texel
+// (v % vat_width, f * vat_rows + v / vat_width).
+// Instance transform and time come from the header texels of row
+// gl_InstanceID + instance_base of joint_palette (see Crowd).
+uniform sampler2D vat_positions;
+uniform sampler2D vat_normals;
+uniform int vat_width;
+uniform int vat_rows;
+uniform int vat_nframes;
+uniform float vat_duration;
+uniform vec3 vat_origin;
+uniform sampler2D joint_palette;
+uniform int instance_base;
+uniform vec4 light_position;
+uniform vec3 camera_position;
+in vec2 uv;
+out vec4 vs_light_direction;
+out vec4 vs_normal;
+out vec2 vs_uv;
+out vec4 vs_camera_direction;
+
+vec4 paletteFetch(int x) {
+	return texelFetch(joint_palette, ivec2(x, gl_InstanceID + instance_base), 0);
+}
+
+ivec2 vatTexel(int frame) {
+	return ivec2(gl_VertexID % vat_width, frame * vat_rows + gl_VertexID / vat_width);
+}
+
+void main() {
+	float f = fract(paletteFetch(4).x / vat_duration) * float(vat_nframes);
+	int f0 = min(int(f), vat_nframes - 1);
+	int f1 = (f0 + 1) % vat_nframes;
+	float a = f - float(f0);
+	vec3 pos = mix(texelFetch(vat_positions, vatTexel(f0), 0).xyz,
+	               texelFetch(vat_positions, vatTexel(f1), 0).xyz, a) + vat_origin;
+	vec3 n = mix(texelFetch(vat_normals, vatTexel(f0), 0).xyz,
+	             texelFetch(vat_normals, vatTexel(f1), 0).xyz, a);
+
+	mat4 instance_model = mat4(paletteFetch(0), paletteFetch(1),
+	                           paletteFetch(2), paletteFetch(3));
+	gl_Position = instance_model * vec4(pos, 1.0);
+	vs_normal = vec4(normalize(mat3(instance_model) * n), 0.0);
+	vs_light_direction = light_position - gl_Position;
+	vs_camera_direction = vec4(camera_position, 1.0) - gl_Position;
+	vs_uv = uv;
+}
+)zzz"
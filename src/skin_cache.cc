@@ -0,0 +1,87 @@
+#include <GL/glew.h>
+#include "skin_cache.h"
+#include <debuggl.h>
+#include <algorithm>
+
+constexpr size_t SkinCache::kStride;
+constexpr size_t SkinCache::kPositionOffset;
+constexpr size_t SkinCache::kNormalOffset;
+
+SkinCache::SkinCache(const RenderDataInput& input,
+                     size_t nvertices,
+                     const char* skin_shader,
+                     const std::vector<ShaderUniformPtr>& uniforms)
+	: nvertices_(nvertices)
+{
+	pass_.reset(new RenderPass(-1, input,
+				{ skin_shader, nullptr, nullptr },
+				uniforms,
+				{},
+				{ "skinned_position", "skinned_normal" }
+				));
+	size_t bytes = std::max<size_t>(nvertices_, 1) * kStride;
+	buffer_ = GLResourcePool::instance().acquireBuffer(bytes);
+	GLResourcePool::upload(buffer_, GL_TRANSFORM_FEEDBACK_BUFFER, nullptr, 0);
+	CHECK_GL_ERROR(glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0));
+}
+
+unsigned SkinCache::getInputBuffer(int position) const
+{
+	return pass_->getBuffer(position);
+}
+
+SkinCache::~SkinCache()
+{
+}
+
+bool SkinCache::update(bool pose_dirty, int variant, bool force)
+{
+	if (!pose_dirty && !force && variant == variant_)
+		return false;
+	pass_->useVariant(variant);
+	variant_ = variant;
+	pass_->setup();
+
+	CHECK_GL_ERROR(glEnable(GL_RASTERIZER_DISCARD));
+	CHECK_GL_ERROR(glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+				buffer_.get(), 0, nvertices_ * kStride));
+	CHECK_GL_ERROR(glBeginTransformFeedback(GL_POINTS));
+	CHECK_GL_ERROR(glDrawArrays(GL_POINTS, 0, nvertices_));
+	CHECK_GL_ERROR(glEndTransformFeedback());
+	CHECK_GL_ERROR(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+	CHECK_GL_ERROR(glDisable(GL_RASTERIZER_DISCARD));
+
+	readback_dirty_ = true;
+	nskinned_++;
+	return true;
+}
+
+void SkinCache::readback()
+{
+	if (!readback_dirty_)
+		return ;
+	std::vector<glm::vec4> data(nvertices_ * 2);
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, buffer_.get()));
+	CHECK_GL_ERROR(glGetBufferSubData(GL_ARRAY_BUFFER, 0,
+				nvertices_ * kStride, data.data()));
+	CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, 0));
+	positions_.resize(nvertices_);
+	normals_.resize(nvertices_);
+	for (size_t i = 0; i < nvertices_; i++) {
+		positions_[i] = data[2 * i];
+		normals_[i] = data[2 * i + 1];
+	}
+	readback_dirty_ = false;
+}
+
+const std::vector<glm::vec4>& SkinCache::getPositions()
+{
+	readback();
+	return positions_;
+}
+
+const std::vector<glm::vec4>& SkinCache::getNormals()
+{
+	readback();
+	return normals_;
+}
@@ -0,0 +1,71 @@
+#ifndef SKIN_CACHE_H
+#define SKIN_CACHE_H
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "render_pass.h"
+#include "gl_resource.h"
+
+/*
+ * SkinCache: skin the mesh once into a buffer with transform feedback.
+ *
+ * The skin pass runs the skinning vertex shader over all vertices as
+ * points with rasterization disabled, and captures
+ *      vec4 skinned_position;
+ *      vec4 skinned_normal;
+ * interleaved into getBuffer(). Passes that draw the model read this
+ * buffer (see RenderDataInput::assignBuffer) instead of skinning again.
+ */
+class SkinCache {
+public:
+	/*
+	 * Constructor
+	 *      input: per-vertex skinning attributes
+	 *      nvertices: number of vertices in input
+	 *      skin_shader: VS that writes skinned_position and skinned_normal
+	 *      uniforms: uniforms of the skin shader
+	 */
+	SkinCache(const RenderDataInput& input,
+	          size_t nvertices,
+	          const char* skin_shader,
+	          const std::vector<ShaderUniformPtr>& uniforms);
+	~SkinCache();
+
+	/*
+	 * update: skin again if the pose changed, the variant changed or force
+	 * is set (e.g. for time dependent deformations).
+	 * Return: true if the skin pass ran.
+	 */
+	bool update(bool pose_dirty, int variant, bool force = false);
+
+	unsigned getBuffer() const { return buffer_.get(); }
+	/* getInputBuffer: the GL buffer of the input attribute at position */
+	unsigned getInputBuffer(int position) const;
+	size_t getNVertices() const { return nvertices_; }
+	static constexpr size_t kStride = 2 * sizeof(glm::vec4);
+	static constexpr size_t kPositionOffset = 0;
+	static constexpr size_t kNormalOffset = sizeof(glm::vec4);
+
+	/*
+	 * getPositions/getNormals: read the skinned vertices back to the CPU.
+	 * The copy is refreshed lazily after the skin pass ran, so reading it
+	 * every frame only stalls when the pose changes.
+	 */
+	const std::vector<glm::vec4>& getPositions();
+	const std::vector<glm::vec4>& getNormals();
+
+	size_t getNSkinned() const { return nskinned_; }
+private:
+	void readback();
+
+	size_t nvertices_;
+	std::unique_ptr<RenderPass> pass_;
+	GLResource buffer_;
+	int variant_ = -1;
+	bool readback_dirty_ = true;
+	size_t nskinned_ = 0;
+	std::vector<glm::vec4> positions_, normals_;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <GL/glew.h>
+#include "texture_upload.h"
+#include <debuggl.h>
+#include <hash.h>
+#include <pixel_convert.h>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+
+TextureCache& TextureCache::instance()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+int getMipLevels(int width, int height)
+{
+	int levels = 1;
+	int size = std::max(width, height);
+	while (size > 1) {
+		size >>= 1;
+		levels++;
+	}
+	return levels;
+}
+
+uint64_t TextureCache::getHash(const Image& image)
+{
+	if (!image.hash) {
+		uint64_t h = kHashSeed;
+		h = HashValue(image.width, h);
+		h = HashValue(image.height, h);
+		h = HashValue(image.stride, h);
+		h = HashValue(image.channels, h);
+		h = HashBytes(image.bytes.data(), image.bytes.size(), h);
+		image.hash = h ? h : 1; // 0 means not computed
+	}
+	return image.hash;
+}
+
+bool TextureCache::isSame(const Entry& entry,
+                          const std::vector<std::shared_ptr<const Image>>& layers,
+                          int width,
+                          int height)
+{
+	if (entry.width != width || entry.height != height ||
+	    entry.layers.size() != layers.size())
+		return false;
+	for (size_t i = 0; i < layers.size(); i++) {
+		const Image& a = *entry.layers[i];
+		const Image& b = *layers[i];
+		if (&a == &b)
+			continue;
+		if (a.width != b.width || a.height != b.height ||
+		    a.stride != b.stride || a.channels != b.channels ||
+		    a.bytes.size() != b.bytes.size() ||
+		    memcmp(a.bytes.data(), b.bytes.data(), a.bytes.size()) != 0)
+			return false;
+	}
+	return true;
+}
+
+unsigned TextureCache::acquireArray(const std::vector<std::shared_ptr<const Image>>& layers,
+                                    int width,
+                                    int height)
+{
+	uint64_t key = kHashSeed;
+	key = HashValue(width, key);
+	key = HashValue(height, key);
+	for (const auto& image : layers)
+		key = HashValue(getHash(*image), key);
+	auto range = entries_.equal_range(key);
+	for (auto iter = range.first; iter != range.second; ++iter) {
+		if (!isSame(iter->second, layers, width, height))
+			continue;
+		iter->second.refcount++;
+		return iter->second.texture.get();
+	}
+	if (range.first != range.second)
+		std::cerr << __func__ << ": hash collision on key " << key << std::endl;
+
+	int levels = getMipLevels(width, height);
+	// A full mip chain adds about one third of the base level
+	size_t bytes = size_t(width) * height * 4 * layers.size() * 4 / 3;
+	GLResource texture = GLResourcePool::instance().createTexture(bytes);
+	unsigned tex = texture.get();
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, tex));
+	CHECK_GL_ERROR(glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8,
+				width, height, layers.size()));
+	std::vector<unsigned char> rgba, resampled;
+	for (size_t layer = 0; layer < layers.size(); layer++) {
+		const Image* image = layers[layer].get();
+		const unsigned char* pixels;
+		if (image->channels == 4 && (image->stride == 0 || image->stride == image->width * 4)) {
+			// Already RGBA, e.g. from the model cache
+			pixels = image->bytes.data();
+		} else {
+			ImageToRGBA(*image, rgba);
+			pixels = rgba.data();
+		}
+		if (image->width != width || image->height != height) {
+			resampled.resize(size_t(width) * height * 4);
+			ResampleRGBA(pixels, image->width, image->height,
+			             resampled.data(), width, height);
+			pixels = resampled.data();
+		}
+		CHECK_GL_ERROR(glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+					0, 0, layer, width, height, 1,
+					GL_RGBA, GL_UNSIGNED_BYTE,
+					pixels));
+		std::cerr << __func__ << " load data into texture array " << tex <<
+			" layer " << layer << " dim: " << image->width << " x " << image->height << std::endl;
+	}
+	CHECK_GL_ERROR(glGenerateMipmap(GL_TEXTURE_2D_ARRAY));
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+
+	auto iter = entries_.emplace(key, Entry());
+	Entry& entry = iter->second;
+	entry.texture = std::move(texture);
+	entry.width = width;
+	entry.height = height;
+	entry.layers = layers;
+	entry.refcount = 1;
+	tex2entry_[tex] = iter;
+	return tex;
+}
+
+void TextureCache::release(unsigned texture)
+{
+	auto iter = tex2entry_.find(texture);
+	if (iter == tex2entry_.end())
+		return ;
+	auto entry = iter->second;
+	if (--entry->second.refcount > 0)
+		return ;
+	entries_.erase(entry); // deletes the GL texture
+	tex2entry_.erase(iter);
+}
+
+void TextureCache::clear()
+{
+	entries_.clear(); // deletes the GL textures
+	tex2entry_.clear();
+}
+
+size_t TextureCache::getBytes() const
+{
+	size_t ret = 0;
+	for (const auto& entry : entries_)
+		ret += entry.second.texture.getCapacity();
+	return ret;
+}
@@ -0,0 +1,69 @@
+#ifndef TEXTURE_UPLOAD_H
+#define TEXTURE_UPLOAD_H
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <image.h>
+#include "gl_resource.h"
+
+/*
+ * TextureCache: content-addressed cache of GL textures.
+ *
+ * Textures are keyed by the hash of their pixels, so RenderPass objects (and
+ * models) that use the same images share one GL texture, and the RGB to
+ * RGBA conversion and the mipmap generation run only once per content.
+ * Each image is hashed once (see Image::hash), and a hit is confirmed by
+ * comparing the pixels since different content may hash the same.
+ */
+class TextureCache {
+public:
+	static TextureCache& instance();
+
+	/*
+	 * acquireArray: get a GL_TEXTURE_2D_ARRAY with one layer per image.
+	 * Images are resampled to width x height if necessary, and a full
+	 * mip chain is generated.
+	 * Each call must be paired with a release(). The cache keeps the
+	 * images until then to compare later requests with.
+	 */
+	unsigned acquireArray(const std::vector<std::shared_ptr<const Image>>& layers,
+	                      int width,
+	                      int height);
+	void release(unsigned texture);
+	/*
+	 * clear: delete all textures while the GL context is still current,
+	 * releases of them afterwards are ignored. The cache is static and
+	 * would otherwise delete them after the context is gone.
+	 */
+	void clear();
+
+	size_t getNTextures() const { return entries_.size(); }
+	size_t getBytes() const;
+private:
+	TextureCache() = default;
+
+	struct Entry {
+		GLResource texture;
+		int width = 0;
+		int height = 0;
+		std::vector<std::shared_ptr<const Image>> layers;
+		int refcount = 0;
+	};
+	static uint64_t getHash(const Image& image);
+	static bool isSame(const Entry& entry,
+	                   const std::vector<std::shared_ptr<const Image>>& layers,
+	                   int width,
+	                   int height);
+
+	// Entries with colliding keys are kept side by side
+	typedef std::multimap<uint64_t, Entry> EntryMap;
+	EntryMap entries_;
+	std::map<unsigned, EntryMap::iterator> tex2entry_;
+};
+
+int getMipLevels(int width, int height);
+
+#endif
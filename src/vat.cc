@@ -0,0 +1,231 @@
+#include <GL/glew.h>
+#include "vat.h"
+#include "bone_geometry.h"
+#include <debuggl.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <glm/gtc/packing.hpp>
+
+namespace {
+	const uint32_t kVatMagic = 0x41564b53; // "SKVA"
+	const uint32_t kVatVersion = 1;
+
+	struct VatHeader {
+		uint32_t magic;
+		uint32_t version;
+		int32_t nvertices;
+		int32_t nframes;
+		int32_t width;
+		int32_t rows;
+		float duration;
+		float origin[3];
+	};
+
+	void packTexel(uint16_t* texel, const glm::vec3& v)
+	{
+		texel[0] = glm::packHalf1x16(v.x);
+		texel[1] = glm::packHalf1x16(v.y);
+		texel[2] = glm::packHalf1x16(v.z);
+		texel[3] = glm::packHalf1x16(0.0f);
+	}
+
+	glm::vec3 unpackTexel(const uint16_t* texel)
+	{
+		return glm::vec3(glm::unpackHalf1x16(texel[0]),
+		                 glm::unpackHalf1x16(texel[1]),
+		                 glm::unpackHalf1x16(texel[2]));
+	}
+}
+
+const int VatClip::kDefaultWidth;
+
+void VatClip::skinVertices(const Mesh& mesh, const Configuration& q,
+                           std::vector<glm::vec3>& positions,
+                           std::vector<glm::vec3>& normals)
+{
+	size_t n = mesh.joint0.size();
+	positions.resize(n);
+	normals.resize(n);
+	int jid[4];
+	float weight[4];
+	glm::vec3 offset[4];
+	for (size_t i = 0; i < n; i++) {
+		int njoints = mesh.getInfluences(i, jid, weight, offset);
+		glm::vec3 normal(mesh.vertex_normals[i]);
+		glm::vec3 pos(0.0f), nrm(0.0f);
+		for (int k = 0; k < njoints; k++) {
+			pos += weight[k] * (q.trans[jid[k]] + q.rot[jid[k]] * offset[k]);
+			nrm += weight[k] * (q.rot[jid[k]] * normal);
+		}
+		positions[i] = pos;
+		float len = glm::length(nrm);
+		normals[i] = len > 0.0f ? nrm / len : nrm;
+	}
+}
+
+void VatClip::bake(const Mesh& mesh, const Crowd::PoseSampler& sample,
+                   float duration, int nframes, int max_width)
+{
+	nvertices_ = mesh.joint0.size();
+	nframes_ = std::max(nframes, 1);
+	duration_ = duration;
+	width_ = std::max(1, std::min(nvertices_, max_width));
+	rows_ = (nvertices_ + width_ - 1) / width_;
+
+	std::vector<std::vector<glm::vec3>> frame_positions(nframes_);
+	std::vector<std::vector<glm::vec3>> frame_normals(nframes_);
+	Configuration q;
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (int f = 0; f < nframes_; f++) {
+		sample(f * duration_ / nframes_, q);
+		skinVertices(mesh, q, frame_positions[f], frame_normals[f]);
+		for (const auto& p : frame_positions[f]) {
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+	}
+	// Half floats are most precise around zero
+	origin_ = nvertices_ > 0 ? 0.5f * (lo + hi) : glm::vec3(0.0f);
+
+	size_t frame_texels = size_t(width_) * rows_;
+	positions_.assign(frame_texels * nframes_ * 4, 0);
+	normals_.assign(frame_texels * nframes_ * 4, 0);
+	quantization_error_ = 0.0f;
+	for (int f = 0; f < nframes_; f++) {
+		for (int v = 0; v < nvertices_; v++) {
+			size_t texel = (f * frame_texels + v) * 4;
+			glm::vec3 p = frame_positions[f][v] - origin_;
+			packTexel(&positions_[texel], p);
+			packTexel(&normals_[texel], frame_normals[f][v]);
+			quantization_error_ = std::max(quantization_error_,
+			                               glm::length(unpackTexel(&positions_[texel]) - p));
+		}
+	}
+
+	// Compare the lerp vat.vert does half way between two frames with
+	// skinning at that time.
+	interpolation_error_ = 0.0f;
+	std::vector<glm::vec3> mid_positions, mid_normals;
+	for (int f = 0; f < nframes_ && nframes_ > 1; f++) {
+		sample((f + 0.5f) * duration_ / nframes_, q);
+		skinVertices(mesh, q, mid_positions, mid_normals);
+		const auto& next = frame_positions[(f + 1) % nframes_];
+		for (int v = 0; v < nvertices_; v++) {
+			glm::vec3 lerp = 0.5f * (frame_positions[f][v] + next[v]);
+			interpolation_error_ = std::max(interpolation_error_,
+			                                glm::length(lerp - mid_positions[v]));
+		}
+	}
+}
+
+bool VatClip::save(const std::string& fn) const
+{
+	FILE* f = fopen(fn.c_str(), "wb");
+	if (!f) {
+		std::cerr << __func__ << ": cannot write " << fn << std::endl;
+		return false;
+	}
+	VatHeader header = { kVatMagic, kVatVersion, nvertices_, nframes_, width_, rows_,
+	                     duration_, { origin_.x, origin_.y, origin_.z } };
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+	          fwrite(positions_.data(), sizeof(uint16_t), positions_.size(), f) == positions_.size() &&
+	          fwrite(normals_.data(), sizeof(uint16_t), normals_.size(), f) == normals_.size();
+	if (fclose(f) != 0)
+		ok = false;
+	if (!ok)
+		std::cerr << __func__ << ": cannot write " << fn << std::endl;
+	return ok;
+}
+
+void VatClip::load(const std::string& fn)
+{
+	FILE* f = fopen(fn.c_str(), "rb");
+	if (!f)
+		throw __func__+std::string(": cannot open ")+fn;
+	VatHeader header;
+	bool valid = fread(&header, sizeof(header), 1, f) == 1 &&
+	             header.magic == kVatMagic &&
+	             header.version == kVatVersion &&
+	             header.nvertices >= 0 && header.nframes > 0 &&
+	             header.width > 0 && header.rows >= 0 &&
+	             int64_t(header.width) * header.rows >= header.nvertices;
+	std::vector<uint16_t> positions, normals;
+	if (valid) {
+		size_t nhalves = size_t(header.width) * header.rows * header.nframes * 4;
+		positions.resize(nhalves);
+		normals.resize(nhalves);
+		valid = fread(positions.data(), sizeof(uint16_t), nhalves, f) == nhalves &&
+		        fread(normals.data(), sizeof(uint16_t), nhalves, f) == nhalves;
+	}
+	fclose(f);
+	if (!valid)
+		throw __func__+std::string(": ")+fn+" is not a vertex animation texture";
+
+	nvertices_ = header.nvertices;
+	nframes_ = header.nframes;
+	width_ = header.width;
+	rows_ = header.rows;
+	duration_ = header.duration;
+	origin_ = glm::vec3(header.origin[0], header.origin[1], header.origin[2]);
+	quantization_error_ = interpolation_error_ = -1.0f;
+	positions_.swap(positions);
+	normals_.swap(normals);
+	positions_tex_ = GLResource();
+	normals_tex_ = GLResource();
+}
+
+void VatClip::upload()
+{
+	GLint max_size = 0;
+	CHECK_GL_ERROR(glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size));
+	int height = rows_ * nframes_;
+	if (width_ > max_size || height > max_size)
+		throw __func__+std::string(": ")+std::to_string(width_)+"x"+std::to_string(height)+
+		      " texels exceed GL_MAX_TEXTURE_SIZE, bake fewer frames";
+
+	size_t bytes = positions_.size() * sizeof(uint16_t);
+	GLResource* textures[] = { &positions_tex_, &normals_tex_ };
+	const std::vector<uint16_t>* data[] = { &positions_, &normals_ };
+	for (int i = 0; i < 2; i++) {
+		*textures[i] = GLResourcePool::instance().createTexture(bytes);
+		CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, textures[i]->get()));
+		// Only read with texelFetch, but the texture must be complete
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+		CHECK_GL_ERROR(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+		CHECK_GL_ERROR(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width_, height, 0,
+		                            GL_RGBA, GL_HALF_FLOAT, data[i]->data()));
+	}
+	CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+size_t VatClip::getTextureBytes() const
+{
+	// RGBA16F, positions and normals
+	return 2 * size_t(width_) * rows_ * nframes_ * 8;
+}
+
+size_t VatClip::getFetchBytes() const
+{
+	// Two frames of both textures
+	return 2 * 2 * 8;
+}
+
+void VatClip::report(std::ostream& out, size_t ninstances, float fps) const
+{
+	double frame_bytes = double(nvertices_) * getFetchBytes();
+	double bandwidth = frame_bytes * ninstances * fps;
+	out << "VatClip: " << nframes_ << " frames over " << duration_ << " s, "
+	    << nvertices_ << " vertices in " << width_ << "x" << rows_ << " texels per frame" << std::endl;
+	out << "\ttextures: 2 x RGBA16F " << width_ << "x" << rows_ * nframes_ << ", "
+	    << getTextureBytes() / 1048576.0 << " MiB" << std::endl;
+	out << "\tfetches: " << getFetchBytes() << " bytes per vertex, "
+	    << frame_bytes / 1024.0 << " KiB per instance, "
+	    << bandwidth / 1073741824.0 << " GiB/s for " << ninstances << " instances at "
+	    << fps << " fps (before texture cache hits)" << std::endl;
+	if (quantization_error_ >= 0.0f)
+		out << "\terror: " << quantization_error_ << " from half floats, "
+		    << interpolation_error_ << " between frames (model units)" << std::endl;
+}
@@ -0,0 +1,89 @@
+#ifndef VAT_H
+#define VAT_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <glm/glm.hpp>
+#include "crowd.h"
+#include "gl_resource.h"
+
+struct Mesh;
+struct Configuration;
+
+/*
+ * VatClip: vertex animation texture of one looping clip.
+ *
+ * Every frame of the clip is skinned on the CPU and the results are stored
+ * in two RGBA16F textures, positions (relative to getOrigin()) and
+ * normals. Frame f of vertex v is the texel
+ *      x = v % width, y = f * rows + v / width
+ * so a clip of any vertex count fits under GL_MAX_TEXTURE_SIZE. vat.vert
+ * plays it back with two fetches per texture and a lerp, independently of
+ * the number of joints.
+ *
+ * Deformation effects (SHADER_NUM) are not baked.
+ */
+class VatClip {
+public:
+	static const int kDefaultWidth = 4096;
+
+	/*
+	 * skinVertices: linear blend skinning of mesh in pose q, the same
+	 * computation as blending.vert.
+	 */
+	static void skinVertices(const Mesh& mesh, const Configuration& q,
+	                         std::vector<glm::vec3>& positions,
+	                         std::vector<glm::vec3>& normals);
+
+	/*
+	 * bake: sample nframes poses of the clip at t = i * duration / nframes
+	 * and skin them. The clip loops, frame nframes is frame 0 again.
+	 */
+	void bake(const Mesh& mesh, const Crowd::PoseSampler& sample,
+	          float duration, int nframes, int max_width = kDefaultWidth);
+
+	/* save/load: binary file, load() throws std::string on bad files */
+	bool save(const std::string& fn) const;
+	void load(const std::string& fn);
+
+	/* upload: (re)create the textures from the baked data */
+	void upload();
+	unsigned getPositionTexture() const { return positions_tex_.get(); }
+	unsigned getNormalTexture() const { return normals_tex_.get(); }
+	bool isUploaded() const { return positions_tex_.get() != 0; }
+
+	bool empty() const { return nframes_ == 0; }
+	int getNVertices() const { return nvertices_; }
+	int getNFrames() const { return nframes_; }
+	int getWidth() const { return width_; }
+	int getRows() const { return rows_; } // texture rows per frame
+	float getDuration() const { return duration_; }
+	glm::vec3 getOrigin() const { return origin_; }
+
+	/* getTextureBytes: video memory of both textures */
+	size_t getTextureBytes() const;
+	/* getFetchBytes: texture bytes read per drawn vertex */
+	size_t getFetchBytes() const;
+
+	/*
+	 * report: sizes, bandwidth for ninstances drawn at fps, and the errors
+	 * measured by bake() (half float rounding and the lerp between frames).
+	 */
+	void report(std::ostream& out, size_t ninstances = 1, float fps = 60.0f) const;
+private:
+	int nvertices_ = 0;
+	int nframes_ = 0;
+	int width_ = 0;
+	int rows_ = 0;
+	float duration_ = 0.0f;
+	glm::vec3 origin_ = glm::vec3(0.0f);
+	float quantization_error_ = -1.0f; // < 0: unknown (loaded from a file)
+	float interpolation_error_ = -1.0f;
+	std::vector<uint16_t> positions_; // 4 halves per texel
+	std::vector<uint16_t> normals_;
+	GLResource positions_tex_;
+	GLResource normals_tex_;
+};
+
+#endif
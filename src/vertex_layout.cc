@@ -0,0 +1,70 @@
+#include <GL/glew.h>
+#include "vertex_layout.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+size_t getGLTypeSize(int element_type, size_t element_length)
+{
+	size_t element_size = 4;
+	if (element_type == GL_INT_2_10_10_10_REV ||
+	    element_type == GL_UNSIGNED_INT_2_10_10_10_REV)
+		return 4;
+	else if (element_type == GL_BYTE || element_type == GL_UNSIGNED_BYTE)
+		element_size = 1;
+	else if (element_type == GL_SHORT || element_type == GL_UNSIGNED_SHORT ||
+	         element_type == GL_HALF_FLOAT)
+		element_size = 2;
+	return element_size * element_length;
+}
+
+VertexLayout& VertexLayout::add(int position,
+                                const std::string& name,
+                                size_t element_length,
+                                int element_type,
+                                bool normalized)
+{
+	VertexAttribute attr;
+	attr.position = position;
+	attr.name = name;
+	attr.element_length = element_length;
+	attr.element_type = element_type;
+	attr.normalized = normalized;
+	// Components must be aligned to their own size
+	size_t align = std::min<size_t>(getGLTypeSize(element_type, 1), 4);
+	attr.offset = (stride_ + align - 1) / align * align;
+	stride_ = attr.offset + getGLTypeSize(element_type, element_length);
+	attributes_.emplace_back(attr);
+	return *this;
+}
+
+const VertexAttribute& VertexLayout::getAttribute(int position) const
+{
+	for (const auto& attr : attributes_)
+		if (attr.position == position)
+			return attr;
+	throw __func__+std::string(": error, no attribute at position ")+std::to_string(position);
+}
+
+VertexLayout::Field VertexLayout::getField(int position) const
+{
+	Field field;
+	field.offset = getAttribute(position).offset;
+	return field;
+}
+
+uint32_t packNormal(const glm::vec4& n)
+{
+	return glm::packSnorm3x10_1x2(glm::clamp(n, glm::vec4(-1.0f), glm::vec4(1.0f)));
+}
+
+uint32_t packHalf2(const glm::vec2& v)
+{
+	return glm::packHalf2x16(v);
+}
+
+uint16_t packUnorm16(float v)
+{
+	return uint16_t(std::round(glm::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
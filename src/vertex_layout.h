@@ -0,0 +1,88 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <glm/glm.hpp>
+
+/*
+ * getGLTypeSize: size in bytes of element_length components of
+ *                element_type.
+ * Packed types (e.g. GL_INT_2_10_10_10_REV) always take 4 bytes.
+ */
+size_t getGLTypeSize(int element_type, size_t element_length);
+
+/*
+ * VertexAttribute: one attribute inside an interleaved vertex.
+ */
+struct VertexAttribute {
+	int position = -1;
+	std::string name;
+	size_t element_length = 0;
+	int element_type = 0;
+	bool normalized = false;  // For integer types: read as [0, 1] or [-1, 1] floats
+	size_t offset = 0;
+};
+
+/*
+ * VertexLayout: builder of interleaved vertex formats.
+ *
+ * Attributes are appended in order, each aligned to the size of its
+ * components. The stride is padded to 4 bytes, which most drivers want for
+ * vertex fetch.
+ *
+ * Usage:
+ *      VertexLayout layout;
+ *      layout.add(0, "jid0", 1, GL_UNSIGNED_BYTE)
+ *            .add(1, "w0", 1, GL_UNSIGNED_SHORT, true);
+ *      std::vector<uint8_t> data(layout.getStride() * nvertices);
+ *      auto w0 = layout.getField(1);
+ *      layout.write(data, vertex, w0, packUnorm16(w));
+ *
+ * Fields are looked up by position once, outside of the vertex loop.
+ */
+class VertexLayout {
+public:
+	VertexLayout& add(int position,
+	                  const std::string& name,
+	                  size_t element_length,
+	                  int element_type,
+	                  bool normalized = false);
+
+	size_t getStride() const { return (stride_ + 3) & ~size_t(3); }
+	const std::vector<VertexAttribute>& getAttributes() const { return attributes_; }
+	const VertexAttribute& getAttribute(int position) const;
+
+	/* Field: resolved offset of an attribute, see getField */
+	struct Field {
+		size_t offset = 0;
+	};
+	Field getField(int position) const;
+
+	template<typename T>
+	void write(std::vector<uint8_t>& data, size_t vertex, Field field, const T& value) const
+	{
+		write(data.data(), vertex, field, value);
+	}
+	/* write: into a buffer of at least getStride() * (vertex + 1) bytes, e.g. a mapped one */
+	template<typename T>
+	void write(uint8_t* data, size_t vertex, Field field, const T& value) const
+	{
+		memcpy(data + vertex * getStride() + field.offset, &value, sizeof(T));
+	}
+private:
+	std::vector<VertexAttribute> attributes_;
+	size_t stride_ = 0;
+};
+
+/*
+ * Packing functions for the formats VertexLayout is usually fed with.
+ */
+uint32_t packNormal(const glm::vec4& n);  // GL_INT_2_10_10_10_REV, normalized
+uint32_t packHalf2(const glm::vec2& v);   // 2 x GL_HALF_FLOAT
+uint16_t packUnorm16(float v);            // GL_UNSIGNED_SHORT, normalized
+
+#endif